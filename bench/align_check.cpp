@@ -0,0 +1,124 @@
+// 对齐显示自检：对齐矩阵按文件像素估计（找星在原始数据上做），显示 shader 在去拜耳输出的坐标下采样，
+// BGGR / GRBG / GBRG 的去拜耳输出相对文件是翻转的。对每种 Bayer 模式检查：
+//   - bayer_display_flip 和 CPU 去拜耳的实际方向一致（单个亮像素在输出里的位置）
+//   - 换到显示方向的对齐矩阵（bayer_flip_transform）把帧里的星放到参考帧同一颗星在屏幕上的位置，
+//     即翻转的模式和 RGGB 一样对齐到参考帧
+// 任何一项超差时返回非 0
+#include "Debayer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+int g_failures = 0;
+
+const BayerPattern kPatterns[4] = {BayerPattern::RGGB, BayerPattern::BGGR, BayerPattern::GRBG, BayerPattern::GBRG};
+const char*        kNames[4]    = {"RGGB", "BGGR", "GRBG", "GBRG"};
+
+void report(const char* what, const char* pattern, bool ok, double error, double tolerance)
+{
+    std::printf("%-28s %s %s  max error %.3g (tolerance %.3g)\n", what, pattern, ok ? "ok  " : "FAIL",
+                error, tolerance);
+    if (!ok)
+        ++g_failures;
+}
+
+void apply(const double m[9], double x, double y, double& ox, double& oy)
+{
+    const double w = m[6] * x + m[7] * y + m[8];
+    ox = (m[0] * x + m[1] * y + m[2]) / w;
+    oy = (m[3] * x + m[4] * y + m[5]) / w;
+}
+
+void flip(BayerPattern pattern, int w, int h, double& x, double& y)
+{
+    bool flipX, flipY;
+    bayer_display_flip(pattern, flipX, flipY);
+    if (flipX)
+        x = w - 1 - x;
+    if (flipY)
+        y = h - 1 - y;
+}
+
+// 文件里一个亮像素去拜耳后落在哪里
+void check_debayer_orientation(int k)
+{
+    const int W = 16, H = 12, px = 5, py = 7;
+    FitsImage img;
+    img.width  = W;
+    img.height = H;
+    img.raw.assign((size_t)W * H, 0.0);
+    img.raw[(size_t)py * W + px] = 1.0;
+
+    std::vector<float> rgb((size_t)W * H * 3);
+    if (!debayer_bilinear_rows(img, kPatterns[k], 0.0, 1.0, 0, H, rgb.data()))
+    {
+        report("debayer orientation", kNames[k], false, INFINITY, 0.0);
+        return;
+    }
+
+    size_t best = 0;
+    for (size_t i = 1; i < (size_t)W * H; ++i)
+        if (rgb[i * 3] + rgb[i * 3 + 1] + rgb[i * 3 + 2] > rgb[best * 3] + rgb[best * 3 + 1] + rgb[best * 3 + 2])
+            best = i;
+
+    double x = px, y = py;
+    flip(kPatterns[k], W, H, x, y);
+    const double error = std::hypot((double)(best % W) - x, (double)(best / W) - y);
+    report("debayer orientation", kNames[k], error == 0.0, error, 0.0);
+}
+
+// shader 在屏幕的显示坐标 d 处采样帧的显示坐标 A d；参考帧的星 p 显示在 flip(p)，
+// 帧里同一颗星在文件坐标 M p、显示坐标 flip(M p)，对齐正确时 A flip(p) = flip(M p)
+void check_aligned_position(int k)
+{
+    const int    W = 640, H = 480;
+    const double angle = 1.5 * 3.14159265358979323846 / 180.0;
+    const double refToFrame[9] = {std::cos(angle), -std::sin(angle), 12.3,
+                                  std::sin(angle),  std::cos(angle), -7.8,
+                                  0.0, 0.0, 1.0};
+    double display[9];
+    bayer_flip_transform(kPatterns[k], W, H, refToFrame, display);
+
+    double worst = 0.0;
+    for (int j = 0; j <= 4; ++j)
+        for (int i = 0; i <= 4; ++i)
+        {
+            const double x = 40.0 + i * 140.0, y = 30.0 + j * 105.0;
+
+            double sx = x, sy = y;
+            flip(kPatterns[k], W, H, sx, sy);
+            double ax, ay;
+            apply(display, sx, sy, ax, ay);
+
+            double fx, fy;
+            apply(refToFrame, x, y, fx, fy);
+            flip(kPatterns[k], W, H, fx, fy);
+
+            worst = std::max(worst, std::hypot(ax - fx, ay - fy));
+        }
+    const double tolerance = 1e-9;
+    report("aligned star position", kNames[k], worst <= tolerance, worst, tolerance);
+}
+
+} // namespace
+
+int main()
+{
+    for (int k = 0; k < 4; ++k)
+    {
+        check_debayer_orientation(k);
+        check_aligned_position(k);
+    }
+
+    if (g_failures > 0)
+    {
+        std::printf("%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,75 @@
+// 背景模型自检：改动背景拟合的数学之后跑一遍，任何一项超差时返回非 0
+//   - 已知平面梯度的样本拟合后，节点上的值和真值比较（检查格子中心的坐标约定）
+#include "BackgroundModel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+int g_failures = 0;
+
+void report(const char* name, bool ok, double error, double tolerance)
+{
+    std::printf("%-34s %s  max error %.3g (tolerance %.3g)\n", name, ok ? "ok  " : "FAIL", error, tolerance);
+    if (!ok)
+        ++g_failures;
+}
+
+void check_linear_gradient()
+{
+    // 样本一像素一个，格子 5 x 5 个样本：线性梯度的格子中值正好是格子中心的值
+    const int W = 120, H = 120;
+    std::vector<float> samples((size_t)W * H * 3);
+    auto truth = [&](double px, double py, int ch) {
+        const double x = px / (W - 1) * 2.0 - 1.0;
+        const double y = py / (H - 1) * 2.0 - 1.0;
+        return 0.3 + 0.02 * ch + 0.1 * x - 0.05 * y;
+    };
+    for (int j = 0; j < H; ++j)
+        for (int i = 0; i < W; ++i)
+            for (int ch = 0; ch < 3; ++ch)
+                samples[((size_t)j * W + i) * 3 + ch] = (float)truth(i, j, ch);
+
+    BackgroundFitOptions options;
+    options.grid = 24;
+    BackgroundModel model;
+    if (!fit_background(samples.data(), W, H, W, H, options, model))
+    {
+        std::printf("%-34s FAIL  fit_background returned false\n", "linear gradient");
+        ++g_failures;
+        return;
+    }
+
+    double worst = 0.0;
+    for (int j = 0; j < model.height; ++j)
+        for (int i = 0; i < model.width; ++i)
+        {
+            const double px = (double)i / (model.width - 1) * (W - 1);
+            const double py = (double)j / (model.height - 1) * (H - 1);
+            for (int ch = 0; ch < 3; ++ch)
+            {
+                const double v = model.rgb[((size_t)j * model.width + i) * 3 + ch];
+                worst = std::max(worst, std::fabs(v - truth(px, py, ch)));
+            }
+        }
+    const double tolerance = 1e-4;
+    report("linear gradient", worst <= tolerance, worst, tolerance);
+}
+
+} // namespace
+
+int main()
+{
+    check_linear_gradient();
+
+    if (g_failures > 0)
+    {
+        std::printf("%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
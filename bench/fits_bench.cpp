@@ -0,0 +1,504 @@
+// 处理管线基准：合成 FITS（不同 BITPIX / 尺寸 / Bayer 模式）-> 分阶段计时
+//   load_fits -> normalize_raw -> debayer_bilinear -> auto_stretch -> rgb_to_u8 -> PNG 编码
+// 输出每阶段耗时、MP/s 和进程峰值内存，可写 JSON 供回归对比
+#include "FitsImage.h"
+#include "Debayer.h"
+#include "Stretch.h"
+#include "ImageWriter.h"
+#include "StarDetector.h"
+
+#include <fitsio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// 进程峰值常驻内存（MB）
+double peak_rss_mb()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize / (1024.0 * 1024.0);
+    return 0.0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0.0;
+#if defined(__APPLE__)
+    return ru.ru_maxrss / (1024.0 * 1024.0);   // 字节
+#else
+    return ru.ru_maxrss / 1024.0;              // KB
+#endif
+#endif
+}
+
+struct Options
+{
+    std::vector<double>       sizesMP  = {1, 16, 64};
+    std::vector<int>          bitpix   = {16, -32};
+    std::vector<BayerPattern> patterns = {BayerPattern::RGGB};
+    int                       repeat   = 3;
+    std::string               jsonPath;
+    std::string               tmpDir;
+    bool                      skipPng  = false;
+};
+
+const char* bayer_name(BayerPattern p)
+{
+    switch (p)
+    {
+        case BayerPattern::RGGB: return "RGGB";
+        case BayerPattern::BGGR: return "BGGR";
+        case BayerPattern::GRBG: return "GRBG";
+        case BayerPattern::GBRG: return "GBRG";
+        case BayerPattern::NONE: break;
+    }
+    return "NONE";
+}
+
+bool parse_bayer(const std::string& s, BayerPattern& out)
+{
+    for (BayerPattern p : {BayerPattern::NONE, BayerPattern::RGGB, BayerPattern::BGGR,
+                           BayerPattern::GRBG, BayerPattern::GBRG})
+    {
+        if (s == bayer_name(p))
+        {
+            out = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T, typename F>
+std::vector<T> parse_list(const std::string& s, F convert)
+{
+    std::vector<T> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (!item.empty())
+            out.push_back(convert(item));
+    }
+    return out;
+}
+
+// 3:2 画幅，宽高取偶数（保持 Bayer 2x2 完整）
+void dimensions_for(double megapixels, int& W, int& H)
+{
+    double pixels = std::max(megapixels, 0.01) * 1e6;
+    W = std::max(2, (int)std::lround(std::sqrt(pixels * 1.5)) & ~1);
+    H = std::max(2, (int)std::lround(pixels / W) & ~1);
+}
+
+uint32_t hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// 合成一帧：背景 + 缓慢梯度 + 噪声 + 稀疏高斯星点，Bayer 时按 2x2 位置乘 R/G/B 增益。
+// 逐行写出，生成 200 MP 也只占一行内存
+bool write_synthetic_fits(const std::string& path, int W, int H, int bitpix, BayerPattern pattern)
+{
+    int imgType = USHORT_IMG;
+    double maxValue = 65535.0;
+    switch (bitpix)
+    {
+        case 8:   imgType = BYTE_IMG;   maxValue = 255.0; break;
+        case 16:  imgType = USHORT_IMG; break;
+        case 32:  imgType = LONG_IMG;   break;
+        case -32: imgType = FLOAT_IMG;  break;
+        case -64: imgType = DOUBLE_IMG; break;
+        default:
+            std::cerr << "Unsupported BITPIX " << bitpix << "\n";
+            return false;
+    }
+
+    std::string clobber = "!" + path;
+    fitsfile* fptr = nullptr;
+    int status = 0;
+    long naxes[2] = {W, H};
+    if (fits_create_file(&fptr, clobber.c_str(), &status) ||
+        fits_create_img(fptr, imgType, 2, naxes, &status))
+    {
+        fits_report_error(stderr, status);
+        if (fptr)
+            fits_close_file(fptr, &status);
+        return false;
+    }
+
+    if (pattern != BayerPattern::NONE)
+        fits_update_key(fptr, TSTRING, "BAYERPAT", (void*)bayer_name(pattern), "synthetic", &status);
+
+    const double scale = maxValue / 65535.0;
+    const int    cell  = 24;   // 每个格子最多一颗星
+    std::vector<double> row(W);
+
+    for (int y = 0; y < H && !status; ++y)
+    {
+        int cy = y / cell;
+        for (int x = 0; x < W; ++x)
+        {
+            uint32_t h = hash32((uint32_t)(y * 73856093u) ^ (uint32_t)(x * 19349663u));
+            double noise = ((h & 0xFFFF) / 65535.0 - 0.5) * 60.0;
+            double v = 1200.0 + 400.0 * x / W + 200.0 * y / H + noise;
+
+            int cx = x / cell;
+            uint32_t s = hash32((uint32_t)cx * 2654435761u ^ (uint32_t)cy * 40503u);
+            if ((s & 7) == 0)
+            {
+                double sx = cx * cell + cell * 0.5 + ((s >> 8) & 7) - 3.5;
+                double sy = cy * cell + cell * 0.5 + ((s >> 12) & 7) - 3.5;
+                double dx = x - sx, dy = y - sy;
+                double amp = 2000.0 + (double)((s >> 16) & 0x7FFF);
+                v += amp * std::exp(-(dx * dx + dy * dy) / (2.0 * 1.8 * 1.8));
+            }
+
+            if (pattern != BayerPattern::NONE)
+            {
+                static const double gains[4] = {0.8, 1.0, 1.0, 0.6};
+                v *= gains[((y & 1) << 1) | (x & 1)];
+            }
+
+            row[x] = std::clamp(v, 0.0, 65535.0) * scale;
+        }
+
+        long fpixel[2] = {1, y + 1};
+        fits_write_pix(fptr, TDOUBLE, fpixel, W, row.data(), &status);
+    }
+
+    fits_close_file(fptr, &status);
+    if (status)
+    {
+        fits_report_error(stderr, status);
+        return false;
+    }
+    return true;
+}
+
+struct StageResult
+{
+    std::string name;
+    double      minMs    = 0.0;
+    double      medianMs = 0.0;
+};
+
+struct CaseResult
+{
+    int         width  = 0;
+    int         height = 0;
+    int         bitpix = 0;
+    BayerPattern pattern = BayerPattern::NONE;
+    double      generateMs = 0.0;
+    std::vector<StageResult> stages;
+    double      peakRssMb = 0.0;
+    bool        ok = true;
+};
+
+double megapixels_of(const CaseResult& c)
+{
+    return (double)c.width * c.height / 1e6;
+}
+
+StageResult summarize(const std::string& name, std::vector<double> samples)
+{
+    StageResult r;
+    r.name = name;
+    if (samples.empty())
+        return r;
+    std::sort(samples.begin(), samples.end());
+    r.minMs = samples.front();
+    r.medianMs = samples[samples.size() / 2];
+    return r;
+}
+
+bool run_case(const Options& opt, double mp, int bitpix, BayerPattern pattern, CaseResult& out)
+{
+    dimensions_for(mp, out.width, out.height);
+    out.bitpix  = bitpix;
+    out.pattern = pattern;
+
+    fs::path dir = opt.tmpDir.empty() ? fs::temp_directory_path() : fs::path(opt.tmpDir);
+    std::string tag = std::to_string(out.width) + "x" + std::to_string(out.height) + "_" +
+                      std::to_string(bitpix) + "_" + bayer_name(pattern);
+    fs::path fitsPath = dir / ("fits_bench_" + tag + ".fits");
+    fs::path pngPath  = dir / ("fits_bench_" + tag + ".png");
+
+    auto t0 = Clock::now();
+    if (!write_synthetic_fits(fitsPath.string(), out.width, out.height, bitpix, pattern))
+    {
+        out.ok = false;
+        return false;
+    }
+    out.generateMs = elapsed_ms(t0);
+
+    std::vector<double> tLoad, tNorm, tStars, tDebayer, tStretch, tU8, tPng;
+    bool ok = true;
+
+    for (int r = 0; r < opt.repeat && ok; ++r)
+    {
+        FitsImage img;
+        t0 = Clock::now();
+        ok = load_fits(fitsPath.string(), img, pattern);
+        tLoad.push_back(elapsed_ms(t0));
+        if (!ok)
+            break;
+
+        std::vector<float> norm;
+        t0 = Clock::now();
+        normalize_raw(img, norm);
+        tNorm.push_back(elapsed_ms(t0));
+
+        StarField stars;
+        t0 = Clock::now();
+        detect_stars(norm.data(), img.width, img.height, img.channels,
+                     img.channels == 1 && img.bayer != BayerPattern::NONE, StarDetectOptions(), stars);
+        tStars.push_back(elapsed_ms(t0));
+        norm.clear();
+        norm.shrink_to_fit();
+
+        FitsImage rgb;
+        t0 = Clock::now();
+        ok = debayer_bilinear(img, rgb);
+        tDebayer.push_back(elapsed_ms(t0));
+        if (!ok)
+            break;
+        img = FitsImage();
+        rgb.raw.clear();
+        rgb.raw.shrink_to_fit();
+
+        t0 = Clock::now();
+        auto_stretch(rgb.rgb);
+        tStretch.push_back(elapsed_ms(t0));
+
+        t0 = Clock::now();
+        std::vector<unsigned char> u8 = rgb_to_u8(rgb.rgb, rgb.width, rgb.height);
+        tU8.push_back(elapsed_ms(t0));
+        rgb = FitsImage();
+
+        if (!opt.skipPng)
+        {
+            t0 = Clock::now();
+            std::unique_ptr<ImageRowWriter> writer =
+                open_image_writer(pngPath.string(), ExportFormat::PNG8, out.width, out.height);
+            ok = writer != nullptr;
+            const size_t rowBytes = (size_t)out.width * 3;
+            for (int y = 0; y < out.height && ok; ++y)
+                ok = writer->writeRow(u8.data() + (size_t)(out.height - 1 - y) * rowBytes);
+            if (writer)
+                ok = writer->close() && ok;
+            tPng.push_back(elapsed_ms(t0));
+        }
+    }
+
+    std::error_code ec;
+    fs::remove(fitsPath, ec);
+    fs::remove(pngPath, ec);
+
+    out.ok = ok;
+    out.stages.push_back(summarize("load_fits", tLoad));
+    out.stages.push_back(summarize("normalize_raw", tNorm));
+    out.stages.push_back(summarize("detect_stars", tStars));
+    out.stages.push_back(summarize("debayer_bilinear", tDebayer));
+    out.stages.push_back(summarize("auto_stretch", tStretch));
+    out.stages.push_back(summarize("rgb_to_u8", tU8));
+    if (!opt.skipPng)
+        out.stages.push_back(summarize("png_encode", tPng));
+    out.peakRssMb = peak_rss_mb();
+    return ok;
+}
+
+void print_case(const CaseResult& c)
+{
+    double mp = megapixels_of(c);
+    std::printf("\n%dx%d (%.1f MP)  BITPIX %d  %s  generated in %.0f ms  peak RSS %.0f MB%s\n",
+                c.width, c.height, mp, c.bitpix, bayer_name(c.pattern), c.generateMs, c.peakRssMb,
+                c.ok ? "" : "  FAILED");
+    for (const StageResult& s : c.stages)
+    {
+        std::printf("  %-18s min %9.1f ms  median %9.1f ms  %8.1f MP/s\n",
+                    s.name.c_str(), s.minMs, s.medianMs,
+                    s.minMs > 0.0 ? mp / (s.minMs / 1000.0) : 0.0);
+    }
+}
+
+bool write_json(const std::string& path, const Options& opt, const std::vector<CaseResult>& cases)
+{
+    std::ofstream f(path);
+    if (!f)
+        return false;
+
+    char timeBuf[32] = {0};
+    std::time_t now = std::time(nullptr);
+    std::strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    f << "{\n";
+    f << "  \"benchmark\": \"fits_bench\",\n";
+    f << "  \"timestamp\": \"" << timeBuf << "\",\n";
+    f << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    f << "  \"repeat\": " << opt.repeat << ",\n";
+    f << "  \"cases\": [\n";
+    for (size_t i = 0; i < cases.size(); ++i)
+    {
+        const CaseResult& c = cases[i];
+        double mp = megapixels_of(c);
+        f << "    {\n";
+        f << "      \"width\": " << c.width << ", \"height\": " << c.height
+          << ", \"megapixels\": " << mp << ",\n";
+        f << "      \"bitpix\": " << c.bitpix << ", \"bayer\": \"" << bayer_name(c.pattern) << "\",\n";
+        f << "      \"ok\": " << (c.ok ? "true" : "false")
+          << ", \"peak_rss_mb\": " << c.peakRssMb
+          << ", \"generate_ms\": " << c.generateMs << ",\n";
+        f << "      \"stages\": {\n";
+        for (size_t s = 0; s < c.stages.size(); ++s)
+        {
+            const StageResult& st = c.stages[s];
+            f << "        \"" << st.name << "\": {\"min_ms\": " << st.minMs
+              << ", \"median_ms\": " << st.medianMs
+              << ", \"mp_per_s\": " << (st.minMs > 0.0 ? mp / (st.minMs / 1000.0) : 0.0) << "}"
+              << (s + 1 < c.stages.size() ? "," : "") << "\n";
+        }
+        f << "      }\n";
+        f << "    }" << (i + 1 < cases.size() ? "," : "") << "\n";
+    }
+    f << "  ]\n";
+    f << "}\n";
+    return (bool)f;
+}
+
+void print_usage()
+{
+    std::cout <<
+        "Usage: fits_bench [options]\n"
+        "\n"
+        "  --sizes <mp,...>     image sizes in megapixels (default 1,16,64; up to 200)\n"
+        "  --bitpix <b,...>     8 | 16 | 32 | -32 | -64   (default 16,-32)\n"
+        "  --bayer <p,...>      RGGB | BGGR | GRBG | GBRG | NONE (default RGGB)\n"
+        "  --repeat <n>         runs per case, min and median are reported (default 3)\n"
+        "  --json <file>        write results as JSON\n"
+        "  --tmp <dir>          where synthetic FITS / PNG files are written (default: system temp)\n"
+        "  --no-png             skip the PNG encoding stage\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options opt;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        auto next = [&]() -> std::string {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Missing value for " << a << "\n";
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+
+        if (a == "-h" || a == "--help")
+        {
+            print_usage();
+            return 0;
+        }
+        else if (a == "--sizes")
+            opt.sizesMP = parse_list<double>(next(), [](const std::string& s) { return std::atof(s.c_str()); });
+        else if (a == "--bitpix")
+            opt.bitpix = parse_list<int>(next(), [](const std::string& s) { return std::atoi(s.c_str()); });
+        else if (a == "--bayer")
+        {
+            opt.patterns.clear();
+            for (const std::string& s : parse_list<std::string>(next(), [](const std::string& s) { return s; }))
+            {
+                BayerPattern p;
+                if (!parse_bayer(s, p))
+                {
+                    std::cerr << "Unknown bayer pattern: " << s << "\n";
+                    return 2;
+                }
+                opt.patterns.push_back(p);
+            }
+        }
+        else if (a == "--repeat")   opt.repeat = std::max(1, std::atoi(next().c_str()));
+        else if (a == "--json")     opt.jsonPath = next();
+        else if (a == "--tmp")      opt.tmpDir = next();
+        else if (a == "--no-png")   opt.skipPng = true;
+        else
+        {
+            std::cerr << "Unknown option: " << a << "\n";
+            print_usage();
+            return 2;
+        }
+    }
+
+    // 峰值内存只增不减，从小到大跑，每个 case 的数值才有意义
+    std::sort(opt.sizesMP.begin(), opt.sizesMP.end());
+
+    std::vector<CaseResult> cases;
+    bool allOk = true;
+
+    for (double mp : opt.sizesMP)
+    {
+        for (int bitpix : opt.bitpix)
+        {
+            for (BayerPattern pattern : opt.patterns)
+            {
+                CaseResult c;
+                bool ok = run_case(opt, mp, bitpix, pattern, c);
+                allOk = allOk && ok;
+                print_case(c);
+                cases.push_back(c);
+            }
+        }
+    }
+
+    if (!opt.jsonPath.empty())
+    {
+        if (!write_json(opt.jsonPath, opt, cases))
+        {
+            std::cerr << "Failed to write " << opt.jsonPath << "\n";
+            return 1;
+        }
+        std::printf("\nResults written to %s\n", opt.jsonPath.c_str());
+    }
+
+    return allOk ? 0 : 1;
+}
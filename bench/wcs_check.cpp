@@ -0,0 +1,241 @@
+// WCS 换算自检：改动 WCS 的数学之后跑一遍，任何一项超差时返回非 0
+//   - 像素 -> 天球的绝对值：和参考头上事先算好的 RA / Dec 比较（往返检查发现不了正反两边一致的符号错误）
+//   - 像素 -> 天球 -> 像素往返（TAN，CD / PC / CDELT + CROTA2 三种线性部分，
+//     TAN-SIP 只有 A / B 时走不动点迭代的反向）
+#include "Wcs.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+int g_failures = 0;
+
+void report(const char* name, bool ok, double error, double tolerance)
+{
+    std::printf("%-34s %s  max error %.3g (tolerance %.3g)\n", name, ok ? "ok  " : "FAIL", error, tolerance);
+    if (!ok)
+        ++g_failures;
+}
+
+std::string card(const char* key, const std::string& value)
+{
+    char buf[96];
+    std::snprintf(buf, sizeof(buf), "%-8s= %s", key, value.c_str());
+    return buf;
+}
+
+std::string card(const char* key, double value)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.15g", value);
+    return card(key, std::string(buf));
+}
+
+// 4000 x 3000 的图，参考点在中间，约 1.2"/px，转 30°
+std::vector<std::string> base_cards(const char* suffix, double ra0 = 83.82, double dec0 = -5.39)
+{
+    const std::string ra  = std::string("'RA---TAN") + suffix + "'";
+    const std::string dec = std::string("'DEC--TAN") + suffix + "'";
+    return {card("CTYPE1", ra),        card("CTYPE2", dec),
+            card("CRPIX1", 2000.5),    card("CRPIX2", 1500.5),
+            card("CRVAL1", ra0),       card("CRVAL2", dec0)};
+}
+
+const double kDegToRad = 3.14159265358979323846 / 180.0;
+const double kScale    = 1.2 / 3600.0;
+const double kAngle    = 30.0 * kDegToRad;
+
+// 像素 -> 天球 -> 像素，整幅图上均匀取点
+void check_round_trip(const char* name, const std::vector<std::string>& cards)
+{
+    Wcs wcs;
+    std::string error;
+    if (!parse_wcs(cards, wcs, error))
+    {
+        std::printf("%-34s FAIL  parse_wcs: %s\n", name, error.c_str());
+        ++g_failures;
+        return;
+    }
+
+    std::vector<double> x, y;
+    for (int j = 0; j <= 30; ++j)
+        for (int i = 0; i <= 40; ++i)
+        {
+            x.push_back(i * 3999.0 / 40.0);
+            y.push_back(j * 2999.0 / 30.0);
+        }
+
+    const size_t n = x.size();
+    std::vector<double> ra(n), dec(n), bx(n), by(n);
+    wcs_pixel_to_sky(wcs, x.data(), y.data(), ra.data(), dec.data(), n);
+    wcs_sky_to_pixel(wcs, ra.data(), dec.data(), bx.data(), by.data(), n);
+
+    double worst = 0.0;
+    for (size_t k = 0; k < n; ++k)
+    {
+        const double e = std::hypot(bx[k] - x[k], by[k] - y[k]);
+        worst = std::isfinite(e) ? std::max(worst, e) : INFINITY;
+    }
+    const double tolerance = 1e-6;
+    report(name, worst <= tolerance, worst, tolerance);
+}
+
+// 参考值：像素（从 0 开始）和对应的 RA / Dec（度）
+struct SkyPoint
+{
+    double x, y, ra, dec;
+};
+
+// 参考值按 Calabretta & Greisen (2002) 的球面旋转（中间坐标 -> 本地球面 (φ, θ) -> 天球，LONPOLE = 180）
+// 另外算出，不走 Wcs.cpp 里的 gnomonic 反变换公式；误差按天球上的角距离（角秒）
+void check_absolute(const char* name, const std::vector<std::string>& cards, const SkyPoint* points, size_t n)
+{
+    Wcs wcs;
+    std::string error;
+    if (!parse_wcs(cards, wcs, error))
+    {
+        std::printf("%-34s FAIL  parse_wcs: %s\n", name, error.c_str());
+        ++g_failures;
+        return;
+    }
+
+    double worst = 0.0;
+    for (size_t k = 0; k < n; ++k)
+    {
+        double ra = 0.0, dec = 0.0;
+        wcs_pixel_to_sky(wcs, &points[k].x, &points[k].y, &ra, &dec, 1);
+        const double dra = std::remainder(ra - points[k].ra, 360.0) * std::cos(points[k].dec * kDegToRad);
+        const double e   = std::hypot(dra, dec - points[k].dec) * 3600.0;
+        worst = std::isfinite(e) ? std::max(worst, e) : INFINITY;
+    }
+    const double tolerance = 1e-5;
+    report(name, worst <= tolerance, worst, tolerance);
+}
+
+// 同一个线性部分的两种写法给出的天球坐标应该一样
+void check_same_sky(const char* name, const std::vector<std::string>& a, const std::vector<std::string>& b)
+{
+    Wcs wa, wb;
+    std::string error;
+    if (!parse_wcs(a, wa, error) || !parse_wcs(b, wb, error))
+    {
+        std::printf("%-34s FAIL  parse_wcs: %s\n", name, error.c_str());
+        ++g_failures;
+        return;
+    }
+
+    double worst = 0.0;
+    for (int k = 0; k < 4; ++k)
+        worst = std::max(worst, std::fabs(wa.cd[k] - wb.cd[k]) / kScale);
+    const double tolerance = 1e-9;
+    report(name, worst <= tolerance, worst, tolerance);
+}
+
+void check_wcs()
+{
+    const double c = std::cos(kAngle), s = std::sin(kAngle);
+
+    std::vector<std::string> cd = base_cards("");
+    cd.push_back(card("CD1_1", -kScale * c));
+    cd.push_back(card("CD1_2", -kScale * s));
+    cd.push_back(card("CD2_1", -kScale * s));
+    cd.push_back(card("CD2_2",  kScale * c));
+    check_round_trip("TAN, CD", cd);
+
+    // PC 里直接带比例、没有 CDELT（缺省为 1）
+    std::vector<std::string> pc = base_cards("");
+    pc.push_back(card("PC1_1", -kScale * c));
+    pc.push_back(card("PC1_2", -kScale * s));
+    pc.push_back(card("PC2_1", -kScale * s));
+    pc.push_back(card("PC2_2",  kScale * c));
+    check_round_trip("TAN, PC without CDELT", pc);
+    check_same_sky("PC without CDELT == CD", pc, cd);
+
+    std::vector<std::string> pcd = base_cards("");
+    pcd.push_back(card("CDELT1", -kScale));
+    pcd.push_back(card("CDELT2",  kScale));
+    pcd.push_back(card("PC1_1", c));
+    pcd.push_back(card("PC1_2", s));
+    pcd.push_back(card("PC2_1", -s));
+    pcd.push_back(card("PC2_2", c));
+    check_same_sky("PC x CDELT == CD", pcd, cd);
+
+    // CROTA2 的符号约定：CD1_2 = -CDELT2 sin，CD2_1 = CDELT1 sin
+    std::vector<std::string> rot = base_cards("");
+    rot.push_back(card("CDELT1", -kScale));
+    rot.push_back(card("CDELT2",  kScale));
+    rot.push_back(card("CROTA2", 30.0));
+    check_round_trip("TAN, CDELT + CROTA2", rot);
+    check_same_sky("CDELT + CROTA2 == CD", rot, cd);
+
+    // 3 阶 SIP，角上畸变几个像素；没有 AP / BP，反向走迭代
+    std::vector<std::string> sip = base_cards("-SIP");
+    sip.insert(sip.end(), cd.begin() + 6, cd.end());
+    sip.push_back(card("A_ORDER", 3.0));
+    sip.push_back(card("B_ORDER", 3.0));
+    sip.push_back(card("A_2_0",  1.2e-6));
+    sip.push_back(card("A_1_1", -4.0e-7));
+    sip.push_back(card("A_0_2",  6.0e-7));
+    sip.push_back(card("A_3_0", -2.0e-10));
+    sip.push_back(card("A_1_2",  1.5e-10));
+    sip.push_back(card("B_2_0", -5.0e-7));
+    sip.push_back(card("B_1_1",  9.0e-7));
+    sip.push_back(card("B_0_2", -1.1e-6));
+    sip.push_back(card("B_2_1",  1.0e-10));
+    sip.push_back(card("B_0_3", -2.5e-10));
+    check_round_trip("TAN-SIP, iterative inverse", sip);
+
+    // 参考点落在 CRVAL；CD1_1 < 0，x 增大 RA 减小（东在左）
+    const SkyPoint tanPoints[] = {
+        {1999.5, 1499.5, 83.8200000000, -5.3900000000},
+        {0.0, 0.0, 84.6508741316, -5.4890445848},
+        {3999.0, 0.0, 83.4908455111, -6.1559719064},
+        {0.0, 2999.0, 84.1483250281, -4.6238517008},
+        {3999.0, 2999.0, 82.9893983893, -5.2898289987},
+        {2500.0, 1000.0, 83.7584731105, -5.6176054809},
+    };
+    check_absolute("TAN, CD, known RA / Dec", cd, tanPoints, 6);
+
+    const SkyPoint sipPoints[] = {
+        {1999.5, 1499.5, 83.8200000000, -5.3900000000},
+        {0.0, 0.0, 84.6494297812, -5.4904668863},
+        {3999.0, 0.0, 83.4901406828, -6.1590408964},
+        {0.0, 2999.0, 84.1471715342, -4.6273702415},
+        {3999.0, 2999.0, 82.9885682074, -5.2910806102},
+        {2500.0, 1000.0, 83.7584167964, -5.6178710834},
+    };
+    check_absolute("TAN-SIP, known RA / Dec", sip, sipPoints, 6);
+
+    // 高赤纬、视场跨过 RA = 0
+    std::vector<std::string> high = base_cards("", 359.9, 62.5);
+    high.insert(high.end(), cd.begin() + 6, cd.end());
+    const SkyPoint highPoints[] = {
+        {1999.5, 1499.5, 359.9000000000, 62.5000000000},
+        {0.0, 0.0, 1.6847429878, 62.3889656516},
+        {3999.0, 0.0, 359.2089799109, 61.7321891453},
+        {0.0, 2999.0, 0.6274512314, 63.2642172766},
+        {3999.0, 2999.0, 358.1033029660, 62.5881048806},
+        {2500.0, 1000.0, 359.7683957824, 62.2723290540},
+    };
+    check_absolute("TAN, Dec +62.5 across RA 0", high, highPoints, 6);
+    check_round_trip("TAN, Dec +62.5, round trip", high);
+}
+
+} // namespace
+
+int main()
+{
+    check_wcs();
+
+    if (g_failures > 0)
+    {
+        std::printf("%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "AppPaths.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+std::string app_cache_dir(const std::string& sub)
+{
+    fs::path base;
+#if defined(_WIN32)
+    if (const char* local = std::getenv("LOCALAPPDATA"))
+        base = fs::path(local) / "FitsViewer";
+#elif defined(__APPLE__)
+    if (const char* home = std::getenv("HOME"))
+        base = fs::path(home) / "Library" / "Caches" / "FitsViewer";
+#else
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        base = fs::path(xdg) / "fitsviewer";
+    else if (const char* home = std::getenv("HOME"))
+        base = fs::path(home) / ".cache" / "fitsviewer";
+#endif
+    if (base.empty())
+        return std::string();
+    return (base / sub).string();
+}
+
+std::string unique_temp_path(const std::string& file)
+{
+    static std::atomic<unsigned> counter{0};
+
+    const uint64_t id = (uint64_t)std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                        (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    char suffix[48];
+    std::snprintf(suffix, sizeof(suffix), ".tmp%016llx-%u", (unsigned long long)id, counter++);
+    return file + suffix;
+}
+
+uint64_t fnv1a64(const std::string& s)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s)
+    {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+bool append_file_stamp(const std::string& path, std::string& key)
+{
+    std::error_code ec;
+    fs::path abs = fs::absolute(path, ec);
+    if (ec) return false;
+    auto mtime = fs::last_write_time(abs, ec);
+    if (ec) return false;
+    auto size = fs::file_size(abs, ec);
+    if (ec) return false;
+
+    std::ostringstream ss;
+    ss << abs.string() << '|' << (long long)mtime.time_since_epoch().count()
+       << '|' << (unsigned long long)size << '|';
+    key += ss.str();
+    return true;
+}
+
+std::string cache_file_path(const std::string& dir, const std::string& key, const char* ext)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx", (unsigned long long)fnv1a64(key));
+    return (fs::path(dir) / (std::string(name) + ext)).string();
+}
+
+bool replace_file(const std::string& file, const std::function<bool(FILE*)>& write)
+{
+    std::error_code ec;
+    const fs::path parent = fs::path(file).parent_path();
+    if (!parent.empty())
+        fs::create_directories(parent, ec);
+
+    const std::string tmp = unique_temp_path(file);
+    FILE* fp = std::fopen(tmp.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    bool ok = write(fp);
+    ok = (std::fclose(fp) == 0) && ok;
+
+    if (ok)
+        fs::rename(tmp, file, ec);
+    if (!ok || ec)
+    {
+        std::error_code rec;
+        fs::remove(tmp, rec);
+        return false;
+    }
+    return true;
+}
+
+FILE* open_cache_file(const std::string& file, const char magic[4], uint32_t version, const std::string& key)
+{
+    FILE* fp = std::fopen(file.c_str(), "rb");
+    if (!fp)
+        return nullptr;
+
+    char     stored[4] = {};
+    uint32_t header[2] = {};   // version, keyLen
+    bool ok = std::fread(stored, 1, 4, fp) == 4 && std::equal(stored, stored + 4, magic) &&
+              std::fread(header, sizeof(header), 1, fp) == 1 &&
+              header[0] == version && header[1] == key.size();
+    if (ok)
+    {
+        std::string storedKey(header[1], '\0');
+        ok = std::fread(&storedKey[0], 1, storedKey.size(), fp) == storedKey.size() && storedKey == key;
+    }
+
+    if (!ok)
+    {
+        std::fclose(fp);
+        return nullptr;
+    }
+    return fp;
+}
+
+bool write_cache_file(const std::string& file, const char magic[4], uint32_t version, const std::string& key,
+                      const std::function<bool(FILE*)>& writeBody)
+{
+    return replace_file(file, [&](FILE* fp) {
+        uint32_t header[2] = {version, (uint32_t)key.size()};
+        return std::fwrite(magic, 1, 4, fp) == 4 &&
+               std::fwrite(header, sizeof(header), 1, fp) == 1 &&
+               std::fwrite(key.data(), 1, key.size(), fp) == key.size() &&
+               writeBody(fp);
+    });
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+// 程序缓存目录下的子目录（不保证已存在）：
+// macOS: ~/Library/Caches/FitsViewer/<sub>，Windows: %LOCALAPPDATA%\FitsViewer\<sub>，
+// 其它: $XDG_CACHE_HOME/fitsviewer/<sub> 或 ~/.cache/fitsviewer/<sub>。
+// 找不到用户目录时返回空字符串（调用方不落盘）
+std::string app_cache_dir(const std::string& sub);
+
+// 和 file 同目录的临时文件名，每次调用都不同（线程 id + 时钟 + 计数），
+// 多个线程 / 进程同时写同一个缓存时不会互相覆盖对方还没改名的临时文件
+std::string unique_temp_path(const std::string& file);
+
+// 下面几个函数是磁盘缓存的公共部分，用在：缩略图（ThumbnailCache，thumbs/）、
+// 头索引（HeaderIndex，headers/，文本文件，只用 cache_file_path / replace_file）、
+// 坏点表（Cosmetic，defects/）、对齐结果（Registration，registration/）。键里的其它内容和数据布局见各自的头文件
+
+// 缓存文件名用的 64 位 FNV-1a 哈希
+uint64_t fnv1a64(const std::string& s);
+
+// 在 key 后追加 "绝对路径|修改时间|大小|"（修改时间取 file_time_type 的原始计数，不截断到秒），
+// 任何一项变了都视为新文件；文件不存在时返回 false
+bool append_file_stamp(const std::string& path, std::string& key);
+
+// 缓存目录下按 key 的哈希命名的文件：<dir>/<16 位十六进制><ext>
+std::string cache_file_path(const std::string& dir, const std::string& key, const char* ext);
+
+// 先写唯一命名的临时文件再改名覆盖 file，其它线程 / 进程不会读到写了一半的文件；
+// write 返回 false 或写入出错时删掉临时文件。file 所在目录不存在时先创建
+bool replace_file(const std::string& file, const std::function<bool(FILE*)>& write);
+
+// 二进制缓存文件的公共头：magic（4 字节）+ version + key 长度（uint32）+ key，之后是各自的数据。
+// open_cache_file 校验头（magic / 版本 / key 都一致），成功时返回停在数据开头的 FILE*（调用方 fclose）；
+// write_cache_file 写公共头 + writeBody 写的数据，经 replace_file 落盘
+FILE* open_cache_file(const std::string& file, const char magic[4], uint32_t version, const std::string& key);
+bool  write_cache_file(const std::string& file, const char magic[4], uint32_t version, const std::string& key,
+                       const std::function<bool(FILE*)>& writeBody);
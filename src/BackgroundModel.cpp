@@ -0,0 +1,270 @@
+#include "BackgroundModel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+static int term_count(int degree)
+{
+    return (degree + 1) * (degree + 2) / 2;
+}
+
+// 基函数 x^i y^j，按总次数从低到高排列
+static void basis(double x, double y, int degree, double* out)
+{
+    double xp[5] = {1.0, x, x * x, x * x * x, x * x * x * x};
+    double yp[5] = {1.0, y, y * y, y * y * y, y * y * y * y};
+    int k = 0;
+    for (int t = 0; t <= degree; ++t)
+        for (int j = 0; j <= t; ++j)
+            out[k++] = xp[t - j] * yp[j];
+}
+
+static float median_of(std::vector<float>& v)
+{
+    const size_t mid = v.size() / 2;
+    std::nth_element(v.begin(), v.begin() + mid, v.end());
+    return v[mid];
+}
+
+// 格子内的 sigma clip 中值；剩下的样本太少（格子大部分是星 / 饱和）时返回 false
+static bool clipped_median(std::vector<float>& v, float sigma, float& out)
+{
+    const size_t total = v.size();
+    std::vector<float> dev;
+    for (int iter = 0; iter < 3 && !v.empty(); ++iter)
+    {
+        const float m = median_of(v);
+        dev.resize(v.size());
+        for (size_t i = 0; i < v.size(); ++i)
+            dev[i] = std::fabs(v[i] - m);
+        const float s = 1.4826f * median_of(dev);
+        if (!(s > 0.0f))
+            break;
+
+        const size_t before = v.size();
+        v.erase(std::remove_if(v.begin(), v.end(), [&](float x) { return std::fabs(x - m) > sigma * s; }),
+                v.end());
+        if (v.size() == before)
+            break;
+    }
+
+    if (v.size() < std::max<size_t>(4, total * 3 / 10))
+        return false;
+    out = median_of(v);
+    return out < 0.98f;   // 饱和区域不是背景
+}
+
+// 高斯消元（列主元）解 A x = b，A 为 n x n，右端 b 有 3 列（每通道一列）；奇异时返回 false
+static bool solve_multi_rhs(std::vector<double> a, std::vector<double> b, int n, std::vector<double>& x)
+{
+    for (int col = 0; col < n; ++col)
+    {
+        int pivot = col;
+        for (int r = col + 1; r < n; ++r)
+            if (std::fabs(a[r * n + col]) > std::fabs(a[pivot * n + col]))
+                pivot = r;
+        if (std::fabs(a[pivot * n + col]) < 1e-12)
+            return false;
+        if (pivot != col)
+        {
+            for (int c = 0; c < n; ++c)
+                std::swap(a[col * n + c], a[pivot * n + c]);
+            for (int c = 0; c < 3; ++c)
+                std::swap(b[col * 3 + c], b[pivot * 3 + c]);
+        }
+        for (int r = col + 1; r < n; ++r)
+        {
+            const double f = a[r * n + col] / a[col * n + col];
+            if (f == 0.0)
+                continue;
+            for (int c = col; c < n; ++c)
+                a[r * n + c] -= f * a[col * n + c];
+            for (int c = 0; c < 3; ++c)
+                b[r * 3 + c] -= f * b[col * 3 + c];
+        }
+    }
+
+    x.assign((size_t)n * 3, 0.0);
+    for (int r = n - 1; r >= 0; --r)
+        for (int c = 0; c < 3; ++c)
+        {
+            double s = b[r * 3 + c];
+            for (int k = r + 1; k < n; ++k)
+                s -= a[r * n + k] * x[k * 3 + c];
+            x[r * 3 + c] = s / a[r * n + r];
+        }
+    return true;
+}
+
+bool fit_background(const float* samples, int sw, int sh, int imageW, int imageH,
+                    const BackgroundFitOptions& options, BackgroundModel& out)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    out = BackgroundModel{};
+    if (!samples || sw <= 0 || sh <= 0 || imageW <= 1 || imageH <= 1)
+        return false;
+
+    const int degree = std::clamp(options.degree, 1, 4);
+    const int nt     = term_count(degree);
+
+    // 格子数按原图长宽比，但每格至少要有几个样本
+    const int grid = std::max(options.grid, 2);
+    int gx = imageW >= imageH ? grid : std::max(2, (int)std::lround((double)grid * imageW / imageH));
+    int gy = imageH >= imageW ? grid : std::max(2, (int)std::lround((double)grid * imageH / imageW));
+    gx = std::min(gx, std::max(1, sw / 4));
+    gy = std::min(gy, std::max(1, sh / 4));
+
+    struct Cell
+    {
+        double x, y;     // [-1, 1]
+        float  v[3];
+        double b[15];
+    };
+    std::vector<Cell> cells;
+    cells.reserve((size_t)gx * gy);
+
+    std::vector<float> values;
+    for (int cy = 0; cy < gy; ++cy)
+    {
+        const int j0 = cy * sh / gy, j1 = (cy + 1) * sh / gy;
+        for (int cx = 0; cx < gx; ++cx)
+        {
+            const int i0 = cx * sw / gx, i1 = (cx + 1) * sw / gx;
+
+            Cell cell;
+            bool ok = true;
+            for (int c = 0; c < 3 && ok; ++c)
+            {
+                values.clear();
+                for (int j = j0; j < j1; ++j)
+                    for (int i = i0; i < i1; ++i)
+                        values.push_back(samples[((size_t)j * sw + i) * 3 + c]);
+                ok = clipped_median(values, options.sigma, cell.v[c]);
+            }
+            if (!ok)
+                continue;
+
+            // 格子覆盖原图 [i0, i1) / sw * W 这段（以像素边缘为 0），中点减 0.5 换成像素中心坐标，
+            // 和节点一样把像素 0 .. W-1 映射到 [-1, 1]
+            const double px = 0.5 * (i0 + i1) / sw * imageW - 0.5;
+            const double py = 0.5 * (j0 + j1) / sh * imageH - 0.5;
+            cell.x = px / (imageW - 1) * 2.0 - 1.0;
+            cell.y = py / (imageH - 1) * 2.0 - 1.0;
+            basis(cell.x, cell.y, degree, cell.b);
+            cells.push_back(cell);
+        }
+    }
+
+    const int minCells = std::max(2 * nt, 6);
+    if ((int)cells.size() < minCells)
+        return false;
+
+    // 拟合 + 剔除：残差按三通道平均，和稳健 sigma 比较；被剔除的格子每轮重新判定，可以回来
+    std::vector<char>   active(cells.size(), 1);
+    std::vector<double> coef;
+    std::vector<float>  resid(cells.size());
+    std::vector<float>  tmp;
+    int used = 0;
+    for (int iter = 0; iter < 10; ++iter)
+    {
+        std::vector<double> a((size_t)nt * nt, 0.0), b((size_t)nt * 3, 0.0);
+        used = 0;
+        for (size_t k = 0; k < cells.size(); ++k)
+        {
+            if (!active[k])
+                continue;
+            const Cell& cell = cells[k];
+            for (int r = 0; r < nt; ++r)
+            {
+                for (int c = 0; c < nt; ++c)
+                    a[r * nt + c] += cell.b[r] * cell.b[c];
+                for (int ch = 0; ch < 3; ++ch)
+                    b[r * 3 + ch] += cell.b[r] * cell.v[ch];
+            }
+            ++used;
+        }
+        if (used < minCells || !solve_multi_rhs(a, b, nt, coef))
+            return false;
+
+        for (size_t k = 0; k < cells.size(); ++k)
+        {
+            double r = 0.0;
+            for (int ch = 0; ch < 3; ++ch)
+            {
+                double m = 0.0;
+                for (int t = 0; t < nt; ++t)
+                    m += coef[t * 3 + ch] * cells[k].b[t];
+                r += cells[k].v[ch] - m;
+            }
+            resid[k] = (float)(r / 3.0);
+        }
+
+        tmp.clear();
+        for (size_t k = 0; k < cells.size(); ++k)
+            if (active[k])
+                tmp.push_back(resid[k]);
+        const float med = median_of(tmp);
+        for (float& d : tmp)
+            d = std::fabs(d - med);
+        const float sigma = std::max(1.4826f * median_of(tmp), 1e-6f);
+
+        bool changed = false;
+        for (size_t k = 0; k < cells.size(); ++k)
+        {
+            const char keep = std::fabs(resid[k] - med) <= options.rejectSigma * sigma ? 1 : 0;
+            changed |= keep != active[k];
+            active[k] = keep;
+        }
+        if (!changed)
+            break;
+        if ((int)std::count(active.begin(), active.end(), 1) < minCells)
+            return false;
+    }
+
+    used = (int)std::count(active.begin(), active.end(), 1);
+    double sum2 = 0.0;
+    for (size_t k = 0; k < cells.size(); ++k)
+        if (active[k])
+            sum2 += (double)resid[k] * resid[k];
+
+    // 在节点网格上求值
+    const int ms = std::max(options.modelSize, 2);
+    const int mw = imageW >= imageH ? ms : std::max(2, (int)std::lround((double)ms * imageW / imageH));
+    const int mh = imageH >= imageW ? ms : std::max(2, (int)std::lround((double)ms * imageH / imageW));
+    out.rgb.resize((size_t)mw * mh * 3);
+    double bv[15];
+    for (int j = 0; j < mh; ++j)
+    {
+        const double y = (double)j / (mh - 1) * 2.0 - 1.0;
+        for (int i = 0; i < mw; ++i)
+        {
+            basis((double)i / (mw - 1) * 2.0 - 1.0, y, degree, bv);
+            for (int ch = 0; ch < 3; ++ch)
+            {
+                double m = 0.0;
+                for (int t = 0; t < nt; ++t)
+                    m += coef[t * 3 + ch] * bv[t];
+                out.rgb[((size_t)j * mw + i) * 3 + ch] = (float)m;
+            }
+        }
+    }
+
+    for (int ch = 0; ch < 3; ++ch)
+    {
+        tmp.resize((size_t)mw * mh);
+        for (size_t k = 0; k < tmp.size(); ++k)
+            tmp[k] = out.rgb[k * 3 + ch];
+        out.level[ch] = median_of(tmp);
+    }
+
+    out.valid    = true;
+    out.width    = mw;
+    out.height   = mh;
+    out.degree   = degree;
+    out.cells    = used;
+    out.rejected = (int)cells.size() - used;
+    out.rms      = (float)std::sqrt(sum2 / std::max(used, 1));
+    out.ms       = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    return true;
+}
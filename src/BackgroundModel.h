@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+
+// 背景扣除方式（显示 shader 里在去拜耳之后、白平衡之前做）
+enum class BackgroundMode {
+    Off      = 0,
+    Subtract = 1,    // c - bg + level：光污染梯度（加性）
+    Divide   = 2     // c / bg * level：暗角 / 平场残差（乘性）
+};
+
+struct BackgroundFitOptions
+{
+    int   grid      = 24;     // 长边上的格子数，短边按长宽比
+    float sigma     = 2.5f;   // 格子内 sigma clip 的倍数
+    float rejectSigma = 3.0f; // 格子残差超过它倍的稳健 sigma 时当成星云 / 亮目标，不参与拟合
+    int   degree    = 2;      // 多项式阶数 1..4
+    int   modelSize = 64;     // 背景纹理长边的节点数
+};
+
+struct BackgroundModel
+{
+    bool  valid  = false;
+    int   width  = 0;                 // 背景纹理尺寸（节点数）
+    int   height = 0;
+    std::vector<float> rgb;           // width * height * 3，第 0 行是图像第 0 行
+    float level[3] = {0.0f, 0.0f, 0.0f};   // 各通道模型的中值：扣除后背景保持在这个水平
+    int   degree   = 0;
+    int   cells    = 0;               // 参与拟合的格子数
+    int   rejected = 0;               // 被当成目标剔除的格子数
+    float rms      = 0.0f;            // 参与拟合的格子残差 RMS（归一化单位，三通道平均）
+    double ms      = 0.0;
+};
+
+// 在降采样的样本上拟合背景曲面：
+// samples 是 sw x sh 的交错 RGB（均匀覆盖整幅图，第 0 行是图像第 0 行），imageW / imageH 是原图尺寸。
+// 1) 按格子对每个通道做 sigma clip 中值；
+// 2) 对格子中值按 x^i y^j（i + j <= degree）做最小二乘，残差过大的格子反复剔除后重拟合；
+// 3) 在 modelSize 的节点网格上求值（节点 j 对应原图像素 j / (n - 1) * (imageW - 1)）。
+// 只处理几百个格子，毫秒级。样本不够时返回 false
+bool fit_background(const float* samples, int sw, int sh, int imageW, int imageH,
+                    const BackgroundFitOptions& options, BackgroundModel& out);
@@ -0,0 +1,109 @@
+#include "BlinkPlayer.h"
+#include "GlImageRenderer.h"
+
+#include <algorithm>
+#include <iostream>
+
+void BlinkPlayer::clear(GlImageRenderer& renderer)
+{
+    renderer.setDisplayTexture(0);
+    for (Frame& f : _frames)
+        renderer.deleteFrameTexture(f.texture);
+    _frames.clear();
+
+    _usedBytes   = 0;
+    _current     = -1;
+    _playing     = false;
+    _measuredFps = 0.0f;
+}
+
+bool BlinkPlayer::fits(int width, int height) const
+{
+    return _usedBytes + GlImageRenderer::frameTextureBytes(width, height) <= _budget;
+}
+
+bool BlinkPlayer::addFrame(GlImageRenderer& renderer, const std::string& path,
+                           const std::vector<float>& bayerOrGray, int width, int height,
+                           double rawMin, double rawMax, const double* refToFrame)
+{
+    if (!fits(width, height))
+        return false;
+
+    unsigned int tex = renderer.createFrameTexture(bayerOrGray, width, height);
+    if (!tex)
+    {
+        std::cerr << "Blink: cannot upload " << path << " (size mismatch or out of GPU memory)\n";
+        return false;
+    }
+
+    Frame frame;
+    frame.path    = path;
+    frame.texture = tex;
+    frame.rawMin  = rawMin;
+    frame.rawMax  = rawMax;
+    frame.aligned = refToFrame != nullptr;
+    if (refToFrame)
+        std::copy(refToFrame, refToFrame + 9, frame.refToFrame);
+    _frames.push_back(frame);
+    _usedBytes += GlImageRenderer::frameTextureBytes(width, height);
+    return true;
+}
+
+void BlinkPlayer::setFps(float fps)
+{
+    _fps = std::clamp(fps, 1.0f, 60.0f);
+}
+
+void BlinkPlayer::play(double now)
+{
+    if (_frames.empty())
+        return;
+    _playing    = true;
+    _nextSwitch = now;
+    _lastSwitch = now;
+}
+
+void BlinkPlayer::step(GlImageRenderer& renderer, int delta)
+{
+    int n = (int)_frames.size();
+    if (n == 0)
+        return;
+    show(renderer, ((_current + delta) % n + n) % n);
+}
+
+void BlinkPlayer::update(GlImageRenderer& renderer, double now)
+{
+    if (!_playing || _frames.empty() || now < _nextSwitch)
+        return;
+
+    double period = 1.0 / _fps;
+
+    // 掉帧时直接追上当前时间，不连续补切
+    _nextSwitch += period;
+    if (_nextSwitch < now)
+        _nextSwitch = now + period;
+
+    double dt = now - _lastSwitch;
+    if (dt > 0.0)
+    {
+        float inst = (float)(1.0 / dt);
+        _measuredFps = (_measuredFps <= 0.0f) ? inst : _measuredFps * 0.9f + inst * 0.1f;
+    }
+    _lastSwitch = now;
+
+    step(renderer, 1);
+}
+
+const BlinkPlayer::Frame* BlinkPlayer::currentFrame() const
+{
+    if (_current < 0 || _current >= (int)_frames.size())
+        return nullptr;
+    return &_frames[_current];
+}
+
+void BlinkPlayer::show(GlImageRenderer& renderer, int index)
+{
+    _current = index;
+    renderer.setDisplayTexture(_frames[index].texture, _frames[index].rawMin, _frames[index].rawMax);
+    renderer.setAlignment(_frames[index].aligned ? _frames[index].refToFrame : nullptr);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class GlImageRenderer;
+
+// 闪烁 / 动画播放：一组同尺寸的帧全部常驻为 GPU 纹理（受显存预算限制），
+// 播放时只切换显示纹理，拉伸参数沿用参考帧算好的值，不解码、不读回统计。
+class BlinkPlayer
+{
+public:
+    struct Frame
+    {
+        std::string  path;
+        unsigned int texture = 0;
+        double       rawMin  = 0.0;        // 这一帧的归一化范围，显示时换算到参考帧的范围
+        double       rawMax  = 1.0;
+        bool         aligned = false;
+        double       refToFrame[9] = {};   // 对齐显示用（GlImageRenderer::setAlignment）
+    };
+
+    BlinkPlayer() = default;
+
+    BlinkPlayer(const BlinkPlayer&) = delete;
+    BlinkPlayer& operator=(const BlinkPlayer&) = delete;
+
+    // 删除所有帧纹理，显示切回底图（对齐由调用方恢复成底图的）
+    void clear(GlImageRenderer& renderer);
+
+    // 上传一帧；超出预算或尺寸不符返回 false。rawMin / rawMax 是 bayerOrGray 的归一化范围
+    // （每帧按自己的最小 / 最大值归一化，显示时统一换算到参考帧的范围，共用一组黑白点亮度不跳）。
+    // refToFrame 非空时播放到这一帧按它对齐显示
+    bool addFrame(GlImageRenderer& renderer, const std::string& path,
+                  const std::vector<float>& bayerOrGray, int width, int height,
+                  double rawMin, double rawMax, const double* refToFrame = nullptr);
+
+    // 再放一帧 width x height 会不会超预算
+    bool fits(int width, int height) const;
+
+    void   setBudget(size_t bytes) { _budget = bytes; }
+    size_t budget() const { return _budget; }
+    size_t usedBytes() const { return _usedBytes; }
+
+    void  setFps(float fps);
+    float fps() const { return _fps; }
+
+    void play(double now);
+    void pause() { _playing = false; }
+    bool playing() const { return _playing; }
+
+    // 手动前后翻一帧（循环）
+    void step(GlImageRenderer& renderer, int delta);
+
+    // 每个 UI 帧调用，按目标帧率切换显示纹理
+    void update(GlImageRenderer& renderer, double now);
+
+    int          frameCount() const { return (int)_frames.size(); }
+    int          currentIndex() const { return _current; }
+    const Frame* currentFrame() const;
+
+    // 实际切换帧率（指数滑动平均）
+    float measuredFps() const { return _measuredFps; }
+
+private:
+    void show(GlImageRenderer& renderer, int index);
+
+private:
+    std::vector<Frame> _frames;
+    size_t _budget    = (size_t)2048 << 20;
+    size_t _usedBytes = 0;
+
+    float  _fps         = 15.0f;
+    bool   _playing     = false;
+    int    _current     = -1;
+    double _nextSwitch  = 0.0;   // 下一次切换的时间（秒）
+    double _lastSwitch  = 0.0;
+    float  _measuredFps = 0.0f;
+};
@@ -0,0 +1,309 @@
+#include "Calibration.h"
+#include "Cosmetic.h"
+#include "HeaderIndex.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+
+// 每个线程至少处理的行数，小图不值得开线程
+static const int kMinRowsPerThread = 64;
+
+bool load_calibration_frame(const std::string& path, CalibrationFrame& out)
+{
+    FitsImage img;
+    if (!load_fits(path, img, BayerPattern::NONE))
+        return false;
+
+    if (img.channels != 1 || img.raw.size() != (size_t)img.width * img.height)
+    {
+        std::cerr << "Calibration master must be a single plane: " << path << "\n";
+        return false;
+    }
+
+    out.path    = path;
+    out.width   = img.width;
+    out.height  = img.height;
+    out.exptime = header_exposure(img.headerCards);
+    out.data.resize(img.raw.size());
+
+    const double* src = img.raw.data();
+    float*        dst = out.data.data();
+    parallel_for(0, img.height, kMinRowsPerThread, [&](int y0, int y1) {
+        for (size_t i = (size_t)y0 * img.width, n = (size_t)y1 * img.width; i < n; ++i)
+            dst[i] = (float)src[i];
+    });
+    return true;
+}
+
+double header_exposure(const std::vector<std::string>& cards)
+{
+    double exposure = std::numeric_limits<double>::quiet_NaN();
+    std::string key, value;
+    for (const std::string& card : cards)
+    {
+        if (!parse_fits_card(card, key, value) || value.empty())
+            continue;
+        if (key == "EXPTIME")
+            return std::atof(value.c_str());
+        if (key == "EXPOSURE")
+            exposure = std::atof(value.c_str());
+    }
+    return exposure;
+}
+
+std::shared_ptr<const Calibration> Calibration::build(const CalibrationFrame* bias,
+                                                      const CalibrationFrame* dark,
+                                                      const CalibrationFrame* flat,
+                                                      bool scaleDark, std::string& error)
+{
+    int W = 0, H = 0;
+    for (const CalibrationFrame* f : {bias, dark, flat})
+    {
+        if (!f)
+            continue;
+        if (!f->isValid())
+        {
+            error = "empty master: " + f->path;
+            return nullptr;
+        }
+        if (W == 0)
+        {
+            W = f->width;
+            H = f->height;
+        }
+        else if (f->width != W || f->height != H)
+        {
+            error = "master size mismatch: " + f->path;
+            return nullptr;
+        }
+    }
+    if (W == 0)
+    {
+        error = "no masters";
+        return nullptr;
+    }
+
+    std::shared_ptr<Calibration> cal(new Calibration());
+    cal->_width     = W;
+    cal->_height    = H;
+    cal->_scaleDark = scaleDark && bias != nullptr;
+
+    const size_t n = (size_t)W * H;
+    if (bias)
+        cal->_bias = bias->data;
+
+    if (dark)
+    {
+        cal->_darkExptime = dark->exptime;
+        cal->_thermal.resize(n);
+        const float* d = dark->data.data();
+        const float* b = bias ? bias->data.data() : nullptr;
+        float*       t = cal->_thermal.data();
+        parallel_for(0, H, kMinRowsPerThread, [&](int y0, int y1) {
+            for (size_t i = (size_t)y0 * W, e = (size_t)y1 * W; i < e; ++i)
+                t[i] = b ? d[i] - b[i] : d[i];
+        });
+    }
+
+    if (flat)
+    {
+        // 减去偏置后按全图均值归一化，存倒数（应用时只做乘法）
+        cal->_invFlat.resize(n);
+        const float* f = flat->data.data();
+        const float* b = bias ? bias->data.data() : nullptr;
+        float*       inv = cal->_invFlat.data();
+
+        std::mutex sumMutex;
+        double     sum = 0.0;
+        parallel_for(0, H, kMinRowsPerThread, [&](int y0, int y1) {
+            double s = 0.0;
+            for (size_t i = (size_t)y0 * W, e = (size_t)y1 * W; i < e; ++i)
+            {
+                inv[i] = b ? f[i] - b[i] : f[i];
+                s += inv[i];
+            }
+            std::lock_guard<std::mutex> lock(sumMutex);
+            sum += s;
+        });
+
+        const double mean = sum / (double)n;
+        if (!(mean > 0.0))
+        {
+            error = "flat has no signal: " + flat->path;
+            return nullptr;
+        }
+
+        // 死像素 / 暗角外的零值不放大，保持原样
+        const float minNorm = 1e-3f;
+        const float scale   = (float)mean;
+        parallel_for(0, H, kMinRowsPerThread, [&](int y0, int y1) {
+            for (size_t i = (size_t)y0 * W, e = (size_t)y1 * W; i < e; ++i)
+            {
+                float v = inv[i] / scale;
+                inv[i] = v > minNorm ? 1.0f / v : 1.0f;
+            }
+        });
+    }
+
+    return cal;
+}
+
+double Calibration::darkScale(const FitsImage& img) const
+{
+    if (!_scaleDark || !(_darkExptime > 0.0))
+        return 1.0;
+    double t = header_exposure(img.headerCards);
+    return t >= 0.0 ? t / _darkExptime : 1.0;
+}
+
+// 各步骤用模板参数展开，内层循环没有分支，编译器可以直接向量化
+template <bool Bias, bool Dark, bool Flat>
+static void calibrate_span(double* __restrict r, const float* __restrict b,
+                           const float* __restrict t, const float* __restrict f,
+                           size_t n, double k, double& mn, double& mx)
+{
+    double lo = mn, hi = mx;
+    for (size_t i = 0; i < n; ++i)
+    {
+        double v = r[i];
+        if (Bias) v -= b[i];
+        if (Dark) v -= k * t[i];
+        if (Flat) v *= f[i];
+        r[i] = v;
+        lo = v < lo ? v : lo;
+        hi = v > hi ? v : hi;
+    }
+    mn = lo;
+    mx = hi;
+}
+
+using CalibrateSpanFn = void (*)(double*, const float*, const float*, const float*,
+                                 size_t, double, double&, double&);
+
+static CalibrateSpanFn pick_span(bool bias, bool dark, bool flat)
+{
+    static const CalibrateSpanFn table[8] = {
+        calibrate_span<false, false, false>, calibrate_span<false, false, true>,
+        calibrate_span<false, true,  false>, calibrate_span<false, true,  true>,
+        calibrate_span<true,  false, false>, calibrate_span<true,  false, true>,
+        calibrate_span<true,  true,  false>, calibrate_span<true,  true,  true>,
+    };
+    return table[(bias ? 4 : 0) | (dark ? 2 : 0) | (flat ? 1 : 0)];
+}
+
+bool Calibration::apply(FitsImage& img, double& mn, double& mx) const
+{
+    return apply(img, mn, mx, true, true, true);
+}
+
+bool Calibration::apply(FitsImage& img, double& mn, double& mx, bool useBias, bool useDark, bool useFlat) const
+{
+    const size_t plane = (size_t)img.width * img.height;
+    if (img.width != _width || img.height != _height || plane == 0 || img.raw.size() % plane != 0)
+        return false;
+
+    const int       planes = (int)(img.raw.size() / plane);
+    const double    k      = darkScale(img);
+    const bool      bias   = useBias && hasBias();
+    const bool      dark   = useDark && hasDark();
+    const bool      flat   = useFlat && hasFlat();
+    CalibrateSpanFn span   = pick_span(bias, dark, flat);
+
+    std::mutex mergeMutex;
+    double     lo =  std::numeric_limits<double>::infinity();
+    double     hi = -std::numeric_limits<double>::infinity();
+
+    // 行号跨所有平面连续编号，每块自己统计 min / max，最后合并一次
+    parallel_for(0, _height * planes, kMinRowsPerThread, [&](int r0, int r1) {
+        double cmn = std::numeric_limits<double>::infinity();
+        double cmx = -cmn;
+        for (int r = r0; r < r1;)
+        {
+            int p     = r / _height;
+            int y0    = r % _height;
+            int y1    = std::min(_height, y0 + (r1 - r));
+            size_t o  = (size_t)y0 * _width;
+            size_t n  = (size_t)(y1 - y0) * _width;
+            span(img.raw.data() + p * plane + o,
+                 bias ? _bias.data() + o : nullptr,
+                 dark ? _thermal.data() + o : nullptr,
+                 flat ? _invFlat.data() + o : nullptr,
+                 n, k, cmn, cmx);
+            r += y1 - y0;
+        }
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        lo = std::min(lo, cmn);
+        hi = std::max(hi, cmx);
+    });
+
+    mn = lo;
+    mx = hi;
+    return true;
+}
+
+static void raw_minmax_parallel(const FitsImage& img, double& mn, double& mx)
+{
+    const int    rows = (int)(img.raw.size() / std::max(1, img.width));
+    const double* raw = img.raw.data();
+
+    std::mutex mergeMutex;
+    mn =  std::numeric_limits<double>::infinity();
+    mx = -std::numeric_limits<double>::infinity();
+    parallel_for(0, rows, kMinRowsPerThread, [&](int r0, int r1) {
+        double lo = std::numeric_limits<double>::infinity();
+        double hi = -lo;
+        for (size_t i = (size_t)r0 * img.width, e = (size_t)r1 * img.width; i < e; ++i)
+        {
+            double v = raw[i];
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        mn = std::min(mn, lo);
+        mx = std::max(mx, hi);
+    });
+}
+
+bool calibrate_and_normalize(FitsImage& img, const Calibration* cal, const CosmeticSettings* cosmetic,
+                             std::vector<float>& normalized, double* outMin, double* outMax)
+{
+    normalized.resize(img.raw.size());
+    if (img.raw.empty() || img.width <= 0)
+        return false;
+
+    double mn = 0.0, mx = 1.0;
+    bool calibrated = cal && cal->apply(img, mn, mx);
+    if (cal && !calibrated)
+        std::cerr << "Calibration skipped: master size " << cal->width() << "x" << cal->height()
+                  << " != image " << img.width << "x" << img.height << "\n";
+    if (cosmetic)
+        cosmetic_correct(img, img.channels == 1 && img.bayer != BayerPattern::NONE, *cosmetic, mn, mx);
+    else if (!calibrated)
+        raw_minmax_parallel(img, mn, mx);
+
+    // 与 normalize_raw 相同：全相同时按 0~1
+    if (!(mn < mx))
+    {
+        mn = 0.0;
+        mx = 1.0;
+    }
+    const double scale = 1.0 / (mx - mn);
+    if (outMin) *outMin = mn;
+    if (outMax) *outMax = mx;
+
+    const int     rows = (int)(img.raw.size() / img.width);
+    const double* raw  = img.raw.data();
+    float*        out  = normalized.data();
+    parallel_for(0, rows, kMinRowsPerThread, [&](int r0, int r1) {
+        for (size_t i = (size_t)r0 * img.width, e = (size_t)r1 * img.width; i < e; ++i)
+        {
+            float v = (float)((raw[i] - mn) * scale);
+            out[i] = std::clamp(v, 0.0f, 1.0f);
+        }
+    });
+    return calibrated;
+}
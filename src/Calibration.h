@@ -0,0 +1,83 @@
+#pragma once
+
+#include "FitsImage.h"
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+// 一张校准主帧（master bias / dark / flat）：单平面，原生 ADU 存成 float
+struct CalibrationFrame
+{
+    std::string        path;
+    int                width   = 0;
+    int                height  = 0;
+    double             exptime = std::numeric_limits<double>::quiet_NaN();
+    std::vector<float> data;
+
+    bool isValid() const { return width > 0 && height > 0 && !data.empty(); }
+};
+
+// 读取主帧，只接受单平面图像
+bool load_calibration_frame(const std::string& path, CalibrationFrame& out);
+
+// 头里的曝光时间（EXPTIME，其次 EXPOSURE），没有时为 NaN
+double header_exposure(const std::vector<std::string>& cards);
+
+// 准备好的校准数据，构建后不再修改，可以被多个线程共享。
+// light = (raw - bias - k * thermal) * invFlat
+//   thermal = dark - bias（没有 bias 时就是 dark 本身，此时 k 固定为 1，因为 dark 里还带着偏置）
+//   k       = 亮场曝光 / dark 曝光（scaleDark 且两边都有 EXPTIME 时）
+//   invFlat = 1 / ((flat - bias) / 均值)
+class Calibration
+{
+public:
+    // 传 nullptr 的主帧跳过对应步骤；所有主帧尺寸必须一致，否则返回 nullptr 并写 error
+    static std::shared_ptr<const Calibration> build(const CalibrationFrame* bias,
+                                                    const CalibrationFrame* dark,
+                                                    const CalibrationFrame* flat,
+                                                    bool scaleDark, std::string& error);
+
+    int  width()  const { return _width; }
+    int  height() const { return _height; }
+    bool hasBias() const { return !_bias.empty(); }
+    bool hasDark() const { return !_thermal.empty(); }
+    bool hasFlat() const { return !_invFlat.empty(); }
+
+    // 准备好的数组（GPU 校准上传纹理用），没有对应主帧时为空
+    const std::vector<float>& bias()    const { return _bias; }
+    const std::vector<float>& thermal() const { return _thermal; }
+    const std::vector<float>& invFlat() const { return _invFlat; }
+
+    // 这一帧实际用的 dark 系数
+    double darkScale(const FitsImage& img) const;
+
+    // 原地校准 raw（三平面时每个平面用同一套主帧），同一趟里统计 min / max；
+    // 尺寸不一致时返回 false，raw 不动
+    bool apply(FitsImage& img, double& mn, double& mx) const;
+
+    // 同上，只用勾选的步骤（GPU 模式的 Calibration 带着全部主帧，开关在 shader 参数里）
+    bool apply(FitsImage& img, double& mn, double& mx, bool useBias, bool useDark, bool useFlat) const;
+
+private:
+    Calibration() = default;
+
+    int                _width  = 0;
+    int                _height = 0;
+    bool               _scaleDark = true;
+    double             _darkExptime = std::numeric_limits<double>::quiet_NaN();
+    std::vector<float> _bias;
+    std::vector<float> _thermal;
+    std::vector<float> _invFlat;
+};
+
+struct CosmeticSettings;
+
+// 校准（cal 为空或尺寸不符时跳过）+ 坏点修正（cosmetic 为空时跳过）+ 归一化到 0~1，多线程分行带执行。
+// 校准和 min / max 统计在同一趟里完成，所以不修坏点时总共两趟，和不校准时一样；
+// 坏点修正必须在校准之后（热点要在减 dark 之后判断），它自己重新统计 min / max。
+// 返回是否真的做了校准；outMin / outMax 为归一化用的范围（raw = min + n * (max - min)）
+bool calibrate_and_normalize(FitsImage& img, const Calibration* cal, const CosmeticSettings* cosmetic,
+                             std::vector<float>& normalized,
+                             double* outMin = nullptr, double* outMax = nullptr);
@@ -0,0 +1,206 @@
+#include "CaptureWatcher.h"
+
+#include "FitsImage.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+// 没有变化通知（监视失败）时多久重新列一次目录
+static const double kRescanSeconds = 2.0;
+// 等待写完的文件多久重新 stat 一次
+static const double kCheckSeconds  = 0.2;
+
+static double seconds_between(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b)
+{
+    return std::chrono::duration<double>(b - a).count();
+}
+
+bool CaptureWatcher::start(const std::string& dir, bool includeExisting)
+{
+    stop();
+
+    std::error_code ec;
+    if (dir.empty() || !fs::is_directory(dir, ec))
+        return false;
+
+    _dir      = dir;
+    _watching = _watcher.watch(dir);
+
+    const Clock::time_point now = Clock::now();
+    _lastScan  = now;
+    _lastCheck = now;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+    {
+        std::error_code fec;
+        if (!it->is_regular_file(fec) || !has_fits_extension(it->path().filename().string()))
+            continue;
+
+        const std::string name = it->path().filename().string();
+        Signature sig;
+        if (!stat_file(name, sig))
+            continue;
+
+        if (includeExisting)
+            _pending[name] = Pending{sig, now, true, false};
+        else
+            _known[name] = sig;
+    }
+    return true;
+}
+
+void CaptureWatcher::stop()
+{
+    _watcher.close();
+    _watching = false;
+    _dir.clear();
+    _known.clear();
+    _pending.clear();
+}
+
+bool CaptureWatcher::stat_file(const std::string& name, Signature& out) const
+{
+    std::error_code ec;
+    const fs::path p = fs::path(_dir) / name;
+    uintmax_t size = fs::file_size(p, ec);
+    if (ec)
+        return false;
+    fs::file_time_type mtime = fs::last_write_time(p, ec);
+    if (ec)
+        return false;
+
+    out.size  = size;
+    out.mtime = (int64_t)mtime.time_since_epoch().count();
+    return true;
+}
+
+void CaptureWatcher::touch(const std::string& name, Clock::time_point now, bool closed, bool needClose)
+{
+    if (!has_fits_extension(name))
+        return;
+
+    Signature sig;
+    if (!stat_file(name, sig))
+    {
+        // 删掉 / 改名走了
+        _pending.erase(name);
+        _known.erase(name);
+        return;
+    }
+
+    auto known = _known.find(name);
+    if (known != _known.end() && known->second == sig)
+        return;
+
+    // 关闭后又被改写（补写头）时要等新的关闭通知；重新列目录（可能丢了事件）时不再要求
+    auto pending = _pending.find(name);
+    if (pending == _pending.end())
+        _pending[name] = Pending{sig, now, closed, needClose};
+    else if (!(pending->second.last == sig))
+        pending->second = Pending{sig, now, closed || (pending->second.closed && !needClose), needClose};
+    else
+    {
+        Pending& p = pending->second;
+        if (closed && !p.closed)
+        {
+            p.closed = true;
+            p.since  = now;
+        }
+        p.needClose = p.needClose && needClose;
+    }
+}
+
+void CaptureWatcher::rescan()
+{
+    const Clock::time_point now = Clock::now();
+    _lastScan = now;
+
+    std::error_code ec;
+    for (fs::directory_iterator it(_dir, ec), end; !ec && it != end; it.increment(ec))
+    {
+        std::error_code fec;
+        if (it->is_regular_file(fec))
+            touch(it->path().filename().string(), now, false, false);
+    }
+}
+
+bool CaptureWatcher::poll(std::vector<std::string>& ready)
+{
+    ready.clear();
+    if (_dir.empty())
+        return false;
+
+    const Clock::time_point now = Clock::now();
+
+    std::vector<std::string> names;
+    std::vector<std::string> closed;
+    bool needRescan = false;
+    if (_watching)
+    {
+        if (_watcher.poll(names, needRescan, &closed))
+        {
+            if (needRescan)
+                rescan();
+            else
+            {
+                const bool needClose = _watcher.reportsClose();
+                for (const std::string& name : names)
+                    touch(name, now, std::find(closed.begin(), closed.end(), name) != closed.end(), needClose);
+            }
+        }
+    }
+    else if (seconds_between(_lastScan, now) >= kRescanSeconds)
+    {
+        rescan();
+    }
+
+    if (_pending.empty() || seconds_between(_lastCheck, now) < kCheckSeconds)
+        return false;
+    _lastCheck = now;
+
+    // 关闭写入之后再隔一次检查没变（拍摄软件有时关闭后再打开补写头），
+    // 或者平台没有关闭通知时 stableTime 内都没变，才算写完
+    std::vector<std::pair<Signature, std::string>> done;
+    for (auto it = _pending.begin(); it != _pending.end();)
+    {
+        Signature sig;
+        if (!stat_file(it->first, sig))
+        {
+            it = _pending.erase(it);
+            continue;
+        }
+
+        if (!(sig == it->second.last))
+        {
+            Pending& p = it->second;
+            p = Pending{sig, now, p.closed && !p.needClose, p.needClose};
+            ++it;
+            continue;
+        }
+
+        if (it->second.needClose && !it->second.closed)
+        {
+            ++it;
+            continue;
+        }
+
+        const double quiet = it->second.closed ? kCheckSeconds : _stableTime;
+        if (sig.size > 0 && seconds_between(it->second.since, now) >= quiet)
+        {
+            _known[it->first] = sig;
+            done.emplace_back(sig, it->first);
+            it = _pending.erase(it);
+            continue;
+        }
+        ++it;
+    }
+
+    std::sort(done.begin(), done.end(), [](const auto& a, const auto& b) {
+        return a.first.mtime != b.first.mtime ? a.first.mtime < b.first.mtime : a.second < b.second;
+    });
+    for (const auto& d : done)
+        ready.push_back((fs::path(_dir) / d.second).string());
+    return !ready.empty();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "DirectoryWatcher.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// 采集目录监视：找出新出现（或被覆盖写）且已经写完的 FITS 文件。
+// 变化通知来自 DirectoryWatcher（Linux inotify，其他平台只知道“有变化”时重新列目录），
+// 写完的判断：inotify 报告了关闭写入（或改名进来）且之后再隔一次检查大小 / 修改时间没变，
+// inotify 在监视时没有关闭通知的文件一直等；其他平台（以及事件溢出后重新列目录发现的文件）
+// 没有这个通知，要求 stableTime 内不再变化。
+// 监视失败时退化成定时重新列目录。不是线程安全的，由一个线程非阻塞地轮询。
+class CaptureWatcher
+{
+public:
+    // includeExisting 为 false 时开始监视前已有的文件不报告
+    bool start(const std::string& dir, bool includeExisting);
+    void stop();
+
+    bool active() const { return !_dir.empty(); }
+    const std::string& directory() const { return _dir; }
+
+    void setStableTime(double seconds) { _stableTime = seconds; }
+
+    // 取走新就绪的文件（完整路径，按修改时间从旧到新），没有时返回 false
+    bool poll(std::vector<std::string>& ready);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Signature
+    {
+        uintmax_t size  = 0;
+        int64_t   mtime = 0;
+        bool operator==(const Signature& o) const { return size == o.size && mtime == o.mtime; }
+    };
+
+    struct Pending
+    {
+        Signature         last;
+        Clock::time_point since;   // last 从什么时候起没再变（收到关闭通知时也重新计）
+        bool              closed    = false;   // 收到过关闭写入的通知
+        bool              needClose = false;   // 变化来自 inotify 事件，必须等到关闭通知
+    };
+
+    bool stat_file(const std::string& name, Signature& out) const;
+    void rescan();
+    void touch(const std::string& name, Clock::time_point now, bool closed, bool needClose);
+
+private:
+    std::string                      _dir;
+    DirectoryWatcher                 _watcher;
+    bool                             _watching   = false;
+    double                           _stableTime = 1.0;
+    Clock::time_point                _lastScan;
+    Clock::time_point                _lastCheck;
+    std::map<std::string, Signature> _known;     // 已经报告过（或开始时就在）的文件
+    std::map<std::string, Pending>   _pending;   // 文件名 -> 等待写完
+};
@@ -0,0 +1,322 @@
+#include "Cosmetic.h"
+#include "AppPaths.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+static const char     kDefectMagic[4] = {'F', 'V', 'D', 'M'};
+static const uint32_t kDefectVersion  = 2;
+
+static const int kMinRowsPerThread = 32;
+
+// 8 个数的中值（排序网络，19 次比较交换）
+template <class T>
+static inline T median8(T* a)
+{
+    auto cs = [&](int i, int j) {
+        if (a[j] < a[i])
+            std::swap(a[i], a[j]);
+    };
+    cs(0, 1); cs(2, 3); cs(4, 5); cs(6, 7);
+    cs(0, 2); cs(1, 3); cs(4, 6); cs(5, 7);
+    cs(1, 2); cs(5, 6); cs(0, 4); cs(3, 7);
+    cs(1, 5); cs(2, 6);
+    cs(1, 4); cs(3, 6);
+    cs(2, 4); cs(3, 5);
+    cs(3, 4);
+    return (a[3] + a[4]) / 2;
+}
+
+// 同色邻居：越界时取对侧（镜像），边缘像素也有 8 个邻居
+static inline const double* mirror_row(const double* data, int W, int H, int y, int d, int dir)
+{
+    int yy = y + dir * d;
+    if (yy < 0 || yy >= H)
+        yy = y - dir * d;
+    return data + (size_t)yy * W;
+}
+
+template <class T>
+static inline void gather_row_neighbors(const T* ru, const T* r0, const T* rd, int W, int x, int d, T* n)
+{
+    int xl = x - d >= 0 ? x - d : x + d;
+    int xr = x + d <  W ? x + d : x - d;
+    n[0] = ru[xl]; n[1] = ru[x]; n[2] = ru[xr];
+    n[3] = r0[xl];               n[4] = r0[xr];
+    n[5] = rd[xl]; n[6] = rd[x]; n[7] = rd[xr];
+}
+
+template <class T>
+static inline void gather_neighbors(const T* data, int W, int H, int x, int y, int d, T* n)
+{
+    int yu = y - d >= 0 ? y - d : y + d;
+    int yd = y + d <  H ? y + d : y - d;
+    gather_row_neighbors(data + (size_t)yu * W, data + (size_t)y * W, data + (size_t)yd * W, W, x, d, n);
+}
+
+// 判断 v 是否离群，是的话 out 为替换值（邻居中值）
+template <class T>
+static inline bool is_outlier(T v, T* n, double noise, float hotSigma, float coldSigma, T& out)
+{
+    T lo = n[0], hi = n[0];
+    for (int i = 1; i < 8; ++i)
+    {
+        lo = n[i] < lo ? n[i] : lo;
+        hi = n[i] > hi ? n[i] : hi;
+    }
+
+    // 绝大多数像素在这里就排除了，不用排序：中值不低于最小邻居，
+    // 所以 v - lo 不到 hotSigma * noise 时 v - m 也不可能超过阈值
+    const bool hot  = hotSigma > 0.0f && v > hi && (double)(v - lo) > hotSigma * noise;
+    const bool cold = coldSigma > 0.0f && v < lo && (double)(hi - v) > coldSigma * noise;
+    if (!hot && !cold)
+        return false;
+
+    T m = median8(n);
+    T dev[8];
+    for (int i = 0; i < 8; ++i)
+        dev[i] = n[i] > m ? n[i] - m : m - n[i];
+    double sigma = std::max(noise, 1.4826 * (double)median8(dev));
+
+    if (hot && (double)(v - m) > hotSigma * sigma)
+    {
+        out = m;
+        return true;
+    }
+    if (cold && (double)(m - v) > coldSigma * sigma)
+    {
+        out = m;
+        return true;
+    }
+    return false;
+}
+
+template <class T>
+static double noise_sigma_impl(const T* data, int W, int H, bool cfa)
+{
+    const int d = cfa ? 2 : 1;
+    if (W < 2 * d + 1 || H < 2 * d + 1)
+        return 0.0;
+
+    // 约 6.5 万个样本，网格步长取偶数，Bayer 时四种颜色都会抽到
+    const size_t target = (size_t)1 << 16;
+    int step = (int)std::sqrt((double)W * H / (double)target);
+    step = std::max(2, step + (step & 1));
+
+    std::vector<double> res;
+    res.reserve(target * 2);
+    for (int y = d; y < H - d; y += step)
+    {
+        for (int x = d + (y / step & 1); x < W - d; x += step)
+        {
+            T n[8];
+            gather_neighbors(data, W, H, x, y, d, n);
+            res.push_back(std::abs((double)data[(size_t)y * W + x] - (double)median8(n)));
+        }
+    }
+    if (res.empty())
+        return 0.0;
+
+    std::nth_element(res.begin(), res.begin() + res.size() / 2, res.end());
+    return 1.4826 * res[res.size() / 2];
+}
+
+double estimate_noise_sigma(const double* data, int width, int height, bool cfa)
+{
+    return noise_sigma_impl(data, width, height, cfa);
+}
+
+double estimate_noise_sigma(const float* data, int width, int height, bool cfa)
+{
+    return noise_sigma_impl(data, width, height, cfa);
+}
+
+int cosmetic_correct(FitsImage& img, bool cfa, const CosmeticSettings& settings, double& mn, double& mx)
+{
+    const int W = img.width, H = img.height;
+    const size_t plane = (size_t)W * H;
+    mn =  std::numeric_limits<double>::infinity();
+    mx = -std::numeric_limits<double>::infinity();
+    if (plane == 0 || img.raw.size() % plane != 0)
+        return 0;
+
+    const int  planes = (int)(img.raw.size() / plane);
+    const int  d      = cfa ? 2 : 1;
+    const bool useMap = !settings.defects.pixels.empty() &&
+                        settings.defects.width == W && settings.defects.height == H;
+    const float hotSigma  = settings.detect ? settings.hotSigma  : 0.0f;
+    const float coldSigma = settings.detect ? settings.coldSigma : 0.0f;
+
+    std::mutex mergeMutex;
+    std::vector<std::pair<size_t, double>> fixes;
+    int fixed = 0;
+
+    for (int p = 0; p < planes; ++p)
+    {
+        const double* data  = img.raw.data() + p * plane;
+        const double  noise = settings.detect ? estimate_noise_sigma(data, W, H, cfa) : 0.0;
+        const std::vector<uint32_t>& defects = settings.defects.pixels;
+
+        // 先在原始数据上检测，各线程记下要改的像素，全部结束后再写回（邻居不会被别的线程改到一半）
+        fixes.clear();
+        parallel_for(0, H, kMinRowsPerThread, [&](int y0, int y1) {
+            std::vector<std::pair<size_t, double>> local;
+            double lo =  std::numeric_limits<double>::infinity();
+            double hi = -lo;
+
+            auto cursor = useMap ? std::lower_bound(defects.begin(), defects.end(), (uint32_t)((size_t)y0 * W))
+                                 : defects.end();
+            double n[8];
+            for (int y = y0; y < y1; ++y)
+            {
+                const double* row  = data + (size_t)y * W;
+                const double* up   = mirror_row(data, W, H, y, d, -1);
+                const double* down = mirror_row(data, W, H, y, d, 1);
+                for (int x = 0; x < W; ++x)
+                {
+                    const size_t i = (size_t)y * W + x;
+                    const double v = row[x];
+
+                    if (cursor != defects.end() && *cursor == i)
+                    {
+                        ++cursor;
+                        gather_row_neighbors(up, row, down, W, x, d, n);
+                        local.emplace_back(i, median8(n));
+                        continue;
+                    }
+
+                    if (hotSigma > 0.0f || coldSigma > 0.0f)
+                    {
+                        double repl;
+                        gather_row_neighbors(up, row, down, W, x, d, n);
+                        if (is_outlier(v, n, noise, hotSigma, coldSigma, repl))
+                        {
+                            local.emplace_back(i, repl);
+                            continue;
+                        }
+                    }
+
+                    lo = v < lo ? v : lo;
+                    hi = v > hi ? v : hi;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mergeMutex);
+            fixes.insert(fixes.end(), local.begin(), local.end());
+            mn = std::min(mn, lo);
+            mx = std::max(mx, hi);
+        });
+
+        double* out = img.raw.data() + p * plane;
+        for (const auto& [i, v] : fixes)
+        {
+            out[i] = v;
+            mn = std::min(mn, v);
+            mx = std::max(mx, v);
+        }
+        fixed += (int)fixes.size();
+    }
+    return fixed;
+}
+
+void build_defect_map(const float* dark, int width, int height, bool cfa, float sigma, DefectMap& out)
+{
+    out.width  = width;
+    out.height = height;
+    out.pixels.clear();
+    if (!dark || width <= 0 || height <= 0)
+        return;
+
+    const int    d     = cfa ? 2 : 1;
+    const double noise = estimate_noise_sigma(dark, width, height, cfa);
+
+    std::mutex mergeMutex;
+    std::vector<std::vector<uint32_t>> bands;
+    parallel_for(0, height, kMinRowsPerThread, [&](int y0, int y1) {
+        std::vector<uint32_t> local;
+        float n[8];
+        for (int y = y0; y < y1; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                float repl;
+                gather_neighbors(dark, width, height, x, y, d, n);
+                if (is_outlier(dark[(size_t)y * width + x], n, noise, sigma, 0.0f, repl))
+                    local.push_back((uint32_t)((size_t)y * width + x));
+            }
+        }
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        bands.push_back(std::move(local));
+    });
+
+    for (const auto& b : bands)
+        out.pixels.insert(out.pixels.end(), b.begin(), b.end());
+    std::sort(out.pixels.begin(), out.pixels.end());
+}
+
+// ---------- 磁盘缓存 ----------
+
+static bool defect_cache_file(const std::string& cacheDir, const std::string& darkPath,
+                              bool cfa, float sigma, std::string& file, std::string& key)
+{
+    if (cacheDir.empty())
+        return false;
+
+    key.clear();
+    if (!append_file_stamp(darkPath, key))
+        return false;
+
+    std::ostringstream ss;
+    ss << sigma << '|' << (cfa ? 1 : 0);
+    key += ss.str();
+    file = cache_file_path(cacheDir, key, ".dfm");
+    return true;
+}
+
+bool load_cached_defect_map(const std::string& cacheDir, const std::string& darkPath,
+                            bool cfa, float sigma, DefectMap& out)
+{
+    std::string file;
+    std::string key;
+    if (!defect_cache_file(cacheDir, darkPath, cfa, sigma, file, key))
+        return false;
+
+    FILE* fp = open_cache_file(file, kDefectMagic, kDefectVersion, key);
+    if (!fp)
+        return false;
+
+    uint32_t header[3] = {};   // width, height, count
+    bool ok = std::fread(header, sizeof(header), 1, fp) == 1 &&
+              (uint64_t)header[2] <= (uint64_t)header[0] * header[1];
+    if (ok)
+    {
+        out.width  = (int)header[0];
+        out.height = (int)header[1];
+        out.pixels.resize(header[2]);
+        ok = std::fread(out.pixels.data(), sizeof(uint32_t), out.pixels.size(), fp) == out.pixels.size();
+    }
+
+    std::fclose(fp);
+    return ok;
+}
+
+void store_cached_defect_map(const std::string& cacheDir, const std::string& darkPath,
+                             bool cfa, float sigma, const DefectMap& map)
+{
+    std::string file;
+    std::string key;
+    if (!defect_cache_file(cacheDir, darkPath, cfa, sigma, file, key))
+        return;
+
+    write_cache_file(file, kDefectMagic, kDefectVersion, key, [&](FILE* fp) {
+        uint32_t header[3] = {(uint32_t)map.width, (uint32_t)map.height, (uint32_t)map.pixels.size()};
+        return std::fwrite(header, sizeof(header), 1, fp) == 1 &&
+               std::fwrite(map.pixels.data(), sizeof(uint32_t), map.pixels.size(), fp) == map.pixels.size();
+    });
+}
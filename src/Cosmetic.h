@@ -0,0 +1,43 @@
+#pragma once
+
+#include "FitsImage.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 已知坏点表（通常来自 master dark）：行优先像素下标，升序
+struct DefectMap
+{
+    int                   width  = 0;
+    int                   height = 0;
+    std::vector<uint32_t> pixels;
+};
+
+// 坏点 / 热点修正参数，构建后不再修改，可以在线程间共享
+struct CosmeticSettings
+{
+    bool      detect    = true;    // 按同色邻居检测离群点
+    float     hotSigma  = 5.0f;
+    float     coldSigma = 0.0f;    // 0 为不修暗点
+    DefectMap defects;             // 为空或尺寸不符时不用
+};
+
+// 离群判定（CPU / GPU 相同）：取同色邻居（Bayer 时距离 2、单色时距离 1 的 8 个）的中值 m，
+// 像素高于所有邻居且 v - m > hotSigma * σ 时为热点（暗点对称），替换为 m。
+// σ = max(全图噪声, 1.4826 * 邻居的 MAD)：星点核心周围的邻居本身起伏大，不会被误判。
+// 原地修正 raw（多线程，先检测后统一写回），同一趟统计修正后的 min / max；返回修正的像素数
+int cosmetic_correct(FitsImage& img, bool cfa, const CosmeticSettings& settings, double& mn, double& mx);
+
+// 全图噪声：等间隔抽样，v - 邻居中值 的 MAD * 1.4826
+double estimate_noise_sigma(const double* data, int width, int height, bool cfa);
+double estimate_noise_sigma(const float* data, int width, int height, bool cfa);
+
+// 从 master dark 按同样的判定找热点
+void build_defect_map(const float* dark, int width, int height, bool cfa, float sigma, DefectMap& out);
+
+// 坏点表磁盘缓存：键 = dark 的绝对路径 + 修改时间 + 大小 + sigma + cfa，任何一项变了都重新生成
+bool load_cached_defect_map(const std::string& cacheDir, const std::string& darkPath,
+                            bool cfa, float sigma, DefectMap& out);
+void store_cached_defect_map(const std::string& cacheDir, const std::string& darkPath,
+                             bool cfa, float sigma, const DefectMap& map);
@@ -66,74 +66,102 @@ static void conceptual_to_physical(
     if (py >= H) py = H - 1;
 }
 
-bool debayer_bilinear(const FitsImage& in, FitsImage& out)
+void raw_minmax(const FitsImage& in, double& mn, double& mx)
 {
-    if (!in.isValid())
+    compute_minmax(in.raw, mn, mx);
+}
+
+void bayer_display_flip(BayerPattern pattern, bool& flipX, bool& flipY)
+{
+    flipX = pattern == BayerPattern::BGGR || pattern == BayerPattern::GRBG;
+    flipY = pattern == BayerPattern::BGGR || pattern == BayerPattern::GBRG;
+}
+
+void bayer_flip_transform(BayerPattern pattern, int width, int height, const double m[9], double out[9])
+{
+    bool flipX, flipY;
+    bayer_display_flip(pattern, flipX, flipY);
+    const double f[9] = {flipX ? -1.0 : 1.0, 0.0, flipX ? width - 1.0 : 0.0,
+                         0.0, flipY ? -1.0 : 1.0, flipY ? height - 1.0 : 0.0,
+                         0.0, 0.0, 1.0};
+
+    double fm[9];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+            fm[r * 3 + c] = f[r * 3] * m[c] + f[r * 3 + 1] * m[3 + c] + f[r * 3 + 2] * m[6 + c];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+            out[r * 3 + c] = fm[r * 3] * f[c] + fm[r * 3 + 1] * f[3 + c] + fm[r * 3 + 2] * f[6 + c];
+}
+
+bool debayer_bilinear_rows(const FitsImage& in, BayerPattern pattern,
+                           double mn, double mx,
+                           int y0, int y1, float* outRGB)
+{
+    if (!in.isValid() || !outRGB)
         return false;
 
-    // 非 Bayer 或 3 通道：灰度转 RGB
-    if (in.bayer == BayerPattern::NONE || in.channels == 3)
-    {
-        out = in;
-        out.channels = 3;
-        out.bayer = BayerPattern::NONE;
-        out.rgb.resize(static_cast<size_t>(out.width) * out.height * 3);
+    const int W = in.width;
+    const int H = in.height;
+    y0 = std::max(y0, 0);
+    y1 = std::min(y1, H);
+
+    double range = mx - mn;
+    if (range == 0.0)
+        range = 1.0;
+
+    auto norm = [&](double v) -> float {
+        float t = static_cast<float>((v - mn) / range);
+        return std::clamp(t, 0.0f, 1.0f);
+    };
 
-        double mn, mx;
-        compute_minmax(in.raw, mn, mx);
-        double range = mx - mn;
+    // 非 Bayer：灰度转 RGB；3 通道：按平面读 R/G/B
+    if (pattern == BayerPattern::NONE || in.channels == 3)
+    {
+        const size_t plane = static_cast<size_t>(W) * H;
+        const bool planar = in.channels == 3 && in.raw.size() >= plane * 3;
 
-        for (int y = 0; y < out.height; ++y)
+        for (int y = y0; y < y1; ++y)
         {
-            for (int x = 0; x < out.width; ++x)
+            float* dst = outRGB + static_cast<size_t>(y - y0) * W * 3;
+            for (int x = 0; x < W; ++x)
             {
-                size_t idx = static_cast<size_t>(y) * out.width + x;
-                float v = static_cast<float>((in.raw[idx] - mn) / range);
-                v = std::clamp(v, 0.0f, 1.0f);
-                out.rgb[idx * 3 + 0] = v;
-                out.rgb[idx * 3 + 1] = v;
-                out.rgb[idx * 3 + 2] = v;
+                size_t idx = static_cast<size_t>(y) * W + x;
+                if (planar)
+                {
+                    dst[x * 3 + 0] = norm(in.raw[idx]);
+                    dst[x * 3 + 1] = norm(in.raw[plane + idx]);
+                    dst[x * 3 + 2] = norm(in.raw[2 * plane + idx]);
+                }
+                else
+                {
+                    float v = norm(in.raw[idx]);
+                    dst[x * 3 + 0] = v;
+                    dst[x * 3 + 1] = v;
+                    dst[x * 3 + 2] = v;
+                }
             }
         }
         return true;
     }
 
-    if (in.bayer != BayerPattern::RGGB &&
-        in.bayer != BayerPattern::BGGR &&
-        in.bayer != BayerPattern::GRBG &&
-        in.bayer != BayerPattern::GBRG)
+    if (pattern != BayerPattern::RGGB &&
+        pattern != BayerPattern::BGGR &&
+        pattern != BayerPattern::GRBG &&
+        pattern != BayerPattern::GBRG)
     {
         std::cerr << "debayer_bilinear: unsupported bayer pattern.\n";
         return false;
     }
 
-    const int W = in.width;
-    const int H = in.height;
-
-    out.width = W;
-    out.height = H;
-    out.channels = 3;
-    out.bayer = BayerPattern::NONE;
-    out.raw = in.raw;
-    out.rgb.assign(static_cast<size_t>(W) * H * 3, 0.0f);
-
-    double mn, mx;
-    compute_minmax(in.raw, mn, mx);
-    double range = mx - mn;
-
-    auto norm = [&](double v) -> float {
-        float t = static_cast<float>((v - mn) / range);
-        return std::clamp(t, 0.0f, 1.0f);
-    };
-
     auto get_norm = [&](int cx, int cy) -> float {
         int px = cx, py = cy;
-        conceptual_to_physical(cx, cy, W, H, in.bayer, px, py);
+        conceptual_to_physical(cx, cy, W, H, pattern, px, py);
         size_t idx = static_cast<size_t>(py) * W + px;
         return norm(in.raw[idx]);
     };
 
-    for (int y = 0; y < H; ++y)
+    for (int y = y0; y < y1; ++y)
     {
         for (int x = 0; x < W; ++x)
         {
@@ -185,12 +213,40 @@ bool debayer_bilinear(const FitsImage& in, FitsImage& out)
                              get_norm(x + 1, y + 1));
             }
 
-            size_t dst = static_cast<size_t>(y) * W + x;
-            out.rgb[dst * 3 + 0] = R;
-            out.rgb[dst * 3 + 1] = G;
-            out.rgb[dst * 3 + 2] = B;
+            size_t dst = static_cast<size_t>(y - y0) * W + x;
+            outRGB[dst * 3 + 0] = R;
+            outRGB[dst * 3 + 1] = G;
+            outRGB[dst * 3 + 2] = B;
         }
     }
 
     return true;
 }
+
+bool debayer_bilinear(const FitsImage& in, FitsImage& out)
+{
+    if (!in.isValid())
+        return false;
+
+    double mn, mx;
+    compute_minmax(in.raw, mn, mx);
+
+    const bool isRgbSource = (in.bayer == BayerPattern::NONE || in.channels == 3);
+
+    std::vector<float> rgb(static_cast<size_t>(in.width) * in.height * 3, 0.0f);
+    if (!debayer_bilinear_rows(in, in.bayer, mn, mx, 0, in.height, rgb.data()))
+        return false;
+
+    if (isRgbSource)
+        out = in;
+    else
+    {
+        out.width  = in.width;
+        out.height = in.height;
+        out.raw    = in.raw;
+    }
+    out.channels = 3;
+    out.bayer = BayerPattern::NONE;
+    out.rgb = std::move(rgb);
+    return true;
+}
@@ -4,3 +4,21 @@
 
 // 全分辨率双线性去拜耳：支持 RGGB / BGGR / GRBG / GBRG
 bool debayer_bilinear(const FitsImage& in, FitsImage& out);
+
+// RAW 的最小/最大值（全相同时返回 0/1），去拜耳时按它归一化到 [0,1]
+void raw_minmax(const FitsImage& in, double& mn, double& mx);
+
+// 只计算第 [y0, y1) 行的交错 RGB（0~1），mn/mx 为整幅图的归一化范围，
+// 用于按行带流式处理大图；pattern 覆盖 in.bayer（UI 可能在加载后改过）；
+// outRGB 至少 (y1 - y0) * width * 3
+bool debayer_bilinear_rows(const FitsImage& in, BayerPattern pattern,
+                           double mn, double mx,
+                           int y0, int y1, float* outRGB);
+
+// 去拜耳输出（屏幕显示 / 导出的方向）相对文件像素的翻转，和上面按“概念 RGGB”取像素一致：
+// BGGR 旋转 180°，GRBG 水平翻转，GBRG 垂直翻转。翻转自逆，文件坐标 <-> 显示坐标都用它
+void bayer_display_flip(BayerPattern pattern, bool& flipX, bool& flipY);
+
+// 文件像素坐标下的 3x3 变换（行优先，如对齐矩阵）换到去拜耳输出坐标下：F * m * F，
+// F 为上面的翻转（x -> W - 1 - x 和 / 或 y -> H - 1 - y）
+void bayer_flip_transform(BayerPattern pattern, int width, int height, const double m[9], double out[9]);
@@ -0,0 +1,221 @@
+#include "DirectoryLister.h"
+#include "FitsImage.h"
+
+#include <chrono>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// 每批最多多少项：第一批尽快到达界面，之后随列随显示
+static const size_t kBatchSize = 512;
+
+static int64_t to_unix_seconds(fs::file_time_type t)
+{
+    // C++17 没有 clock_cast，按两个时钟的当前时间差换算
+    using namespace std::chrono;
+    auto sys = time_point_cast<system_clock::duration>(t - fs::file_time_type::clock::now() + system_clock::now());
+    return (int64_t)duration_cast<seconds>(sys.time_since_epoch()).count();
+}
+
+static bool stat_entry(const fs::directory_entry& entry, DirEntry& out)
+{
+    std::error_code ec;
+    out.name  = entry.path().filename().string();
+    out.isDir = entry.is_directory(ec);
+    if (ec)
+        return false;
+
+    out.isFits = !out.isDir && has_fits_extension(out.name);
+    out.size   = out.isDir ? 0 : (uint64_t)entry.file_size(ec);
+    if (ec)
+        out.size = 0;
+
+    auto mtime = entry.last_write_time(ec);
+    out.mtime  = ec ? 0 : to_unix_seconds(mtime);
+    return true;
+}
+
+DirectoryLister::~DirectoryLister()
+{
+    stop();
+}
+
+void DirectoryLister::start()
+{
+    if (_worker.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = false;
+    }
+    _worker = std::thread(&DirectoryLister::workerLoop, this);
+}
+
+void DirectoryLister::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        ++_generation;
+    }
+    _cv.notify_all();
+
+    if (_worker.joinable())
+        _worker.join();
+}
+
+void DirectoryLister::list(const std::string& dir)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_generation;
+
+        // 全量请求之前排队的请求都没意义了
+        _requests.clear();
+        Request req;
+        req.dir        = dir;
+        req.full       = true;
+        req.generation = _generation;
+        _requests.push_back(std::move(req));
+    }
+    _cv.notify_one();
+}
+
+void DirectoryLister::update(const std::string& dir, const std::vector<std::string>& names)
+{
+    if (names.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Request req;
+        req.dir        = dir;
+        req.full       = false;
+        req.names      = names;
+        req.generation = _generation;
+        _requests.push_back(std::move(req));
+    }
+    _cv.notify_one();
+}
+
+bool DirectoryLister::poll(std::vector<DirListing>& out)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_results.empty())
+        return false;
+
+    for (DirListing& r : _results)
+        out.push_back(std::move(r));
+    _results.clear();
+    return true;
+}
+
+bool DirectoryLister::busy() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _busy || !_requests.empty();
+}
+
+void DirectoryLister::push(DirListing&& batch)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _results.push_back(std::move(batch));
+}
+
+void DirectoryLister::workerLoop()
+{
+    for (;;)
+    {
+        Request req;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [&] { return _stopping || !_requests.empty(); });
+            if (_stopping)
+                return;
+
+            req = std::move(_requests.front());
+            _requests.pop_front();
+            _busy = true;
+        }
+
+        if (req.full)
+            runFull(req);
+        else
+            runUpdate(req);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _busy = false;
+    }
+}
+
+void DirectoryLister::runFull(const Request& req)
+{
+    auto cancelled = [&] {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stopping || _generation != req.generation;
+    };
+
+    DirListing batch;
+    batch.dir   = req.dir;
+    batch.reset = true;
+
+    std::error_code ec;
+    fs::directory_iterator it(req.dir, fs::directory_options::skip_permission_denied, ec);
+    if (ec)
+    {
+        batch.done  = true;
+        batch.error = ec.message();
+        push(std::move(batch));
+        return;
+    }
+
+    for (fs::directory_iterator end; it != end; it.increment(ec))
+    {
+        if (ec)
+        {
+            batch.error = ec.message();
+            break;
+        }
+
+        DirEntry e;
+        if (stat_entry(*it, e))
+            batch.entries.push_back(std::move(e));
+
+        if (batch.entries.size() >= kBatchSize)
+        {
+            if (cancelled())
+                return;
+            push(std::move(batch));
+            batch = DirListing();
+            batch.dir = req.dir;
+        }
+    }
+
+    if (cancelled())
+        return;
+    batch.done = true;
+    push(std::move(batch));
+}
+
+void DirectoryLister::runUpdate(const Request& req)
+{
+    DirListing batch;
+    batch.dir         = req.dir;
+    batch.incremental = true;
+
+    for (const std::string& name : req.names)
+    {
+        std::error_code ec;
+        fs::directory_entry entry(fs::path(req.dir) / name, ec);
+        DirEntry e;
+        if (!ec && entry.exists(ec) && stat_entry(entry, e))
+            batch.entries.push_back(std::move(e));
+        else
+            batch.removed.push_back(name);
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_generation == req.generation)
+        _results.push_back(std::move(batch));
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 目录项元数据：列目录时一次取好，界面每帧只读缓存，不再 stat
+struct DirEntry
+{
+    std::string name;
+    bool        isDir  = false;
+    bool        isFits = false;
+    uint64_t    size   = 0;
+    int64_t     mtime  = 0;     // Unix 秒
+};
+
+// 一批列目录结果：全量列目录会分成若干批（reset 的那批清空旧列表），
+// 增量更新只带变化的项 + 已删除的名字
+struct DirListing
+{
+    std::string              dir;
+    bool                     incremental = false;   // update() 的结果，否则是全量列目录的一批
+    bool                     reset = false;         // 先清空再加入 entries
+    bool                     done  = false;         // 这次全量列目录的最后一批
+    std::vector<DirEntry>    entries;         // 新增 / 更新
+    std::vector<std::string> removed;
+    std::string              error;
+};
+
+// 后台列目录：网络盘上几千个文件的 stat 都在工作线程里做，结果分批交给 UI 线程。
+// 新的全量请求会让正在进行的旧请求提前结束。
+class DirectoryLister
+{
+public:
+    DirectoryLister() = default;
+    ~DirectoryLister();
+
+    DirectoryLister(const DirectoryLister&) = delete;
+    DirectoryLister& operator=(const DirectoryLister&) = delete;
+
+    void start();
+    void stop();
+
+    // 全量列目录
+    void list(const std::string& dir);
+
+    // 只重新 stat 这些名字（目录监视报告的变化），不存在的当作删除
+    void update(const std::string& dir, const std::vector<std::string>& names);
+
+    // 按顺序取走所有结果
+    bool poll(std::vector<DirListing>& out);
+
+    bool busy() const;
+
+private:
+    struct Request
+    {
+        std::string              dir;
+        bool                     full = true;
+        std::vector<std::string> names;
+        unsigned                 generation = 0;
+    };
+
+    void workerLoop();
+    void runFull(const Request& req);
+    void runUpdate(const Request& req);
+    void push(DirListing&& batch);
+
+private:
+    std::thread             _worker;
+    mutable std::mutex      _mutex;
+    std::condition_variable _cv;
+    bool                    _stopping = false;
+    bool                    _busy     = false;
+
+    std::deque<Request>     _requests;
+    std::vector<DirListing> _results;
+    unsigned                _generation = 0;   // 每个全量请求加 1，旧请求看到变化就退出
+};
@@ -0,0 +1,218 @@
+#include "DirectoryWatcher.h"
+
+#include <algorithm>
+#include <iostream>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+    #include <filesystem>
+#elif defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/event.h>
+    #include <unistd.h>
+#else
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+    close();
+}
+
+#if defined(_WIN32)
+
+bool DirectoryWatcher::watch(const std::string& dir)
+{
+    close();
+    _dir = dir;
+
+    std::wstring wdir = std::filesystem::path(dir).wstring();
+    HANDLE h = FindFirstChangeNotificationW(wdir.c_str(), FALSE,
+                                            FILE_NOTIFY_CHANGE_FILE_NAME |
+                                            FILE_NOTIFY_CHANGE_DIR_NAME |
+                                            FILE_NOTIFY_CHANGE_SIZE |
+                                            FILE_NOTIFY_CHANGE_LAST_WRITE);
+    if (h == INVALID_HANDLE_VALUE)
+        return false;
+
+    _handle = h;
+    return true;
+}
+
+void DirectoryWatcher::close()
+{
+    if (_handle)
+    {
+        FindCloseChangeNotification((HANDLE)_handle);
+        _handle = nullptr;
+    }
+}
+
+bool DirectoryWatcher::reportsClose() const
+{
+    return false;
+}
+
+bool DirectoryWatcher::poll(std::vector<std::string>& changedNames, bool& rescan,
+                            std::vector<std::string>* closedNames)
+{
+    (void)changedNames;
+    (void)closedNames;
+    rescan = false;
+    if (!_handle)
+        return false;
+
+    if (WaitForSingleObject((HANDLE)_handle, 0) != WAIT_OBJECT_0)
+        return false;
+
+    FindNextChangeNotification((HANDLE)_handle);
+    rescan = true;
+    return true;
+}
+
+#elif defined(__APPLE__)
+
+bool DirectoryWatcher::watch(const std::string& dir)
+{
+    close();
+    _dir = dir;
+
+    _wd = ::open(dir.c_str(), O_EVTONLY);
+    if (_wd < 0)
+        return false;
+
+    _fd = kqueue();
+    if (_fd < 0)
+    {
+        close();
+        return false;
+    }
+
+    struct kevent change;
+    EV_SET(&change, _wd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+           NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, nullptr);
+    if (kevent(_fd, &change, 1, nullptr, 0, nullptr) < 0)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void DirectoryWatcher::close()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+    if (_wd >= 0)
+        ::close(_wd);
+    _fd = -1;
+    _wd = -1;
+}
+
+bool DirectoryWatcher::reportsClose() const
+{
+    return false;
+}
+
+bool DirectoryWatcher::poll(std::vector<std::string>& changedNames, bool& rescan,
+                            std::vector<std::string>* closedNames)
+{
+    (void)changedNames;
+    (void)closedNames;
+    rescan = false;
+    if (_fd < 0)
+        return false;
+
+    struct kevent   events[8];
+    struct timespec zero = {0, 0};
+    int n = kevent(_fd, nullptr, 0, events, 8, &zero);
+    if (n <= 0)
+        return false;
+
+    rescan = true;
+    return true;
+}
+
+#else
+
+bool DirectoryWatcher::watch(const std::string& dir)
+{
+    close();
+    _dir = dir;
+
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd < 0)
+        return false;
+
+    _wd = inotify_add_watch(_fd, dir.c_str(),
+                            IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY |
+                            IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (_wd < 0)
+    {
+        std::cerr << "inotify_add_watch failed for " << dir << "\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void DirectoryWatcher::close()
+{
+    if (_fd >= 0)
+        ::close(_fd);   // 关闭 fd 会同时移除 watch
+    _fd = -1;
+    _wd = -1;
+}
+
+bool DirectoryWatcher::reportsClose() const
+{
+    return _fd >= 0;
+}
+
+bool DirectoryWatcher::poll(std::vector<std::string>& changedNames, bool& rescan,
+                            std::vector<std::string>* closedNames)
+{
+    rescan = false;
+    if (_fd < 0)
+        return false;
+
+    bool changed = false;
+    alignas(inotify_event) char buf[16384];
+
+    for (;;)
+    {
+        ssize_t len = ::read(_fd, buf, sizeof(buf));
+        if (len <= 0)
+            break;   // EAGAIN：已读完
+
+        for (char* p = buf; p < buf + len; )
+        {
+            const inotify_event* ev = reinterpret_cast<const inotify_event*>(p);
+            p += sizeof(inotify_event) + ev->len;
+
+            changed = true;
+            if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+                rescan = true;
+            else if (ev->len > 0)
+            {
+                changedNames.emplace_back(ev->name);
+                if (closedNames && (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)))
+                    closedNames->emplace_back(ev->name);
+            }
+        }
+    }
+
+    if (!changed)
+        return false;
+
+    // 同一个文件写入时会有多个事件
+    std::sort(changedNames.begin(), changedNames.end());
+    changedNames.erase(std::unique(changedNames.begin(), changedNames.end()), changedNames.end());
+    return true;
+}
+
+#endif
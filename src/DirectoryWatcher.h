@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// 监视单个目录的变化（不递归），由 UI 线程每帧非阻塞轮询：
+// - Linux: inotify，能报告具体哪些文件名变了
+// - macOS: kqueue (EVFILT_VNODE)，Windows: FindFirstChangeNotification，只知道“有变化”
+// 拿不到具体名字（或事件溢出）时 rescan 为 true，调用方重新列整个目录
+class DirectoryWatcher
+{
+public:
+    DirectoryWatcher() = default;
+    ~DirectoryWatcher();
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    // 切换到新目录；失败时返回 false（之后 poll 永远没有变化）
+    bool watch(const std::string& dir);
+    void close();
+
+    // 取走自上次调用以来的变化；没有变化返回 false。
+    // closedNames 非空时另外给出写完关闭（IN_CLOSE_WRITE）或改名进来（IN_MOVED_TO）的文件名，只有 inotify 提供
+    bool poll(std::vector<std::string>& changedNames, bool& rescan,
+              std::vector<std::string>* closedNames = nullptr);
+
+    // poll 会不会给出 closedNames（只有 inotify 在监视时）
+    bool reportsClose() const;
+
+    const std::string& directory() const { return _dir; }
+
+private:
+    std::string _dir;
+
+#if defined(_WIN32)
+    void* _handle = nullptr;   // HANDLE
+#else
+    int   _fd     = -1;        // inotify / kqueue
+    int   _wd     = -1;        // inotify watch 描述符 / kqueue 监视的目录 fd
+#endif
+};
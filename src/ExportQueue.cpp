@@ -0,0 +1,135 @@
+#include "ExportQueue.h"
+#include "Profiler.h"
+
+#include <iostream>
+
+ExportQueue::~ExportQueue()
+{
+    stop();
+}
+
+void ExportQueue::start()
+{
+    if (_worker.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = false;
+    }
+    _worker = std::thread(&ExportQueue::workerLoop, this);
+}
+
+void ExportQueue::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cv.notify_all();
+
+    if (_worker.joinable())
+        _worker.join();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (const ExportJob& job : _jobs)
+        _completed.push_back({job.id, job.path, false});
+    _jobs.clear();
+}
+
+void ExportQueue::submit(ExportJob job)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(std::move(job));
+    }
+    _cv.notify_one();
+}
+
+bool ExportQueue::pollCompleted(std::vector<ExportResult>& out)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_completed.empty())
+        return false;
+    out.insert(out.end(), _completed.begin(), _completed.end());
+    _completed.clear();
+    return true;
+}
+
+int ExportQueue::pendingCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return (int)_jobs.size() + (_busy ? 1 : 0);
+}
+
+bool ExportQueue::currentProgress(std::string& path, float& progress) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_busy)
+        return false;
+    path = _currentPath;
+    progress = _progress.load();
+    return true;
+}
+
+void ExportQueue::workerLoop()
+{
+    for (;;)
+    {
+        ExportJob job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [&] { return _stopping || !_jobs.empty(); });
+            if (_stopping)
+                return;
+
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+            _busy = true;
+            _currentPath = job.path;
+            _progress = 0.0f;
+        }
+
+        bool ok = encode(job);
+        if (!ok)
+            std::cerr << "Failed to write image: " << job.path << "\n";
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _busy = false;
+        _completed.push_back({job.id, job.path, ok});
+    }
+}
+
+bool ExportQueue::encode(const ExportJob& job)
+{
+    ProfileScope scope("export encode");
+
+    if (job.task)
+    {
+        bool ok = job.task(_progress);
+        _progress = 1.0f;
+        return ok;
+    }
+
+    if (!job.pixels || job.width <= 0 || job.height <= 0)
+        return false;
+
+    std::unique_ptr<ImageRowWriter> writer =
+        open_image_writer(job.path, job.format, job.width, job.height, job.options);
+    if (!writer)
+        return false;
+
+    bool ok = true;
+    for (int y = 0; y < job.height && ok; ++y)
+    {
+        int srcRow = job.bottomUp ? (job.height - 1 - y) : y;
+        ok = writer->writeRow(job.pixels + (size_t)srcRow * job.rowBytes);
+
+        if ((y & 63) == 0)
+            _progress = (float)(y + 1) / (float)job.height;
+    }
+
+    ok = writer->close() && ok;
+    _progress = 1.0f;
+    return ok;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "ImageWriter.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 不经过 GPU 读回的导出（如 CPU 处理的 FITS），自己负责写文件并更新进度 0~1
+using ExportTask = std::function<bool(std::atomic<float>& progress)>;
+
+// 一个待编码的导出任务：像素已经在内存里（通常是映射的 PBO），编码线程只读不写；
+// 设置了 task 时忽略像素字段，直接在编码线程里运行 task
+struct ExportJob
+{
+    int                id       = 0;
+    std::string        path;
+    ExportFormat       format   = ExportFormat::PNG8;
+    ImageWriterOptions options;
+
+    const unsigned char* pixels   = nullptr;   // 交错 RGB，16 bit 为本机字节序
+    int                  width    = 0;
+    int                  height   = 0;
+    size_t               rowBytes = 0;
+    bool                 bottomUp = true;      // OpenGL 读回的行顺序
+
+    ExportTask           task;
+};
+
+// 编码完成事件，由 UI 线程轮询
+struct ExportResult
+{
+    int         id = 0;
+    std::string path;
+    bool        ok = false;
+};
+
+// 导出编码队列：单个后台线程按提交顺序逐个编码写文件，
+// 提交方在收到对应 id 的完成事件之前必须保持 pixels 有效
+class ExportQueue
+{
+public:
+    ExportQueue() = default;
+    ~ExportQueue();
+
+    void start();
+    // 等当前任务写完后退出；还在排队的任务会以失败事件返回
+    void stop();
+
+    void submit(ExportJob job);
+
+    // 取走所有完成事件，没有时返回 false
+    bool pollCompleted(std::vector<ExportResult>& out);
+
+    // 排队 + 正在编码的任务数
+    int pendingCount() const;
+
+    // 当前正在编码的任务，空闲时返回 false
+    bool currentProgress(std::string& path, float& progress) const;
+
+private:
+    void workerLoop();
+    bool encode(const ExportJob& job);
+
+private:
+    std::thread                 _worker;
+    mutable std::mutex          _mutex;
+    std::condition_variable     _cv;
+    std::deque<ExportJob>       _jobs;
+    std::vector<ExportResult>   _completed;
+    bool                        _stopping = false;
+
+    bool                        _busy = false;
+    std::string                 _currentPath;
+    std::atomic<float>          _progress{0.0f};
+};
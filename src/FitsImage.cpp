@@ -1,9 +1,101 @@
 #include "FitsImage.h"
+#include "HeaderIndex.h"
 
 #include <fitsio.h>
 #include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 
+bool has_fits_extension(const std::string& path)
+{
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return false;
+
+    std::string ext = path.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    return ext == ".fits" || ext == ".fit" || ext == ".fts";
+}
+
+static BayerPattern shift_bayer(BayerPattern p, bool oddX, bool oddY)
+{
+    // 平移一列：R<->G 左右交换；平移一行：上下两行交换
+    if (oddX)
+    {
+        switch (p)
+        {
+        case BayerPattern::RGGB: p = BayerPattern::GRBG; break;
+        case BayerPattern::GRBG: p = BayerPattern::RGGB; break;
+        case BayerPattern::BGGR: p = BayerPattern::GBRG; break;
+        case BayerPattern::GBRG: p = BayerPattern::BGGR; break;
+        default: break;
+        }
+    }
+    if (oddY)
+    {
+        switch (p)
+        {
+        case BayerPattern::RGGB: p = BayerPattern::GBRG; break;
+        case BayerPattern::GBRG: p = BayerPattern::RGGB; break;
+        case BayerPattern::BGGR: p = BayerPattern::GRBG; break;
+        case BayerPattern::GRBG: p = BayerPattern::BGGR; break;
+        default: break;
+        }
+    }
+    return p;
+}
+
+static bool parse_bayer_name(std::string s, BayerPattern& out)
+{
+    for (char& c : s)
+        c = (char)std::toupper((unsigned char)c);
+    s.erase(std::remove(s.begin(), s.end(), ' '), s.end());
+
+    if (s == "RGGB")      out = BayerPattern::RGGB;
+    else if (s == "BGGR") out = BayerPattern::BGGR;
+    else if (s == "GRBG") out = BayerPattern::GRBG;
+    else if (s == "GBRG") out = BayerPattern::GBRG;
+    else return false;
+    return true;
+}
+
+bool bayer_pattern_from_header(const std::vector<std::string>& cards, int height, BayerPattern& out)
+{
+    std::string pat, colorType, rowOrder;
+    long xoff = 0, yoff = 0;
+
+    std::string key, value;
+    for (const std::string& card : cards)
+    {
+        if (!parse_fits_card(card, key, value))
+            continue;
+
+        if (key == "BAYERPAT")      pat = value;
+        else if (key == "COLORTYP") colorType = value;
+        else if (key == "ROWORDER") rowOrder = value;
+        // 偏移可能写成浮点（"0.0"）
+        else if (key == "XBAYROFF") xoff = std::lround(std::atof(value.c_str()));
+        else if (key == "YBAYROFF") yoff = std::lround(std::atof(value.c_str()));
+    }
+
+    BayerPattern p;
+    if (!parse_bayer_name(pat, p) && !parse_bayer_name(colorType, p))
+        return false;
+
+    // BOTTOM-UP：头里的排列指画面最上一行，也就是文件的最后一行
+    for (char& c : rowOrder)
+        c = (char)std::toupper((unsigned char)c);
+    if (rowOrder == "BOTTOM-UP" && height > 0)
+        yoff += height - 1;
+
+    out = shift_bayer(p, (xoff & 1) != 0, (yoff & 1) != 0);
+    return true;
+}
+
 bool load_fits(const std::string& path, FitsImage& outImage, BayerPattern bayerHint)
 {
     fitsfile* fptr = nullptr;
@@ -40,7 +132,31 @@ bool load_fits(const std::string& path, FitsImage& outImage, BayerPattern bayerH
     outImage.height = static_cast<int>(height);
     outImage.channels = 1;
     outImage.bayer = bayerHint;
+    outImage.bayerFromHeader = false;
     outImage.raw.clear();
+    outImage.headerCards.clear();
+
+    // 头卡片读失败不影响图像本身
+    int nkeys = 0;
+    int hdrStatus = 0;
+    if (!fits_get_hdrspace(fptr, &nkeys, nullptr, &hdrStatus))
+    {
+        outImage.headerCards.reserve(nkeys);
+        char card[FLEN_CARD];
+        for (int i = 1; i <= nkeys; ++i)
+        {
+            if (fits_read_record(fptr, i, card, &hdrStatus))
+                break;
+            outImage.headerCards.emplace_back(card);
+        }
+    }
+
+    BayerPattern headerBayer;
+    if (bayer_pattern_from_header(outImage.headerCards, outImage.height, headerBayer))
+    {
+        outImage.bayer = headerBayer;
+        outImage.bayerFromHeader = true;
+    }
 
     long npixels = width * height * depth;
     outImage.raw.resize(npixels);
@@ -61,11 +177,35 @@ bool load_fits(const std::string& path, FitsImage& outImage, BayerPattern bayerH
     {
         outImage.channels = 3;
         outImage.bayer = BayerPattern::NONE;
+        outImage.bayerFromHeader = false;
     }
 
     return true;
 }
 
+void normalize_raw(const FitsImage& img, std::vector<float>& out)
+{
+    out.resize(img.raw.size());
+    if (img.raw.empty())
+        return;
+
+    auto [itMin, itMax] = std::minmax_element(img.raw.begin(), img.raw.end());
+    double mn = *itMin;
+    double mx = *itMax;
+    if (mn == mx)
+    {
+        mn = 0.0;
+        mx = 1.0;
+    }
+    double range = mx - mn;
+
+    for (size_t i = 0; i < img.raw.size(); ++i)
+    {
+        float v = static_cast<float>((img.raw[i] - mn) / range);
+        out[i] = std::clamp(v, 0.0f, 1.0f);
+    }
+}
+
 std::vector<unsigned char> rgb_to_u8(const std::vector<float>& rgb, int width, int height)
 {
     std::vector<unsigned char> out;
@@ -16,6 +16,7 @@ struct FitsImage {
     int height = 0;
     int channels = 1;          // 1: 单通道, 3: RGB
     BayerPattern bayer = BayerPattern::NONE;
+    bool bayerFromHeader = false;   // bayer 来自头里的 BAYERPAT，而不是调用方给的提示
 
     // 原始 FITS 数据，统一用 double 存
     std::vector<double> raw;
@@ -23,13 +24,27 @@ struct FitsImage {
     // 显示用 RGB，0~1 浮点
     std::vector<float> rgb;
 
+    // 主 HDU 的原始头卡片（每条 80 字符，不含 END），写出处理结果时原样带上
+    std::vector<std::string> headerCards;
+
     bool isValid() const {
         return width > 0 && height > 0 && !raw.empty();
     }
 };
 
-// 从 FITS 文件读取数据
+// 扩展名是否为 .fits / .fit / .fts（不区分大小写）
+bool has_fits_extension(const std::string& path);
+
+// 从头卡片确定 Bayer 排列：BAYERPAT（或 COLORTYP），按 XBAYROFF / YBAYROFF 的奇偶平移，
+// ROWORDER = 'BOTTOM-UP' 时按图像高度的奇偶再平移一行。结果相对文件第 0 行第 0 列，
+// 和 BayerPattern 的约定一致。没有可识别的关键字时返回 false
+bool bayer_pattern_from_header(const std::vector<std::string>& cards, int height, BayerPattern& out);
+
+// 从 FITS 文件读取数据；头里有 CFA 关键字时用头里的排列（bayerFromHeader = true），否则用 bayerHint
 bool load_fits(const std::string& path, FitsImage& outImage, BayerPattern bayerHint);
 
+// RAW 按最小/最大值线性归一化到 [0,1]（全相同时按 0~1），即上传给 GPU 的单通道数据
+void normalize_raw(const FitsImage& img, std::vector<float>& out);
+
 // 把 0~1 RGB 映射到 8bit
 std::vector<unsigned char> rgb_to_u8(const std::vector<float>& rgb, int width, int height);
@@ -0,0 +1,235 @@
+#include "FitsWriter.h"
+#include "Debayer.h"
+
+#include <fitsio.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// 这些关键字描述的是原始数据的存储方式或数值范围，写出新的浮点数据后会失效
+static bool is_stale_keyword(const char* card)
+{
+    char name[FLEN_KEYWORD] = {0};
+    int len = 0;
+    int status = 0;
+    if (fits_get_keyname(const_cast<char*>(card), name, &len, &status))
+        return true;
+
+    if (std::strcmp(name, "END") == 0 ||
+        std::strcmp(name, "BAYERPAT") == 0 ||
+        std::strcmp(name, "XBAYROFF") == 0 ||
+        std::strcmp(name, "YBAYROFF") == 0 ||
+        std::strcmp(name, "DATAMIN") == 0 ||
+        std::strcmp(name, "DATAMAX") == 0)
+        return true;
+
+    int cls = fits_get_keyclass(const_cast<char*>(card));
+    return cls == TYP_STRUC_KEY || cls == TYP_CMPRS_KEY || cls == TYP_SCAL_KEY ||
+           cls == TYP_NULL_KEY  || cls == TYP_RANG_KEY  || cls == TYP_CKSUM_KEY;
+}
+
+FitsWriter::~FitsWriter()
+{
+    release();
+}
+
+void FitsWriter::release()
+{
+    if (_fptr)
+    {
+        int status = 0;
+        fits_close_file(static_cast<fitsfile*>(_fptr), &status);
+        _fptr = nullptr;
+    }
+    _plane.clear();
+    _plane.shrink_to_fit();
+}
+
+bool FitsWriter::open(const std::string& path, int width, int height, int planes,
+                      const std::vector<std::string>& headerCards)
+{
+    release();
+
+    if (width <= 0 || height <= 0 || (planes != 1 && planes != 3))
+        return false;
+
+    _width       = width;
+    _height      = height;
+    _planes      = planes;
+    _rowsWritten = 0;
+
+    // "!" 前缀：已存在时覆盖
+    std::string clobber = "!" + path;
+    fitsfile* fptr = nullptr;
+    int status = 0;
+    if (fits_create_file(&fptr, clobber.c_str(), &status))
+    {
+        fits_report_error(stderr, status);
+        return false;
+    }
+    _fptr = fptr;
+
+    long naxes[3] = {width, height, planes};
+    if (fits_create_img(fptr, FLOAT_IMG, planes == 3 ? 3 : 2, naxes, &status))
+    {
+        fits_report_error(stderr, status);
+        release();
+        return false;
+    }
+
+    for (const std::string& card : headerCards)
+    {
+        if (is_stale_keyword(card.c_str()))
+            continue;
+
+        // 单条卡片写失败（比如不合规的非标准卡片）就跳过
+        int cardStatus = 0;
+        fits_write_record(fptr, card.c_str(), &cardStatus);
+    }
+
+    fits_write_date(fptr, &status);
+    if (status)
+    {
+        fits_report_error(stderr, status);
+        release();
+        return false;
+    }
+
+    return true;
+}
+
+bool FitsWriter::addHistory(const std::string& text)
+{
+    if (!_fptr || _rowsWritten > 0)
+        return false;
+
+    int status = 0;
+    fits_write_history(static_cast<fitsfile*>(_fptr), text.c_str(), &status);
+    return status == 0;
+}
+
+bool FitsWriter::writeRows(const float* data, int rows, int stride)
+{
+    if (!_fptr || !data || stride < _planes)
+        return false;
+    if (rows <= 0)
+        return true;
+    if (_rowsWritten + rows > _height)
+    {
+        std::cerr << "FitsWriter: too many rows\n";
+        return false;
+    }
+
+    fitsfile* fptr = static_cast<fitsfile*>(_fptr);
+    const size_t count = static_cast<size_t>(rows) * _width;
+    _plane.resize(count);
+
+    for (int p = 0; p < _planes; ++p)
+    {
+        for (size_t i = 0; i < count; ++i)
+            _plane[i] = data[i * stride + p];
+
+        long fpixel[3] = {1, _rowsWritten + 1, p + 1};
+        int status = 0;
+        if (fits_write_pix(fptr, TFLOAT, fpixel, (LONGLONG)count, _plane.data(), &status))
+        {
+            fits_report_error(stderr, status);
+            return false;
+        }
+    }
+
+    _rowsWritten += rows;
+    return true;
+}
+
+bool FitsWriter::close()
+{
+    if (!_fptr)
+        return false;
+
+    bool ok = _rowsWritten == _height;
+    if (!ok)
+        std::cerr << "FitsWriter: expected " << _height << " rows, got " << _rowsWritten << "\n";
+
+    int status = 0;
+    fits_close_file(static_cast<fitsfile*>(_fptr), &status);
+    _fptr = nullptr;
+    if (status)
+    {
+        fits_report_error(stderr, status);
+        ok = false;
+    }
+
+    _plane.clear();
+    _plane.shrink_to_fit();
+    return ok;
+}
+
+bool write_processed_fits(const FitsImage& img,
+                          const std::string& path,
+                          const FitsExportOptions& options,
+                          const std::function<void(float)>& progress)
+{
+    if (!img.isValid())
+        return false;
+
+    const int W = img.width;
+    const int H = img.height;
+    const bool mono = options.bayer == BayerPattern::NONE && img.channels == 1;
+    const int planes = mono ? 1 : 3;
+    const int bandRows = std::max(options.bandRows, 1);
+
+    double mn = 0.0, mx = 1.0;
+    raw_minmax(img, mn, mx);
+    const double range = (mx - mn) == 0.0 ? 1.0 : (mx - mn);
+
+    FitsWriter writer;
+    if (!writer.open(path, W, H, planes, img.headerCards))
+        return false;
+
+    if (!mono)
+        writer.addHistory("Debayered (bilinear) by FitsViewer");
+    if (options.stretch)
+        writer.addHistory("Display stretch applied, values scaled to 0-1");
+
+    const StretchParams& sp = options.params;
+    const float gains[3] = {sp.wbR, sp.wbG, sp.wbB};
+
+    std::vector<float> band(static_cast<size_t>(bandRows) * W * 3);
+
+    for (int y0 = 0; y0 < H; y0 += bandRows)
+    {
+        int y1 = std::min(y0 + bandRows, H);
+        size_t pixels = static_cast<size_t>(y1 - y0) * W;
+
+        if (!debayer_bilinear_rows(img, options.bayer, mn, mx, y0, y1, band.data()))
+        {
+            writer.close();
+            return false;
+        }
+
+        if (options.stretch)
+        {
+            apply_stretch(band.data(), pixels, sp);
+        }
+        else
+        {
+            // 线性输出：还原到原始 ADU，再乘白平衡增益
+            for (size_t i = 0; i < pixels * 3; ++i)
+                band[i] = static_cast<float>(band[i] * range + mn) * gains[i % 3];
+        }
+
+        // 灰度源只写一个平面（三个分量相同，拉伸后取 G 与显示亮度一致）
+        const float* src = mono ? band.data() + 1 : band.data();
+        if (!writer.writeRows(src, y1 - y0, 3))
+        {
+            writer.close();
+            return false;
+        }
+
+        if (progress)
+            progress(static_cast<float>(y1) / static_cast<float>(H));
+    }
+
+    return writer.close();
+}
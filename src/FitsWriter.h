@@ -0,0 +1,62 @@
+#pragma once
+
+#include "FitsImage.h"
+#include "Stretch.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// 流式写 32 bit 浮点 FITS：planes = 1 时是 NAXIS=2 的单平面，planes = 3 时是 NAXIS3=3 的 R/G/B 三平面。
+// 调用方按 FITS 行序（第 0 行是文件第一行）分行带喂交错数据，写入器把每个行带拆成平面后
+// 直接 fits_write_pix，内存只占一个行带。
+class FitsWriter
+{
+public:
+    FitsWriter() = default;
+    ~FitsWriter();
+
+    FitsWriter(const FitsWriter&) = delete;
+    FitsWriter& operator=(const FitsWriter&) = delete;
+
+    // headerCards 为原图头卡片，结构/缩放/校验和等会随数据失效的关键字会被跳过
+    bool open(const std::string& path, int width, int height, int planes,
+              const std::vector<std::string>& headerCards);
+
+    // 追加 HISTORY 卡片，必须在写数据之前调用
+    bool addHistory(const std::string& text);
+
+    // rows 行交错数据，每像素 stride 个 float，取前 planes 个分量（stride >= planes）
+    bool writeRows(const float* data, int rows, int stride);
+
+    // 行数不足或写盘失败返回 false
+    bool close();
+
+private:
+    void release();
+
+private:
+    void* _fptr        = nullptr;   // fitsfile*
+    int   _width       = 0;
+    int   _height      = 0;
+    int   _planes      = 1;
+    int   _rowsWritten = 0;
+
+    std::vector<float> _plane;      // 行带的单个平面
+};
+
+// 处理后 FITS 的导出参数
+struct FitsExportOptions
+{
+    bool          stretch  = false;   // true: 按显示参数拉伸到 0~1；false: 线性，保持原始 ADU 量纲
+    StretchParams params;             // stretch 为 false 时只用白平衡
+    BayerPattern  bayer    = BayerPattern::NONE;   // 去拜耳用的模式（3 通道源忽略）
+    int           bandRows = 64;
+};
+
+// 去拜耳（+ 白平衡 / 拉伸）后写成 32 bit 浮点 FITS，逐行带处理、逐行带写出。
+// 彩色源写三平面，灰度源写单平面；progress 取值 0~1，可为空
+bool write_processed_fits(const FitsImage& img,
+                          const std::string& path,
+                          const FitsExportOptions& options,
+                          const std::function<void(float)>& progress = {});
@@ -0,0 +1,386 @@
+#include "FramePrefetcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+FramePrefetcher::~FramePrefetcher()
+{
+    stop();
+}
+
+void FramePrefetcher::start()
+{
+    if (_worker.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = false;
+    }
+    _worker = std::thread(&FramePrefetcher::workerLoop, this);
+}
+
+void FramePrefetcher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _workCv.notify_all();
+    _doneCv.notify_all();
+
+    if (_worker.joinable())
+        _worker.join();
+}
+
+void FramePrefetcher::setSequence(const std::vector<std::string>& paths, BayerPattern bayer)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _paths = paths;
+        _bayer = bayer;
+        ++_generation;
+
+        clearCacheLocked();
+        _current = -1;
+    }
+    _workCv.notify_one();
+}
+
+void FramePrefetcher::setCalibration(std::shared_ptr<const Calibration> calibration)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _calibration = std::move(calibration);
+        ++_generation;
+        clearCacheLocked();
+    }
+    _workCv.notify_one();
+}
+
+void FramePrefetcher::setCosmetic(std::shared_ptr<const CosmeticSettings> cosmetic)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _cosmetic = std::move(cosmetic);
+        ++_generation;
+        clearCacheLocked();
+    }
+    _workCv.notify_one();
+}
+
+void FramePrefetcher::setStarDetection(std::shared_ptr<const StarDetectOptions> options)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _starOptions = std::move(options);
+}
+
+void FramePrefetcher::setAlignTarget(std::shared_ptr<const AlignTarget> target)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _alignTarget = std::move(target);
+        for (auto it = _cache.begin(); it != _cache.end();)
+        {
+            if (it->first == _current)
+            {
+                ++it;
+                continue;
+            }
+            _bytes -= it->second->bytes;
+            _lru.remove(it->first);
+            it = _cache.erase(it);
+        }
+    }
+    _workCv.notify_one();
+}
+
+void FramePrefetcher::clearCacheLocked()
+{
+    _cache.clear();
+    _lru.clear();
+    _bytes = 0;
+    _failed.clear();
+}
+
+void FramePrefetcher::invalidate(int index)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _cache.find(index);
+        if (it != _cache.end())
+        {
+            _bytes -= it->second->bytes;
+            _cache.erase(it);
+            _lru.remove(index);
+        }
+        _failed.erase(index);
+
+        // 其他帧的缓存还有效，只是让正在解码的这一帧结果作废
+        if (_inFlight == index)
+            ++_generation;
+    }
+    _workCv.notify_one();
+}
+
+std::vector<std::string> FramePrefetcher::sequence() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _paths;
+}
+
+void FramePrefetcher::appendSequence(const std::vector<std::string>& paths)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _paths.insert(_paths.end(), paths.begin(), paths.end());
+    }
+    _workCv.notify_one();
+}
+
+void FramePrefetcher::setBudget(size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _budget = bytes;
+        evictLocked();
+    }
+    _workCv.notify_one();
+}
+
+void FramePrefetcher::setWindow(int ahead, int behind)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _ahead  = std::max(ahead, 0);
+        _behind = std::max(behind, 0);
+    }
+    _workCv.notify_one();
+}
+
+void FramePrefetcher::request(int index)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (index < 0 || index >= (int)_paths.size())
+            return;
+        _current = index;
+        evictLocked();
+    }
+    _workCv.notify_one();
+}
+
+void FramePrefetcher::touchLocked(int index)
+{
+    auto it = std::find(_lru.begin(), _lru.end(), index);
+    if (it != _lru.end())
+        _lru.erase(it);
+    _lru.push_front(index);
+}
+
+std::shared_ptr<const DecodedFrame> FramePrefetcher::tryGet(int index)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _cache.find(index);
+    if (it == _cache.end())
+        return nullptr;
+    touchLocked(index);
+    return it->second;
+}
+
+std::shared_ptr<const DecodedFrame> FramePrefetcher::wait(int index)
+{
+    request(index);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (index < 0 || index >= (int)_paths.size())
+        return nullptr;
+
+    _doneCv.wait(lock, [&] {
+        return _stopping || _cache.count(index) || _failed.count(index);
+    });
+
+    auto it = _cache.find(index);
+    if (it == _cache.end())
+        return nullptr;
+    touchLocked(index);
+    return it->second;
+}
+
+bool FramePrefetcher::failed(int index) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _failed.count(index) != 0;
+}
+
+int FramePrefetcher::cachedCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return (int)_cache.size();
+}
+
+size_t FramePrefetcher::cachedBytes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _bytes;
+}
+
+bool FramePrefetcher::inWindowLocked(int index) const
+{
+    return _current >= 0 &&
+           index >= _current - _behind &&
+           index <= _current + _ahead;
+}
+
+int FramePrefetcher::pickNextLocked() const
+{
+    if (_current < 0)
+        return -1;
+
+    // 窗口外的帧都可以让位，算一下淘汰后还剩多少
+    size_t pinned = 0;
+    for (const auto& [index, frame] : _cache)
+    {
+        if (inWindowLocked(index))
+            pinned += frame->bytes;
+    }
+
+    const int n = (int)_paths.size();
+    const int reach = std::max(_ahead, _behind);
+    for (int d = 0; d <= reach; ++d)
+    {
+        for (int sign : {1, -1})
+        {
+            if (d == 0 && sign < 0)
+                continue;
+            if ((sign > 0 && d > _ahead) || (sign < 0 && d > _behind))
+                continue;
+
+            int index = _current + sign * d;
+            if (index < 0 || index >= n)
+                continue;
+            if (_cache.count(index) || _failed.count(index) || index == _inFlight)
+                continue;
+
+            // 当前帧总是要解码；预取的帧放不进预算就停
+            if (d > 0 && pinned + _lastFrameBytes > _budget)
+                return -1;
+            return index;
+        }
+    }
+    return -1;
+}
+
+void FramePrefetcher::evictLocked()
+{
+    // 从最久未用的开始淘汰窗口外的帧。窗口内的不淘汰（否则帧大小不一时会反复解码同一帧），
+    // 预取前 pickNextLocked 已经按预算检查过，所以只有调小预算时才会暂时超出
+    for (auto it = _lru.end(); it != _lru.begin() && _bytes > _budget;)
+    {
+        --it;
+        int index = *it;
+        if (index == _current || inWindowLocked(index))
+            continue;
+
+        _bytes -= _cache[index]->bytes;
+        _cache.erase(index);
+        it = _lru.erase(it);
+    }
+}
+
+void FramePrefetcher::workerLoop()
+{
+    for (;;)
+    {
+        int index = -1;
+        std::string path;
+        BayerPattern bayer = BayerPattern::NONE;
+        std::shared_ptr<const Calibration> calibration;
+        std::shared_ptr<const CosmeticSettings> cosmetic;
+        std::shared_ptr<const StarDetectOptions> starOptions;
+        std::shared_ptr<const AlignTarget> alignTarget;
+        unsigned generation = 0;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _workCv.wait(lock, [&] { return _stopping || pickNextLocked() >= 0; });
+            if (_stopping)
+                return;
+
+            index      = pickNextLocked();
+            path       = _paths[index];
+            bayer      = _bayer;
+            calibration = _calibration;
+            cosmetic   = _cosmetic;
+            starOptions = _starOptions;
+            alignTarget = _alignTarget;
+            generation = _generation;
+            _inFlight  = index;
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        auto frame = std::make_shared<DecodedFrame>();
+        auto image = std::make_shared<FitsImage>();
+        bool ok = load_fits(path, *image, bayer);
+        if (ok)
+        {
+            frame->calibrated = calibrate_and_normalize(*image, calibration.get(), cosmetic.get(),
+                                                        frame->normalized, &frame->rawMin, &frame->rawMax);
+            if (starOptions)
+            {
+                auto stars = std::make_shared<StarField>();
+                detect_stars(frame->normalized.data(), image->width, image->height, image->channels,
+                             image->channels == 1 && image->bayer != BayerPattern::NONE, *starOptions, *stars);
+                frame->stars = stars;
+
+                // 对齐：先查磁盘缓存，没有才匹配（全图找星已经在上面做完，匹配本身只要几毫秒）
+                if (alignTarget && alignTarget->refStars && path != alignTarget->refPath &&
+                    stars->width == alignTarget->refStars->width && stars->height == alignTarget->refStars->height)
+                {
+                    auto reg = std::make_shared<Registration>();
+                    const RegisterOptions regOptions;
+                    if (!load_cached_registration(alignTarget->cacheDir, alignTarget->refPath, path,
+                                                  alignTarget->refStars->options, regOptions, *reg))
+                    {
+                        register_stars(*alignTarget->refStars, *stars, regOptions, *reg);
+                        store_cached_registration(alignTarget->cacheDir, alignTarget->refPath, path,
+                                                  alignTarget->refStars->options, regOptions, *reg);
+                    }
+                    frame->registration    = reg;
+                    frame->registrationRef = alignTarget->refPath;
+                }
+            }
+            frame->path  = path;
+            frame->bytes = image->raw.size() * sizeof(double) +
+                           frame->normalized.size() * sizeof(float);
+            frame->image = image;
+            frame->decodeMs = std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() - t0).count();
+        }
+        else
+        {
+            std::cerr << "Prefetch failed: " << path << "\n";
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _inFlight = -1;
+            if (generation == _generation)
+            {
+                if (ok)
+                {
+                    _cache[index] = frame;
+                    touchLocked(index);
+                    _bytes += frame->bytes;
+                    _lastFrameBytes = frame->bytes;
+                    evictLocked();
+                }
+                else
+                {
+                    _failed.insert(index);
+                }
+            }
+        }
+        _doneCv.notify_all();
+    }
+}
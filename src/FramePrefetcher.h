@@ -0,0 +1,134 @@
+#pragma once
+
+#include "Calibration.h"
+#include "Cosmetic.h"
+#include "FitsImage.h"
+#include "Registration.h"
+#include "StarDetector.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 解码好、可以直接上传的一帧：RAW（导出 / 后续处理用）+ 归一化后的单通道数据
+struct DecodedFrame
+{
+    std::string                      path;
+    std::shared_ptr<const FitsImage> image;
+    std::vector<float>               normalized;
+    size_t                           bytes    = 0;
+    double                           decodeMs = 0.0;
+    bool                             calibrated = false;   // raw / normalized 是校准后的数据
+    double                           rawMin = 0.0;         // 归一化范围：raw = rawMin + n * (rawMax - rawMin)
+    double                           rawMax = 1.0;
+    std::shared_ptr<const StarField> stars;                // 开了找星时在解码线程里顺带做
+    std::shared_ptr<const Registration> registration;      // 开了对齐时和 registrationRef 的匹配结果
+    std::string                      registrationRef;
+};
+
+// 对齐的参考帧：开着对齐时解码线程在找星之后顺带和它匹配，UI 线程换帧时不用再找星 / 匹配
+struct AlignTarget
+{
+    std::string                      refPath;
+    std::shared_ptr<const StarField> refStars;
+    std::string                      cacheDir;   // 匹配结果的磁盘缓存，空时不落盘
+};
+
+// 图像序列预取：后台线程按 “当前帧 -> 后 1 -> 前 1 -> 后 2 ...” 的顺序解码窗口内的帧，
+// 结果放进按内存预算淘汰的 LRU。cfitsio 不保证可重入，所以只有一个解码线程，
+// 同步打开文件也走这个线程（wait）。
+class FramePrefetcher
+{
+public:
+    FramePrefetcher() = default;
+    ~FramePrefetcher();
+
+    FramePrefetcher(const FramePrefetcher&) = delete;
+    FramePrefetcher& operator=(const FramePrefetcher&) = delete;
+
+    void start();
+    void stop();
+
+    // 换序列会清空缓存；正在解码的旧序列帧完成后直接丢弃
+    void setSequence(const std::vector<std::string>& paths, BayerPattern bayer);
+    std::vector<std::string> sequence() const;
+
+    // 在序列末尾接上新帧（跟随目录时新写完的帧）：已有帧的下标不变，缓存保留
+    void appendSequence(const std::vector<std::string>& paths);
+
+    // 换校准主帧（nullptr 为不校准）：主帧在整个序列里共用，已解码的帧全部作废
+    void setCalibration(std::shared_ptr<const Calibration> calibration);
+
+    // 换坏点修正参数（nullptr 为不修），同样作废已解码的帧
+    void setCosmetic(std::shared_ptr<const CosmeticSettings> cosmetic);
+
+    // 找星参数（nullptr 为不找）：不影响像素，已解码的帧保留，只对之后解码的帧生效
+    void setStarDetection(std::shared_ptr<const StarDetectOptions> options);
+
+    // 对齐参考帧（nullptr 为不对齐，需要同时开着找星）。已解码的帧是按旧参考帧匹配的：
+    // 除当前帧外作废，后台重新解码时顺带匹配（当前帧通常就是参考帧，或由调用方补做）
+    void setAlignTarget(std::shared_ptr<const AlignTarget> target);
+
+    void setBudget(size_t bytes);
+    void setWindow(int ahead, int behind);
+
+    // 设置当前帧并按它重新排预取顺序
+    void request(int index);
+
+    // 已经解码好就返回（并标记为最近使用），否则返回 nullptr，不阻塞
+    std::shared_ptr<const DecodedFrame> tryGet(int index);
+
+    // 请求并阻塞等待；解码失败返回 nullptr
+    std::shared_ptr<const DecodedFrame> wait(int index);
+
+    // 解码失败过的帧
+    bool failed(int index) const;
+
+    // 文件在磁盘上被覆盖写了：丢掉这一帧的缓存 / 失败记录，正在解码的旧内容完成后也丢弃
+    void invalidate(int index);
+
+    int    cachedCount() const;
+    size_t cachedBytes() const;
+
+private:
+    void workerLoop();
+    int  pickNextLocked() const;
+    bool inWindowLocked(int index) const;
+    void evictLocked();
+    void touchLocked(int index);
+    void clearCacheLocked();
+
+private:
+    std::thread             _worker;
+    mutable std::mutex      _mutex;
+    std::condition_variable _workCv;
+    std::condition_variable _doneCv;
+    bool                    _stopping = false;
+
+    std::vector<std::string> _paths;
+    BayerPattern             _bayer      = BayerPattern::NONE;
+    std::shared_ptr<const Calibration> _calibration;
+    std::shared_ptr<const CosmeticSettings> _cosmetic;
+    std::shared_ptr<const StarDetectOptions> _starOptions;
+    std::shared_ptr<const AlignTarget> _alignTarget;
+    unsigned                 _generation = 0;   // 每次换序列加 1
+
+    int    _current = -1;
+    int    _ahead   = 2;
+    int    _behind  = 1;
+    size_t _budget  = (size_t)2048 << 20;
+
+    std::map<int, std::shared_ptr<const DecodedFrame>> _cache;
+    std::list<int>                                     _lru;        // 前面是最近使用
+    size_t                                             _bytes = 0;
+    size_t                                             _lastFrameBytes = 0;
+    std::set<int>                                      _failed;
+    int                                                _inFlight = -1;
+};
@@ -1,9 +1,12 @@
 #include "GlImageRenderer.h"
+#include "Debayer.h"
+#include "Profiler.h"
 
 #include <glad/glad.h>
 #include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <cstring>
 
 static inline float clamp01(float v)
 {
@@ -57,6 +60,8 @@ bool GlImageRenderer::init()
         return false;
     if (!createStatsShader())
         return false;
+    if (!createCosmeticShader())
+        return false;
 
     glGenTextures(1, &_baseTexture);
 
@@ -88,10 +93,26 @@ bool GlImageRenderer::init()
 
 void GlImageRenderer::shutdown()
 {
+    _gpuTimer.shutdown();
+    clearCalibration();
+    destroyCosmetic();
+    clearBackgroundModel();
+    if (_bgSampleTex)
+    {
+        glDeleteTextures(1, &_bgSampleTex);
+        _bgSampleTex = 0;
+    }
+    if (_bgSampleFBO)
+    {
+        glDeleteFramebuffers(1, &_bgSampleFBO);
+        _bgSampleFBO = 0;
+    }
+
     if (_baseTexture)
     {
         glDeleteTextures(1, &_baseTexture);
         _baseTexture = 0;
+        _baseTexWidth = _baseTexHeight = 0;
     }
     if (_statsTex)
     {
@@ -103,6 +124,16 @@ void GlImageRenderer::shutdown()
         glDeleteFramebuffers(1, &_statsFBO);
         _statsFBO = 0;
     }
+    if (_statsFence)
+    {
+        glDeleteSync((GLsync)_statsFence);
+        _statsFence = nullptr;
+    }
+    if (_statsPbo)
+    {
+        glDeleteBuffers(1, &_statsPbo);
+        _statsPbo = 0;
+    }
     if (_statsProgram)
     {
         glDeleteProgram(_statsProgram);
@@ -112,6 +143,7 @@ void GlImageRenderer::shutdown()
     {
         glDeleteTextures(1, &_exportTex);
         _exportTex = 0;
+        _exportTexW = _exportTexH = 0;
     }
     if (_exportFBO)
     {
@@ -195,9 +227,52 @@ uniform int   uStretchMode;   // 0: linear, 1: asinh, 2: log, 3: sqrt
 uniform float uZoom;
 uniform vec2  uPan;
 
+uniform bool  uAlignEnabled;  // 对齐显示：屏幕按参考帧坐标排布，反算显示帧里的采样位置
+uniform mat3  uAlign;         // 参考帧像素 -> 显示帧像素（齐次）
+
 uniform vec3  uWBGain;        // 白平衡: (R,G,B) 增益
 uniform int   uBayerPattern;  // 0: NONE, 1: RGGB, 2: BGGR, 3: GRBG, 4: GBRG
 
+uniform bool  uExportMode;    // 导出：恒等视图，不做长宽比/缩放/平移
+uniform vec4  uExportRect;    // 导出裁剪矩形 (u0, v0, u1, v1)，纹理 uv
+
+// GPU 校准（去拜耳之前、按物理像素）：n 是底图的归一化值，先还原成 ADU，
+// 减 bias / dark、乘 flat 倒数后再映射回 0~1
+uniform bool      uCalEnabled;
+uniform sampler2D uCalOffsetTex;   // r: bias - 中值, g: thermal
+uniform sampler2D uCalFlatTex;     // r: 1 / flat
+uniform vec4      uCalRaw;         // (rawMin, rawRange, outLow, 1 / outRange)
+uniform vec4      uCalParams;      // (bias 中值, 用 bias, dark 系数, 用 flat)
+
+float calibrate(float n, ivec2 p)
+{
+    if (!uCalEnabled)
+        return n;
+    float v = uCalRaw.x + n * uCalRaw.y;
+    vec2 o = texelFetch(uCalOffsetTex, p, 0).rg;
+    v -= uCalParams.y * (uCalParams.x + o.r) + uCalParams.z * o.g;
+    if (uCalParams.w > 0.5)
+        v *= texelFetch(uCalFlatTex, p, 0).r;
+    return (v - uCalRaw.z) * uCalRaw.w;
+}
+
+// 背景模型（去拜耳之后、白平衡之前）：小纹理线性插值，节点 j 对应像素 j / (n - 1) * (size - 1)
+uniform int       uBgMode;     // 0: 关, 1: 减, 2: 除
+uniform sampler2D uBgTex;      // rgb: 背景模型
+uniform vec2      uBgSize;     // 背景纹理尺寸（节点数）
+uniform vec3      uBgLevel;    // 扣除后保持的背景水平
+
+vec3 remove_background(vec3 c, vec2 uv, vec2 texSize)
+{
+    if (uBgMode == 0)
+        return c;
+    vec2 t = uv * texSize / max(texSize - 1.0, vec2(1.0)) * (uBgSize - 1.0);
+    vec3 bg = texture(uBgTex, (t + 0.5) / uBgSize).rgb;
+    if (uBgMode == 1)
+        return c - bg + uBgLevel;
+    return c / max(bg, vec3(1e-4)) * uBgLevel;
+}
+
 float clamp01(float x) { return clamp(x, 0.0, 1.0); }
 
 float toneCurve(float x, float black, float white, float gamma)
@@ -243,7 +318,7 @@ ivec2 conceptual_to_physical(ivec2 c, ivec2 size, int pattern)
 float sample_raw_bayer(ivec2 c, ivec2 size, int pattern, sampler2D tex)
 {
     ivec2 p = conceptual_to_physical(c, size, pattern);
-    return texelFetch(tex, p, 0).r;
+    return calibrate(texelFetch(tex, p, 0).r, p);
 }
 
 // 基于 RGGB 概念坐标的双线性去拜耳
@@ -320,23 +395,19 @@ vec3 debayer_bilinear(vec2 uv, sampler2D tex, vec2 texSize, int pattern)
     return vec3(R, G, B);
 }
 
-void main()
+// 交互视图：先保持长宽比，把 vTexCoord 映射到“裁剪后的纹理 uv”，再做缩放/平移
+// 返回 false 表示落在图像外
+bool view_to_texture(vec2 uv, out vec2 outUV)
 {
-    // 先保持长宽比，把 vTexCoord 映射到“裁剪后的纹理 uv”，再做缩放/平移
     float texAspect    = uTexSize.x / uTexSize.y;
     float screenAspect = uViewportSize.x / uViewportSize.y;
 
-    vec2 uv = vTexCoord;
-
     if (screenAspect > texAspect)
     {
         float scale = texAspect / screenAspect;
         float x = (uv.x - 0.5) * scale + 0.5;
         if (x < 0.0 || x > 1.0)
-        {
-            FragColor = vec4(0.0, 0.0, 0.0, 1.0);
-            return;
-        }
+            return false;
         uv.x = x;
     }
     else
@@ -344,17 +415,39 @@ void main()
         float scale = screenAspect / texAspect;
         float y = (uv.y - 0.5) * scale + 0.5;
         if (y < 0.0 || y > 1.0)
-        {
-            FragColor = vec4(0.0, 0.0, 0.0, 1.0);
-            return;
-        }
+            return false;
         uv.y = y;
     }
 
     // 再以纹理中心为基准做缩放/平移
-    vec2 uvCentered = uv - vec2(0.5);
-    uvCentered /= max(uZoom, 0.1);
-    uvCentered += vec2(0.5) + uPan;
+    outUV = uv - vec2(0.5);
+    outUV /= max(uZoom, 0.1);
+    outUV += vec2(0.5) + uPan;
+    return true;
+}
+
+void main()
+{
+    vec2 uvCentered;
+
+    if (uExportMode)
+    {
+        // 导出：输出像素直接对应裁剪矩形内的纹理坐标。边上的像素会因为浮点误差（或放大导出时
+        // 半个输出像素的偏移）落到第一 / 最后一个像素中心之外，夹回像素中心的范围，不让下面的越界判断涂黑
+        uvCentered = mix(uExportRect.xy, uExportRect.zw, vTexCoord);
+        uvCentered = clamp(uvCentered, vec2(0.0), (uTexSize - 1.0) / uTexSize);
+    }
+    else if (!view_to_texture(vTexCoord, uvCentered))
+    {
+        FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+    else if (uAlignEnabled)
+    {
+        // 和 debayer_bilinear 一致：像素 i 的中心在 uv = i / size
+        vec3 q = uAlign * vec3(uvCentered * uTexSize, 1.0);
+        uvCentered = (q.xy / q.z) / uTexSize;
+    }
 
     if (uvCentered.x < 0.0 || uvCentered.y < 0.0 ||
         uvCentered.x > 1.0 || uvCentered.y > 1.0)
@@ -365,6 +458,7 @@ void main()
 
     // 去拜耳
     vec3 c = debayer_bilinear(uvCentered, uBaseTex, uTexSize, uBayerPattern);
+    c = remove_background(c, uvCentered, uTexSize);
 
     // 白平衡
     c *= uWBGain;
@@ -455,7 +549,24 @@ void main()
     _uWBGainLoc          = glGetUniformLocation(_shaderProgram, "uWBGain");
     _uBayerPatternLoc    = glGetUniformLocation(_shaderProgram, "uBayerPattern");
 
+    _uAlignEnabledLoc    = glGetUniformLocation(_shaderProgram, "uAlignEnabled");
+    _uAlignLoc           = glGetUniformLocation(_shaderProgram, "uAlign");
+
+    _uExportModeLoc      = glGetUniformLocation(_shaderProgram, "uExportMode");
+    _uExportRectLoc      = glGetUniformLocation(_shaderProgram, "uExportRect");
+
+    _uCalEnabledLoc      = glGetUniformLocation(_shaderProgram, "uCalEnabled");
+    _uCalRawLoc          = glGetUniformLocation(_shaderProgram, "uCalRaw");
+    _uCalParamsLoc       = glGetUniformLocation(_shaderProgram, "uCalParams");
+
+    _uBgModeLoc          = glGetUniformLocation(_shaderProgram, "uBgMode");
+    _uBgSizeLoc          = glGetUniformLocation(_shaderProgram, "uBgSize");
+    _uBgLevelLoc         = glGetUniformLocation(_shaderProgram, "uBgLevel");
+
     glUniform1i(_uBaseTexLoc, 0);
+    glUniform1i(glGetUniformLocation(_shaderProgram, "uCalOffsetTex"), 1);
+    glUniform1i(glGetUniformLocation(_shaderProgram, "uCalFlatTex"), 2);
+    glUniform1i(glGetUniformLocation(_shaderProgram, "uBgTex"), 3);
     glUseProgram(0);
     return true;
 }
@@ -482,6 +593,44 @@ uniform sampler2D uBaseTex;
 uniform vec2  uTexSize;
 uniform int   uBayerPattern;
 uniform vec3  uWBGain;
+uniform bool  uOutputRgb;     // 输出去拜耳后、扣背景 / 白平衡之前的 RGB（背景采样用）
+
+// GPU 校准（去拜耳之前、按物理像素）：n 是底图的归一化值，先还原成 ADU，
+// 减 bias / dark、乘 flat 倒数后再映射回 0~1
+uniform bool      uCalEnabled;
+uniform sampler2D uCalOffsetTex;   // r: bias - 中值, g: thermal
+uniform sampler2D uCalFlatTex;     // r: 1 / flat
+uniform vec4      uCalRaw;         // (rawMin, rawRange, outLow, 1 / outRange)
+uniform vec4      uCalParams;      // (bias 中值, 用 bias, dark 系数, 用 flat)
+
+float calibrate(float n, ivec2 p)
+{
+    if (!uCalEnabled)
+        return n;
+    float v = uCalRaw.x + n * uCalRaw.y;
+    vec2 o = texelFetch(uCalOffsetTex, p, 0).rg;
+    v -= uCalParams.y * (uCalParams.x + o.r) + uCalParams.z * o.g;
+    if (uCalParams.w > 0.5)
+        v *= texelFetch(uCalFlatTex, p, 0).r;
+    return (v - uCalRaw.z) * uCalRaw.w;
+}
+
+// 背景模型（去拜耳之后、白平衡之前）：小纹理线性插值，节点 j 对应像素 j / (n - 1) * (size - 1)
+uniform int       uBgMode;     // 0: 关, 1: 减, 2: 除
+uniform sampler2D uBgTex;      // rgb: 背景模型
+uniform vec2      uBgSize;     // 背景纹理尺寸（节点数）
+uniform vec3      uBgLevel;    // 扣除后保持的背景水平
+
+vec3 remove_background(vec3 c, vec2 uv, vec2 texSize)
+{
+    if (uBgMode == 0)
+        return c;
+    vec2 t = uv * texSize / max(texSize - 1.0, vec2(1.0)) * (uBgSize - 1.0);
+    vec3 bg = texture(uBgTex, (t + 0.5) / uBgSize).rgb;
+    if (uBgMode == 1)
+        return c - bg + uBgLevel;
+    return c / max(bg, vec3(1e-4)) * uBgLevel;
+}
 
 float clamp01(float x) { return clamp(x, 0.0, 1.0); }
 
@@ -513,7 +662,7 @@ ivec2 conceptual_to_physical(ivec2 c, ivec2 size, int pattern)
 float sample_raw_bayer(ivec2 c, ivec2 size, int pattern, sampler2D tex)
 {
     ivec2 p = conceptual_to_physical(c, size, pattern);
-    return texelFetch(tex, p, 0).r;
+    return calibrate(texelFetch(tex, p, 0).r, p);
 }
 
 vec3 debayer_bilinear(vec2 uv, sampler2D tex, vec2 texSize, int pattern)
@@ -595,6 +744,12 @@ void main()
 
     // 统计时不需要保持屏幕比例，只要均匀采样整个图像即可
     vec3 c = debayer_bilinear(uv, uBaseTex, uTexSize, uBayerPattern);
+    if (uOutputRgb)
+    {
+        FragColor = vec4(c, 1.0);
+        return;
+    }
+    c = remove_background(c, uv, uTexSize);
 
     // 白平衡
     c *= uWBGain;
@@ -628,7 +783,151 @@ void main()
     _uStatsTexSizeLoc      = glGetUniformLocation(_statsProgram, "uTexSize");
     _uStatsBayerPatternLoc = glGetUniformLocation(_statsProgram, "uBayerPattern");
     _uStatsWBGainLoc       = glGetUniformLocation(_statsProgram, "uWBGain");
+    _uStatsCalEnabledLoc   = glGetUniformLocation(_statsProgram, "uCalEnabled");
+    _uStatsCalRawLoc       = glGetUniformLocation(_statsProgram, "uCalRaw");
+    _uStatsCalParamsLoc    = glGetUniformLocation(_statsProgram, "uCalParams");
+    _uStatsOutputRgbLoc    = glGetUniformLocation(_statsProgram, "uOutputRgb");
+    _uStatsBgModeLoc       = glGetUniformLocation(_statsProgram, "uBgMode");
+    _uStatsBgSizeLoc       = glGetUniformLocation(_statsProgram, "uBgSize");
+    _uStatsBgLevelLoc      = glGetUniformLocation(_statsProgram, "uBgLevel");
     glUniform1i(_uStatsBaseTexLoc, 0);
+    glUniform1i(glGetUniformLocation(_statsProgram, "uCalOffsetTex"), 1);
+    glUniform1i(glGetUniformLocation(_statsProgram, "uCalFlatTex"), 2);
+    glUniform1i(glGetUniformLocation(_statsProgram, "uBgTex"), 3);
+    glUseProgram(0);
+
+    return true;
+}
+
+// 坏点修正预处理 shader：每个片元对应一个图像像素，输出校准 + 修正后的值。
+// 判定与 CPU 的 cosmetic_correct 相同：同色 8 邻居的中值 m，高于所有邻居且 v - m > k * σ 时替换为 m，
+// σ = max(全图噪声, 1.4826 * 邻居 MAD)；大多数像素在比较最大 / 最小邻居时就直接输出了
+bool GlImageRenderer::createCosmeticShader()
+{
+    const char* vs_src = R"(#version 330 core
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec2 aUV;
+void main()
+{
+    gl_Position = vec4(aPos, 0.0, 1.0);
+}
+)";
+
+    const char* fs_src = R"(#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D uBaseTex;
+uniform int   uStep;     // 同色邻居距离：Bayer 为 2，单色为 1
+uniform vec3  uSigma;    // (hotSigma, coldSigma, 全图噪声)，sigma 为 0 的一侧不修
+
+uniform bool      uCalEnabled;
+uniform sampler2D uCalOffsetTex;   // r: bias - 中值, g: thermal
+uniform sampler2D uCalFlatTex;     // r: 1 / flat
+uniform vec4      uCalRaw;         // (rawMin, rawRange, outLow, 1 / outRange)
+uniform vec4      uCalParams;      // (bias 中值, 用 bias, dark 系数, 用 flat)
+
+float calibrate(float n, ivec2 p)
+{
+    if (!uCalEnabled)
+        return n;
+    float v = uCalRaw.x + n * uCalRaw.y;
+    vec2 o = texelFetch(uCalOffsetTex, p, 0).rg;
+    v -= uCalParams.y * (uCalParams.x + o.r) + uCalParams.z * o.g;
+    if (uCalParams.w > 0.5)
+        v *= texelFetch(uCalFlatTex, p, 0).r;
+    return (v - uCalRaw.z) * uCalRaw.w;
+}
+
+// 越界时取对侧（镜像），和 CPU 一致
+int mirror(int c, int o, int n)
+{
+    int t = c + o;
+    return (t < 0 || t >= n) ? c - o : t;
+}
+
+float fetch(ivec2 p)
+{
+    return calibrate(texelFetch(uBaseTex, p, 0).r, p);
+}
+
+float median8(inout float a[8])
+{
+    for (int i = 1; i < 8; ++i)
+    {
+        float x = a[i];
+        int j = i - 1;
+        while (j >= 0 && a[j] > x)
+        {
+            a[j + 1] = a[j];
+            --j;
+        }
+        a[j + 1] = x;
+    }
+    return 0.5 * (a[3] + a[4]);
+}
+
+void main()
+{
+    ivec2 size = textureSize(uBaseTex, 0);
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    float v = fetch(p);
+
+    int xl = mirror(p.x, -uStep, size.x), xr = mirror(p.x, uStep, size.x);
+    int yu = mirror(p.y, -uStep, size.y), yd = mirror(p.y, uStep, size.y);
+    float n[8];
+    n[0] = fetch(ivec2(xl, yu)); n[1] = fetch(ivec2(p.x, yu)); n[2] = fetch(ivec2(xr, yu));
+    n[3] = fetch(ivec2(xl, p.y));                              n[4] = fetch(ivec2(xr, p.y));
+    n[5] = fetch(ivec2(xl, yd)); n[6] = fetch(ivec2(p.x, yd)); n[7] = fetch(ivec2(xr, yd));
+
+    float lo = n[0], hi = n[0];
+    for (int i = 1; i < 8; ++i)
+    {
+        lo = min(lo, n[i]);
+        hi = max(hi, n[i]);
+    }
+
+    bool hot  = uSigma.x > 0.0 && v > hi && v - lo > uSigma.x * uSigma.z;
+    bool cold = uSigma.y > 0.0 && v < lo && hi - v > uSigma.y * uSigma.z;
+    if (hot || cold)
+    {
+        float m = median8(n);
+        float dev[8];
+        for (int i = 0; i < 8; ++i)
+            dev[i] = abs(n[i] - m);
+        float sigma = max(uSigma.z, 1.4826 * median8(dev));
+        if ((hot && v - m > uSigma.x * sigma) || (cold && m - v > uSigma.y * sigma))
+            v = m;
+    }
+
+    FragColor = vec4(v, 0.0, 0.0, 1.0);
+}
+)";
+
+    GLuint vs = compileShader(GL_VERTEX_SHADER, vs_src);
+    if (!vs) return false;
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fs_src);
+    if (!fs)
+    {
+        glDeleteShader(vs);
+        return false;
+    }
+
+    _cosmeticProgram = linkProgram(vs, fs);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    if (!_cosmeticProgram)
+        return false;
+
+    glUseProgram(_cosmeticProgram);
+    _uCosStepLoc       = glGetUniformLocation(_cosmeticProgram, "uStep");
+    _uCosSigmaLoc      = glGetUniformLocation(_cosmeticProgram, "uSigma");
+    _uCosCalEnabledLoc = glGetUniformLocation(_cosmeticProgram, "uCalEnabled");
+    _uCosCalRawLoc     = glGetUniformLocation(_cosmeticProgram, "uCalRaw");
+    _uCosCalParamsLoc  = glGetUniformLocation(_cosmeticProgram, "uCalParams");
+    glUniform1i(glGetUniformLocation(_cosmeticProgram, "uBaseTex"), 0);
+    glUniform1i(glGetUniformLocation(_cosmeticProgram, "uCalOffsetTex"), 1);
+    glUniform1i(glGetUniformLocation(_cosmeticProgram, "uCalFlatTex"), 2);
     glUseProgram(0);
 
     return true;
@@ -665,10 +964,18 @@ void GlImageRenderer::destroyShaders()
         glDeleteProgram(_statsProgram);
         _statsProgram = 0;
     }
+    if (_cosmeticProgram)
+    {
+        glDeleteProgram(_cosmeticProgram);
+        _cosmeticProgram = 0;
+    }
 }
 
 void GlImageRenderer::uploadBaseTexture(const std::vector<float>& bayerOrGray, int width, int height)
 {
+    ProfileScope  cpuScope("uploadBaseTexture");
+    GpuTimerScope gpuScope(_gpuTimer, "uploadBaseTexture");
+
     if (bayerOrGray.empty() || width <= 0 || height <= 0 || !_baseTexture)
     {
         _hasTexture = false;
@@ -682,11 +989,503 @@ void GlImageRenderer::uploadBaseTexture(const std::vector<float>& bayerOrGray, i
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // Bayer / 灰度 单通道
+    // Bayer / 灰度 单通道；尺寸不变（翻序列 / 跟随目录）时只更新内容，不重新分配存储
+    if (width == _baseTexWidth && height == _baseTexHeight)
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_FLOAT, bayerOrGray.data());
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height,
+                     0, GL_RED, GL_FLOAT, bayerOrGray.data());
+        _baseTexWidth  = width;
+        _baseTexHeight = height;
+    }
+
+    _hasTexture    = true;
+    _cosmeticDirty = true;
+}
+
+unsigned int GlImageRenderer::createFrameTexture(const std::vector<float>& bayerOrGray, int width, int height)
+{
+    ProfileScope  cpuScope("uploadFrameTexture");
+    GpuTimerScope gpuScope(_gpuTimer, "uploadFrameTexture");
+
+    if (!_hasTexture || width != _imgWidth || height != _imgHeight ||
+        bayerOrGray.size() < (size_t)width * height)
+        return 0;
+
+    // 先清掉之前遗留的错误，下面用 glGetError 判断显存不足
+    while (glGetError() != GL_NO_ERROR) {}
+
+    unsigned int tex = 0;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height,
                  0, GL_RED, GL_FLOAT, bayerOrGray.data());
 
-    _hasTexture = true;
+    if (glGetError() != GL_NO_ERROR)
+    {
+        glDeleteTextures(1, &tex);
+        return 0;
+    }
+    return tex;
+}
+
+void GlImageRenderer::deleteFrameTexture(unsigned int texture)
+{
+    if (!texture)
+        return;
+    if (_displayTexture == texture)
+        _displayTexture = 0;
+    if (_cosmeticSource == texture)
+        _cosmeticDirty = true;   // 纹理名会被复用
+    glDeleteTextures(1, &texture);
+}
+
+// 抽样估计 0.01% / 99.99% 分位数，主帧上的个别坏点不会把校准后的范围撑得过大
+static void robust_range(const float* data, size_t n, float& lo, float& hi)
+{
+    const size_t maxSamples = (size_t)1 << 20;
+    const size_t step = std::max<size_t>(1, n / maxSamples);
+    std::vector<float> samples;
+    samples.reserve(n / step + 1);
+    for (size_t i = 0; i < n; i += step)
+        samples.push_back(data[i]);
+
+    size_t iLo = (size_t)(samples.size() * 0.0001);
+    size_t iHi = samples.size() - 1 - iLo;
+    std::nth_element(samples.begin(), samples.begin() + iLo, samples.end());
+    lo = samples[iLo];
+    std::nth_element(samples.begin(), samples.begin() + iHi, samples.end());
+    hi = samples[iHi];
+}
+
+static float sampled_median(const float* data, size_t n)
+{
+    const size_t step = std::max<size_t>(1, n / ((size_t)1 << 20));
+    std::vector<float> samples;
+    for (size_t i = 0; i < n; i += step)
+        samples.push_back(data[i]);
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2];
+}
+
+bool GlImageRenderer::uploadCalibration(const float* bias, const float* thermal, const float* invFlat,
+                                        int width, int height)
+{
+    ProfileScope  cpuScope("uploadCalibration");
+    GpuTimerScope gpuScope(_gpuTimer, "uploadCalibration");
+
+    clearCalibration();
+    _cosmeticDirty = true;
+    if (width <= 0 || height <= 0 || (!bias && !thermal && !invFlat))
+        return false;
+
+    const size_t n = (size_t)width * height;
+    while (glGetError() != GL_NO_ERROR) {}
+
+    if (bias || thermal)
+    {
+        // bias 减去中值后只剩几十 ADU 的起伏，R16F 精度足够；thermal 本身就不大
+        _calBiasMedian = bias ? sampled_median(bias, n) : 0.0f;
+        if (bias)
+            robust_range(bias, n, _calBiasLo, _calBiasHi);
+        if (thermal)
+            robust_range(thermal, n, _calThermLo, _calThermHi);
+
+        std::vector<float> rg(n * 2);
+        for (size_t i = 0; i < n; ++i)
+        {
+            rg[i * 2]     = bias ? bias[i] - _calBiasMedian : 0.0f;
+            rg[i * 2 + 1] = thermal ? std::min(thermal[i], 65504.0f) : 0.0f;
+        }
+
+        glGenTextures(1, &_calOffsetTex);
+        glBindTexture(GL_TEXTURE_2D, _calOffsetTex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, width, height, 0, GL_RG, GL_FLOAT, rg.data());
+    }
+
+    if (invFlat)
+    {
+        robust_range(invFlat, n, _calFlatLo, _calFlatHi);
+
+        glGenTextures(1, &_calFlatTex);
+        glBindTexture(GL_TEXTURE_2D, _calFlatTex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height, 0, GL_RED, GL_FLOAT, invFlat);
+    }
+
+    if (glGetError() != GL_NO_ERROR)
+    {
+        std::cerr << "Calibration texture upload failed\n";
+        clearCalibration();
+        return false;
+    }
+
+    _calWidth   = width;
+    _calHeight  = height;
+    _calHasBias = bias != nullptr;
+    _calHasDark = thermal != nullptr;
+    return true;
+}
+
+void GlImageRenderer::clearCalibration()
+{
+    if (_calOffsetTex)
+        glDeleteTextures(1, &_calOffsetTex);
+    if (_calFlatTex)
+        glDeleteTextures(1, &_calFlatTex);
+    _calOffsetTex = 0;
+    _calFlatTex   = 0;
+    _calWidth = _calHeight = 0;
+    _calHasBias = _calHasDark = false;
+    _calBiasMedian = 0.0f;
+    _calBiasLo = _calBiasHi = 0.0f;
+    _calThermLo = _calThermHi = 0.0f;
+    _calFlatLo = _calFlatHi = 1.0f;
+    _cosmeticDirty = true;
+}
+
+void GlImageRenderer::setCalibrationParams(double rawMin, double rawMax, float darkScale,
+                                           bool useBias, bool useDark, bool useFlat)
+{
+    _calUseBias   = useBias && _calHasBias;
+    _calUseDark   = useDark && _calHasDark;
+    _calUseFlat   = useFlat && _calFlatTex != 0;
+    _calDarkScale = std::max(darkScale, 0.0f);
+
+    // 估计校准后的取值范围，映射回 0~1（shader 里去拜耳后会 clamp）
+    double subLo = 0.0, subHi = 0.0;
+    if (_calUseBias)
+    {
+        subLo += _calBiasLo;
+        subHi += _calBiasHi;
+    }
+    if (_calUseDark)
+    {
+        subLo += _calDarkScale * _calThermLo;
+        subHi += _calDarkScale * _calThermHi;
+    }
+    double fLo = _calUseFlat ? _calFlatLo : 1.0;
+    double fHi = _calUseFlat ? _calFlatHi : 1.0;
+
+    double aLo = rawMin - subHi;
+    double aHi = rawMax - subLo;
+    double lo  = std::min(aLo * fLo, aLo * fHi);
+    double hi  = std::max(aHi * fLo, aHi * fHi);
+    if (!(hi > lo))
+        hi = lo + 1.0;
+
+    _calRaw[0] = (float)rawMin;
+    _calRaw[1] = (float)(rawMax - rawMin);
+    _calRaw[2] = (float)lo;
+    _calRaw[3] = (float)(1.0 / (hi - lo));
+    _cosmeticDirty = true;
+}
+
+void GlImageRenderer::outputRange(double& lo, double& hi) const
+{
+    lo = _calRaw[2];
+    hi = _calRaw[2] + 1.0 / _calRaw[3];
+}
+
+void GlImageRenderer::setDisplayTexture(unsigned int texture, double rawMin, double rawMax)
+{
+    _displayTexture = texture;
+    _displayRaw[0]  = (float)rawMin;
+    _displayRaw[1]  = (float)(rawMax - rawMin);
+}
+
+bool GlImageRenderer::calibrationActive() const
+{
+    return (_calUseBias || _calUseDark || _calUseFlat) &&
+           _calWidth == _imgWidth && _calHeight == _imgHeight;
+}
+
+// display：输入是帧纹理（闪烁播放），按它自己的归一化范围还原 ADU，输出到底图的输出范围
+// （各帧共用底图的黑白点）；不校准时也要做这个线性换算，只是 bias / dark / flat 都关掉
+void GlImageRenderer::bindCalibration(int enabledLoc, int rawLoc, int paramsLoc, bool enabled, bool display)
+{
+    glUniform1i(enabledLoc, enabled || display ? 1 : 0);
+    if (!enabled && !display)
+        return;
+
+    const float* raw = display ? _displayRaw : _calRaw;
+    glUniform4f(rawLoc, raw[0], raw[1], _calRaw[2], _calRaw[3]);
+    if (!enabled)
+    {
+        glUniform4f(paramsLoc, 0.0f, 0.0f, 0.0f, 0.0f);
+        return;
+    }
+    glUniform4f(paramsLoc, _calBiasMedian, _calUseBias ? 1.0f : 0.0f,
+                _calUseDark ? _calDarkScale : 0.0f, _calUseFlat ? 1.0f : 0.0f);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, _calOffsetTex);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, _calFlatTex);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void GlImageRenderer::setCosmeticParams(bool enabled, float hotSigma, float coldSigma, float noiseSigma)
+{
+    if (enabled == _cosmeticEnabled && hotSigma == _cosmeticHot &&
+        coldSigma == _cosmeticCold && noiseSigma == _cosmeticNoise)
+        return;
+
+    _cosmeticEnabled = enabled;
+    _cosmeticHot     = hotSigma;
+    _cosmeticCold    = coldSigma;
+    _cosmeticNoise   = noiseSigma;
+    _cosmeticDirty   = true;
+}
+
+bool GlImageRenderer::cosmeticActive() const
+{
+    return _cosmeticEnabled && _cosmeticProgram && _hasTexture &&
+           (_cosmeticHot > 0.0f || _cosmeticCold > 0.0f);
+}
+
+void GlImageRenderer::destroyCosmetic()
+{
+    if (_cosmeticTex)
+        glDeleteTextures(1, &_cosmeticTex);
+    if (_cosmeticFBO)
+        glDeleteFramebuffers(1, &_cosmeticFBO);
+    _cosmeticTex = 0;
+    _cosmeticFBO = 0;
+    _cosmeticTexW = _cosmeticTexH = 0;
+    _cosmeticDirty = true;
+}
+
+// 需要时重算修正纹理，成功（或不需要重算）时返回 true。
+// display 时修正的是屏幕上的帧纹理（闪烁播放），结果换算到底图的输出范围；统计 / 导出始终用底图，
+// 两者交替时按输入纹理重算
+bool GlImageRenderer::updateCosmetic(bool display)
+{
+    const unsigned int source = display && _displayTexture ? _displayTexture : _baseTexture;
+    display = source != _baseTexture;
+    if (source != _cosmeticSource)
+        _cosmeticDirty = true;
+    if (!_cosmeticDirty)
+        return _cosmeticTex != 0;
+
+    ProfileScope  cpuScope("cosmeticPass");
+    GpuTimerScope gpuScope(_gpuTimer, "cosmeticPass");
+
+    if (!_cosmeticFBO)
+        glGenFramebuffers(1, &_cosmeticFBO);
+    if (!_cosmeticTex)
+        glGenTextures(1, &_cosmeticTex);
+
+    glBindTexture(GL_TEXTURE_2D, _cosmeticTex);
+    if (_cosmeticTexW != _imgWidth || _cosmeticTexH != _imgHeight)
+    {
+        while (glGetError() != GL_NO_ERROR) {}
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, _imgWidth, _imgHeight, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (glGetError() != GL_NO_ERROR)
+        {
+            std::cerr << "Cosmetic texture allocation failed\n";
+            destroyCosmetic();
+            _cosmeticDirty = false;   // 显存不够时不要每帧重试，参数变了再试
+            return false;
+        }
+        _cosmeticTexW = _imgWidth;
+        _cosmeticTexH = _imgHeight;
+    }
+
+    GLint prevFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
+    GLint prevViewport[4];
+    glGetIntegerv(GL_VIEWPORT, prevViewport);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _cosmeticFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _cosmeticTex, 0);
+    GLenum drawBuf = GL_COLOR_ATTACHMENT0;
+    glDrawBuffers(1, &drawBuf);
+    bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    if (ok)
+    {
+        glViewport(0, 0, _imgWidth, _imgHeight);
+        glUseProgram(_cosmeticProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, source);
+
+        // 噪声是底图归一化单位，换到输出范围时按 rawRange / outRange 缩放（flat 的影响忽略）
+        const bool cal   = calibrationActive();
+        const float noise = cal || display ? _cosmeticNoise * _calRaw[1] * _calRaw[3] : _cosmeticNoise;
+        glUniform1i(_uCosStepLoc, _bayerPattern != 0 ? 2 : 1);
+        glUniform3f(_uCosSigmaLoc, _cosmeticHot, _cosmeticCold, noise);
+        bindCalibration(_uCosCalEnabledLoc, _uCosCalRawLoc, _uCosCalParamsLoc, cal, display);
+
+        glBindVertexArray(_quadVAO);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+    else
+    {
+        std::cerr << "Cosmetic FBO incomplete\n";
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
+    glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+
+    if (!ok)
+        destroyCosmetic();
+    _cosmeticSource = source;
+    _cosmeticDirty  = false;
+    return ok;
+}
+
+// 绑定输入（单元 0）和校准参数：display 时是屏幕上的帧纹理（闪烁播放），否则是底图。
+// 帧纹理和底图同尺寸，同样按主帧校准 / 修坏点。坏点修正开着时读修正纹理，它已经校准过，shader 里不再校准
+void GlImageRenderer::bindSource(int enabledLoc, int rawLoc, int paramsLoc, bool display)
+{
+    display = display && _displayTexture != 0;
+    const bool cosmetic = cosmeticActive() && updateCosmetic(display);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, cosmetic ? _cosmeticTex : display ? _displayTexture : _baseTexture);
+    bindCalibration(enabledLoc, rawLoc, paramsLoc, !cosmetic && calibrationActive(), !cosmetic && display);
+}
+
+bool GlImageRenderer::setBackgroundModel(const float* rgb, int width, int height, const float level[3])
+{
+    if (!rgb || width < 2 || height < 2)
+    {
+        clearBackgroundModel();
+        return false;
+    }
+
+    if (!_bgTex)
+        glGenTextures(1, &_bgTex);
+    glBindTexture(GL_TEXTURE_2D, _bgTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, rgb);
+
+    _bgWidth  = width;
+    _bgHeight = height;
+    for (int c = 0; c < 3; ++c)
+        _bgLevel[c] = level[c];
+    return true;
+}
+
+void GlImageRenderer::clearBackgroundModel()
+{
+    if (_bgTex)
+        glDeleteTextures(1, &_bgTex);
+    _bgTex = 0;
+    _bgWidth = _bgHeight = 0;
+}
+
+void GlImageRenderer::setBackgroundMode(int mode)
+{
+    _bgMode = std::clamp(mode, 0, 2);
+}
+
+void GlImageRenderer::bindBackground(int modeLoc, int sizeLoc, int levelLoc, bool enabled)
+{
+    enabled = enabled && _bgMode != 0 && _bgTex != 0;
+    glUniform1i(modeLoc, enabled ? _bgMode : 0);
+    if (!enabled)
+        return;
+
+    glUniform2f(sizeLoc, (float)_bgWidth, (float)_bgHeight);
+    glUniform3f(levelLoc, _bgLevel[0], _bgLevel[1], _bgLevel[2]);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, _bgTex);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+bool GlImageRenderer::sampleBackground(std::vector<float>& rgb, int& width, int& height)
+{
+    ProfileScope  cpuScope("sampleBackground");
+    GpuTimerScope gpuScope(_gpuTimer, "sampleBackground");
+
+    rgb.clear();
+    width = height = 0;
+    if (!_hasTexture || !_statsProgram || _imgWidth <= 0 || _imgHeight <= 0)
+        return false;
+
+    const int size = _bgSampleSize;
+    if (!_bgSampleFBO)
+    {
+        glGenTextures(1, &_bgSampleTex);
+        glBindTexture(GL_TEXTURE_2D, _bgSampleTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size, size, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenFramebuffers(1, &_bgSampleFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, _bgSampleFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _bgSampleTex, 0);
+        GLenum drawBuf = GL_COLOR_ATTACHMENT0;
+        glDrawBuffers(1, &drawBuf);
+        const bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!ok)
+        {
+            std::cerr << "Background sample FBO incomplete\n";
+            glDeleteFramebuffers(1, &_bgSampleFBO);
+            glDeleteTextures(1, &_bgSampleTex);
+            _bgSampleFBO = 0;
+            _bgSampleTex = 0;
+            return false;
+        }
+    }
+
+    GLint prevFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
+    GLint prevViewport[4];
+    glGetIntegerv(GL_VIEWPORT, prevViewport);
+
+    if (cosmeticActive())
+        updateCosmetic();
+
+    // 和统计 pass 同一个 shader：均匀覆盖整幅图，每个样本是一个像素去拜耳后的 RGB（已校准 / 修坏点）
+    glBindFramebuffer(GL_FRAMEBUFFER, _bgSampleFBO);
+    glViewport(0, 0, size, size);
+    glUseProgram(_statsProgram);
+    glUniform2f(_uStatsTexSizeLoc, (float)_imgWidth, (float)_imgHeight);
+    glUniform1i(_uStatsBayerPatternLoc, _bayerPattern);
+    glUniform1i(_uStatsOutputRgbLoc, 1);
+    bindSource(_uStatsCalEnabledLoc, _uStatsCalRawLoc, _uStatsCalParamsLoc);
+    bindBackground(_uStatsBgModeLoc, _uStatsBgSizeLoc, _uStatsBgLevelLoc, false);
+
+    glBindVertexArray(_quadVAO);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+
+    rgb.resize((size_t)size * size * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, size, size, GL_RGB, GL_FLOAT, rgb.data());
+
+    glUniform1i(_uStatsOutputRgbLoc, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
+    glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+    glUseProgram(0);
+
+    width  = size;
+    height = size;
+    return true;
+}
+
+void GlImageRenderer::setBayerPattern(int pattern)
+{
+    if (pattern != _bayerPattern)
+        _cosmeticDirty = true;
+    _bayerPattern = pattern;
 }
 
 void GlImageRenderer::setAutoParams(bool useAuto, float low, float high, float strength)
@@ -728,6 +1527,72 @@ void GlImageRenderer::setViewParams(float zoom, float panX, float panY)
     _panY = panY;
 }
 
+void GlImageRenderer::setAlignment(const double* refToFrame)
+{
+    _alignEnabled = refToFrame != nullptr;
+    for (int i = 0; i < 9; ++i)
+        _align[i] = refToFrame ? refToFrame[i] : (i % 4 == 0 ? 1.0 : 0.0);
+}
+
+// 屏幕上图像区域（保持长宽比、居中）占视图的比例
+static void fit_scale(int imgW, int imgH, float viewW, float viewH, float& sx, float& sy)
+{
+    float texAspect    = (float)imgW / (float)imgH;
+    float screenAspect = viewW / viewH;
+    sx = sy = 1.0f;
+    if (screenAspect > texAspect)
+        sx = texAspect / screenAspect;
+    else
+        sy = screenAspect / texAspect;
+}
+
+void GlImageRenderer::flipToDisplay(float& x, float& y) const
+{
+    bool flipX, flipY;
+    bayer_display_flip(static_cast<BayerPattern>(_bayerPattern), flipX, flipY);
+    if (flipX)
+        x = (float)(_imgWidth - 1) - x;
+    if (flipY)
+        y = (float)(_imgHeight - 1) - y;
+}
+
+bool GlImageRenderer::imageToView(float x, float y, float viewW, float viewH, float& vx, float& vy) const
+{
+    if (_imgWidth <= 0 || _imgHeight <= 0 || viewW <= 0.0f || viewH <= 0.0f)
+        return false;
+
+    flipToDisplay(x, y);
+
+    float sx, sy;
+    fit_scale(_imgWidth, _imgHeight, viewW, viewH, sx, sy);
+    const float zoom = std::max(_zoom, 0.1f);
+
+    // 与 debayer_bilinear 相同：像素 i 的中心在 uv = i / size
+    float u = (x / (float)_imgWidth  - 0.5f - _panX) * zoom;
+    float v = (y / (float)_imgHeight - 0.5f - _panY) * zoom;
+    vx = (u / sx + 0.5f) * viewW;
+    vy = (0.5f - v / sy) * viewH;
+    return true;
+}
+
+bool GlImageRenderer::viewToImage(float vx, float vy, float viewW, float viewH, float& x, float& y) const
+{
+    if (_imgWidth <= 0 || _imgHeight <= 0 || viewW <= 0.0f || viewH <= 0.0f)
+        return false;
+
+    float sx, sy;
+    fit_scale(_imgWidth, _imgHeight, viewW, viewH, sx, sy);
+    const float zoom = std::max(_zoom, 0.1f);
+
+    float u = (vx / viewW - 0.5f) * sx;
+    float v = (0.5f - vy / viewH) * sy;
+    x = (u / zoom + 0.5f + _panX) * (float)_imgWidth;
+    y = (v / zoom + 0.5f + _panY) * (float)_imgHeight;
+    flipToDisplay(x, y);
+    return std::fabs(u) <= 0.5f && std::fabs(v) <= 0.5f &&
+           x >= -0.5f && y >= -0.5f && x < _imgWidth - 0.5f && y < _imgHeight - 0.5f;
+}
+
 void GlImageRenderer::updateUniforms(int viewportWidth, int viewportHeight)
 {
     glUniform1f(_uLowLoc,  _autoLow);
@@ -749,18 +1614,36 @@ void GlImageRenderer::updateUniforms(int viewportWidth, int viewportHeight)
 
     glUniform3f(_uWBGainLoc, _wbR, _wbG, _wbB);
     glUniform1i(_uBayerPatternLoc, _bayerPattern);
+
+    // 对齐矩阵按文件像素算，shader 里的坐标是去拜耳输出的方向
+    double align[9];
+    float  alignF[9];
+    bayer_flip_transform(static_cast<BayerPattern>(_bayerPattern), _imgWidth, _imgHeight, _align, align);
+    for (int i = 0; i < 9; ++i)
+        alignF[i] = (float)align[i];
+    glUniform1i(_uAlignEnabledLoc, _alignEnabled ? 1 : 0);
+    glUniformMatrix3fv(_uAlignLoc, 1, GL_TRUE, alignF);
+
+    glUniform1i(_uExportModeLoc, 0);
 }
 
 void GlImageRenderer::render(int viewportWidth, int viewportHeight)
 {
+    ProfileScope  cpuScope("render");
+    GpuTimerScope gpuScope(_gpuTimer, "render");
+
     if (!_hasTexture || !_shaderProgram || !_quadVAO)
         return;
 
-    glUseProgram(_shaderProgram);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, _baseTexture);
+    // 预处理要切 FBO，先于主 shader 做完
+    if (cosmeticActive())
+        updateCosmetic(true);
 
+    glUseProgram(_shaderProgram);
     updateUniforms(viewportWidth, viewportHeight);
+    bindSource(_uCalEnabledLoc, _uCalRawLoc, _uCalParamsLoc, true);
+    // 闪烁播放的帧也扣参考帧的背景模型：黑白点是按扣除后的参考帧定的
+    bindBackground(_uBgModeLoc, _uBgSizeLoc, _uBgLevelLoc, true);
 
     glBindVertexArray(_quadVAO);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
@@ -775,6 +1658,9 @@ bool GlImageRenderer::computeAutoParamsGpu(bool useAuto,
                                            float& outLow,
                                            float& outHigh)
 {
+    ProfileScope  cpuScope("computeAutoParamsGpu");
+    GpuTimerScope gpuScope(_gpuTimer, "computeAutoParamsGpu");
+
     if (!_hasTexture || !_statsFBO || !_statsProgram || _imgWidth <= 0 || _imgHeight <= 0)
     {
         outLow = 0.0f;
@@ -789,46 +1675,132 @@ bool GlImageRenderer::computeAutoParamsGpu(bool useAuto,
         return true;
     }
 
-    // === 1. 在统计 FBO 上渲染亮度图（256x256） ===
+    // 同步读回：glReadPixels 要等 GPU 画完统计纹理
+    std::vector<float> lum;
+    readStatsLuminance(&lum);
+
+    if (lum.empty())
+    {
+        outLow = 0.0f;
+        outHigh = 1.0f;
+        return false;
+    }
+
+    if (!autoLevels(lum, blackClip, whiteClip, outLow, outHigh))
+        return false;
+    buildHistogram(lum, outLow, outHigh);
+    return true;
+}
+
+bool GlImageRenderer::beginStatsReadback()
+{
+    ProfileScope cpuScope("beginStatsReadback");
+
+    if (!_hasTexture || !_statsFBO || !_statsProgram || _imgWidth <= 0 || _imgHeight <= 0)
+        return false;
+
+    // 上一次还没取走的结果作废：同一个 PBO 上的读回按提交顺序执行，新 fence 之前旧的一定也完成了
+    if (_statsFence)
+    {
+        glDeleteSync((GLsync)_statsFence);
+        _statsFence = nullptr;
+    }
+    readStatsLuminance(nullptr);
+    return _statsFence != nullptr;
+}
+
+bool GlImageRenderer::finishStatsReadback(float blackClip, float whiteClip,
+                                          float displayLow, float displayHigh,
+                                          float& autoLow, float& autoHigh)
+{
+    if (!_statsFence || !_statsPbo)
+        return false;
+
+    GLenum r = glClientWaitSync((GLsync)_statsFence, 0, 0);
+    if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED)
+        return false;   // GPU 还没写完，下一帧再试
+    glDeleteSync((GLsync)_statsFence);
+    _statsFence = nullptr;
+
+    ProfileScope cpuScope("finishStatsReadback");
+
+    const size_t n = (size_t)_statsSize * _statsSize;
+    std::vector<float> lum(n);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _statsPbo);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)(n * sizeof(float)), GL_MAP_READ_BIT);
+    if (mapped)
+    {
+        std::memcpy(lum.data(), mapped, n * sizeof(float));
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!mapped)
+        return false;
+
+    if (!autoLevels(lum, blackClip, whiteClip, autoLow, autoHigh))
+        return false;
+    buildHistogram(lum, displayLow, displayHigh);
+    return true;
+}
+
+void GlImageRenderer::readStatsLuminance(std::vector<float>* lum)
+{
+    // 在统计 FBO 上渲染亮度图（256x256）
     GLint prevFBO = 0;
     glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
     GLint prevViewport[4];
     glGetIntegerv(GL_VIEWPORT, prevViewport);
 
+    if (cosmeticActive())
+        updateCosmetic();
+
     glBindFramebuffer(GL_FRAMEBUFFER, _statsFBO);
     glViewport(0, 0, _statsSize, _statsSize);
     glClearColor(0, 0, 0, 1);
     glClear(GL_COLOR_BUFFER_BIT);
 
     glUseProgram(_statsProgram);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, _baseTexture);
-
     glUniform2f(_uStatsTexSizeLoc, (float)_imgWidth, (float)_imgHeight);
     glUniform1i(_uStatsBayerPatternLoc, _bayerPattern);
     glUniform3f(_uStatsWBGainLoc, _wbR, _wbG, _wbB);
+    glUniform1i(_uStatsOutputRgbLoc, 0);
+    bindSource(_uStatsCalEnabledLoc, _uStatsCalRawLoc, _uStatsCalParamsLoc);
+    bindBackground(_uStatsBgModeLoc, _uStatsBgSizeLoc, _uStatsBgLevelLoc, true);
 
     glBindVertexArray(_quadVAO);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
     glBindVertexArray(0);
 
-    // === 2. 从统计纹理读回“线性 + 白平衡后”的亮度数据（RED 通道） ===
-    std::vector<float> lum;
-    lum.resize((size_t)_statsSize * _statsSize);
-    glReadPixels(0, 0, _statsSize, _statsSize, GL_RED, GL_FLOAT, lum.data());
+    // 读回“线性 + 白平衡后”的亮度数据（RED 通道）：lum 非空时同步读，否则写进 PBO 并插 fence 立即返回
+    const size_t n = (size_t)_statsSize * _statsSize;
+    if (lum)
+    {
+        lum->resize(n);
+        glReadPixels(0, 0, _statsSize, _statsSize, GL_RED, GL_FLOAT, lum->data());
+    }
+    else
+    {
+        if (!_statsPbo)
+        {
+            glGenBuffers(1, &_statsPbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, _statsPbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)(n * sizeof(float)), nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _statsPbo);
+        glReadPixels(0, 0, _statsSize, _statsSize, GL_RED, GL_FLOAT, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        _statsFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
 
     glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
     glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
     glUseProgram(0);
+}
 
-    if (lum.empty())
-    {
-        outLow = 0.0f;
-        outHigh = 1.0f;
-        return false;
-    }
-
-    // === 3. 按百分位计算黑白点（blackClip / whiteClip） ===
+bool GlImageRenderer::autoLevels(const std::vector<float>& lum, float blackClip, float whiteClip,
+                                 float& outLow, float& outHigh) const
+{
+    // 按百分位计算黑白点（blackClip / whiteClip）
     std::vector<float> sorted = lum;
     std::sort(sorted.begin(), sorted.end());
 
@@ -867,10 +1839,15 @@ bool GlImageRenderer::computeAutoParamsGpu(bool useAuto,
     outLow  = clamp01(low);
     outHigh = clamp01(high);
 
-    // === 4. 基于“拉伸后的亮度”构建直方图（真正和画面一致） ===
+    return true;
+}
+
+void GlImageRenderer::buildHistogram(const std::vector<float>& lum, float low, float high)
+{
+    // 基于“拉伸后的亮度”构建直方图（真正和画面一致）
     _histogram.assign(_histBins, 0.0f);
 
-    float range = std::max(outHigh - outLow, 1e-3f);
+    float range = std::max(high - low, 1e-3f);
     float s = std::max(_stretchStrength, 1.0f);
     float asinhDenom = std::asinh(s);
     if (asinhDenom < 1e-6f) asinhDenom = 1e-6f;
@@ -880,7 +1857,7 @@ bool GlImageRenderer::computeAutoParamsGpu(bool useAuto,
     for (float v : lum)
     {
         // 线性裁剪到 [low, high]
-        float t = (v - outLow) / range;
+        float t = (v - low) / range;
         t = clamp01(t);
 
         // 按当前 stretch 模式变换（和主 shader 一致）
@@ -926,32 +1903,60 @@ bool GlImageRenderer::computeAutoParamsGpu(bool useAuto,
             c = std::sqrt(c);      // 再 sqrt 提升小值（可换成 pow(c, 0.3f) 更夸张）
         }
     }
-
-    return true;
 }
 
 
+bool GlImageRenderer::resolveExportRegion(const ExportRegion& region,
+                                          int& cropX, int& cropY, int& cropW, int& cropH,
+                                          int& outWidth, int& outHeight) const
+{
+    if (!_hasTexture || _imgWidth <= 0 || _imgHeight <= 0)
+        return false;
+
+    int x0 = std::clamp(region.x, 0, _imgWidth);
+    int y0 = std::clamp(region.y, 0, _imgHeight);
+    int x1 = region.width  > 0 ? std::min(region.x + region.width,  _imgWidth)  : _imgWidth;
+    int y1 = region.height > 0 ? std::min(region.y + region.height, _imgHeight) : _imgHeight;
+    if (x1 <= x0 || y1 <= y0)
+        return false;
+
+    float scale = region.scale > 0.0f ? region.scale : 1.0f;
 
-bool GlImageRenderer::renderToImage(int outWidth, int outHeight, std::vector<unsigned char>& outRGB)
+    cropX = x0;
+    cropY = y0;
+    cropW = x1 - x0;
+    cropH = y1 - y0;
+    outWidth  = std::max(1, (int)std::lround(cropW * scale));
+    outHeight = std::max(1, (int)std::lround(cropH * scale));
+    return true;
+}
+
+// 导出渲染：绑定导出 FBO 并画一帧，成功时导出 FBO 保持绑定，由调用方恢复之前的 FBO/viewport
+bool GlImageRenderer::drawExport(const ExportRegion& region, int& outWidth, int& outHeight)
 {
-    if (!_hasTexture || !_shaderProgram || !_quadVAO || outWidth <= 0 || outHeight <= 0)
+    int cropX = 0, cropY = 0, cropW = 0, cropH = 0;
+    if (!resolveExportRegion(region, cropX, cropY, cropW, cropH, outWidth, outHeight))
         return false;
 
+    if (cosmeticActive())
+        updateCosmetic();
+
     if (!_exportFBO)
         glGenFramebuffers(1, &_exportFBO);
     if (!_exportTex)
         glGenTextures(1, &_exportTex);
 
     glBindTexture(GL_TEXTURE_2D, _exportTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, outWidth, outHeight,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    GLint prevFBO = 0;
-    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
-    GLint prevViewport[4];
-    glGetIntegerv(GL_VIEWPORT, prevViewport);
+    if (_exportTexW != outWidth || _exportTexH != outHeight)
+    {
+        // 16 bit 定点，8 bit 导出时读回再量化，两种格式共用一张纹理
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, outWidth, outHeight,
+                     0, GL_RGBA, GL_UNSIGNED_SHORT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        _exportTexW = outWidth;
+        _exportTexH = outHeight;
+    }
 
     glBindFramebuffer(GL_FRAMEBUFFER, _exportFBO);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
@@ -962,8 +1967,6 @@ bool GlImageRenderer::renderToImage(int outWidth, int outHeight, std::vector<uns
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
     {
         std::cerr << "Export FBO incomplete\n";
-        glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
-        glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
         return false;
     }
 
@@ -972,34 +1975,198 @@ bool GlImageRenderer::renderToImage(int outWidth, int outHeight, std::vector<uns
     glClear(GL_COLOR_BUFFER_BIT);
 
     glUseProgram(_shaderProgram);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, _baseTexture);
 
-    // 导出时也使用当前 zoom/pan，但 viewport 尺寸是 full-res
+    // 拉伸/白平衡/曲线等与预览一致，视图换成恒等变换 + 裁剪矩形
     updateUniforms(outWidth, outHeight);
+    bindSource(_uCalEnabledLoc, _uCalRawLoc, _uCalParamsLoc);
+    bindBackground(_uBgModeLoc, _uBgSizeLoc, _uBgLevelLoc, true);
+
+    // 去拜耳按 floor(uv * size + 0.5) 取像素，这里整体左移半个像素，
+    // 让 scale = 1 时每个输出像素正好对应一个原始像素
+    float invW = 1.0f / (float)_imgWidth;
+    float invH = 1.0f / (float)_imgHeight;
+    glUniform1i(_uExportModeLoc, 1);
+    glUniform4f(_uExportRectLoc,
+                ((float)cropX - 0.5f) * invW,
+                ((float)cropY - 0.5f) * invH,
+                ((float)(cropX + cropW) - 0.5f) * invW,
+                ((float)(cropY + cropH) - 0.5f) * invH);
 
     glBindVertexArray(_quadVAO);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
     glBindVertexArray(0);
 
-    outRGB.resize((size_t)outWidth * outHeight * 3);
-    glReadPixels(0, 0, outWidth, outHeight, GL_RGB, GL_UNSIGNED_BYTE, outRGB.data());
+    glUseProgram(0);
+    return true;
+}
+
+bool GlImageRenderer::renderToRows(const ExportRegion& region,
+                                   ExportPixelFormat format,
+                                   const ExportRowSink& sink)
+{
+    ProfileScope  cpuScope("renderToRows");
+    GpuTimerScope gpuScope(_gpuTimer, "renderToRows");
 
-    // 垂直翻转（OpenGL 原点在左下，导出希望左上）
-    int rowBytes = outWidth * 3;
-    for (int y = 0; y < outHeight / 2; ++y)
+    if (!_hasTexture || !_shaderProgram || !_quadVAO || !sink)
+        return false;
+
+    GLint prevFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
+    GLint prevViewport[4];
+    glGetIntegerv(GL_VIEWPORT, prevViewport);
+
+    int outWidth = 0, outHeight = 0;
+    bool ok = drawExport(region, outWidth, outHeight);
+
+    if (ok)
     {
-        unsigned char* row1 = outRGB.data() + y * rowBytes;
-        unsigned char* row2 = outRGB.data() + (outHeight - 1 - y) * rowBytes;
-        for (int x = 0; x < rowBytes; ++x)
-            std::swap(row1[x], row2[x]);
+        // 按行带读回：OpenGL 原点在左下，从最上面的行带开始读，带内倒序交给 sink
+        const bool   is16     = (format == ExportPixelFormat::RGB16);
+        const GLenum type     = is16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+        const size_t rowBytes = (size_t)outWidth * 3 * (is16 ? 2 : 1);
+
+        std::vector<unsigned char> band(rowBytes * std::min(_exportBandRows, outHeight));
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);   // RGB 行宽不一定是 4 的倍数
+
+        for (int yTop = 0; yTop < outHeight && ok; yTop += _exportBandRows)
+        {
+            int rows = std::min(_exportBandRows, outHeight - yTop);
+            int glY  = outHeight - yTop - rows;
+            glReadPixels(0, glY, outWidth, rows, GL_RGB, type, band.data());
+
+            for (int i = 0; i < rows && ok; ++i)
+                ok = sink(band.data() + (size_t)(rows - 1 - i) * rowBytes, yTop + i);
+        }
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
     glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
-    glUseProgram(0);
 
-    return true;
+    return ok;
+}
+
+bool GlImageRenderer::beginExportReadback(const ExportRegion& region,
+                                          ExportPixelFormat format,
+                                          ExportReadback& out)
+{
+    ProfileScope  cpuScope("beginExportReadback");
+    GpuTimerScope gpuScope(_gpuTimer, "beginExportReadback");
+
+    releaseExportReadback(out);
+    out.failed = false;
+
+    if (!_hasTexture || !_shaderProgram || !_quadVAO)
+        return false;
+
+    GLint prevFBO = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFBO);
+    GLint prevViewport[4];
+    glGetIntegerv(GL_VIEWPORT, prevViewport);
+
+    int outWidth = 0, outHeight = 0;
+    bool ok = drawExport(region, outWidth, outHeight);
+
+    if (ok)
+    {
+        const bool is16 = (format == ExportPixelFormat::RGB16);
+        out.width    = outWidth;
+        out.height   = outHeight;
+        out.format   = format;
+        out.rowBytes = (size_t)outWidth * 3 * (is16 ? 2 : 1);
+
+        // glReadPixels 写进 PBO 立即返回，真正的拷贝由驱动异步完成
+        glGenBuffers(1, &out.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, out.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)(out.rowBytes * outHeight), nullptr, GL_STREAM_READ);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, outWidth, outHeight, GL_RGB,
+                     is16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        out.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, prevFBO);
+    glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+
+    return ok;
+}
+
+const void* GlImageRenderer::mapExportReadback(ExportReadback& rb)
+{
+    if (rb.mapped)
+        return rb.mapped;
+    if (!rb.pbo || rb.failed)
+    {
+        rb.failed = true;
+        return nullptr;
+    }
+
+    if (rb.fence)
+    {
+        GLenum r = glClientWaitSync((GLsync)rb.fence, 0, 0);
+        if (r == GL_WAIT_FAILED)
+        {
+            rb.failed = true;
+            return nullptr;
+        }
+        if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED)
+            return nullptr;   // GPU 还没写完，下一帧再试
+        glDeleteSync((GLsync)rb.fence);
+        rb.fence = nullptr;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+    rb.mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                 (GLsizeiptr)(rb.rowBytes * rb.height), GL_MAP_READ_BIT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!rb.mapped)
+        rb.failed = true;   // 显存 / 地址空间不足，重试也不会成功
+    return rb.mapped;
+}
+
+void GlImageRenderer::releaseExportReadback(ExportReadback& rb)
+{
+    if (rb.fence)
+    {
+        glDeleteSync((GLsync)rb.fence);
+        rb.fence = nullptr;
+    }
+    if (rb.pbo)
+    {
+        if (rb.mapped)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &rb.pbo);
+        rb.pbo = 0;
+    }
+    rb.mapped = nullptr;
+}
+
+bool GlImageRenderer::renderToImage(const ExportRegion& region,
+                                    std::vector<unsigned char>& outRGB,
+                                    int& outWidth,
+                                    int& outHeight)
+{
+    ProfileScope  cpuScope("renderToImage");
+    GpuTimerScope gpuScope(_gpuTimer, "renderToImage");
+
+    int cropX = 0, cropY = 0, cropW = 0, cropH = 0;
+    if (!resolveExportRegion(region, cropX, cropY, cropW, cropH, outWidth, outHeight))
+        return false;
+
+    const size_t rowBytes = (size_t)outWidth * 3;
+    outRGB.resize(rowBytes * outHeight);
+
+    return renderToRows(region, ExportPixelFormat::RGB8,
+                        [&](const void* row, int y) {
+                            std::memcpy(outRGB.data() + (size_t)y * rowBytes, row, rowBytes);
+                            return true;
+                        });
 }
 
 bool GlImageRenderer::getLuminanceHistogram(std::vector<float>& outHist) const
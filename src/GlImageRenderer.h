@@ -1,7 +1,43 @@
 #pragma once
 
+#include "GpuTimer.h"
+
+#include <functional>
 #include <vector>
 
+// 导出区域：图像像素坐标（第 0 行是 FITS 第一行，即画面底部），与交互视图的缩放/平移无关
+struct ExportRegion
+{
+    int   x      = 0;
+    int   y      = 0;
+    int   width  = 0;      // <= 0 表示到图像右边缘
+    int   height = 0;      // <= 0 表示到图像上边缘
+    float scale  = 1.0f;   // 输出尺寸 = 裁剪尺寸 * scale
+};
+
+// 导出读回的像素格式（交错 RGB，16 bit 为本机字节序 uint16）
+enum class ExportPixelFormat {
+    RGB8  = 0,
+    RGB16 = 1
+};
+
+// 逐行接收导出结果：y 自上而下递增，返回 false 表示中止导出
+using ExportRowSink = std::function<bool(const void* row, int y)>;
+
+// 异步导出读回：glReadPixels 写入 PBO + fence，由 GL 线程按帧轮询，
+// 映射后的指针可以交给编码线程直接读，编码完成后再回到 GL 线程释放
+struct ExportReadback
+{
+    unsigned int      pbo      = 0;
+    void*             fence    = nullptr;   // GLsync
+    const void*       mapped   = nullptr;   // 映射后的像素，行自下而上
+    int               width    = 0;
+    int               height   = 0;
+    size_t            rowBytes = 0;
+    ExportPixelFormat format   = ExportPixelFormat::RGB8;
+    bool              failed   = false;     // 等待 fence 或映射失败，这次读回不会再有结果
+};
+
 // 负责 GPU 渲染：
 // - 保存 Bayer/灰度纹理（单通道）
 // - shader 内完成：去拜耳 + 白平衡 + auto stretch + tone curve + 多种拉伸模式 + 缩放/平移
@@ -19,6 +55,18 @@ public:
     // 上传 Bayer / 灰度 (0~1 float)，只在加载新图时调用一次
     void uploadBaseTexture(const std::vector<float>& bayerOrGray, int width, int height);
 
+    // 额外的常驻帧纹理（闪烁播放用）：必须和底图同尺寸，格式同为 R16F，失败返回 0
+    unsigned int createFrameTexture(const std::vector<float>& bayerOrGray, int width, int height);
+    void         deleteFrameTexture(unsigned int texture);
+
+    // 单张帧纹理占用的显存（R16F）
+    static size_t frameTextureBytes(int width, int height) { return (size_t)width * height * 2; }
+
+    // 屏幕显示用的纹理，0 表示底图；统计 / 导出始终使用底图。
+    // rawMin / rawMax 是这张帧纹理自己的归一化范围，显示时换算到底图的输出范围（outputRange），
+    // 各帧共用底图的黑白点时亮度才一致
+    void setDisplayTexture(unsigned int texture, double rawMin = 0.0, double rawMax = 1.0);
+
     // auto stretch 参数
     void setAutoParams(bool useAuto, float low, float high, float strength);
 
@@ -32,11 +80,63 @@ public:
     void setWhiteBalance(float rGain, float gGain, float bGain);
 
     // Bayer 模式：0: NONE, 1: RGGB, 2: BGGR, 3: GRBG, 4: GBRG
-    void setBayerPattern(int pattern) { _bayerPattern = pattern; }
+    void setBayerPattern(int pattern);
+
+    // GPU 校准主帧（ADU）：bias、thermal（dark - bias）、invFlat（归一化 flat 的倒数），任一可为 nullptr。
+    // 只在换主帧时上传一次（bias / thermal 合成一张 RG16F，flat 一张 R16F）；尺寸须和底图一致才生效
+    bool uploadCalibration(const float* bias, const float* thermal, const float* invFlat,
+                           int width, int height);
+    void clearCalibration();
+    bool hasCalibration() const { return _calOffsetTex != 0 || _calFlatTex != 0; }
+
+    // 当前底图的归一化范围（raw = rawMin + n * (rawMax - rawMin)）、dark 系数和各步骤开关。
+    // 只改 uniform，不重新上传底图；去拜耳之前在 shader 里做 (raw - bias - k * thermal) * invFlat，
+    // 主 shader 和统计 shader 都用，所以 auto stretch / 直方图 / 导出反映的是校准后的数据。
+    // 显示帧纹理（闪烁播放）时同样校准（帧纹理和底图同尺寸），按各帧自己的归一化范围还原 ADU
+    void setCalibrationParams(double rawMin, double rawMax, float darkScale,
+                              bool useBias, bool useDark, bool useFlat);
+
+    // 显示 / 统计数据 0~1 对应的 ADU 范围：不校准时就是底图的 rawMin / rawMax，校准时是估计的校准后范围。
+    // 黑白点（setAutoParams）在这个单位下，换帧时据此换算
+    void outputRange(double& lo, double& hi) const;
+
+    // GPU 坏点修正预处理：在（校准后的）底图上按同色邻居找热点 / 暗点，判定和 cosmetic_correct 相同，
+    // 结果写进一张同尺寸的 R16F 纹理，之后显示 / 统计 / 导出都读这张纹理。
+    // 只在底图、校准或这些参数变了之后重算一次，平移缩放不会触发。
+    // noiseSigma 是底图归一化单位下的全图噪声（estimate_noise_sigma），sigma 为 0 的一侧不修
+    void setCosmeticParams(bool enabled, float hotSigma, float coldSigma, float noiseSigma);
+
+    // 背景模型：在统计 shader 里按 size x size 均匀抽样，读回去拜耳后、扣背景 / 白平衡之前的交错 RGB
+    // （已校准 / 修坏点，和显示的是同一份数据），交给 fit_background 拟合
+    bool sampleBackground(std::vector<float>& rgb, int& width, int& height);
+
+    // 上传拟合好的背景模型（width x height 的交错 RGB，节点 j 对应像素 j / (width - 1) * (imageW - 1)），
+    // 存成小 RGB32F 纹理线性插值。mode：0 关，1 减（c - bg + level），2 除（c / bg * level）。
+    // 在去拜耳之后、白平衡之前做，主 shader 和统计 shader 都用，auto stretch 的分位数按扣除后的数据统计；
+    // 显示帧纹理（闪烁播放）时扣同一个模型（黑白点是按扣除后的当前帧定的）
+    bool setBackgroundModel(const float* rgb, int width, int height, const float level[3]);
+    void clearBackgroundModel();
+    void setBackgroundMode(int mode);
 
     // 视图参数（缩放 + 平移）
     void setViewParams(float zoom, float panX, float panY);
 
+    // 对齐显示：refToFrame 为 3x3 行优先矩阵，把参考帧像素坐标映射到当前显示帧的像素坐标（都是文件像素，
+    // 和找星一致），nullptr 为不对齐。只作用于交互视图：fragment shader 里按屏幕像素在参考帧坐标下反算
+    // 要采样的帧坐标，不在 CPU 上重采样；去拜耳输出有翻转的 Bayer 模式在上传前换到显示方向
+    // （bayer_flip_transform）。统计 / 导出仍按帧自身的几何
+    void setAlignment(const double* refToFrame);
+
+    // 与 shader 里 view_to_texture 相同的映射（CPU 版，叠加层 / 光标读数用）。
+    // 图像坐标是文件像素坐标，以像素中心为整数（不翻转时第 0 行在屏幕下方）；BGGR / GRBG / GBRG
+    // 去拜耳后画面相对文件是翻转的（bayer_display_flip），这里一并换算，找星结果、WCS 可以直接用。
+    // 视图坐标以左上角为原点，单位同 viewW / viewH。
+    // 像素 i 的中心在纹理 uv = i / size（和 debayer_bilinear、导出裁剪矩形一致），不是 (i + 0.5) / size，
+    // 否则叠加层会差半个像素
+    // 还没有底图时返回 false；viewToImage 落在图像外也返回 false（坐标照常给出）
+    bool imageToView(float x, float y, float viewW, float viewH, float& vx, float& vy) const;
+    bool viewToImage(float vx, float vy, float viewW, float viewH, float& x, float& y) const;
+
     // 每帧调用，viewport 是当前帧缓冲大小
     void render(int viewportWidth, int viewportHeight);
 
@@ -48,8 +148,44 @@ public:
                               float& outLow,
                               float& outHigh);
 
-    // 使用当前 shader 状态，把结果渲染到 outWidth x outHeight，然后读回 RGB8
-    bool renderToImage(int outWidth, int outHeight, std::vector<unsigned char>& outRGB);
+    // 异步统计：统计纹理读进 PBO 后立即返回，不等 GPU（跟随目录换帧时用，避免 glReadPixels 同步等待）。
+    // 之后每帧调用 finishStatsReadback，GPU 完成前返回 false；完成后按 displayLow / displayHigh
+    // （当前显示用的黑白点）重建直方图，同时给出这一帧自己的 auto 黑白点
+    bool beginStatsReadback();
+    bool finishStatsReadback(float blackClip, float whiteClip,
+                             float displayLow, float displayHigh,
+                             float& autoLow, float& autoHigh);
+    bool statsReadbackPending() const { return _statsFence != nullptr; }
+
+    // 计算导出区域实际的裁剪矩形和输出尺寸（越界会被裁掉），区域为空时返回 false
+    bool resolveExportRegion(const ExportRegion& region,
+                             int& cropX, int& cropY, int& cropW, int& cropH,
+                             int& outWidth, int& outHeight) const;
+
+    // 导出渲染：使用独立的恒等视图（不读取交互的 zoom/pan），只共享拉伸/白平衡等参数
+    // 渲染到 RGBA16 离屏纹理，再按行带读回，逐行交给 sink（自上而下），
+    // 读回缓冲只有一个行带大小，适合直接接流式写文件
+    bool renderToRows(const ExportRegion& region,
+                      ExportPixelFormat format,
+                      const ExportRowSink& sink);
+
+    // 异步版本：渲染并发起 PBO 读回后立即返回
+    bool beginExportReadback(const ExportRegion& region,
+                             ExportPixelFormat format,
+                             ExportReadback& out);
+
+    // GPU 完成后映射 PBO 并返回像素指针，还没完成返回 nullptr（不阻塞）；
+    // 等待或映射出错时也返回 nullptr 并置 rb.failed，调用方应释放读回并报告失败
+    const void* mapExportReadback(ExportReadback& rb);
+
+    // 解除映射并删除 PBO（必须在 GL 线程、且没有别的线程在读映射内存时调用）
+    void releaseExportReadback(ExportReadback& rb);
+
+    // 同上，但把整幅 RGB8 结果收集到 outRGB
+    bool renderToImage(const ExportRegion& region,
+                       std::vector<unsigned char>& outRGB,
+                       int& outWidth,
+                       int& outHeight);
 
     // 拷贝最新的亮度直方图（如果还没统计过，返回 false）
     bool getLuminanceHistogram(std::vector<float>& outHist) const;
@@ -60,15 +196,38 @@ public:
 
 private:
     bool createQuad();
+
+    // 画统计纹理并读回亮度：lum 非空时同步读，否则读进 _statsPbo 并设置 _statsFence
+    void readStatsLuminance(std::vector<float>* lum);
+    bool autoLevels(const std::vector<float>& lum, float blackClip, float whiteClip,
+                    float& outLow, float& outHigh) const;
+    void buildHistogram(const std::vector<float>& lum, float low, float high);
     bool createMainShader();
     bool createStatsShader();
+    bool createCosmeticShader();
     void destroyQuad();
     void destroyShaders();
     void updateUniforms(int viewportWidth, int viewportHeight);
+    bool calibrationActive() const;
+    void bindCalibration(int enabledLoc, int rawLoc, int paramsLoc, bool enabled, bool display = false);
+    bool drawExport(const ExportRegion& region, int& outWidth, int& outHeight);
+    bool cosmeticActive() const;
+    bool updateCosmetic(bool display = false);
+    void bindSource(int enabledLoc, int rawLoc, int paramsLoc, bool display = false);
+    void destroyCosmetic();
+    void bindBackground(int modeLoc, int sizeLoc, int levelLoc, bool enabled);
+    void flipToDisplay(float& x, float& y) const;   // 文件像素 <-> 显示方向（自逆）
 
 private:
+    // GL_TIME_ELAPSED 计时（结果进 Profiler）
+    GpuTimer _gpuTimer;
+
     // 主渲染资源
     unsigned int _baseTexture   = 0;  // Bayer/灰度纹理（单通道 float）
+    int          _baseTexWidth  = 0;  // _baseTexture 已分配的尺寸
+    int          _baseTexHeight = 0;
+    unsigned int _displayTexture = 0; // 非 0 时屏幕显示这张帧纹理（不归 renderer 所有）
+    float        _displayRaw[2] = {0.0f, 1.0f};   // 帧纹理的 (rawMin, rawRange)
     unsigned int _quadVAO       = 0;
     unsigned int _quadVBO       = 0;
     unsigned int _quadEBO       = 0;
@@ -96,20 +255,91 @@ private:
     int _uWBGainLoc          = -1;   // vec3 白平衡增益
     int _uBayerPatternLoc    = -1;   // int Bayer 模式
 
+    int _uAlignEnabledLoc    = -1;   // bool 对齐显示
+    int _uAlignLoc           = -1;   // mat3 参考帧像素 -> 显示帧像素
+
+    int _uExportModeLoc      = -1;   // bool 导出模式（恒等视图）
+    int _uExportRectLoc      = -1;   // vec4 导出裁剪矩形（纹理 uv）
+
+    int _uCalEnabledLoc      = -1;   // bool 是否校准
+    int _uCalRawLoc          = -1;   // vec4 (rawMin, rawRange, outLow, 1 / outRange)
+    int _uCalParamsLoc       = -1;   // vec4 (bias 中值, 用 bias, dark 系数, 用 flat)
+
+    int _uBgModeLoc          = -1;   // int 背景扣除方式
+    int _uBgSizeLoc          = -1;   // vec2 背景纹理尺寸
+    int _uBgLevelLoc         = -1;   // vec3 扣除后保持的背景水平
+
     // 统计 FBO + 纹理 + shader
     unsigned int _statsFBO      = 0;
     unsigned int _statsTex      = 0;
     unsigned int _statsProgram  = 0;
     int          _statsSize     = 256;  // 统计纹理尺寸：256x256
+    unsigned int _statsPbo      = 0;    // 异步统计的读回缓冲
+    void*        _statsFence    = nullptr;   // GLsync
 
     int _uStatsBaseTexLoc       = -1;
     int _uStatsTexSizeLoc       = -1;
     int _uStatsBayerPatternLoc  = -1;
     int _uStatsWBGainLoc        = -1;
-
-    // 导出 FBO + 纹理（全分辨率）
-    unsigned int _exportFBO = 0;
-    unsigned int _exportTex = 0;
+    int _uStatsCalEnabledLoc    = -1;
+    int _uStatsCalRawLoc        = -1;
+    int _uStatsCalParamsLoc     = -1;
+    int _uStatsOutputRgbLoc     = -1;
+    int _uStatsBgModeLoc        = -1;
+    int _uStatsBgSizeLoc        = -1;
+    int _uStatsBgLevelLoc       = -1;
+
+    // GPU 校准：纹理单元 1 为 (bias - 中值, thermal)，单元 2 为 invFlat
+    unsigned int _calOffsetTex = 0;
+    unsigned int _calFlatTex   = 0;
+    int          _calWidth     = 0;
+    int          _calHeight    = 0;
+    bool         _calHasBias   = false;
+    bool         _calHasDark   = false;
+    float        _calBiasMedian = 0.0f;
+    float        _calBiasLo = 0.0f, _calBiasHi = 0.0f;       // 稳健范围（0.01% / 99.99%），用来估计校准后的取值范围
+    float        _calThermLo = 0.0f, _calThermHi = 0.0f;
+    float        _calFlatLo = 1.0f, _calFlatHi = 1.0f;
+    bool         _calUseBias = false;
+    bool         _calUseDark = false;
+    bool         _calUseFlat = false;
+    float        _calRaw[4]    = {0.0f, 1.0f, 0.0f, 1.0f};
+    float        _calDarkScale = 1.0f;
+
+    // 背景模型：纹理单元 3，RGB32F 小纹理
+    unsigned int _bgTex       = 0;
+    int          _bgWidth     = 0;
+    int          _bgHeight    = 0;
+    int          _bgMode      = 0;
+    float        _bgLevel[3]  = {0.0f, 0.0f, 0.0f};
+    unsigned int _bgSampleFBO = 0;     // 背景抽样（RGBA32F）
+    unsigned int _bgSampleTex = 0;
+    int          _bgSampleSize = 256;
+
+    // 坏点修正预处理：结果纹理已经是校准后的值，用它时主 / 统计 shader 不再校准
+    unsigned int _cosmeticProgram = 0;
+    unsigned int _cosmeticFBO     = 0;
+    unsigned int _cosmeticTex     = 0;
+    int          _cosmeticTexW    = 0;
+    int          _cosmeticTexH    = 0;
+    bool         _cosmeticDirty   = true;
+    unsigned int _cosmeticSource  = 0;       // 修正纹理是按哪张输入（底图 / 帧纹理）算的
+    bool         _cosmeticEnabled = false;
+    float        _cosmeticHot     = 5.0f;
+    float        _cosmeticCold    = 0.0f;
+    float        _cosmeticNoise   = 0.0f;
+    int _uCosStepLoc      = -1;   // int 同色邻居距离
+    int _uCosSigmaLoc     = -1;   // vec3 (hotSigma, coldSigma, 噪声)
+    int _uCosCalEnabledLoc = -1;
+    int _uCosCalRawLoc    = -1;
+    int _uCosCalParamsLoc = -1;
+
+    // 导出 FBO + 纹理（全分辨率，RGBA16）
+    unsigned int _exportFBO  = 0;
+    unsigned int _exportTex  = 0;
+    int          _exportTexW = 0;
+    int          _exportTexH = 0;
+    static constexpr int _exportBandRows = 64;   // 每次 glReadPixels 读回的行数
 
     // 图像尺寸
     int _imgWidth  = 0;
@@ -133,6 +363,9 @@ private:
     float _panX            = 0.0f;
     float _panY            = 0.0f;
 
+    bool  _alignEnabled    = false;
+    double _align[9]       = {1, 0, 0, 0, 1, 0, 0, 0, 1};   // 行优先，文件像素坐标
+
     // 白平衡
     float _wbR             = 1.0f;
     float _wbG             = 1.0f;
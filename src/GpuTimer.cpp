@@ -0,0 +1,101 @@
+#include "GpuTimer.h"
+#include "Profiler.h"
+
+#include <glad/glad.h>
+
+// 结果迟迟取不回（比如驱动不支持）时的上限，超过就丢掉最旧的
+static constexpr size_t kMaxPending = 64;
+
+void GpuTimer::shutdown()
+{
+    if (_active)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        _active = false;
+    }
+
+    for (const Pending& p : _pending)
+        _free.push_back(p.query);
+    _pending.clear();
+
+    if (!_free.empty())
+        glDeleteQueries((GLsizei)_free.size(), _free.data());
+    _free.clear();
+}
+
+bool GpuTimer::begin(const char* name)
+{
+    if (_active || !Profiler::instance().enabled())
+        return false;
+
+    poll();
+
+    if (_pending.size() >= kMaxPending)
+    {
+        _free.push_back(_pending.front().query);
+        _pending.pop_front();
+    }
+
+    GLuint query = 0;
+    if (!_free.empty())
+    {
+        query = _free.back();
+        _free.pop_back();
+    }
+    else
+    {
+        glGenQueries(1, &query);
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    _pending.push_back({query, name, Profiler::instance().nowUs()});
+    _active = true;
+    return true;
+}
+
+void GpuTimer::end()
+{
+    if (!_active)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    _active = false;
+}
+
+void GpuTimer::poll()
+{
+    // 查询按提交顺序完成，遇到第一个没完成的就停
+    size_t ready = _active ? 1 : 0;   // 正在进行的那个（队尾）不能查
+    while (_pending.size() > ready)
+    {
+        const Pending& p = _pending.front();
+
+        GLint available = 0;
+        glGetQueryObjectiv(p.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(p.query, GL_QUERY_RESULT, &ns);
+
+        // GPU 耗时不可能超过发起以来的墙钟时间，超过的是驱动给的无效值（软件渲染器上见过）
+        double gpuMs  = ns / 1.0e6;
+        double wallMs = (Profiler::instance().nowUs() - p.cpuStartUs) / 1000.0;
+        if (gpuMs <= wallMs + 1.0)
+            Profiler::instance().recordGpu(p.name, p.cpuStartUs, gpuMs);
+
+        _free.push_back(p.query);
+        _pending.pop_front();
+    }
+}
+
+GpuTimerScope::GpuTimerScope(GpuTimer& timer, const char* name)
+    : _timer(timer),
+      _started(timer.begin(name))
+{
+}
+
+GpuTimerScope::~GpuTimerScope()
+{
+    if (_started)
+        _timer.end();
+}
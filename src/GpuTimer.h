@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// GL_TIME_ELAPSED 计时：查询对象循环复用，结果在之后的调用里非阻塞地取回，
+// 取到后交给 Profiler（显示为 "GPU <name>"）。
+// GL_TIME_ELAPSED 不能嵌套，嵌套的 begin 会被忽略。只能在 GL 线程使用。
+class GpuTimer
+{
+public:
+    GpuTimer() = default;
+    ~GpuTimer() = default;
+
+    void shutdown();
+
+    // name 必须是字符串字面量；没有真正开始（嵌套 / 关闭统计）时返回 false，这时不要调 end
+    bool begin(const char* name);
+    void end();
+
+    // 收集已经完成的查询
+    void poll();
+
+private:
+    struct Pending
+    {
+        unsigned int query;
+        const char*  name;
+        int64_t      cpuStartUs;
+    };
+
+    std::vector<unsigned int> _free;
+    std::deque<Pending>       _pending;
+    bool                      _active = false;
+};
+
+// 作用域 GPU 计时，嵌套在另一个 GpuTimerScope 里时什么都不做
+class GpuTimerScope
+{
+public:
+    GpuTimerScope(GpuTimer& timer, const char* name);
+    ~GpuTimerScope();
+
+    GpuTimerScope(const GpuTimerScope&) = delete;
+    GpuTimerScope& operator=(const GpuTimerScope&) = delete;
+
+private:
+    GpuTimer& _timer;
+    bool      _started;
+};
@@ -0,0 +1,438 @@
+#include "HeaderIndex.h"
+#include "AppPaths.h"
+#include "FitsImage.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+static const int  kBlockSize  = 2880;
+static const int  kCardSize   = 80;
+static const int  kMaxBlocks  = 1000;   // 头最多读这么多块（~2.8 MB），防止把非 FITS 文件整个读进来
+static const char kIndexMagic[] = "FVHI\t2";
+
+// ---------- 头卡片 ----------
+
+bool read_fits_header_cards(const std::string& path, std::vector<std::string>& cards)
+{
+    cards.clear();
+
+    FILE* fp = std::fopen(path.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    char block[kBlockSize];
+    bool ok = false;
+    for (int b = 0; b < kMaxBlocks && !ok; ++b)
+    {
+        if (std::fread(block, 1, kBlockSize, fp) != (size_t)kBlockSize)
+            break;
+
+        if (b == 0 && std::string(block, 6) != "SIMPLE")
+            break;
+
+        for (int c = 0; c < kBlockSize / kCardSize; ++c)
+        {
+            const char* card = block + c * kCardSize;
+            if (std::string(card, 8) == "END     ")
+            {
+                ok = true;
+                break;
+            }
+            cards.emplace_back(card, kCardSize);
+        }
+    }
+
+    std::fclose(fp);
+    return ok;
+}
+
+static std::string trim_right(const std::string& s)
+{
+    size_t end = s.find_last_not_of(' ');
+    return end == std::string::npos ? std::string() : s.substr(0, end + 1);
+}
+
+static std::string trim(const std::string& s)
+{
+    size_t begin = s.find_first_not_of(' ');
+    if (begin == std::string::npos)
+        return std::string();
+    return trim_right(s.substr(begin));
+}
+
+bool parse_fits_card(const std::string& card, std::string& key, std::string& value)
+{
+    if (card.size() < 10 || card[8] != '=' || card[9] != ' ')
+        return false;
+
+    key = trim_right(card.substr(0, 8));
+
+    std::string rest = card.substr(10);
+    size_t start = rest.find_first_not_of(' ');
+    if (start == std::string::npos)
+    {
+        value.clear();
+        return true;
+    }
+
+    if (rest[start] == '\'')
+    {
+        // 字符串值：'' 表示一个单引号
+        value.clear();
+        for (size_t i = start + 1; i < rest.size(); ++i)
+        {
+            if (rest[i] == '\'')
+            {
+                if (i + 1 < rest.size() && rest[i + 1] == '\'')
+                {
+                    value += '\'';
+                    ++i;
+                    continue;
+                }
+                break;
+            }
+            value += rest[i];
+        }
+        value = trim_right(value);
+        return true;
+    }
+
+    size_t slash = rest.find('/', start);
+    value = trim(rest.substr(start, slash == std::string::npos ? std::string::npos : slash - start));
+    return true;
+}
+
+static double parse_number(const std::string& s)
+{
+    if (s.empty())
+        return std::numeric_limits<double>::quiet_NaN();
+
+    // FITS 允许 D 作为指数符号
+    std::string t = s;
+    std::replace(t.begin(), t.end(), 'D', 'E');
+    char* end = nullptr;
+    double v = std::strtod(t.c_str(), &end);
+    return (end && end != t.c_str()) ? v : std::numeric_limits<double>::quiet_NaN();
+}
+
+void frame_header_from_cards(const std::vector<std::string>& cards, FrameHeader& out)
+{
+    std::string key, value;
+    for (const std::string& card : cards)
+    {
+        if (!parse_fits_card(card, key, value))
+            continue;
+
+        if      (key == "NAXIS1")   out.width  = (int)parse_number(value);
+        else if (key == "NAXIS2")   out.height = (int)parse_number(value);
+        else if (key == "NAXIS3")   out.planes = (int)parse_number(value);
+        else if (key == "BITPIX")   out.bitpix = (int)parse_number(value);
+        else if (key == "FILTER")   out.filter = value;
+        else if (key == "IMAGETYP") out.imageType = value;
+        else if (key == "FRAME" && out.imageType.empty()) out.imageType = value;
+        else if (key == "OBJECT")   out.object = value;
+        else if (key == "DATE-OBS") out.dateObs = value;
+        else if (key == "BAYERPAT") out.bayerPat = value;
+        else if (key == "EXPTIME")  out.exptime = parse_number(value);
+        else if (key == "EXPOSURE" && std::isnan(out.exptime)) out.exptime = parse_number(value);
+        else if (key == "CCD-TEMP" || key == "CCDTEMP") out.ccdTemp = parse_number(value);
+        else if (key == "GAIN")     out.gain = parse_number(value);
+        else if (key == "HFR")      out.hfr  = parse_number(value);
+    }
+}
+
+// ---------- 索引文件（每行一个文件，制表符分隔） ----------
+
+static std::string sanitize(const std::string& s)
+{
+    std::string r = s;
+    for (char& c : r)
+    {
+        if (c == '\t' || c == '\n' || c == '\r')
+            c = ' ';
+    }
+    return r;
+}
+
+static std::string format_number(double v)
+{
+    if (std::isnan(v))
+        return std::string();
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.6g", v);
+    return buf;
+}
+
+static void save_index(const std::string& path, const std::vector<FrameHeader>& headers)
+{
+    std::ostringstream out;
+    out << kIndexMagic << '\n';
+    for (const FrameHeader& h : headers)
+    {
+        out << h.name << '\t' << h.size << '\t' << h.mtime << '\t'
+            << h.width << '\t' << h.height << '\t' << h.planes << '\t' << h.bitpix << '\t'
+            << sanitize(h.filter) << '\t' << sanitize(h.imageType) << '\t'
+            << sanitize(h.object) << '\t' << sanitize(h.dateObs) << '\t' << sanitize(h.bayerPat) << '\t'
+            << format_number(h.exptime) << '\t' << format_number(h.ccdTemp) << '\t'
+            << format_number(h.gain) << '\t' << format_number(h.hfr) << '\n';
+    }
+
+    const std::string text = out.str();
+    replace_file(path, [&](FILE* fp) { return std::fwrite(text.data(), 1, text.size(), fp) == text.size(); });
+}
+
+static void load_index(const std::string& path, std::unordered_map<std::string, FrameHeader>& out)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::string line;
+    if (!in || !std::getline(in, line) || line != kIndexMagic)
+        return;
+
+    while (std::getline(in, line))
+    {
+        std::vector<std::string> f;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, '\t'))
+            f.push_back(field);
+        while (f.size() < 16)
+            f.emplace_back();   // 末尾空字段会被 getline 吃掉
+
+        FrameHeader h;
+        h.name      = f[0];
+        h.size      = std::strtoull(f[1].c_str(), nullptr, 10);
+        h.mtime     = std::strtoll(f[2].c_str(), nullptr, 10);
+        h.width     = std::atoi(f[3].c_str());
+        h.height    = std::atoi(f[4].c_str());
+        h.planes    = std::atoi(f[5].c_str());
+        h.bitpix    = std::atoi(f[6].c_str());
+        h.filter    = f[7];
+        h.imageType = f[8];
+        h.object    = f[9];
+        h.dateObs   = f[10];
+        h.bayerPat  = f[11];
+        h.exptime   = parse_number(f[12]);
+        h.ccdTemp   = parse_number(f[13]);
+        h.gain      = parse_number(f[14]);
+        h.hfr       = parse_number(f[15]);
+        if (!h.name.empty())
+            out[h.name] = std::move(h);
+    }
+}
+
+// ---------- 扫描线程 ----------
+
+HeaderIndexer::~HeaderIndexer()
+{
+    stop();
+}
+
+void HeaderIndexer::start()
+{
+    if (_worker.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = false;
+    }
+    _worker = std::thread(&HeaderIndexer::workerLoop, this);
+}
+
+void HeaderIndexer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        ++_generation;
+    }
+    _cv.notify_all();
+
+    if (_worker.joinable())
+        _worker.join();
+}
+
+void HeaderIndexer::setIndexDir(const std::string& dir)
+{
+    if (!dir.empty())
+    {
+        std::error_code ec;
+        fs::create_directories(dir, ec);
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _indexDir = dir;
+}
+
+void HeaderIndexer::scan(const std::string& dir)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _request    = dir;
+        _hasRequest = true;
+        _hasResult  = false;
+        ++_generation;
+    }
+    _cv.notify_one();
+}
+
+bool HeaderIndexer::poll(std::string& dir, std::vector<FrameHeader>& out)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_hasResult)
+        return false;
+
+    dir = _resultDir;
+    out.swap(_result);
+    _result.clear();
+    _hasResult = false;
+    return true;
+}
+
+bool HeaderIndexer::busy() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _busy || _hasRequest;
+}
+
+void HeaderIndexer::progress(int& done, int& total) const
+{
+    done  = _done.load();
+    total = _total.load();
+}
+
+std::string HeaderIndexer::indexPath(const std::string& dir) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_indexDir.empty())
+        return std::string();
+
+    std::error_code ec;
+    fs::path abs = fs::absolute(dir, ec);
+    return cache_file_path(_indexDir, ec ? dir : abs.string(), ".idx");
+}
+
+void HeaderIndexer::workerLoop()
+{
+    for (;;)
+    {
+        std::string dir;
+        unsigned    generation;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [&] { return _stopping || _hasRequest; });
+            if (_stopping)
+                return;
+
+            dir         = _request;
+            generation  = _generation;
+            _hasRequest = false;
+            _busy       = true;
+        }
+
+        std::vector<FrameHeader> headers;
+        bool ok = runScan(dir, generation, headers);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _busy = false;
+        if (ok && generation == _generation)
+        {
+            _resultDir = dir;
+            _result    = std::move(headers);
+            _hasResult = true;
+        }
+    }
+}
+
+bool HeaderIndexer::runScan(const std::string& dir, unsigned generation, std::vector<FrameHeader>& out)
+{
+    auto cancelled = [&] {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stopping || generation != _generation;
+    };
+
+    // 1) 列出 FITS 文件和 size / mtime
+    std::vector<FrameHeader> files;
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+         !ec && it != end; it.increment(ec))
+    {
+        std::error_code fec;
+        if (!it->is_regular_file(fec) || !has_fits_extension(it->path().filename().string()))
+            continue;
+
+        FrameHeader h;
+        h.name  = it->path().filename().string();
+        h.size  = (uint64_t)it->file_size(fec);
+        h.mtime = (int64_t)it->last_write_time(fec).time_since_epoch().count();
+        if (h.name.find_first_of("\t\n\r") == std::string::npos)
+            files.push_back(std::move(h));
+    }
+    if (ec)
+    {
+        std::cerr << "Header scan: cannot list " << dir << " (" << ec.message() << ")\n";
+        return false;
+    }
+    std::sort(files.begin(), files.end(),
+              [](const FrameHeader& a, const FrameHeader& b) { return a.name < b.name; });
+
+    // 2) 索引里 size / mtime 没变的直接复用
+    std::string idxPath = indexPath(dir);
+    std::unordered_map<std::string, FrameHeader> cached;
+    if (!idxPath.empty())
+        load_index(idxPath, cached);
+
+    std::vector<size_t> stale;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        auto it = cached.find(files[i].name);
+        if (it != cached.end() && it->second.size == files[i].size && it->second.mtime == files[i].mtime)
+            files[i] = it->second;
+        else
+            stale.push_back(i);
+    }
+
+    _total = (int)files.size();
+    _done  = (int)(files.size() - stale.size());
+
+    // 3) 其余文件并行读头（网络盘上主要是等 IO，线程多一些）
+    if (!stale.empty())
+    {
+        unsigned hw = std::thread::hardware_concurrency();
+        ThreadPool pool((int)std::min<size_t>(stale.size(), std::max(8u, hw)));
+        for (size_t i : stale)
+        {
+            pool.submit([&, i] {
+                if (cancelled())
+                    return;
+
+                std::vector<std::string> cards;
+                FrameHeader& h = files[i];
+                std::string path = (fs::path(dir) / h.name).string();
+                if (read_fits_header_cards(path, cards))
+                    frame_header_from_cards(cards, h);
+                ++_done;
+            });
+        }
+        pool.wait();
+    }
+
+    if (cancelled())
+        return false;
+
+    if (!idxPath.empty() && (!stale.empty() || cached.size() != files.size()))
+        save_index(idxPath, files);
+
+    out = std::move(files);
+    return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 只读主 HDU 的头（按 2880 字节块读到 END 为止），不碰数据区，也不经过 cfitsio，
+// 可以在多个线程里同时调用。cards 为每条 80 字符的卡片（不含 END）
+bool read_fits_header_cards(const std::string& path, std::vector<std::string>& cards);
+
+// 解析一条卡片的关键字和值：字符串去掉引号和尾部空格，其它值去掉注释；
+// 没有值（COMMENT / HISTORY 等）时返回 false
+bool parse_fits_card(const std::string& card, std::string& key, std::string& value);
+
+// 一帧的常用头信息（浏览 / 排序 / 过滤用），缺失的数值为 NaN
+struct FrameHeader
+{
+    std::string name;          // 文件名（不含目录）
+    uint64_t    size   = 0;
+    int64_t     mtime  = 0;    // 文件修改时间（file_time_type 的原始计数，不截断），和 size 一起判断索引是否过期
+
+    int         width  = 0;
+    int         height = 0;
+    int         planes = 1;
+    int         bitpix = 0;
+
+    std::string filter;
+    std::string imageType;     // IMAGETYP / FRAME
+    std::string object;
+    std::string dateObs;
+    std::string bayerPat;
+
+    double      exptime = std::numeric_limits<double>::quiet_NaN();
+    double      ccdTemp = std::numeric_limits<double>::quiet_NaN();
+    double      gain    = std::numeric_limits<double>::quiet_NaN();
+    double      hfr     = std::numeric_limits<double>::quiet_NaN();   // 采集软件写入的 HFR（有的话）
+};
+
+// 从头卡片填 FrameHeader（name / size / mtime 不动）
+void frame_header_from_cards(const std::vector<std::string>& cards, FrameHeader& out);
+
+// 目录头信息索引：后台线程按目录扫描，文件头并行读取；
+// 结果存成每个目录一个的小文本索引，下次只重新读 size / mtime 变了的文件
+class HeaderIndexer
+{
+public:
+    HeaderIndexer() = default;
+    ~HeaderIndexer();
+
+    HeaderIndexer(const HeaderIndexer&) = delete;
+    HeaderIndexer& operator=(const HeaderIndexer&) = delete;
+
+    void start();
+    void stop();
+
+    // 索引文件目录，为空时不落盘
+    void setIndexDir(const std::string& dir);
+
+    // 扫描目录（新请求会取消正在进行的旧扫描）
+    void scan(const std::string& dir);
+
+    // 扫描完成后取走结果（按文件名排序）
+    bool poll(std::string& dir, std::vector<FrameHeader>& out);
+
+    bool busy() const;
+    void progress(int& done, int& total) const;
+
+private:
+    void workerLoop();
+    bool runScan(const std::string& dir, unsigned generation, std::vector<FrameHeader>& out);
+    std::string indexPath(const std::string& dir) const;
+
+private:
+    std::thread             _worker;
+    mutable std::mutex      _mutex;
+    std::condition_variable _cv;
+    bool                    _stopping = false;
+    bool                    _busy     = false;
+
+    std::string _indexDir;
+    std::string _request;            // 待扫描目录
+    bool        _hasRequest = false;
+    unsigned    _generation = 0;     // 每个请求加 1，扫描中看到变化就放弃
+
+    bool                     _hasResult = false;
+    std::string              _resultDir;
+    std::vector<FrameHeader> _result;
+
+    std::atomic<int> _done{0};
+    std::atomic<int> _total{0};
+};
@@ -0,0 +1,178 @@
+#include "HeadlessGlContext.h"
+
+#include <glad/glad.h>
+#include <iostream>
+
+#if defined(FITSVIEWER_HEADLESS_OSMESA)
+#include <GL/osmesa.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+HeadlessGlContext::~HeadlessGlContext()
+{
+    destroy();
+}
+
+#if defined(FITSVIEWER_HEADLESS_OSMESA)
+
+const char* HeadlessGlContext::backendName() const
+{
+    return "OSMesa";
+}
+
+bool HeadlessGlContext::create(int major, int minor)
+{
+    destroy();
+
+    const int attribs[] = {
+        OSMESA_FORMAT,                OSMESA_RGBA,
+        OSMESA_DEPTH_BITS,            0,
+        OSMESA_PROFILE,               OSMESA_CORE_PROFILE,
+        OSMESA_CONTEXT_MAJOR_VERSION, major,
+        OSMESA_CONTEXT_MINOR_VERSION, minor,
+        0
+    };
+
+    OSMesaContext ctx = OSMesaCreateContextAttribs(attribs, nullptr);
+    if (!ctx)
+    {
+        std::cerr << "OSMesaCreateContextAttribs failed\n";
+        return false;
+    }
+    _context = ctx;
+
+    if (!makeCurrent())
+    {
+        destroy();
+        return false;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)OSMesaGetProcAddress))
+    {
+        std::cerr << "Failed to load GL functions (OSMesa)\n";
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+bool HeadlessGlContext::makeCurrent()
+{
+    if (!_context)
+        return false;
+    return OSMesaMakeCurrent(static_cast<OSMesaContext>(_context), _pixel,
+                             GL_UNSIGNED_BYTE, 1, 1) == GL_TRUE;
+}
+
+void HeadlessGlContext::destroy()
+{
+    if (_context)
+    {
+        OSMesaDestroyContext(static_cast<OSMesaContext>(_context));
+        _context = nullptr;
+    }
+}
+
+#else // EGL
+
+const char* HeadlessGlContext::backendName() const
+{
+    return "EGL";
+}
+
+bool HeadlessGlContext::create(int major, int minor)
+{
+    destroy();
+
+    // 优先 Mesa surfaceless 平台（不需要 X / Wayland / DRM 设备节点），否则退回默认显示
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint vMajor = 0, vMinor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &vMajor, &vMinor))
+    {
+        std::cerr << "eglInitialize failed: 0x" << std::hex << eglGetError() << std::dec << "\n";
+        return false;
+    }
+    _display = display;
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        std::cerr << "eglBindAPI(EGL_OPENGL_API) failed\n";
+        destroy();
+        return false;
+    }
+
+    const EGLint configAttribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config = nullptr;
+    EGLint numConfigs = 0;
+    eglChooseConfig(display, configAttribs, &config, 1, &numConfigs);
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION,       major,
+        EGL_CONTEXT_MINOR_VERSION,       minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    // surfaceless 平台可能没有 config，这时用 EGL_KHR_no_config_context
+    EGLContext context = eglCreateContext(display,
+                                          numConfigs > 0 ? config : EGL_NO_CONFIG_KHR,
+                                          EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT)
+    {
+        std::cerr << "eglCreateContext failed: 0x" << std::hex << eglGetError() << std::dec << "\n";
+        destroy();
+        return false;
+    }
+    _context = context;
+
+    if (!makeCurrent())
+    {
+        std::cerr << "eglMakeCurrent failed: 0x" << std::hex << eglGetError() << std::dec << "\n";
+        destroy();
+        return false;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+        std::cerr << "Failed to load GL functions (EGL)\n";
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+bool HeadlessGlContext::makeCurrent()
+{
+    if (!_display || !_context)
+        return false;
+    return eglMakeCurrent(static_cast<EGLDisplay>(_display), EGL_NO_SURFACE, EGL_NO_SURFACE,
+                          static_cast<EGLContext>(_context)) == EGL_TRUE;
+}
+
+void HeadlessGlContext::destroy()
+{
+    if (_display)
+    {
+        EGLDisplay display = static_cast<EGLDisplay>(_display);
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (_context)
+            eglDestroyContext(display, static_cast<EGLContext>(_context));
+        eglTerminate(display);
+    }
+    _context = nullptr;
+    _display = nullptr;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+// 无窗口的 OpenGL 上下文，给批处理 / CI 跑和界面完全相同的 GlImageRenderer shader 管线。
+// 后端在编译期选择：
+//   FITSVIEWER_HEADLESS_EGL    —— EGL surfaceless（Mesa llvmpipe / 显卡驱动均可），默认
+//   FITSVIEWER_HEADLESS_OSMESA —— OSMesa 纯软件渲染
+// 渲染器自己用 FBO 渲染，上下文不需要默认帧缓冲。
+class HeadlessGlContext
+{
+public:
+    HeadlessGlContext() = default;
+    ~HeadlessGlContext();
+
+    HeadlessGlContext(const HeadlessGlContext&) = delete;
+    HeadlessGlContext& operator=(const HeadlessGlContext&) = delete;
+
+    // 创建 core profile 上下文、设为当前并加载 GL 函数指针（glad）
+    bool create(int major = 3, int minor = 3);
+    void destroy();
+
+    bool makeCurrent();
+
+    // "EGL" / "OSMesa"
+    const char* backendName() const;
+
+private:
+    void* _display = nullptr;   // EGLDisplay
+    void* _context = nullptr;   // EGLContext / OSMesaContext
+    unsigned char _pixel[4] = {0, 0, 0, 0};   // OSMesa 要求的颜色缓冲（1x1，不使用）
+};
@@ -3,6 +3,11 @@
 #include "Stretch.h"
 #include "FitsImage.h"
 #include "EmbeddedFont.h"
+#include "ImageWriter.h"
+#include "FitsWriter.h"
+#include "Profiler.h"
+#include "AppPaths.h"
+#include "Cosmetic.h"
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -18,29 +23,53 @@
 #include <stdexcept>
 #include <algorithm>
 #include <filesystem>
+#include <cctype>
 #include <cmath>
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#include <ctime>
+#include <sstream>
 
 namespace fs = std::filesystem;
 
-static inline float clamp01(float v)
-{
-    if (v < 0.0f) return 0.0f;
-    if (v > 1.0f) return 1.0f;
-    return v;
-}
-
 // ===== App 自定义配置，写入 imgui.ini =====
 struct AppSettings
 {
     std::string lastDir;
     int  bayerPattern   = 1;   // 默认 RGGB
+    int  bayerFromHeader = 1;  // 头里有 BAYERPAT 时优先用头里的
     int  stretchMode    = 1;   // 默认 Arcsinh
     float wbR           = 1.0f;
     float wbG           = 1.0f;
     float wbB           = 1.0f;
+    int  exportFormat   = 0;   // 默认 PNG 8-bit
+    int  exportLevel    = 6;   // zlib 压缩级别
+    int  prefetchBudgetMB = 2048;
+    int  blinkBudgetMB    = 2048;   // 闪烁播放的显存预算
+    int  blinkFps         = 15;
+    int  exportFitsStretch = 0;
+    int  fileDialogThumbs  = 1;     // 文件对话框用缩略图网格
+    int  thumbSize         = 128;
+    std::string calPath[3];         // master bias / dark / flat
+    int  calScaleDark      = 1;
+    int  calOnGpu          = 0;
+    int  cosmetic          = 0;
+    float cosmeticHot      = 5.0f;
+    float cosmeticCold     = 0.0f;
+    int  cosmeticDarkMap   = 0;
+    int  stackMethod       = 2;     // 默认 sigma clip
+    float stackSigmaLow    = 3.0f;
+    float stackSigmaHigh   = 3.0f;
+    int  stackNormalize    = 1;
+    int  starDetect        = 0;
+    int  starOverlay       = 1;
+    float starSigma        = 5.0f;
+    std::string liveDir;            // 实时叠加监视的采集目录
+    int  liveMethod        = 1;     // 默认 sigma clip
+    float liveSigma        = 3.0f;
+    int  liveNormalize     = 1;
+    int  liveIncludeExisting = 0;
+    int  backgroundMode    = 0;
+    int  backgroundDegree  = 2;
+    int  wcsGrid           = 0;
 };
 
 static AppSettings g_AppSettings;
@@ -66,6 +95,9 @@ static void AppSettings_ReadLine(ImGuiContext*, ImGuiSettingsHandler*, void*, co
     else if (sscanf(line, "Bayer=%d", &g_AppSettings.bayerPattern) == 1)
     {
     }
+    else if (sscanf(line, "BayerFromHeader=%d", &g_AppSettings.bayerFromHeader) == 1)
+    {
+    }
     else if (sscanf(line, "StretchMode=%d", &g_AppSettings.stretchMode) == 1)
     {
     }
@@ -78,6 +110,106 @@ static void AppSettings_ReadLine(ImGuiContext*, ImGuiSettingsHandler*, void*, co
     else if (sscanf(line, "WBB=%f", &g_AppSettings.wbB) == 1)
     {
     }
+    else if (sscanf(line, "ExportFormat=%d", &g_AppSettings.exportFormat) == 1)
+    {
+    }
+    else if (sscanf(line, "ExportFitsStretch=%d", &g_AppSettings.exportFitsStretch) == 1)
+    {
+    }
+    else if (sscanf(line, "ExportLevel=%d", &g_AppSettings.exportLevel) == 1)
+    {
+    }
+    else if (sscanf(line, "PrefetchBudgetMB=%d", &g_AppSettings.prefetchBudgetMB) == 1)
+    {
+    }
+    else if (sscanf(line, "BlinkBudgetMB=%d", &g_AppSettings.blinkBudgetMB) == 1)
+    {
+    }
+    else if (sscanf(line, "BlinkFps=%d", &g_AppSettings.blinkFps) == 1)
+    {
+    }
+    else if (sscanf(line, "FileDialogThumbs=%d", &g_AppSettings.fileDialogThumbs) == 1)
+    {
+    }
+    else if (sscanf(line, "ThumbSize=%d", &g_AppSettings.thumbSize) == 1)
+    {
+    }
+    else if (strncmp(line, "CalBias=", 8) == 0)
+    {
+        g_AppSettings.calPath[0] = line + 8;
+    }
+    else if (strncmp(line, "CalDark=", 8) == 0)
+    {
+        g_AppSettings.calPath[1] = line + 8;
+    }
+    else if (strncmp(line, "CalFlat=", 8) == 0)
+    {
+        g_AppSettings.calPath[2] = line + 8;
+    }
+    else if (sscanf(line, "CalScaleDark=%d", &g_AppSettings.calScaleDark) == 1)
+    {
+    }
+    else if (sscanf(line, "CalOnGpu=%d", &g_AppSettings.calOnGpu) == 1)
+    {
+    }
+    else if (sscanf(line, "Cosmetic=%d", &g_AppSettings.cosmetic) == 1)
+    {
+    }
+    else if (sscanf(line, "CosmeticHot=%f", &g_AppSettings.cosmeticHot) == 1)
+    {
+    }
+    else if (sscanf(line, "CosmeticCold=%f", &g_AppSettings.cosmeticCold) == 1)
+    {
+    }
+    else if (sscanf(line, "CosmeticDarkMap=%d", &g_AppSettings.cosmeticDarkMap) == 1)
+    {
+    }
+    else if (sscanf(line, "StackMethod=%d", &g_AppSettings.stackMethod) == 1)
+    {
+    }
+    else if (sscanf(line, "StackSigmaLow=%f", &g_AppSettings.stackSigmaLow) == 1)
+    {
+    }
+    else if (sscanf(line, "StackSigmaHigh=%f", &g_AppSettings.stackSigmaHigh) == 1)
+    {
+    }
+    else if (sscanf(line, "StackNormalize=%d", &g_AppSettings.stackNormalize) == 1)
+    {
+    }
+    else if (sscanf(line, "StarDetect=%d", &g_AppSettings.starDetect) == 1)
+    {
+    }
+    else if (sscanf(line, "StarOverlay=%d", &g_AppSettings.starOverlay) == 1)
+    {
+    }
+    else if (sscanf(line, "StarSigma=%f", &g_AppSettings.starSigma) == 1)
+    {
+    }
+    else if (strncmp(line, "LiveDir=", 8) == 0)
+    {
+        g_AppSettings.liveDir = line + 8;
+    }
+    else if (sscanf(line, "LiveMethod=%d", &g_AppSettings.liveMethod) == 1)
+    {
+    }
+    else if (sscanf(line, "LiveSigma=%f", &g_AppSettings.liveSigma) == 1)
+    {
+    }
+    else if (sscanf(line, "LiveNormalize=%d", &g_AppSettings.liveNormalize) == 1)
+    {
+    }
+    else if (sscanf(line, "LiveIncludeExisting=%d", &g_AppSettings.liveIncludeExisting) == 1)
+    {
+    }
+    else if (sscanf(line, "BackgroundMode=%d", &g_AppSettings.backgroundMode) == 1)
+    {
+    }
+    else if (sscanf(line, "BackgroundDegree=%d", &g_AppSettings.backgroundDegree) == 1)
+    {
+    }
+    else if (sscanf(line, "WcsGrid=%d", &g_AppSettings.wcsGrid) == 1)
+    {
+    }
 }
 
 static void AppSettings_WriteAll(ImGuiContext* ctx, ImGuiSettingsHandler* handler, ImGuiTextBuffer* out_buf)
@@ -88,10 +220,47 @@ static void AppSettings_WriteAll(ImGuiContext* ctx, ImGuiSettingsHandler* handle
         out_buf->appendf("LastDir=%s\n", g_AppSettings.lastDir.c_str());
 
     out_buf->appendf("Bayer=%d\n", g_AppSettings.bayerPattern);
+    out_buf->appendf("BayerFromHeader=%d\n", g_AppSettings.bayerFromHeader);
     out_buf->appendf("StretchMode=%d\n", g_AppSettings.stretchMode);
     out_buf->appendf("WBR=%f\n", g_AppSettings.wbR);
     out_buf->appendf("WBG=%f\n", g_AppSettings.wbG);
     out_buf->appendf("WBB=%f\n", g_AppSettings.wbB);
+    out_buf->appendf("ExportFormat=%d\n", g_AppSettings.exportFormat);
+    out_buf->appendf("ExportLevel=%d\n", g_AppSettings.exportLevel);
+    out_buf->appendf("ExportFitsStretch=%d\n", g_AppSettings.exportFitsStretch);
+    out_buf->appendf("PrefetchBudgetMB=%d\n", g_AppSettings.prefetchBudgetMB);
+    out_buf->appendf("BlinkBudgetMB=%d\n", g_AppSettings.blinkBudgetMB);
+    out_buf->appendf("BlinkFps=%d\n", g_AppSettings.blinkFps);
+    out_buf->appendf("FileDialogThumbs=%d\n", g_AppSettings.fileDialogThumbs);
+    out_buf->appendf("ThumbSize=%d\n", g_AppSettings.thumbSize);
+    if (!g_AppSettings.calPath[0].empty())
+        out_buf->appendf("CalBias=%s\n", g_AppSettings.calPath[0].c_str());
+    if (!g_AppSettings.calPath[1].empty())
+        out_buf->appendf("CalDark=%s\n", g_AppSettings.calPath[1].c_str());
+    if (!g_AppSettings.calPath[2].empty())
+        out_buf->appendf("CalFlat=%s\n", g_AppSettings.calPath[2].c_str());
+    out_buf->appendf("CalScaleDark=%d\n", g_AppSettings.calScaleDark);
+    out_buf->appendf("CalOnGpu=%d\n", g_AppSettings.calOnGpu);
+    out_buf->appendf("Cosmetic=%d\n", g_AppSettings.cosmetic);
+    out_buf->appendf("CosmeticHot=%f\n", g_AppSettings.cosmeticHot);
+    out_buf->appendf("CosmeticCold=%f\n", g_AppSettings.cosmeticCold);
+    out_buf->appendf("CosmeticDarkMap=%d\n", g_AppSettings.cosmeticDarkMap);
+    out_buf->appendf("StackMethod=%d\n", g_AppSettings.stackMethod);
+    out_buf->appendf("StackSigmaLow=%f\n", g_AppSettings.stackSigmaLow);
+    out_buf->appendf("StackSigmaHigh=%f\n", g_AppSettings.stackSigmaHigh);
+    out_buf->appendf("StackNormalize=%d\n", g_AppSettings.stackNormalize);
+    out_buf->appendf("StarDetect=%d\n", g_AppSettings.starDetect);
+    out_buf->appendf("StarOverlay=%d\n", g_AppSettings.starOverlay);
+    out_buf->appendf("StarSigma=%f\n", g_AppSettings.starSigma);
+    if (!g_AppSettings.liveDir.empty())
+        out_buf->appendf("LiveDir=%s\n", g_AppSettings.liveDir.c_str());
+    out_buf->appendf("LiveMethod=%d\n", g_AppSettings.liveMethod);
+    out_buf->appendf("LiveSigma=%f\n", g_AppSettings.liveSigma);
+    out_buf->appendf("LiveNormalize=%d\n", g_AppSettings.liveNormalize);
+    out_buf->appendf("LiveIncludeExisting=%d\n", g_AppSettings.liveIncludeExisting);
+    out_buf->appendf("BackgroundMode=%d\n", g_AppSettings.backgroundMode);
+    out_buf->appendf("BackgroundDegree=%d\n", g_AppSettings.backgroundDegree);
+    out_buf->appendf("WcsGrid=%d\n", g_AppSettings.wcsGrid);
     out_buf->append("\n");
 }
 // ===== App 自定义配置结束 =====
@@ -202,16 +371,93 @@ bool ImageApp::init()
     _fileListDirty = true;
 
     _bayerHint   = static_cast<BayerPattern>(g_AppSettings.bayerPattern);
+    _bayerFromHeader = g_AppSettings.bayerFromHeader != 0;
     _stretchMode = g_AppSettings.stretchMode;
     _wbR         = g_AppSettings.wbR;
     _wbG         = g_AppSettings.wbG;
     _wbB         = g_AppSettings.wbB;
+    _exportFormat = std::clamp(g_AppSettings.exportFormat, 0, 4);
+    _exportFitsStretch = g_AppSettings.exportFitsStretch != 0;
+    _exportLevel  = std::clamp(g_AppSettings.exportLevel, 1, 9);
+
+    _prefetchBudgetMB = std::clamp(g_AppSettings.prefetchBudgetMB, 256, 65536);
+    _blinkBudgetMB    = std::clamp(g_AppSettings.blinkBudgetMB, 256, 65536);
+    _blinkFps         = (float)std::clamp(g_AppSettings.blinkFps, 1, 60);
+    _blink.setBudget((size_t)_blinkBudgetMB << 20);
+    _blink.setFps(_blinkFps);
+
+    _exportQueue.start();
+
+    // 主帧只记住路径，需要时在界面里手动加载
+    for (int i = 0; i < 3; ++i)
+        _calPath[i] = g_AppSettings.calPath[i];
+    _calScaleDark = g_AppSettings.calScaleDark != 0;
+    _calOnGpu     = g_AppSettings.calOnGpu != 0;
+    _cosmeticHot     = std::clamp(g_AppSettings.cosmeticHot, 0.0f, 50.0f);
+    _cosmeticCold    = std::clamp(g_AppSettings.cosmeticCold, 0.0f, 50.0f);
+    _cosmeticDarkMap = g_AppSettings.cosmeticDarkMap != 0;
+
+    _stackMethod    = std::clamp(g_AppSettings.stackMethod, 0, 3);
+    _stackSigmaLow  = std::clamp(g_AppSettings.stackSigmaLow, 1.0f, 10.0f);
+    _stackSigmaHigh = std::clamp(g_AppSettings.stackSigmaHigh, 1.0f, 10.0f);
+    _stackNormalize = g_AppSettings.stackNormalize != 0;
+
+    _liveDir             = g_AppSettings.liveDir;
+    _liveMethod          = std::clamp(g_AppSettings.liveMethod, 0, 1);
+    _liveSigma           = std::clamp(g_AppSettings.liveSigma, 1.5f, 10.0f);
+    _liveNormalize       = g_AppSettings.liveNormalize != 0;
+    _liveIncludeExisting = g_AppSettings.liveIncludeExisting != 0;
+
+    _bgMode   = std::clamp(g_AppSettings.backgroundMode, 0, 2);
+    _bgDegree = std::clamp(g_AppSettings.backgroundDegree, 1, 4);
+    _wcsGrid  = g_AppSettings.wcsGrid != 0;
+
+    _prefetcher.setBudget((size_t)_prefetchBudgetMB << 20);
+    _prefetcher.setWindow(_prefetchAhead, _prefetchBehind);
+    _prefetcher.start();
+
+    // 坏点修正只依赖参数（坏点表要等 dark 加载后才有），启动时就可以交给预取线程
+    _cosmeticEnabled = g_AppSettings.cosmetic != 0;
+    update_cpu_cosmetic();
+
+    _starDetect  = g_AppSettings.starDetect != 0;
+    _starOverlay = g_AppSettings.starOverlay != 0;
+    _starSigma   = std::clamp(g_AppSettings.starSigma, 2.0f, 20.0f);
+    update_star_detection();
+
+    _fileDialogThumbs = g_AppSettings.fileDialogThumbs != 0;
+    _thumbCellSize    = std::clamp(g_AppSettings.thumbSize, 64, 256);
+    _thumbCache.setCacheDir(ThumbnailCache::defaultCacheDir());
+    _thumbCache.setBayer(_bayerHint, _bayerFromHeader);
+    _thumbCache.start();
+
+    _dirLister.start();
+
+    _headerIndexer.setIndexDir(app_cache_dir("headers"));
+    _headerIndexer.start();
 
     return true;
 }
 
 void ImageApp::shutdown()
 {
+    _stacker.cancel();
+    _liveStacker.stop();
+    _prefetcher.stop();
+    _thumbCache.stop();
+    _dirLister.stop();
+    _dirWatcher.close();
+    _followWatcher.stop();
+    _headerIndexer.stop();
+
+    // 先停编码线程，再释放它可能还在读的 PBO
+    _exportQueue.stop();
+    for (PendingExport& p : _pendingExports)
+        _renderer.releaseExportReadback(p.readback);
+    _pendingExports.clear();
+
+    _blink.clear(_renderer);
+    clear_thumbnails();
     _renderer.shutdown();
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -239,15 +485,30 @@ void ImageApp::main_loop()
 {
     while (!glfwWindowShouldClose(_window))
     {
-        glfwPollEvents();
+        ProfileScope frameScope("frame");
 
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
+        {
+            ProfileScope scope("poll events");
+            glfwPollEvents();
+        }
 
-        render_ui();
+        {
+            ProfileScope scope("ImGui build");
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+
+            update_exports();
+            update_sequence();
+            update_blink();
+            update_stack();
+            update_live_stack();
+            update_follow_folder();
+            render_ui();
+
+            ImGui::Render();
+        }
 
-        ImGui::Render();
         int display_w, display_h;
         glfwGetFramebufferSize(_window, &display_w, &display_h);
 
@@ -271,14 +532,25 @@ void ImageApp::main_loop()
         glClear(GL_COLOR_BUFFER_BIT);
 
         _renderer.render(display_w, display_h);
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
-        glfwSwapBuffers(_window);
+        {
+            ProfileScope scope("ImGui draw");
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
+
+        {
+            ProfileScope scope("swap");
+            glfwSwapBuffers(_window);
+        }
     }
 }
 
 void ImageApp::render_ui()
 {
+    render_star_overlay();
+    render_wcs_overlay();
+    render_cursor_readout();
+
     ImGui::Begin("Controls");
 
     // ===== 文件路径 / 打开 =====
@@ -292,6 +564,17 @@ void ImageApp::render_ui()
         if (!_currentPath.empty())
             load_fits_file(_currentPath);
     }
+    render_follow_controls();
+
+    render_sequence_controls();
+    render_blink_controls();
+    render_align_controls();
+    render_stack_controls();
+    render_live_stack_controls();
+    render_star_controls();
+    render_wcs_controls();
+    bool calibrationChanged = render_calibration_controls();
+    bool backgroundChanged  = render_background_controls();
 
     // ===== Bayer 模式 =====
     const char* patterns[] = {"None", "RGGB", "BGGR", "GRBG", "GBRG"};
@@ -308,6 +591,17 @@ void ImageApp::render_ui()
         }
     }
 
+    if (ImGui::Checkbox("Use header CFA", &_bayerFromHeader))
+    {
+        g_AppSettings.bayerFromHeader = _bayerFromHeader ? 1 : 0;
+        bayerChanged = true;
+    }
+    if (_fits && _fits->bayerFromHeader)
+    {
+        ImGui::SameLine();
+        ImGui::TextDisabled("(header: %s)", patterns[static_cast<int>(_fits->bayer)]);
+    }
+
     ImGui::Separator();
 
     // ===== 拉伸模式 =====
@@ -348,6 +642,18 @@ void ImageApp::render_ui()
     // Bayer 改变后，也需要重新统计自动拉伸 & 直方图
     if (bayerChanged)
         autoParamsChanged = true;
+    if (calibrationChanged)
+        autoParamsChanged = true;
+    if (backgroundChanged)
+        autoParamsChanged = true;
+
+    // 背景样本是去拜耳 + 校准后的数据，这两样变了要重新拟合（Bayer 先交给 renderer，下面统计也要用）
+    if ((calibrationChanged || bayerChanged) && _hasImage)
+    {
+        if (bayerChanged)
+            _renderer.setBayerPattern(static_cast<int>(effective_bayer()));
+        refit_background();
+    }
 
     // ===== 调用 GPU 统计 auto 参数 + 更新直方图 =====
     if (autoParamsChanged && _hasImage)
@@ -477,35 +783,163 @@ void ImageApp::render_ui()
 
     ImGui::Separator();
 
-    // ===== 导出 PNG（使用原文件名） =====
-    if (ImGui::Button("Export PNG"))
+    // ===== 导出（使用原文件名，扩展名按格式替换） =====
+    const char* exportFormats[] = {"PNG 8-bit", "PNG 16-bit", "TIFF 16-bit", "TIFF 16-bit (Deflate)",
+                                   "FITS 32-bit float"};
+    if (ImGui::Combo("Export format", &_exportFormat, exportFormats, IM_ARRAYSIZE(exportFormats)))
+        g_AppSettings.exportFormat = _exportFormat;
+
+    if (static_cast<ExportFormat>(_exportFormat) == ExportFormat::FITS32)
+    {
+        // FITS 总是全分辨率，从 RAW 在 CPU 上处理
+        if (ImGui::Checkbox("Stretch FITS data", &_exportFitsStretch))
+            g_AppSettings.exportFitsStretch = _exportFitsStretch ? 1 : 0;
+    }
+    else
+    {
+        ImGui::SliderFloat("Export scale", &_exportScale, 0.1f, 1.0f, "%.2f");
+
+        // 压缩级别：1 最快，9 文件最小（PNG / TIFF Deflate）
+        if (ImGui::SliderInt("Compression", &_exportLevel, 1, 9))
+            g_AppSettings.exportLevel = _exportLevel;
+    }
+
+    // 整幅读回已经占满时先等前面的编码完成（FITS 导出不读回，不受限制）
+    const bool exportBlocked = static_cast<ExportFormat>(_exportFormat) != ExportFormat::FITS32 &&
+                               export_readbacks_full();
+    ImGui::BeginDisabled(exportBlocked);
+    if (ImGui::Button("Export"))
     {
         _exportJustSucceeded = false;
+        _exportJustFailed    = false;
         if (_hasImage)
-            export_png("ignored");   // 实现里已经用 _currentPath 生成真正路径
+            export_image();
     }
-
-    if (_exportJustSucceeded && !_lastExportPath.empty())
+    ImGui::EndDisabled();
+    if (exportBlocked)
     {
-        ImGui::Spacing();
-        ImGui::TextColored(ImVec4(0.3f, 0.9f, 0.3f, 1.0f),
-                           "导出成功: %s", _lastExportPath.c_str());
+        ImGui::SameLine();
+        ImGui::TextDisabled("等待前面的导出编码完成");
     }
 
+    render_export_status();
+
+    ImGui::Separator();
+    ImGui::Checkbox("Profiler (F3)", &_showProfiler);
+    ImGui::SameLine();
+    ImGui::Checkbox("Frame table (F4)", &_showFrameTable);
+
     ImGui::End();
 
+    if (ImGui::IsKeyPressed(ImGuiKey_F3, false))
+        _showProfiler = !_showProfiler;
+    if (_showProfiler)
+        render_profiler();
+
+    if (ImGui::IsKeyPressed(ImGuiKey_F4, false))
+        _showFrameTable = !_showFrameTable;
+    if (_showFrameTable)
+        render_frame_table();
+
     // ===== 文件对话框 =====
     if (_showFileDialog)
         render_file_dialog();
 
-    // Bayer 模式改变：即时更新 GPU Bayer pattern
+    // Bayer 模式改变：即时更新 GPU Bayer pattern，缩略图按新模式重新生成
     if (bayerChanged)
     {
-        _renderer.setBayerPattern(static_cast<int>(_bayerHint));
+        _renderer.setBayerPattern(static_cast<int>(effective_bayer()));
+        _thumbCache.setBayer(_bayerHint, _bayerFromHeader);
+        clear_thumbnails();
     }
 }
 
 
+// ---------- 性能统计 ----------
+
+void ImageApp::render_profiler()
+{
+    Profiler& profiler = Profiler::instance();
+
+    ImGui::SetNextWindowSize(ImVec2(560, 420), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Profiler", &_showProfiler))
+    {
+        ImGui::End();
+        return;
+    }
+
+    // 帧时间曲线（最近 Profiler::kHistory 帧）
+    std::vector<float> frames;
+    profiler.history("frame", frames);
+    if (!frames.empty())
+    {
+        float maxMs = *std::max_element(frames.begin(), frames.end());
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "frame %.2f ms", frames.back());
+        ImGui::PlotLines("##frametime", frames.data(), (int)frames.size(), 0, overlay,
+                         0.0f, std::max(maxMs, 16.7f), ImVec2(-1, 80));
+    }
+
+    std::vector<Profiler::StageStats> stats;
+    profiler.snapshot(stats);
+
+    const ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg |
+                                  ImGuiTableFlags_SizingStretchProp | ImGuiTableFlags_ScrollY;
+    if (ImGui::BeginTable("stages", 6, flags, ImVec2(0, 240)))
+    {
+        ImGui::TableSetupScrollFreeze(0, 1);
+        ImGui::TableSetupColumn("Stage", ImGuiTableColumnFlags_WidthStretch, 3.0f);
+        ImGui::TableSetupColumn("Last");
+        ImGui::TableSetupColumn("p50");
+        ImGui::TableSetupColumn("p95");
+        ImGui::TableSetupColumn("p99");
+        ImGui::TableSetupColumn("Max");
+        ImGui::TableHeadersRow();
+
+        for (const Profiler::StageStats& st : stats)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            if (st.gpu)
+                ImGui::TextColored(ImVec4(0.5f, 0.8f, 1.0f, 1.0f), "%s", st.name.c_str());
+            else
+                ImGui::TextUnformatted(st.name.c_str());
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", st.lastMs);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", st.p50);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", st.p95);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", st.p99);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", st.maxMs);
+        }
+        ImGui::EndTable();
+    }
+    ImGui::TextDisabled("ms，最近 %d 个样本；蓝色为 GPU 时间（GL_TIME_ELAPSED）", Profiler::kHistory);
+
+    // Chrome trace：chrome://tracing 或 ui.perfetto.dev 打开
+    if (!profiler.tracing())
+    {
+        if (ImGui::Button("Start trace"))
+            profiler.startTrace();
+    }
+    else
+    {
+        if (ImGui::Button("Stop && save trace"))
+        {
+            profiler.stopTrace();
+            std::string path = (fs::current_path() / "fitsviewer_trace.json").string();
+            _lastTracePath = profiler.writeChromeTrace(path) ? path : std::string();
+            if (_lastTracePath.empty())
+                std::cerr << "Failed to write trace " << path << "\n";
+        }
+        ImGui::SameLine();
+        ImGui::Text("recording: %zu events", profiler.traceEventCount());
+    }
+
+    if (!_lastTracePath.empty())
+        ImGui::TextWrapped("Trace: %s", _lastTracePath.c_str());
+
+    ImGui::End();
+}
+
 // ---------- 文件对话 ----------
 void ImageApp::open_file_dialog()
 {
@@ -536,21 +970,136 @@ void ImageApp::open_file_dialog()
     _showFileDialog = true;
 }
 
+static bool dir_entry_less(const DirEntry& a, const DirEntry& b)
+{
+    return a.name < b.name;
+}
+
 void ImageApp::refresh_file_list()
 {
+    // 真正的列目录在后台线程，这里只发请求并开始监视
     _fileEntries.clear();
-    try
+    _dirStaging.clear();
+    _dirChangedNames.clear();
+    _dirRescan      = false;
+    _dirChangeTime  = -1.0;
+    _dirError.clear();
+    _dirListing     = true;
+    _dirProgressive = true;
+
+    _dirLister.list(_fileDialogDir);
+    _dirWatcher.watch(_fileDialogDir);
+    _fileListDirty = false;
+
+    // 上一个目录还没开始生成的缩略图不要了
+    _thumbCache.cancelPending();
+    for (auto& kv : _thumbs)
+    {
+        if (kv.second.state == 1)
+            kv.second.state = 0;
+    }
+}
+
+void ImageApp::update_file_list()
+{
+    std::vector<DirListing> batches;
+    if (_dirLister.poll(batches))
     {
-        for (auto& entry : fs::directory_iterator(_fileDialogDir))
-            _fileEntries.push_back(entry.path().filename().string());
+        bool changed = false;
+        for (DirListing& batch : batches)
+        {
+            if (batch.dir != _fileDialogDir)
+                continue;   // 已经离开这个目录
+            if (!batch.error.empty())
+                _dirError = batch.error;
+
+            if (batch.incremental)
+            {
+                // 增量更新：先删后插（同名即替换）
+                for (const std::string& name : batch.removed)
+                {
+                    auto it = std::lower_bound(_fileEntries.begin(), _fileEntries.end(), DirEntry{name},
+                                               dir_entry_less);
+                    if (it != _fileEntries.end() && it->name == name)
+                        _fileEntries.erase(it);
+                }
+                for (DirEntry& e : batch.entries)
+                {
+                    auto it = std::lower_bound(_fileEntries.begin(), _fileEntries.end(), e, dir_entry_less);
+                    if (it != _fileEntries.end() && it->name == e.name)
+                        *it = std::move(e);
+                    else
+                        _fileEntries.insert(it, std::move(e));
+                }
+                continue;
+            }
+
+            // 全量列目录的一批
+            std::vector<DirEntry>& target = _dirProgressive ? _fileEntries : _dirStaging;
+            if (batch.reset)
+                target.clear();
+            for (DirEntry& e : batch.entries)
+                target.push_back(std::move(e));
+            if (_dirProgressive)
+                changed = true;   // 分批到达的顺序不保证，插完再排
+
+            if (batch.done)
+            {
+                _dirListing = false;
+                if (!_dirProgressive)
+                {
+                    _fileEntries.swap(_dirStaging);
+                    _dirStaging.clear();
+                    changed = true;
+                }
+            }
+        }
 
-        std::sort(_fileEntries.begin(), _fileEntries.end());
+        if (changed)
+            std::sort(_fileEntries.begin(), _fileEntries.end(), dir_entry_less);
     }
-    catch (const std::exception& e)
+
+    // 目录监视：具体文件名变了只重新 stat 这几个，拿不到名字才重新列整个目录
+    std::vector<std::string> names;
+    bool rescan = false;
+    if (_dirWatcher.poll(names, rescan))
     {
-        std::cerr << "refresh_file_list error: " << e.what() << "\n";
+        _dirChangedNames.insert(_dirChangedNames.end(), names.begin(), names.end());
+        _dirRescan     = _dirRescan || rescan;
+        _dirChangeTime = glfwGetTime();
+    }
+
+    // 正在写入的文件会连续触发事件，等 0.3 秒没有新事件再处理；全量列目录期间先攒着
+    if (_dirChangeTime >= 0.0 && !_dirListing && glfwGetTime() - _dirChangeTime > 0.3)
+    {
+        if (_dirRescan)
+        {
+            _dirProgressive = false;
+            _dirListing     = true;
+            _dirLister.list(_fileDialogDir);
+        }
+        else
+        {
+            std::sort(_dirChangedNames.begin(), _dirChangedNames.end());
+            _dirChangedNames.erase(std::unique(_dirChangedNames.begin(), _dirChangedNames.end()),
+                                   _dirChangedNames.end());
+            _dirLister.update(_fileDialogDir, _dirChangedNames);
+
+            // 变化的文件缩略图作废（新的修改时间 = 新的缓存键）
+            for (const std::string& name : _dirChangedNames)
+            {
+                auto it = _thumbs.find((fs::path(_fileDialogDir) / name).string());
+                if (it == _thumbs.end())
+                    continue;
+                if (it->second.texture)
+                    glDeleteTextures(1, &it->second.texture);
+                _thumbs.erase(it);
+            }
+        }
+        _dirChangedNames.clear();
+        _dirRescan     = false;
+        _dirChangeTime = -1.0;
     }
-    _fileListDirty = false;
 }
 
 void ImageApp::render_file_dialog()
@@ -558,6 +1107,9 @@ void ImageApp::render_file_dialog()
     if (!_showFileDialog) return;
     if (_fileListDirty)  refresh_file_list();
 
+    update_file_list();
+    update_thumbnails();
+
     ImGuiIO& io = ImGui::GetIO();
     ImGui::SetNextWindowSize(ImVec2(io.DisplaySize.x * 0.7f, io.DisplaySize.y * 0.7f),
                              ImGuiCond_FirstUseEver);
@@ -580,35 +1132,42 @@ void ImageApp::render_file_dialog()
         }
         catch (...) {}
     }
+    ImGui::SameLine();
+    if (ImGui::Checkbox("Thumbnails", &_fileDialogThumbs))
+        g_AppSettings.fileDialogThumbs = _fileDialogThumbs ? 1 : 0;
+    if (_fileDialogThumbs)
+    {
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(160.0f);
+        if (ImGui::SliderInt("Size", &_thumbCellSize, 64, 256))
+            g_AppSettings.thumbSize = _thumbCellSize;
+
+        int pending = _thumbCache.pendingCount();
+        if (pending > 0)
+        {
+            ImGui::SameLine();
+            ImGui::TextDisabled("生成缩略图: %d", pending);
+        }
+    }
+    if (_dirListing)
+    {
+        ImGui::SameLine();
+        ImGui::TextDisabled("读取目录... %d", (int)(_dirProgressive ? _fileEntries.size() : _dirStaging.size()));
+    }
+    if (!_dirError.empty())
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", _dirError.c_str());
 
     ImGui::Separator();
 
     ImGui::BeginChild("file_list", ImVec2(0, -ImGui::GetFrameHeightWithSpacing()), true);
 
-    for (const auto& name : _fileEntries)
+    if (_fileDialogThumbs)
     {
-        fs::path p = fs::path(_fileDialogDir) / name;
-        bool isDir = false;
-        try { isDir = fs::is_directory(p); } catch (...) {}
-
-        if (isDir)
-            ImGui::Text("[D] %s", name.c_str());
-        else
-            ImGui::Text("%s", name.c_str());
-
-        if (ImGui::IsItemHovered() && ImGui::IsMouseDoubleClicked(0))
-        {
-            if (isDir)
-            {
-                _fileDialogDir = p.string();
-                _fileListDirty = true;
-            }
-            else
-            {
-                _currentPath = p.string();
-                _showFileDialog = false;
-            }
-        }
+        render_thumbnail_grid();
+    }
+    else
+    {
+        render_file_table();
     }
 
     ImGui::EndChild();
@@ -628,131 +1187,2387 @@ void ImageApp::render_file_dialog()
     ImGui::End();
 }
 
-// ---------- 图像加载 ----------
+static void format_file_size(uint64_t bytes, char* buf, size_t bufSize)
+{
+    if (bytes < 1024)
+        snprintf(buf, bufSize, "%llu B", (unsigned long long)bytes);
+    else if (bytes < (1ull << 20))
+        snprintf(buf, bufSize, "%.1f KB", bytes / 1024.0);
+    else if (bytes < (1ull << 30))
+        snprintf(buf, bufSize, "%.1f MB", bytes / (1024.0 * 1024.0));
+    else
+        snprintf(buf, bufSize, "%.2f GB", bytes / (1024.0 * 1024.0 * 1024.0));
+}
 
-void ImageApp::load_fits_file(const std::string& path)
+void ImageApp::render_file_table()
 {
-    // 更新 lastDir
-    try
+    ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV |
+                            ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable;
+    if (!ImGui::BeginTable("files", 3, flags))
+        return;
+
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_WidthStretch);
+    ImGui::TableSetupColumn("Size", ImGuiTableColumnFlags_WidthFixed, 110.0f);
+    ImGui::TableSetupColumn("Modified", ImGuiTableColumnFlags_WidthFixed, 190.0f);
+    ImGui::TableHeadersRow();
+
+    // 只为可见行生成控件，几万个文件也只画一屏
+    ImGuiListClipper clipper;
+    clipper.Begin((int)_fileEntries.size());
+    while (clipper.Step())
     {
-        fs::path p(path);
-        if (fs::exists(p))
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i)
         {
-            fs::path dir = p.has_parent_path() ? p.parent_path() : fs::current_path();
-            _fileDialogDir = dir.string();
-            g_AppSettings.lastDir = _fileDialogDir;
-        }
-    }
-    catch (...) {}
+            const DirEntry& entry = _fileEntries[i];
+            std::string path = (fs::path(_fileDialogDir) / entry.name).string();
 
-    FitsImage img;
-    if (!load_fits(path, img, _bayerHint))
-    {
-        std::cerr << "Failed to load " << path << "\n";
-        return;
-    }
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            ImGui::PushID(i);
 
-    _fits = img;
-    _imgWidth  = _fits.width;
-    _imgHeight = _fits.height;
-    _hasImage  = !_fits.raw.empty();
+            std::string label = entry.isDir ? "[D] " + entry.name : entry.name;
+            bool selected = !entry.isDir && path == _currentPath;
+            if (ImGui::Selectable(label.c_str(), selected,
+                                  ImGuiSelectableFlags_SpanAllColumns | ImGuiSelectableFlags_AllowDoubleClick))
+            {
+                if (!entry.isDir)
+                    _currentPath = path;
+
+                if (ImGui::IsMouseDoubleClicked(0))
+                {
+                    if (entry.isDir)
+                    {
+                        _fileDialogDir = path;
+                        _fileListDirty = true;
+                    }
+                    else
+                    {
+                        _showFileDialog = false;
+                    }
+                }
+            }
 
-    _zoom = 1.0f;
-    _panX = 0.0f;
-    _panY = 0.0f;
+            ImGui::TableSetColumnIndex(1);
+            if (!entry.isDir)
+            {
+                char size[32];
+                format_file_size(entry.size, size, sizeof(size));
+                ImGui::TextUnformatted(size);
+            }
 
-    // 归一化 RAW 到 [0,1]，上传给 GPU
-    std::vector<float> bayerNorm;
-    bayerNorm.resize(_fits.raw.size());
+            ImGui::TableSetColumnIndex(2);
+            if (entry.mtime > 0)
+            {
+                char when[32] = "";
+                time_t t = (time_t)entry.mtime;
+                if (const struct tm* tmv = localtime(&t))
+                    strftime(when, sizeof(when), "%Y-%m-%d %H:%M", tmv);
+                ImGui::TextUnformatted(when);
+            }
 
-    if (!_fits.raw.empty())
-    {
-        auto [itMin, itMax] = std::minmax_element(_fits.raw.begin(), _fits.raw.end());
-        double mn = *itMin;
-        double mx = *itMax;
-        if (mn == mx)
-        {
-            mn = 0.0;
-            mx = 1.0;
+            ImGui::PopID();
         }
-        double range = mx - mn;
+    }
+    clipper.End();
+
+    ImGui::EndTable();
+}
 
-        for (size_t i = 0; i < _fits.raw.size(); ++i)
+void ImageApp::render_thumbnail_grid()
+{
+    ++_uiFrame;
+
+    const ImGuiStyle& style = ImGui::GetStyle();
+    const float cell  = (float)_thumbCellSize;
+    const float textH = ImGui::GetTextLineHeight();
+    const float avail = ImGui::GetContentRegionAvail().x;
+    const int   n     = (int)_fileEntries.size();
+    const int   cols  = std::max(1, (int)((avail + style.ItemSpacing.x) / (cell + style.ItemSpacing.x)));
+    const int   rows  = (n + cols - 1) / cols;
+
+    ImDrawList* dl = ImGui::GetWindowDrawList();
+
+    // 只处理可见行：请求缩略图、画格子
+    ImGuiListClipper clipper;
+    clipper.Begin(rows, cell + textH + style.ItemSpacing.y * 2.0f);
+    while (clipper.Step())
+    {
+        for (int r = clipper.DisplayStart; r < clipper.DisplayEnd; ++r)
         {
-            float v = static_cast<float>((_fits.raw[i] - mn) / range);
-            bayerNorm[i] = clamp01(v);
+            for (int c = 0; c < cols; ++c)
+            {
+                int i = r * cols + c;
+                if (i >= n)
+                    break;
+                if (c > 0)
+                    ImGui::SameLine();
+
+                const DirEntry& entry = _fileEntries[i];
+                const std::string& name = entry.name;
+                std::string path = (fs::path(_fileDialogDir) / name).string();
+                bool isDir  = entry.isDir;
+                bool isFits = entry.isFits;
+
+                ImGui::PushID(i);
+                ImGui::BeginGroup();
+
+                ImVec2 p0 = ImGui::GetCursorScreenPos();
+                ImGui::InvisibleButton("cell", ImVec2(cell, cell + textH + style.ItemSpacing.y));
+                bool hovered = ImGui::IsItemHovered();
+                bool clicked = ImGui::IsItemClicked(ImGuiMouseButton_Left);
+                bool dblClicked = hovered && ImGui::IsMouseDoubleClicked(0);
+
+                ImVec2 p1(p0.x + cell, p0.y + cell);
+                bool selected = !isDir && path == _currentPath;
+                dl->AddRectFilled(p0, p1, ImGui::GetColorU32(selected ? ImGuiCol_HeaderActive
+                                                             : hovered ? ImGuiCol_HeaderHovered
+                                                                       : ImGuiCol_FrameBg));
+
+                const char* placeholder = isDir ? "[D]" : (isFits ? "..." : "");
+                if (isFits)
+                {
+                    ThumbEntry& t = _thumbs[path];
+                    t.lastUsed = _uiFrame;
+                    if (t.state == 0)
+                    {
+                        _thumbCache.request(path);
+                        t.state = 1;
+                    }
+
+                    if (t.state == 2 && t.texture && t.width > 0 && t.height > 0)
+                    {
+                        // 保持宽高比居中
+                        float s  = std::min(cell / t.width, cell / t.height);
+                        float w  = t.width * s;
+                        float h  = t.height * s;
+                        ImVec2 a(p0.x + (cell - w) * 0.5f, p0.y + (cell - h) * 0.5f);
+                        dl->AddImage((ImTextureID)(intptr_t)t.texture, a, ImVec2(a.x + w, a.y + h));
+                        placeholder = nullptr;
+                    }
+                    else if (t.state == 3)
+                    {
+                        placeholder = "?";
+                    }
+                }
+
+                if (placeholder && *placeholder)
+                {
+                    ImVec2 ts = ImGui::CalcTextSize(placeholder);
+                    dl->AddText(ImVec2(p0.x + (cell - ts.x) * 0.5f, p0.y + (cell - ts.y) * 0.5f),
+                                ImGui::GetColorU32(ImGuiCol_TextDisabled), placeholder);
+                }
+
+                // 文件名，超出格子宽度的部分裁掉
+                ImVec2 namePos(p0.x, p1.y + style.ItemSpacing.y * 0.5f);
+                dl->PushClipRect(namePos, ImVec2(p1.x, namePos.y + textH), true);
+                dl->AddText(namePos, ImGui::GetColorU32(ImGuiCol_Text), name.c_str());
+                dl->PopClipRect();
+
+                if (hovered)
+                    ImGui::SetTooltip("%s", name.c_str());
+
+                if (clicked && !isDir)
+                    _currentPath = path;
+
+                if (dblClicked)
+                {
+                    if (isDir)
+                    {
+                        _fileDialogDir = path;
+                        _fileListDirty = true;
+                    }
+                    else
+                    {
+                        _currentPath = path;
+                        _showFileDialog = false;
+                    }
+                }
+
+                ImGui::EndGroup();
+                ImGui::PopID();
+            }
         }
     }
+    clipper.End();
+}
 
-    _renderer.uploadBaseTexture(bayerNorm, _fits.width, _fits.height);
-    _renderer.setBayerPattern(static_cast<int>(_bayerHint));
-    _renderer.setWhiteBalance(_wbR, _wbG, _wbB);
-    _renderer.setStretchMode(_stretchMode);
+void ImageApp::update_thumbnails()
+{
+    // 每帧最多上传有限个纹理，滚动到上千个已缓存的缩略图时也不会卡住一帧
+    const int kMaxUploadsPerFrame = 32;
 
-    // GPU 统计 auto stretch 参数 + 直方图
-    float low = 0.0f, high = 1.0f;
-    if (_renderer.computeAutoParamsGpu(_autoStretch, _blackClip, _whiteClip, low, high))
+    std::vector<ThumbnailCache::Result> ready;
+    if (_thumbCache.pollReady(ready, kMaxUploadsPerFrame))
     {
-        _autoLow  = low;
-        _autoHigh = high;
+        ProfileScope scope("thumbnail upload");
 
-        _histogram.clear();
-        _renderer.getLuminanceHistogram(_histogram);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (const ThumbnailCache::Result& r : ready)
+        {
+            auto it = _thumbs.find(r.first);
+            if (it == _thumbs.end() || it->second.state != 1)
+                continue;   // 已经被清掉（换 Bayer 等）
+
+            ThumbEntry& t = it->second;
+            if (!r.second)
+            {
+                t.state = 3;
+                continue;
+            }
+
+            if (!t.texture)
+                glGenTextures(1, &t.texture);
+            glBindTexture(GL_TEXTURE_2D, t.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, r.second->width, r.second->height,
+                         0, GL_RGB, GL_UNSIGNED_BYTE, r.second->rgb.data());
+            t.width  = r.second->width;
+            t.height = r.second->height;
+            t.state  = 2;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
     }
-    else
+
+    // 纹理数超过上限时，释放最久没显示的（再次显示时从磁盘缓存很快读回）
+    const size_t kMaxTextures  = 768;
+    const size_t kKeepTextures = 512;
+
+    std::vector<std::pair<uint64_t, std::string>> loaded;
+    for (const auto& kv : _thumbs)
+    {
+        if (kv.second.texture)
+            loaded.emplace_back(kv.second.lastUsed, kv.first);
+    }
+    if (loaded.size() <= kMaxTextures)
+        return;
+
+    std::sort(loaded.begin(), loaded.end());
+    for (size_t i = 0; i + kKeepTextures < loaded.size(); ++i)
+    {
+        ThumbEntry& t = _thumbs[loaded[i].second];
+        if (t.lastUsed + 1 >= _uiFrame)
+            break;   // 当前可见，不动
+        glDeleteTextures(1, &t.texture);
+        _thumbs.erase(loaded[i].second);
+    }
+}
+
+void ImageApp::clear_thumbnails()
+{
+    _thumbCache.cancelPending();
+    for (auto& kv : _thumbs)
+    {
+        if (kv.second.texture)
+            glDeleteTextures(1, &kv.second.texture);
+    }
+    _thumbs.clear();
+}
+
+// ---------- 图像加载 ----------
+
+// 同目录的 FITS 组成浏览序列（按文件名排序）；path 不在里面时序列只有它自己
+static void directory_sequence(const std::string& path, std::vector<std::string>& sequence, int& index)
+{
+    sequence.clear();
+    index = -1;
+    try
+    {
+        fs::path p(path);
+        fs::path dir = p.has_parent_path() ? p.parent_path() : fs::path(".");
+        std::vector<fs::path> files;
+        for (const auto& entry : fs::directory_iterator(dir))
+        {
+            if (entry.is_regular_file() && has_fits_extension(entry.path().string()))
+                files.push_back(entry.path());
+        }
+        std::sort(files.begin(), files.end(),
+                  [](const fs::path& a, const fs::path& b) { return a.filename() < b.filename(); });
+
+        for (const fs::path& f : files)
+        {
+            if (f.filename() == p.filename())
+                index = (int)sequence.size();
+            sequence.push_back((dir / f.filename()).string());
+        }
+    }
+    catch (...) {}
+
+    if (index < 0)
+    {
+        sequence = {path};
+        index = 0;
+    }
+}
+
+void ImageApp::load_fits_file(const std::string& path)
+{
+    // 更新 lastDir
+    try
+    {
+        fs::path p(path);
+        if (fs::exists(p))
+        {
+            fs::path dir = p.has_parent_path() ? p.parent_path() : fs::current_path();
+            _fileDialogDir = dir.string();
+            g_AppSettings.lastDir = _fileDialogDir;
+        }
+    }
+    catch (...) {}
+
+    // 序列变了才重建预取缓存
+    std::vector<std::string> sequence;
+    int index = -1;
+    directory_sequence(path, sequence, index);
+    open_sequence(sequence, index, true);
+}
+
+void ImageApp::open_sequence(const std::vector<std::string>& sequence, int index, bool block)
+{
+    if (index < 0 || index >= (int)sequence.size())
+        return;
+
+    stop_blink();
+
+    bool changed = sequence != _sequence;
+    if (changed)
+    {
+        _sequence = sequence;
+        _prefetcher.setSequence(_sequence, _bayerHint);
+
+        // 参考帧不在新序列里（换了目录）：下一帧成为新的参考帧
+        if (_alignRef && std::find(_sequence.begin(), _sequence.end(), _alignRefPath) == _sequence.end())
+        {
+            _alignRef.reset();
+            _alignCache.clear();
+            update_align_target();
+        }
+    }
+
+    if (!block)
+    {
+        // 当前显示的就是这一帧（只是换了序列顺序），不用重新解码；
+        // 跟随目录时同名文件可能刚被覆盖写，必须重新解码
+        if (changed && _hasImage && _sequence[index] == _currentPath && _sequence[index] != _followTarget)
+        {
+            _sequenceIndex = index;
+            _pendingFrame  = -1;
+            _prefetcher.request(index);
+            return;
+        }
+        if (changed)
+            _sequenceIndex = -1;
+        show_sequence_frame(index);
+        return;
+    }
+
+    _sequenceIndex = index;
+    _pendingFrame  = -1;
+
+    // 第一次打开要同步等解码；之后相邻帧一般已经在预取缓存里
+    std::shared_ptr<const DecodedFrame> frame;
+    {
+        ProfileScope scope("open frame");
+        frame = _prefetcher.wait(index);
+    }
+    if (!frame)
+    {
+        std::cerr << "Failed to load " << _sequence[index] << "\n";
+        return;
+    }
+
+    apply_frame(*frame, true);
+}
+
+void ImageApp::apply_frame(const DecodedFrame& frame, bool resetView, bool keepStretch)
+{
+    // 黑白点是相对上一帧输出范围（各帧按自己的最小 / 最大值归一化）的，沿用时要先记下旧范围
+    double oldLo = 0.0, oldHi = 1.0;
+    _renderer.outputRange(oldLo, oldHi);
+
+    _fits = frame.image;
+    const FitsImage& fits = *_fits;
+    _currentPath = frame.path;
+    _frameCalibrated = frame.calibrated;
+    _frameRawMin = frame.rawMin;
+    _frameRawMax = frame.rawMax;
+    _imgWidth  = fits.width;
+    _imgHeight = fits.height;
+    _hasImage  = !fits.raw.empty();
+
+    if (resetView)
+    {
+        _zoom = 1.0f;
+        _panX = 0.0f;
+        _panY = 0.0f;
+    }
+
+    // 归一化好的 RAW（0~1）直接上传给 GPU
+    _renderer.uploadBaseTexture(frame.normalized, fits.width, fits.height);
+    _renderer.setBayerPattern(static_cast<int>(effective_bayer()));
+    _renderer.setWhiteBalance(_wbR, _wbG, _wbB);
+    _renderer.setStretchMode(_stretchMode);
+    update_gpu_calibration();
+
+    // GPU 坏点修正要知道这一帧的噪声水平（归一化单位）；抽样估计很快，总是算好，开关时不用再找原始数据
+    if (fits.channels == 1)
+        _frameNoise = (float)estimate_noise_sigma(frame.normalized.data(), fits.width, fits.height,
+                                                  effective_bayer() != BayerPattern::NONE);
+    update_gpu_cosmetic();
+
+    // 背景模型依赖校准 / 坏点修正后的数据，放在它们之后、统计之前
+    refit_background();
+
+    // WCS 跟着帧走（叠加结果带着参考帧的头）；解析几十张卡片，不用放到后台
+    parse_wcs(fits.headerCards, _wcs, _wcsError);
+    _skyGridDirty = true;
+
+    _stars = frame_stars(frame);
+
+    // 对齐：还没有参考帧（刚打开 / 换了序列）时这一帧就是参考帧
+    if (_alignEnabled && !_alignRef)
+        set_align_reference();
+    else if (_alignEnabled)
+        frame_alignment(frame, _stars, _frameAlign);
+    apply_frame_alignment();
+
+    // 跟随目录换进来的帧沿用当前黑白点（按 ADU 换算）：画面不闪，也不同步等 GPU 读回统计；
+    // 直方图在 update_follow_folder 里异步刷新
+    if (keepStretch)
+    {
+        // 换算到这一帧的输出范围，同样的黑白点落在同样的 ADU 上
+        double newLo = 0.0, newHi = 1.0;
+        _renderer.outputRange(newLo, newHi);
+        if (newHi > newLo && oldHi > oldLo)
+        {
+            auto remap = [&](float v) {
+                return (float)((v * (oldHi - oldLo) + oldLo - newLo) / (newHi - newLo));
+            };
+            _autoLow  = remap(_autoLow);
+            _autoHigh = remap(_autoHigh);
+        }
+
+        _statsPending = _renderer.beginStatsReadback();
+        _renderer.setAutoParams(_autoStretch, _autoLow, _autoHigh, _stretchStrength);
+        return;
+    }
+
+    // GPU 统计 auto stretch 参数 + 直方图
+    _statsPending = false;
+    float low = 0.0f, high = 1.0f;
+    if (_renderer.computeAutoParamsGpu(_autoStretch, _blackClip, _whiteClip, low, high))
+    {
+        _autoLow  = low;
+        _autoHigh = high;
+
+        _histogram.clear();
+        _renderer.getLuminanceHistogram(_histogram);
+    }
+    else
     {
         _autoLow  = 0.0f;
         _autoHigh = 1.0f;
         _histogram.clear();
     }
 
-    _renderer.setAutoParams(_autoStretch, _autoLow, _autoHigh, _stretchStrength);
+    _renderer.setAutoParams(_autoStretch, _autoLow, _autoHigh, _stretchStrength);
+}
+
+void ImageApp::show_sequence_frame(int index)
+{
+    if (index < 0 || index >= (int)_sequence.size() || index == _sequenceIndex)
+        return;
+
+    stop_blink();
+    _sequenceIndex = index;
+    _prefetcher.request(index);
+
+    // 已预取就立即切换，否则等 update_sequence 里解码完成再切
+    std::shared_ptr<const DecodedFrame> frame = _prefetcher.tryGet(index);
+    if (frame)
+    {
+        bool sameSize = frame->image->width == _imgWidth && frame->image->height == _imgHeight;
+        apply_frame(*frame, !sameSize, follow_keeps_stretch(*frame));
+        _pendingFrame = -1;
+    }
+    else
+    {
+        _pendingFrame = index;
+    }
+}
+
+void ImageApp::update_sequence()
+{
+    // 左右键 / PageUp / PageDown 切换（输入框里打字时不响应；闪烁模式下由 update_blink 处理）
+    if (!_sequence.empty() && _blink.frameCount() == 0 && !_blinkLoading &&
+        !ImGui::GetIO().WantTextInput)
+    {
+        if (ImGui::IsKeyPressed(ImGuiKey_RightArrow) || ImGui::IsKeyPressed(ImGuiKey_PageDown))
+            show_sequence_frame(_sequenceIndex + 1);
+        else if (ImGui::IsKeyPressed(ImGuiKey_LeftArrow) || ImGui::IsKeyPressed(ImGuiKey_PageUp))
+            show_sequence_frame(_sequenceIndex - 1);
+    }
+
+    if (_pendingFrame < 0)
+        return;
+
+    std::shared_ptr<const DecodedFrame> frame = _prefetcher.tryGet(_pendingFrame);
+    if (frame)
+    {
+        bool sameSize = frame->image->width == _imgWidth && frame->image->height == _imgHeight;
+        apply_frame(*frame, !sameSize, follow_keeps_stretch(*frame));
+        _pendingFrame = -1;
+    }
+    else if (_prefetcher.failed(_pendingFrame))
+    {
+        std::cerr << "Failed to load " << _sequence[_pendingFrame] << "\n";
+        _pendingFrame = -1;
+    }
+}
+
+void ImageApp::render_sequence_controls()
+{
+    if (_sequence.size() < 2)
+        return;
+
+    if (ImGui::Button("< Prev"))
+        show_sequence_frame(_sequenceIndex - 1);
+    ImGui::SameLine();
+    if (ImGui::Button("Next >"))
+        show_sequence_frame(_sequenceIndex + 1);
+    ImGui::SameLine();
+    ImGui::Text("%d / %d", _sequenceIndex + 1, (int)_sequence.size());
+    if (_pendingFrame >= 0)
+    {
+        ImGui::SameLine();
+        ImGui::TextDisabled("加载中...");
+    }
+
+    ImGui::TextDisabled("预取缓存: %d 帧, %.0f MB（← / → 切换）",
+                        _prefetcher.cachedCount(),
+                        _prefetcher.cachedBytes() / (1024.0 * 1024.0));
+
+    if (ImGui::SliderInt("Prefetch budget (MB)", &_prefetchBudgetMB, 256, 16384))
+    {
+        g_AppSettings.prefetchBudgetMB = _prefetchBudgetMB;
+        _prefetcher.setBudget((size_t)_prefetchBudgetMB << 20);
+    }
+}
+
+void ImageApp::start_blink_load()
+{
+    stop_blink();
+    if (!_hasImage || _sequence.empty())
+        return;
+
+    // 参考帧 = 当前帧，它的 auto stretch 已经算好，播放期间不再重新统计
+    _blink.setBudget((size_t)_blinkBudgetMB << 20);
+    _blink.setFps(_blinkFps);
+    _blinkStart   = std::max(_sequenceIndex, 0);
+    _blinkQueued  = 0;
+    _blinkLoading = true;
+}
+
+void ImageApp::stop_blink()
+{
+    if (_blinkLoading)
+        _prefetcher.request(_sequenceIndex);
+    _blinkLoading = false;
+    _blink.clear(_renderer);
+    apply_frame_alignment();
+}
+
+void ImageApp::update_blink()
+{
+    int n = (int)_sequence.size();
+
+    if (_blinkLoading)
+    {
+        // 每个 UI 帧最多上传一帧，预取线程在后台继续解码后面的帧
+        int index = (_blinkStart + _blinkQueued) % n;
+        _prefetcher.request(index);
+
+        std::shared_ptr<const DecodedFrame> frame = _prefetcher.tryGet(index);
+        bool done = false;
+        if (frame)
+        {
+            ProfileScope scope("blink upload");
+            const FitsImage& img = *frame->image;
+            if (!_blink.fits(img.width, img.height))
+                done = true;
+            else
+            {
+                // 对齐结果命中缓存时不用星表；没命中才找星 + 匹配
+                Registration reg;
+                double refToFrame[9];
+                const double* align = nullptr;
+                if (_alignEnabled && frame_alignment(*frame, nullptr, reg) && invert_transform(reg.toRef, refToFrame))
+                    align = refToFrame;
+                if (!_blink.addFrame(_renderer, frame->path, frame->normalized, img.width, img.height,
+                                     frame->rawMin, frame->rawMax, align))
+                    std::cerr << "Blink: skipped " << frame->path << "\n";
+            }
+            ++_blinkQueued;
+        }
+        else if (_prefetcher.failed(index))
+        {
+            ++_blinkQueued;
+        }
+
+        if (done || _blinkQueued >= n)
+        {
+            _blinkLoading = false;
+            _prefetcher.request(_sequenceIndex);
+            if (_blink.frameCount() > 0)
+            {
+                _blink.step(_renderer, 1);
+                _blink.play(glfwGetTime());
+            }
+        }
+    }
+
+    if (_blink.frameCount() == 0)
+        return;
+
+    if (!ImGui::GetIO().WantTextInput)
+    {
+        if (ImGui::IsKeyPressed(ImGuiKey_Space, false))
+        {
+            if (_blink.playing())
+                _blink.pause();
+            else
+                _blink.play(glfwGetTime());
+        }
+        if (ImGui::IsKeyPressed(ImGuiKey_RightArrow))
+        {
+            _blink.pause();
+            _blink.step(_renderer, 1);
+        }
+        else if (ImGui::IsKeyPressed(ImGuiKey_LeftArrow))
+        {
+            _blink.pause();
+            _blink.step(_renderer, -1);
+        }
+        else if (ImGui::IsKeyPressed(ImGuiKey_Escape, false))
+        {
+            stop_blink();
+            return;
+        }
+    }
+
+    _blink.update(_renderer, glfwGetTime());
+}
+
+void ImageApp::render_blink_controls()
+{
+    if (_sequence.size() < 2 || !_hasImage)
+        return;
+
+    // ===== 闪烁播放 =====
+    ImGui::Separator();
+
+    if (_blink.frameCount() == 0 && !_blinkLoading)
+    {
+        if (ImGui::Button("Load & play"))
+            start_blink_load();
+    }
+    else
+    {
+        if (ImGui::Button(_blink.playing() ? "Pause" : "Play"))
+        {
+            if (_blink.playing())
+                _blink.pause();
+            else
+                _blink.play(glfwGetTime());
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Stop"))
+            stop_blink();
+    }
+
+    if (ImGui::SliderFloat("Blink FPS", &_blinkFps, 1.0f, 30.0f, "%.0f"))
+    {
+        _blink.setFps(_blinkFps);
+        g_AppSettings.blinkFps = (int)(_blinkFps + 0.5f);
+    }
+
+    if (ImGui::SliderInt("GPU budget (MB)", &_blinkBudgetMB, 256, 16384))
+    {
+        g_AppSettings.blinkBudgetMB = _blinkBudgetMB;
+        _blink.setBudget((size_t)_blinkBudgetMB << 20);
+    }
+
+    if (_blinkLoading)
+        ImGui::Text("上传中: %d / %d", _blinkQueued, (int)_sequence.size());
+
+    if (const BlinkPlayer::Frame* f = _blink.currentFrame())
+    {
+        ImGui::Text("帧 %d / %d  %s", _blink.currentIndex() + 1, _blink.frameCount(),
+                    fs::path(f->path).filename().string().c_str());
+        ImGui::TextDisabled("显存 %.0f / %.0f MB, 实际 %.1f fps（空格 播放/暂停，← / → 单步，Esc 退出）",
+                            _blink.usedBytes() / (1024.0 * 1024.0),
+                            _blink.budget() / (1024.0 * 1024.0),
+                            _blink.measuredFps());
+    }
+}
+
+// ---------- 找星 ----------
+
+std::shared_ptr<const StarField> ImageApp::frame_stars(const DecodedFrame& frame)
+{
+    if (!_starOptions || !frame.image)
+        return nullptr;
+
+    // 预取线程里已经找过星就直接用；叠加结果、打开找星之前解码的帧在这里补做
+    if (frame.stars && frame.stars->options.sigma == _starOptions->sigma)
+        return frame.stars;
+
+    ProfileScope scope("detect stars");
+    const FitsImage& img = *frame.image;
+    auto stars = std::make_shared<StarField>();
+    detect_stars(frame.normalized.data(), img.width, img.height, img.channels,
+                 img.channels == 1 && effective_bayer() != BayerPattern::NONE, *_starOptions, *stars);
+    return stars;
+}
+
+void ImageApp::update_star_detection()
+{
+    // 对齐也要星表，开着对齐时即使不显示星也要找
+    std::shared_ptr<StarDetectOptions> options;
+    if (_starDetect || _alignEnabled)
+    {
+        options = std::make_shared<StarDetectOptions>();
+        options->sigma = _starSigma;
+    }
+    _starOptions = options;
+    _prefetcher.setStarDetection(options);
+}
+
+// ---------- 背景梯度 ----------
+
+static const char* kBackgroundModeNames[] = {"Off", "Subtract", "Divide"};
+
+void ImageApp::refit_background()
+{
+    _bgError.clear();
+    _bgModel = BackgroundModel{};
+    if (_bgMode == (int)BackgroundMode::Off || !_hasImage)
+    {
+        _renderer.setBackgroundMode(0);
+        return;
+    }
+
+    // 256x256 个样本，一次同步读回（小纹理，不到 1 MB）
+    BackgroundFitOptions options;
+    options.degree = _bgDegree;
+    std::vector<float> samples;
+    int sw = 0, sh = 0;
+    if (!_renderer.sampleBackground(samples, sw, sh) ||
+        !fit_background(samples.data(), sw, sh, _imgWidth, _imgHeight, options, _bgModel) ||
+        !_renderer.setBackgroundModel(_bgModel.rgb.data(), _bgModel.width, _bgModel.height, _bgModel.level))
+    {
+        _bgError = "背景样本不足（目标 / 饱和区域占满画面？），未扣除";
+        _bgModel = BackgroundModel{};
+        _renderer.setBackgroundMode(0);
+        return;
+    }
+    _renderer.setBackgroundMode(_bgMode);
+}
+
+bool ImageApp::render_background_controls()
+{
+    if (!_hasImage)
+        return false;
+
+    // ===== 背景梯度 =====
+    ImGui::Separator();
+    if (!ImGui::CollapsingHeader("Background"))
+        return false;
+
+    bool changed = false;
+    if (ImGui::Combo("Gradient removal", &_bgMode, kBackgroundModeNames, IM_ARRAYSIZE(kBackgroundModeNames)))
+    {
+        g_AppSettings.backgroundMode = _bgMode;
+        changed = true;
+    }
+    if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("网格上取 sigma clip 中值，拟合多项式曲面后在 shader 里扣除：\n"
+                          "Subtract 用于光污染梯度，Divide 用于暗角 / 平场残差；只影响显示和导出的图像");
+
+    ImGui::BeginDisabled(_bgMode == (int)BackgroundMode::Off);
+    ImGui::SliderInt("Degree##bg", &_bgDegree, 1, 4);
+    if (ImGui::IsItemDeactivatedAfterEdit())
+    {
+        g_AppSettings.backgroundDegree = _bgDegree;
+        changed = true;
+    }
+    ImGui::EndDisabled();
+
+    if (changed)
+        refit_background();
+
+    if (!_bgError.empty())
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", _bgError.c_str());
+    else if (_bgModel.valid)
+        ImGui::TextDisabled("%d 格参与拟合，剔除 %d 格，残差 %.5f（归一化），%.1f ms",
+                            _bgModel.cells, _bgModel.rejected, _bgModel.rms, _bgModel.ms);
+    return changed;
+}
+
+void ImageApp::render_star_controls()
+{
+    if (!_hasImage)
+        return;
+
+    // ===== 找星 =====
+    ImGui::Separator();
+    if (!ImGui::CollapsingHeader("Stars"))
+        return;
+
+    bool changed = false;
+    if (ImGui::Checkbox("Detect stars", &_starDetect))
+    {
+        g_AppSettings.starDetect = _starDetect ? 1 : 0;
+        changed = true;
+    }
+    ImGui::SameLine();
+    if (ImGui::Checkbox("Overlay##stars", &_starOverlay))
+        g_AppSettings.starOverlay = _starOverlay ? 1 : 0;
+
+    // 松开滑块才重新检测，拖动过程中不反复跑
+    ImGui::SliderFloat("Detection sigma", &_starSigma, 2.0f, 20.0f, "%.1f");
+    if (ImGui::IsItemDeactivatedAfterEdit())
+    {
+        g_AppSettings.starSigma = _starSigma;
+        changed = _starDetect;
+    }
+
+    if (changed)
+    {
+        // sigma 变了，之前的星表和按它算的对齐都作废
+        _alignCache.clear();
+        _alignRef.reset();
+        update_align_target();
+        update_star_detection();
+        if (_starOptions)
+            reload_current_frame();
+        else
+            _stars.reset();
+    }
+
+    if (!_stars || !_starDetect)
+        return;
+
+    const StarField& f = *_stars;
+    ImGui::Text("星数 %d（连通域 %d）", (int)f.stars.size(), f.candidates);
+    if (std::isnan(f.medianHfr))
+        ImGui::Text("HFR -  FWHM -");
+    else
+        ImGui::Text("HFR %.2f px  FWHM %.2f px", f.medianHfr, f.medianFwhm);
+    ImGui::TextDisabled("背景 %.4f  噪声 %.5f（归一化），%.0f ms", f.background, f.noise, f.ms);
+}
+
+void ImageApp::render_star_overlay()
+{
+    if (!_starDetect || !_starOverlay || !_stars || !_hasImage || _blink.frameCount() > 0)
+        return;
+
+    ImGuiIO&    io   = ImGui::GetIO();
+    ImDrawList* draw = ImGui::GetBackgroundDrawList();
+    const float vw = io.DisplaySize.x, vh = io.DisplaySize.y;
+
+    // 图像一个像素在屏幕上多大（缩放时圈跟着变）
+    float ax, ay, bx, by;
+    if (!_renderer.imageToView(0.0f, 0.0f, vw, vh, ax, ay) ||
+        !_renderer.imageToView(1.0f, 0.0f, vw, vh, bx, by))
+        return;
+    const float pixel = std::fabs(bx - ax);
+
+    const ImU32 good = IM_COL32(80, 230, 120, 200);
+    const ImU32 sat  = IM_COL32(255, 150, 60, 200);
+    for (const Star& s : _stars->stars)
+    {
+        float x, y;
+        frame_to_view(s.x, s.y, vw, vh, x, y);
+        float r = std::max(4.0f, 2.0f * s.hfr * pixel);
+        if (x < -r || y < -r || x > vw + r || y > vh + r)
+            continue;
+        draw->AddCircle(ImVec2(x, y), r, s.saturated ? sat : good, 0, 1.5f);
+    }
+}
+
+// ---------- 天球坐标 ----------
+
+// 屏幕和当前帧文件像素坐标之间的换算，所有叠加层（星、网格）和光标读数都走这里：
+// 对齐显示时屏幕按参考帧坐标排布，星、WCS 和像素值属于当前帧，要经过 toRef 换算；
+// Bayer 翻转由 renderer 的 imageToView / viewToImage 处理
+bool ImageApp::view_to_frame(float vx, float vy, float viewW, float viewH, double& x, double& y) const
+{
+    float ix, iy;
+    const bool inside = _renderer.viewToImage(vx, vy, viewW, viewH, ix, iy);
+    x = ix;
+    y = iy;
+
+    double refToFrame[9];
+    if (_alignEnabled && _frameAlign.ok && invert_transform(_frameAlign.toRef, refToFrame))
+    {
+        transform_point(refToFrame, ix, iy, x, y);
+        return x >= -0.5 && y >= -0.5 && x < _imgWidth - 0.5 && y < _imgHeight - 0.5;
+    }
+    return inside;
+}
+
+bool ImageApp::frame_to_view(double x, double y, float viewW, float viewH, float& vx, float& vy) const
+{
+    if (_alignEnabled && _frameAlign.ok)
+        transform_point(_frameAlign.toRef, x, y, x, y);
+    return _renderer.imageToView((float)x, (float)y, viewW, viewH, vx, vy);
+}
+
+// 网格只在视图（缩放 / 平移 / 窗口大小）或帧变了时重新生成：可见区域换算到帧坐标，
+// 生成网格后把所有点一次换成视图坐标，之后每帧只是画
+void ImageApp::update_sky_grid(float viewW, float viewH)
+{
+    const float view[7] = {_zoom, _panX, _panY, viewW, viewH, (float)_imgWidth, (float)effective_bayer()};
+    if (!_skyGridDirty && std::equal(view, view + 7, _skyGridView))
+        return;
+    std::copy(view, view + 7, _skyGridView);
+    _skyGridDirty = false;
+
+    ProfileScope scope("sky grid");
+
+    // 视图四角换到帧坐标取外接矩形，再和图像求交
+    const float corners[4][2] = {{0.0f, 0.0f}, {viewW, 0.0f}, {0.0f, viewH}, {viewW, viewH}};
+    double x0 = 1e30, y0 = 1e30, x1 = -1e30, y1 = -1e30;
+    for (const auto& c : corners)
+    {
+        double x, y;
+        view_to_frame(c[0], c[1], viewW, viewH, x, y);
+        x0 = std::min(x0, x);
+        y0 = std::min(y0, y);
+        x1 = std::max(x1, x);
+        y1 = std::max(y1, y);
+    }
+    x0 = std::max(x0, -0.5);
+    y0 = std::max(y0, -0.5);
+    x1 = std::min(x1, _imgWidth - 0.5);
+    y1 = std::min(y1, _imgHeight - 0.5);
+
+    if (!build_sky_grid(_wcs, x0, y0, x1, y1, _skyGrid))
+    {
+        _skyGrid = SkyGrid{};
+        return;
+    }
+
+    for (SkyGridLine& line : _skyGrid.lines)
+        for (size_t i = 0; i < line.x.size(); ++i)
+        {
+            if (std::isnan(line.x[i]))
+                continue;
+            frame_to_view(line.x[i], line.y[i], viewW, viewH, line.x[i], line.y[i]);
+        }
+}
+
+void ImageApp::render_wcs_overlay()
+{
+    if (!_wcsGrid || !_wcs.valid || !_hasImage || _blink.frameCount() > 0)
+        return;
+
+    ImGuiIO&    io   = ImGui::GetIO();
+    ImDrawList* draw = ImGui::GetBackgroundDrawList();
+    const float vw = io.DisplaySize.x, vh = io.DisplaySize.y;
+    update_sky_grid(vw, vh);
+    if (_skyGrid.lines.empty())
+        return;
+
+    // 只画在图像上
+    float ax, ay, bx, by;
+    _renderer.imageToView(-0.5f, -0.5f, vw, vh, ax, ay);
+    _renderer.imageToView(_imgWidth - 0.5f, _imgHeight - 0.5f, vw, vh, bx, by);
+    draw->PushClipRect(ImVec2(std::min(ax, bx), std::min(ay, by)), ImVec2(std::max(ax, bx), std::max(ay, by)), true);
+
+    const ImU32 raColor  = IM_COL32(120, 200, 255, 170);
+    const ImU32 decColor = IM_COL32(255, 210, 120, 170);
+    std::vector<ImVec2> run;
+    for (const SkyGridLine& line : _skyGrid.lines)
+    {
+        const ImU32 color = line.constantRa ? raColor : decColor;
+        run.clear();
+        for (size_t i = 0; i <= line.x.size(); ++i)
+        {
+            if (i < line.x.size() && !std::isnan(line.x[i]))
+            {
+                run.emplace_back(line.x[i], line.y[i]);
+                continue;
+            }
+            if (run.size() >= 2)
+                draw->AddPolyline(run.data(), (int)run.size(), color, ImDrawFlags_None, 1.0f);
+            run.clear();
+        }
+
+        if (line.labelIndex >= 0)
+            draw->AddText(ImVec2(line.x[line.labelIndex] + 3.0f, line.y[line.labelIndex] - ImGui::GetFontSize() - 1.0f),
+                          color, line.label.c_str());
+    }
+    draw->PopClipRect();
+}
+
+void ImageApp::render_cursor_readout()
+{
+    ImGuiIO& io = ImGui::GetIO();
+    if (!_hasImage || !_fits || io.WantCaptureMouse || _blink.frameCount() > 0)
+        return;
+
+    const float vw = io.DisplaySize.x, vh = io.DisplaySize.y;
+    double x, y;
+    if (!view_to_frame(io.MousePos.x, io.MousePos.y, vw, vh, x, y))
+        return;
+
+    const FitsImage& fits = *_fits;
+    const int ix = std::clamp((int)std::lround(x), 0, fits.width - 1);
+    const int iy = std::clamp((int)std::lround(y), 0, fits.height - 1);
+    const size_t plane = (size_t)fits.width * fits.height;
+    const size_t idx   = (size_t)iy * fits.width + ix;
+
+    // 坐标按 FITS 约定从 1 开始（和 CRPIX、DS9 一致）。值取 CPU 侧的 raw（ADU）：CPU 校准 / 坏点修正
+    // 是在解码时原地改的，所以开着它们时显示的是校准 / 修正后的值；GPU 校准只作用在显示上，这里仍是文件里的值
+    char buf[256];
+    int  len = 0;
+    if (fits.channels == 3 && fits.raw.size() >= plane * 3)
+        len = std::snprintf(buf, sizeof(buf), "(%d, %d)  %.6g  %.6g  %.6g", ix + 1, iy + 1,
+                            fits.raw[idx], fits.raw[plane + idx], fits.raw[plane * 2 + idx]);
+    else if (idx < fits.raw.size())
+        len = std::snprintf(buf, sizeof(buf), "(%d, %d)  %.6g", ix + 1, iy + 1, fits.raw[idx]);
+
+    if (_wcs.valid && len > 0 && len < (int)sizeof(buf))
+    {
+        double ra, dec;
+        wcs_pixel_to_sky(_wcs, &x, &y, &ra, &dec, 1);
+        std::snprintf(buf + len, sizeof(buf) - len, "   RA %s  Dec %s",
+                      format_ra(ra, 0.01 / 240.0).c_str(), format_dec(dec, 0.1 / 3600.0).c_str());
+    }
+
+    ImDrawList*  draw = ImGui::GetBackgroundDrawList();
+    const ImVec2 size = ImGui::CalcTextSize(buf);
+    const ImVec2 pos(8.0f, vh - size.y - 8.0f);
+    draw->AddRectFilled(ImVec2(pos.x - 4.0f, pos.y - 2.0f), ImVec2(pos.x + size.x + 4.0f, pos.y + size.y + 2.0f),
+                        IM_COL32(0, 0, 0, 160), 3.0f);
+    draw->AddText(pos, IM_COL32(230, 230, 230, 255), buf);
+}
+
+void ImageApp::render_wcs_controls()
+{
+    if (!_hasImage)
+        return;
+
+    // ===== 天球坐标 =====
+    ImGui::Separator();
+    if (!ImGui::CollapsingHeader("WCS"))
+        return;
+
+    if (!_wcs.valid)
+    {
+        if (!_wcsError.empty())
+            ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", _wcsError.c_str());
+        else
+            ImGui::TextDisabled("头里没有 WCS（未解析）");
+        return;
+    }
+
+    if (ImGui::Checkbox("RA/Dec grid", &_wcsGrid))
+    {
+        g_AppSettings.wcsGrid = _wcsGrid ? 1 : 0;
+        _skyGridDirty = true;
+    }
+
+    double cx = (_imgWidth - 1) * 0.5, cy = (_imgHeight - 1) * 0.5, ra, dec;
+    wcs_pixel_to_sky(_wcs, &cx, &cy, &ra, &dec, 1);
+    const double scale = _wcs.pixelScale();
+    ImGui::Text("中心 %s  %s", format_ra(ra, 0.1 / 240.0).c_str(), format_dec(dec, 1.0 / 3600.0).c_str());
+    ImGui::TextDisabled("%.3f\"/px  旋转 %.2f°  视场 %.1f' x %.1f'", scale, _wcs.rotation(),
+                        _imgWidth * scale / 60.0, _imgHeight * scale / 60.0);
+    if (_wcs.sipOrder > 0)
+        ImGui::TextDisabled("SIP %d 阶%s", _wcs.sipOrder, _wcs.sipInvOrder > 0 ? "（带反向多项式）" : "");
+    if (_wcsGrid && _skyGrid.raStep > 0.0)
+    {
+        // 间隔按时间秒 / 角秒给出，超过一分钟时换成分
+        const double raSec  = std::round(_skyGrid.raStep * 240.0);
+        const double decSec = std::round(_skyGrid.decStep * 3600.0);
+        ImGui::TextDisabled("网格间隔：赤经 %g%s，赤纬 %g%s",
+                            raSec >= 60.0 ? raSec / 60.0 : raSec, raSec >= 60.0 ? "m" : "s",
+                            decSec >= 60.0 ? decSec / 60.0 : decSec, decSec >= 60.0 ? "'" : "\"");
+    }
+}
+
+// ---------- 对齐 ----------
+
+bool ImageApp::frame_alignment(const DecodedFrame& frame, std::shared_ptr<const StarField> stars, Registration& out)
+{
+    out = Registration();
+    if (!_alignEnabled || !_alignRef || !frame.image)
+        return false;
+    if (frame.path == _alignRefPath)
+    {
+        out.ok = true;
+        return true;
+    }
+    // 显示时按参考帧的像素网格采样，尺寸不同的帧不对齐
+    if (frame.image->width != _alignRef->width || frame.image->height != _alignRef->height)
+        return false;
+
+    auto it = _alignCache.find(frame.path);
+    if (it != _alignCache.end())
+    {
+        out = it->second;
+        return out.ok;
+    }
+
+    // 预取线程按当前参考帧匹配过就直接用；参考帧刚换、还没在后台重新解码的帧才在这里补做
+    // 参考帧的找星参数就是当前参数（改参数时参考帧会重建），和预取线程用同一个键
+    const std::string     cacheDir = app_cache_dir("registration");
+    const RegisterOptions regOptions;
+    if (frame.registration && frame.registrationRef == _alignRefPath)
+    {
+        out = *frame.registration;
+    }
+    else if (!load_cached_registration(cacheDir, _alignRefPath, frame.path, _alignRef->options, regOptions, out))
+    {
+        if (!stars)
+            stars = frame_stars(frame);
+        if (stars)
+        {
+            ProfileScope scope("register");
+            register_stars(*_alignRef, *stars, regOptions, out);
+            store_cached_registration(cacheDir, _alignRefPath, frame.path, _alignRef->options, regOptions, out);
+        }
+    }
+    _alignCache[frame.path] = out;
+    return out.ok;
+}
+
+void ImageApp::set_align_reference()
+{
+    _alignCache.clear();
+    _alignRef     = _stars;
+    _alignRefPath = _alignRef ? _currentPath : std::string();
+    _frameAlign   = Registration();
+    _frameAlign.ok = _alignRef != nullptr;
+    apply_frame_alignment();
+    update_align_target();
+}
+
+void ImageApp::update_align_target()
+{
+    std::shared_ptr<AlignTarget> target;
+    if (_alignEnabled && _alignRef)
+    {
+        target = std::make_shared<AlignTarget>();
+        target->refPath  = _alignRefPath;
+        target->refStars = _alignRef;
+        target->cacheDir = app_cache_dir("registration");
+    }
+
+    // 没变时不动预取缓存（换参考帧会作废已解码的帧）
+    const bool same = target ? _prefetchAlign && _prefetchAlign->refPath == target->refPath &&
+                                   _prefetchAlign->refStars == target->refStars
+                             : !_prefetchAlign;
+    if (same)
+        return;
+    _prefetchAlign = target;
+    _prefetcher.setAlignTarget(target);
+}
+
+void ImageApp::apply_frame_alignment()
+{
+    double refToFrame[9];
+    if (_alignEnabled && _frameAlign.ok && invert_transform(_frameAlign.toRef, refToFrame))
+        _renderer.setAlignment(refToFrame);
+    else
+        _renderer.setAlignment(nullptr);
+    _skyGridDirty = true;
+}
+
+void ImageApp::render_align_controls()
+{
+    if (_sequence.size() < 2 || !_hasImage)
+        return;
+
+    if (ImGui::Checkbox("Align to reference", &_alignEnabled))
+    {
+        stop_blink();
+        _alignCache.clear();
+        _alignRef.reset();
+        update_align_target();
+        update_star_detection();
+        if (_alignEnabled)
+        {
+            // 当前帧作为参考帧，没有星表时先补做
+            if (!_stars)
+                reload_current_frame();
+            set_align_reference();
+        }
+        else
+        {
+            _frameAlign = Registration();
+            apply_frame_alignment();
+        }
+    }
+    if (!_alignEnabled)
+        return;
+
+    ImGui::SameLine();
+    if (ImGui::Button("Use current as reference"))
+    {
+        stop_blink();
+        set_align_reference();
+    }
+
+    if (!_alignRef)
+    {
+        ImGui::TextDisabled("参考帧没有星表");
+        return;
+    }
+
+    int failed = 0;
+    for (const auto& kv : _alignCache)
+        failed += kv.second.ok ? 0 : 1;
+    ImGui::TextDisabled("参考帧 %s（%d 颗星）", fs::path(_alignRefPath).filename().string().c_str(),
+                        (int)_alignRef->stars.size());
+    if (_currentPath == _alignRefPath)
+        ImGui::Text("当前帧即参考帧");
+    else if (_frameAlign.ok)
+        ImGui::Text("当前帧 %d 对星，残差 %.2f px", _frameAlign.matches, _frameAlign.rms);
+    else
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "当前帧对齐失败，按原样显示");
+    if (failed > 0)
+        ImGui::TextDisabled("已匹配 %d 帧，失败 %d 帧", (int)_alignCache.size(), failed);
+}
+
+// ---------- 叠加 ----------
+
+static const char* kStackMethodNames[4] = {"Mean", "Median", "Sigma clip", "Winsorized sigma clip"};
+static const char* kStackFileTags[4]    = {"mean", "median", "sigma", "winsor"};
+
+void ImageApp::start_stack()
+{
+    if (_sequence.size() < 2 || _stacker.running())
+        return;
+
+    std::string out = _stackOutPath;
+    if (out.empty())
+    {
+        fs::path dir = fs::path(_sequence.front()).parent_path();
+        out = (dir / ("stack_" + std::string(kStackFileTags[_stackMethod]) + "_" +
+                      std::to_string(_sequence.size()) + ".fits")).string();
+    }
+
+    StackOptions options;
+    options.method    = static_cast<StackMethod>(_stackMethod);
+    options.sigmaLow  = _stackSigmaLow;
+    options.sigmaHigh = _stackSigmaHigh;
+    options.normalize = _stackNormalize;
+    options.memoryBudget = (size_t)_prefetchBudgetMB << 20;
+
+    if (_stacker.start(_sequence, out, options))
+    {
+        _stackTarget = out;
+        _stackStatus = "叠加中: " + out;
+    }
+}
+
+void ImageApp::update_stack()
+{
+    bool ok = false;
+    StackResult result;
+    std::string error;
+    std::shared_ptr<FitsImage> image;
+    if (!_stacker.poll(ok, result, error, image))
+        return;
+
+    if (!ok || !image)
+    {
+        _stackStatus = "叠加失败: " + error;
+        std::cerr << "Stack failed: " << error << "\n";
+        return;
+    }
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%d 帧 %dx%d，%.1f s（读盘 %.1f s，合并 %.1f s，行带 %d 行），剔除 低 %.2f%% / 高 %.2f%%",
+             result.frames, result.width, result.height, result.totalMs / 1000.0,
+             result.readMs / 1000.0, result.combineMs / 1000.0, result.bandRows,
+             result.rejectedLow * 100.0, result.rejectedHigh * 100.0);
+    _stackStatus = buf;
+
+    // 结果直接当成一帧显示（不属于序列，切换序列帧时会被替换）
+    DecodedFrame frame;
+    frame.path = _stackTarget;
+    calibrate_and_normalize(*image, nullptr, nullptr, frame.normalized, &frame.rawMin, &frame.rawMax);
+    frame.image = image;
+
+    stop_blink();
+    apply_frame(frame, _imgWidth != image->width || _imgHeight != image->height);
+}
+
+void ImageApp::render_stack_controls()
+{
+    if (_sequence.size() < 2)
+        return;
+
+    // ===== 叠加 =====
+    ImGui::Separator();
+    if (!ImGui::CollapsingHeader("Stack"))
+        return;
+
+    bool busy = _stacker.running();
+    ImGui::BeginDisabled(busy);
+
+    if (ImGui::Combo("Method", &_stackMethod, kStackMethodNames, IM_ARRAYSIZE(kStackMethodNames)))
+        g_AppSettings.stackMethod = _stackMethod;
+
+    if (_stackMethod >= (int)StackMethod::SigmaClip)
+    {
+        if (ImGui::SliderFloat("Sigma low", &_stackSigmaLow, 1.0f, 10.0f, "%.1f"))
+            g_AppSettings.stackSigmaLow = _stackSigmaLow;
+        if (ImGui::SliderFloat("Sigma high", &_stackSigmaHigh, 1.0f, 10.0f, "%.1f"))
+            g_AppSettings.stackSigmaHigh = _stackSigmaHigh;
+    }
+
+    if (ImGui::Checkbox("Normalize background", &_stackNormalize))
+        g_AppSettings.stackNormalize = _stackNormalize ? 1 : 0;
+
+    ImGui::InputTextWithHint("Output", "默认写到第一帧所在目录", &_stackOutPath);
+
+    if (ImGui::Button("Stack"))
+        start_stack();
+    ImGui::EndDisabled();
+
+    if (busy)
+    {
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel##stack"))
+            _stacker.cancel();
+        ImGui::ProgressBar(_stacker.progress(), ImVec2(-1.0f, 0.0f));
+    }
+    ImGui::TextDisabled("%d 帧，输入不做校准 / 对齐", (int)_sequence.size());
+
+    if (!_stackStatus.empty())
+        ImGui::TextWrapped("%s", _stackStatus.c_str());
+}
+
+// ---------- 实时叠加 ----------
+
+static const char* kLiveMethodNames[2] = {"Mean", "Sigma clip"};
+
+void ImageApp::start_live_stack()
+{
+    std::string dir = _liveDir;
+    if (dir.empty() && !_currentPath.empty())
+        dir = fs::path(_currentPath).parent_path().string();
+
+    LiveStackOptions options;
+    options.method    = (LiveStackMethod)_liveMethod;
+    options.sigma     = _liveSigma;
+    options.normalize = _liveNormalize;
+    options.includeExisting = _liveIncludeExisting;
+    options.bayer       = _bayerHint;
+    options.stars.sigma = _starSigma;
+
+    // 校准必须在对齐重采样之前做（平场上的灰尘不随星移动），所以总在后台线程里按 CPU 做。
+    // GPU 模式下 _calibration 带着全部主帧（开关只改 shader 参数），这里按勾选的重新组一份
+    if (_calOnGpu)
+    {
+        const CalibrationFrame* masters[3] = {};
+        for (int i = 0; i < 3; ++i)
+        {
+            if (_calUse[i] && _calMaster[i].isValid())
+                masters[i] = &_calMaster[i];
+        }
+        if (masters[0] || masters[1] || masters[2])
+        {
+            std::string error;
+            options.calibration = Calibration::build(masters[0], masters[1], masters[2], _calScaleDark, error);
+            if (!options.calibration)
+                std::cerr << "Live stack calibration disabled: " << error << "\n";
+        }
+        if (_cosmeticEnabled)
+        {
+            auto cosmetic = std::make_shared<CosmeticSettings>();
+            cosmetic->hotSigma  = _cosmeticHot;
+            cosmetic->coldSigma = _cosmeticCold;
+            options.cosmetic = cosmetic;
+        }
+    }
+    else
+    {
+        options.calibration = _calibration;
+        options.cosmetic    = _prefetchCosmetic;
+    }
+
+    _liveError.clear();
+    if (!_liveStacker.start(dir, options))
+        _liveError = "无法监视目录: " + (dir.empty() ? std::string("（未指定）") : dir);
+}
+
+void ImageApp::update_live_stack()
+{
+    std::shared_ptr<const DecodedFrame> frame;
+    if (!_liveStacker.poll(frame) || !frame)
+        return;
+
+    // 结果在参考帧的网格上，直接当成一帧显示（切换序列帧时会被替换，下一份结果出来再换回来）
+    stop_blink();
+    apply_frame(*frame, _imgWidth != frame->image->width || _imgHeight != frame->image->height);
+}
+
+void ImageApp::render_live_stack_controls()
+{
+    // ===== 实时叠加 =====
+    ImGui::Separator();
+    if (!ImGui::CollapsingHeader("Live stack"))
+        return;
+
+    const bool running = _liveStacker.running();
+    ImGui::BeginDisabled(running);
+
+    if (ImGui::InputTextWithHint("Directory##live", "默认为当前文件所在目录", &_liveDir))
+        g_AppSettings.liveDir = _liveDir;
+
+    if (ImGui::Combo("Method##live", &_liveMethod, kLiveMethodNames, IM_ARRAYSIZE(kLiveMethodNames)))
+        g_AppSettings.liveMethod = _liveMethod;
+
+    if (_liveMethod == (int)LiveStackMethod::SigmaClip)
+    {
+        if (ImGui::SliderFloat("Sigma##live", &_liveSigma, 1.5f, 10.0f, "%.1f"))
+            g_AppSettings.liveSigma = _liveSigma;
+    }
+
+    if (ImGui::Checkbox("Normalize background##live", &_liveNormalize))
+        g_AppSettings.liveNormalize = _liveNormalize ? 1 : 0;
+    if (ImGui::Checkbox("Include existing frames", &_liveIncludeExisting))
+        g_AppSettings.liveIncludeExisting = _liveIncludeExisting ? 1 : 0;
+
+    ImGui::EndDisabled();
+
+    if (!running)
+    {
+        if (ImGui::Button("Start live stack"))
+            start_live_stack();
+    }
+    else if (ImGui::Button("Stop live stack"))
+    {
+        _liveStacker.stop();
+    }
+
+    if (!_liveError.empty())
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", _liveError.c_str());
+
+    LiveStackStatus st = _liveStacker.status();
+    if (running)
+        ImGui::TextDisabled("监视 %s", _liveStacker.directory().c_str());
+    if (!running && st.frames == 0 && st.skipped == 0)
+        return;
+
+    ImGui::Text("已叠加 %d 帧，跳过 %d 帧，排队 %d 帧", st.frames, st.skipped, st.queued);
+    if (!st.lastFile.empty())
+    {
+        ImGui::TextDisabled("%s: %.0f ms（读 %.0f / 校准 %.0f / 找星对齐 %.0f / 累加 %.0f / 快照 %.0f）",
+                            st.lastFile.c_str(), st.totalMs + st.publishMs, st.loadMs, st.calibrateMs,
+                            st.alignMs, st.accumulateMs, st.publishMs);
+        if (st.lastAlign.ok)
+            ImGui::TextDisabled("%d 对星，残差 %.2f px，剔除 %.2f%% 像素",
+                                st.lastAlign.matches, st.lastAlign.rms, st.clipped * 100.0);
+    }
+    if (!st.message.empty())
+        ImGui::TextWrapped("%s", st.message.c_str());
+}
+
+// ---------- 跟随目录 ----------
+
+void ImageApp::set_follow_folder(bool enabled)
+{
+    _followError.clear();
+    if (!enabled)
+    {
+        _followFolder = false;
+        _followWatcher.stop();
+        _followTarget.clear();
+        return;
+    }
+
+    const std::string dir = sequence_directory();
+    _followFolder = _followWatcher.start(dir, false);
+    if (!_followFolder)
+        _followError = "无法监视目录: " + dir;
+}
+
+bool ImageApp::follow_keeps_stretch(const DecodedFrame& frame) const
+{
+    // 尺寸变了说明换了相机 / 设置，重新统计
+    return _followFolder && _hasImage && frame.path == _followTarget &&
+           frame.image->width == _imgWidth && frame.image->height == _imgHeight;
+}
+
+void ImageApp::update_follow_folder()
+{
+    // 换帧时发起的异步统计：GPU 完成后才读回，只刷新直方图，黑白点保持不变
+    if (_statsPending)
+    {
+        float autoLow = 0.0f, autoHigh = 1.0f;
+        if (_renderer.finishStatsReadback(_blackClip, _whiteClip, _autoLow, _autoHigh, autoLow, autoHigh))
+        {
+            _histogram.clear();
+            _renderer.getLuminanceHistogram(_histogram);
+            _statsPending = false;
+        }
+        else if (!_renderer.statsReadbackPending())
+        {
+            _statsPending = false;
+        }
+    }
+
+    std::vector<std::string> ready;
+    if (!_followFolder || !_followWatcher.poll(ready))
+        return;
+
+    // 一次来了多帧（比如连拍）时只显示最新的
+    const std::string newest = ready.back();
+    _followTarget = newest;
+
+    const fs::path followDir = fs::path(newest).parent_path();
+    if (_sequence.empty() || fs::path(_sequence.back()).parent_path() != followDir)
+    {
+        // 还没有这个目录的序列：列一次目录
+        std::vector<std::string> sequence;
+        int index = -1;
+        directory_sequence(newest, sequence, index);
+        open_sequence(sequence, index, false);
+        return;
+    }
+
+    // 新帧接到已有序列上，不在 UI 线程每帧重新列整个目录
+    std::vector<std::string> added;
+    for (const std::string& path : ready)
+    {
+        auto it = std::find(_sequence.begin(), _sequence.end(), path);
+        if (it == _sequence.end())
+        {
+            added.push_back(path);
+            continue;
+        }
+
+        // 同名文件被覆盖写（或之前预取过），缓存里的是旧内容
+        const int index = (int)(it - _sequence.begin());
+        _prefetcher.invalidate(index);
+        if (index == _sequenceIndex)
+            _sequenceIndex = -1;
+    }
+
+    auto byName = [](const std::string& a, const std::string& b) {
+        return fs::path(a).filename() < fs::path(b).filename();
+    };
+    std::sort(added.begin(), added.end(), byName);
+
+    if (!added.empty() && !byName(_sequence.back(), added.front()))
+    {
+        // 新文件名排到了已有帧中间（拍摄软件换了命名）：下标全变，按文件名重排整个序列
+        std::vector<std::string> sequence = _sequence;
+        sequence.insert(sequence.end(), added.begin(), added.end());
+        std::sort(sequence.begin(), sequence.end(), byName);
+        const int index = (int)(std::find(sequence.begin(), sequence.end(), newest) - sequence.begin());
+        open_sequence(sequence, index, false);
+        return;
+    }
+
+    if (!added.empty())
+    {
+        _sequence.insert(_sequence.end(), added.begin(), added.end());
+        _prefetcher.appendSequence(added);
+    }
+    const int index = (int)(std::find(_sequence.begin(), _sequence.end(), newest) - _sequence.begin());
+    open_sequence(_sequence, index, false);
+}
+
+void ImageApp::render_follow_controls()
+{
+    ImGui::SameLine();
+    bool follow = _followFolder;
+    if (ImGui::Checkbox("Follow folder", &follow))
+        set_follow_folder(follow);
+
+    if (_followFolder)
+        ImGui::TextDisabled("跟随 %s 里写完的新帧", _followWatcher.directory().c_str());
+    if (!_followError.empty())
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", _followError.c_str());
+}
+
+// ---------- 校准 ----------
+
+static const char* kCalibrationNames[3] = {"Bias", "Dark", "Flat"};
+
+bool ImageApp::load_calibration_master(int kind)
+{
+    CalibrationFrame frame;
+    {
+        ProfileScope scope("load master");
+        if (!load_calibration_frame(_calPath[kind], frame))
+        {
+            _calError = std::string("无法读取 ") + kCalibrationNames[kind] + ": " + _calPath[kind];
+            return false;
+        }
+    }
+
+    _calMaster[kind] = std::move(frame);
+    _calUse[kind]    = true;
+    g_AppSettings.calPath[kind] = _calPath[kind];
+    return true;
+}
+
+void ImageApp::rebuild_calibration()
+{
+    // GPU 模式下开关只改 shader 参数，所以主帧全部带上；CPU 模式只带勾选的
+    const CalibrationFrame* masters[3] = {};
+    for (int i = 0; i < 3; ++i)
+    {
+        if ((_calOnGpu || _calUse[i]) && _calMaster[i].isValid())
+            masters[i] = &_calMaster[i];
+    }
+
+    _calError.clear();
+    std::shared_ptr<const Calibration> calibration;
+    if (masters[0] || masters[1] || masters[2])
+    {
+        calibration = Calibration::build(masters[0], masters[1], masters[2], _calScaleDark, _calError);
+        if (!calibration)
+            std::cerr << "Calibration disabled: " << _calError << "\n";
+    }
+    _calibration = calibration;
+
+    if (_calOnGpu && _calibration)
+    {
+        const Calibration& c = *_calibration;
+        _renderer.uploadCalibration(c.hasBias() ? c.bias().data() : nullptr,
+                                    c.hasDark() ? c.thermal().data() : nullptr,
+                                    c.hasFlat() ? c.invFlat().data() : nullptr,
+                                    c.width(), c.height());
+    }
+    else
+    {
+        _renderer.clearCalibration();
+    }
+
+    // 坏点表来自 dark，CPU / GPU 模式切换也会改变坏点修正在哪做
+    bool cosmeticChanged = update_cpu_cosmetic();
+
+    // 预取缓存里的帧按旧设置解码过：只有 CPU 校准 / 坏点修正的状态变了才需要重新解码当前帧
+    std::shared_ptr<const Calibration> cpuCalibration = _calOnGpu ? nullptr : _calibration;
+    if (!cpuCalibration && !_prefetchCalibrated)
+    {
+        if (cosmeticChanged)
+            reload_current_frame();
+        update_gpu_calibration();
+        update_gpu_cosmetic();
+        return;
+    }
+
+    _prefetchCalibrated = cpuCalibration != nullptr;
+    _prefetcher.setCalibration(cpuCalibration);
+    reload_current_frame();
+
+    // 不在序列里的帧（叠加结果）没法重新解码：仍按它是否已在 CPU 上校准设置 shader，不会校准两遍
+    update_gpu_calibration();
+    update_gpu_cosmetic();
 }
 
-// ---------- 导出 PNG：完全用 GPU 渲染 ----------
+void ImageApp::reload_current_frame()
+{
+    stop_blink();
+    if (_sequenceIndex >= 0 && _sequenceIndex < (int)_sequence.size())
+    {
+        std::shared_ptr<const DecodedFrame> frame = _prefetcher.wait(_sequenceIndex);
+        if (frame)
+            apply_frame(*frame, false);
+    }
+}
 
-void ImageApp::export_png(const std::string& /*path_unused*/)
+bool ImageApp::update_cpu_cosmetic()
 {
-    if (!_hasImage || _imgWidth <= 0 || _imgHeight <= 0)
+    std::shared_ptr<CosmeticSettings> settings;
+    if (_cosmeticEnabled && !_calOnGpu)
+    {
+        settings = std::make_shared<CosmeticSettings>();
+        settings->hotSigma  = _cosmeticHot;
+        settings->coldSigma = _cosmeticCold;
+
+        // 坏点表按 dark 文件缓存在磁盘上，同一个 dark 只需要找一次
+        const CalibrationFrame& dark = _calMaster[1];
+        if (_cosmeticDarkMap && dark.isValid())
+        {
+            ProfileScope scope("defect map");
+            const bool  cfa   = effective_bayer() != BayerPattern::NONE;
+            const float sigma = _cosmeticHot > 0.0f ? _cosmeticHot : 5.0f;
+            const std::string cacheDir = app_cache_dir("defects");
+            if (!load_cached_defect_map(cacheDir, dark.path, cfa, sigma, settings->defects))
+            {
+                build_defect_map(dark.data.data(), dark.width, dark.height, cfa, sigma, settings->defects);
+                store_cached_defect_map(cacheDir, dark.path, cfa, sigma, settings->defects);
+            }
+        }
+    }
+    _cosmeticDefects = settings ? settings->defects.pixels.size() : 0;
+
+    if (!settings && !_prefetchCosmetic)
+        return false;
+
+    _prefetchCosmetic = settings;
+    _prefetcher.setCosmetic(settings);
+    return true;
+}
+
+void ImageApp::update_gpu_cosmetic()
+{
+    _renderer.setCosmeticParams(_cosmeticEnabled && _calOnGpu && !_frameCalibrated, _cosmeticHot, _cosmeticCold, _frameNoise);
+}
+
+void ImageApp::update_gpu_calibration()
+{
+    // 已经在 CPU 上校准过的帧（实时叠加的结果）不再让 shader 校准一遍。
+    // 不校准时也传这一帧的范围：renderer 的输出范围（闪烁帧 / 跟随换帧的黑白点换算）以它为准
+    if (!_calOnGpu || !_calibration || !_fits || _frameCalibrated)
+    {
+        _renderer.setCalibrationParams(_frameRawMin, _frameRawMax, 1.0f, false, false, false);
         return;
+    }
+
+    // dark 里带着偏置，所以用 dark 时 bias 部分总要减掉
+    _renderer.setCalibrationParams(_frameRawMin, _frameRawMax,
+                                   (float)_calibration->darkScale(*_fits),
+                                   _calUse[0] || _calUse[1], _calUse[1], _calUse[2]);
+}
 
-    // 使用当前视图参数
-    _renderer.setViewParams(_zoom, _panX, _panY);
+bool ImageApp::render_calibration_controls()
+{
+    if (!ImGui::CollapsingHeader("Calibration"))
+        return false;
 
-    std::vector<unsigned char> rgb;
-    if (!_renderer.renderToImage(_imgWidth, _imgHeight, rgb))
+    bool changed = false;      // 需要重建校准数据
+    bool toggled = false;      // 只是开关变了
+    for (int i = 0; i < 3; ++i)
     {
-        std::cerr << "Failed to render image for export\n";
-        _exportJustSucceeded = false;
+        ImGui::PushID(i);
+
+        const bool loaded = _calMaster[i].isValid();
+        ImGui::BeginDisabled(!loaded);
+        if (ImGui::Checkbox("##use", &_calUse[i]))
+            toggled = true;
+        ImGui::EndDisabled();
+        ImGui::SameLine();
+
+        ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x * 0.6f);
+        ImGui::InputText(kCalibrationNames[i], &_calPath[i]);
+        ImGui::SameLine();
+        if (ImGui::Button("Load") && !_calPath[i].empty())
+        {
+            if (load_calibration_master(i))
+                changed = true;
+        }
+
+        if (loaded)
+        {
+            const CalibrationFrame& m = _calMaster[i];
+            if (std::isnan(m.exptime))
+                ImGui::TextDisabled("    %dx%d  %s", m.width, m.height,
+                                    fs::path(m.path).filename().string().c_str());
+            else
+                ImGui::TextDisabled("    %dx%d  %.1fs  %s", m.width, m.height, m.exptime,
+                                    fs::path(m.path).filename().string().c_str());
+        }
+        ImGui::PopID();
+    }
+
+    if (ImGui::Checkbox("Scale dark by exposure", &_calScaleDark))
+    {
+        g_AppSettings.calScaleDark = _calScaleDark ? 1 : 0;
+        changed = true;
+    }
+
+    if (ImGui::Checkbox("Apply on GPU", &_calOnGpu))
+    {
+        g_AppSettings.calOnGpu = _calOnGpu ? 1 : 0;
+        changed = true;
+    }
+    if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("在显示 shader 里校准：开关即时生效，不重新解码 / 上传当前帧");
+
+    if (changed || (toggled && !_calOnGpu))
+        rebuild_calibration();
+    else if (toggled)
+        update_gpu_calibration();
+
+    // ---- 坏点 / 热点修正 ----
+    ImGui::Separator();
+    bool cosmeticChanged = false;
+    if (ImGui::Checkbox("Hot pixel removal", &_cosmeticEnabled))
+    {
+        g_AppSettings.cosmetic = _cosmeticEnabled ? 1 : 0;
+        cosmeticChanged = true;
+    }
+    if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("和同色邻居（Bayer 时隔一个像素）的中值比较，\n"
+                          "超出 sigma 倍噪声的像素替换成中值；在校准之后、去拜耳之前做");
+
+    ImGui::BeginDisabled(!_cosmeticEnabled);
+    ImGui::SliderFloat("Hot sigma", &_cosmeticHot, 0.0f, 20.0f, "%.1f");
+    if (ImGui::IsItemDeactivatedAfterEdit())
+    {
+        g_AppSettings.cosmeticHot = _cosmeticHot;
+        cosmeticChanged = true;
+    }
+    ImGui::SliderFloat("Cold sigma", &_cosmeticCold, 0.0f, 20.0f, _cosmeticCold > 0.0f ? "%.1f" : "off");
+    if (ImGui::IsItemDeactivatedAfterEdit())
+    {
+        g_AppSettings.cosmeticCold = _cosmeticCold;
+        cosmeticChanged = true;
+    }
+
+    ImGui::BeginDisabled(_calOnGpu || !_calMaster[1].isValid());
+    if (ImGui::Checkbox("Defect map from dark", &_cosmeticDarkMap))
+    {
+        g_AppSettings.cosmeticDarkMap = _cosmeticDarkMap ? 1 : 0;
+        cosmeticChanged = true;
+    }
+    ImGui::EndDisabled();
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled))
+        ImGui::SetTooltip("master dark 里的热点无论亮场里是否明显都替换（结果缓存在磁盘上）；只在 CPU 模式下生效");
+    if (_cosmeticDefects > 0)
+    {
+        ImGui::SameLine();
+        ImGui::TextDisabled("%zu px", _cosmeticDefects);
+    }
+    ImGui::EndDisabled();
+
+    if (cosmeticChanged)
+    {
+        // GPU 模式只改预处理参数，CPU 模式要重新解码当前帧
+        if (update_cpu_cosmetic())
+            reload_current_frame();
+        update_gpu_cosmetic();
+    }
+
+    if (!_calError.empty())
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", _calError.c_str());
+    else if (_calibration && _fits)
+    {
+        const bool sizeOk = _fits->width == _calibration->width() && _fits->height == _calibration->height();
+        if (!sizeOk)
+            ImGui::TextDisabled("当前帧尺寸和主帧不一致，未校准");
+        else if (_frameCalibrated || _calOnGpu)
+            ImGui::Text("当前帧已校准（%s, dark x%.2f）", _frameCalibrated ? "CPU" : "GPU",
+                        _calibration->darkScale(*_fits));
+    }
+
+    return changed || toggled || cosmeticChanged;
+}
+
+// ---------- 帧信息表 ----------
+
+enum FrameTableColumn
+{
+    FrameCol_Name = 0,
+    FrameCol_Type,
+    FrameCol_Filter,
+    FrameCol_Exposure,
+    FrameCol_DateObs,
+    FrameCol_Temp,
+    FrameCol_Gain,
+    FrameCol_Size,
+    FrameCol_HFR,
+    FrameCol_Object,
+    FrameCol_Count
+};
+
+std::string ImageApp::sequence_directory() const
+{
+    const std::string& ref = !_sequence.empty() ? _sequence.front() : _currentPath;
+    if (ref.empty())
+        return _fileDialogDir;
+
+    fs::path p(ref);
+    return p.has_parent_path() ? p.parent_path().string() : std::string(".");
+}
+
+void ImageApp::update_headers()
+{
+    std::string dir = sequence_directory();
+    if (dir != _headersDir)
+    {
+        _headersDir = dir;
+        _headers.clear();
+        _headerOrderDirty = true;
+        _headerIndexer.scan(dir);
+    }
+
+    std::string scanned;
+    std::vector<FrameHeader> headers;
+    if (_headerIndexer.poll(scanned, headers) && scanned == _headersDir)
+    {
+        _headers.swap(headers);
+        _headerOrderDirty = true;
+    }
+}
+
+static std::string to_lower_copy(const std::string& s)
+{
+    std::string r = s;
+    std::transform(r.begin(), r.end(), r.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return r;
+}
+
+// NaN / 空值总排在最后
+static int compare_numbers(double a, double b)
+{
+    bool na = std::isnan(a), nb = std::isnan(b);
+    if (na || nb) return na == nb ? 0 : (na ? 1 : -1);
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+void ImageApp::sort_frame_table()
+{
+    // 过滤：空格分隔的每个词都要出现在 名字 / 类型 / 滤镜 / 目标 之一（不区分大小写）
+    std::vector<std::string> terms;
+    {
+        std::stringstream ss(to_lower_copy(_headerFilter));
+        std::string t;
+        while (ss >> t)
+            terms.push_back(t);
+    }
+
+    _headerOrder.clear();
+    for (int i = 0; i < (int)_headers.size(); ++i)
+    {
+        const FrameHeader& h = _headers[i];
+        std::string hay = to_lower_copy(h.name + " " + h.imageType + " " + h.filter + " " + h.object);
+        bool match = true;
+        for (const std::string& t : terms)
+        {
+            if (hay.find(t) == std::string::npos)
+            {
+                match = false;
+                break;
+            }
+        }
+        if (match)
+            _headerOrder.push_back(i);
+    }
+
+    const int  col = _headerSortColumn;
+    const bool asc = _headerSortAscending;
+    std::stable_sort(_headerOrder.begin(), _headerOrder.end(), [&](int ia, int ib) {
+        const FrameHeader& a = _headers[ia];
+        const FrameHeader& b = _headers[ib];
+        int c = 0;
+        switch (col)
+        {
+            case FrameCol_Type:     c = a.imageType.compare(b.imageType); break;
+            case FrameCol_Filter:   c = a.filter.compare(b.filter); break;
+            case FrameCol_Exposure: c = compare_numbers(a.exptime, b.exptime); break;
+            case FrameCol_DateObs:  c = a.dateObs.compare(b.dateObs); break;
+            case FrameCol_Temp:     c = compare_numbers(a.ccdTemp, b.ccdTemp); break;
+            case FrameCol_Gain:     c = compare_numbers(a.gain, b.gain); break;
+            case FrameCol_Size:     c = compare_numbers((double)a.width * a.height, (double)b.width * b.height); break;
+            case FrameCol_HFR:      c = compare_numbers(a.hfr, b.hfr); break;
+            case FrameCol_Object:   c = a.object.compare(b.object); break;
+            default: break;
+        }
+        if (c == 0)
+            c = a.name.compare(b.name);
+        return asc ? c < 0 : c > 0;
+    });
+
+    _headerOrderDirty = false;
+}
+
+void ImageApp::render_frame_table()
+{
+    update_headers();
+
+    ImGuiIO& io = ImGui::GetIO();
+    ImGui::SetNextWindowSize(ImVec2(io.DisplaySize.x * 0.6f, io.DisplaySize.y * 0.5f), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Frames", &_showFrameTable))
+    {
+        ImGui::End();
         return;
     }
 
+    ImGui::Text("Directory: %s", _headersDir.c_str());
+    if (_headerIndexer.busy())
+    {
+        int done = 0, total = 0;
+        _headerIndexer.progress(done, total);
+        ImGui::SameLine();
+        ImGui::TextDisabled("扫描头信息 %d / %d", done, total);
+    }
+
+    ImGui::SetNextItemWidth(300.0f);
+    if (ImGui::InputTextWithHint("##filter", "过滤：名字 / 类型 / 滤镜 / 目标", &_headerFilter))
+        _headerOrderDirty = true;
+    ImGui::SameLine();
+    if (ImGui::Button("Rescan"))
+    {
+        _headersDir.clear();   // 下一次 update_headers 重新扫描（只重读变化的文件）
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Use as sequence") && !_headerOrder.empty())
+    {
+        // 按表格当前的过滤 + 排序浏览，尽量停在当前帧
+        std::vector<std::string> seq;
+        int index = 0;
+        for (int row = 0; row < (int)_headerOrder.size(); ++row)
+        {
+            std::string path = (fs::path(_headersDir) / _headers[_headerOrder[row]].name).string();
+            if (path == _currentPath)
+                index = row;
+            seq.push_back(std::move(path));
+        }
+        open_sequence(seq, index, false);
+    }
+    ImGui::SameLine();
+    ImGui::TextDisabled("%d / %d 帧", (int)_headerOrder.size(), (int)_headers.size());
+
+    ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV |
+                            ImGuiTableFlags_ScrollY | ImGuiTableFlags_ScrollX | ImGuiTableFlags_Resizable |
+                            ImGuiTableFlags_Reorderable | ImGuiTableFlags_Hideable;
+    if (ImGui::BeginTable("frames", FrameCol_Count, flags))
+    {
+        ImGui::TableSetupScrollFreeze(1, 1);
+        ImGui::TableSetupColumn("Name",     ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_WidthFixed, 220.0f, FrameCol_Name);
+        ImGui::TableSetupColumn("Type",     ImGuiTableColumnFlags_WidthFixed, 90.0f,  FrameCol_Type);
+        ImGui::TableSetupColumn("Filter",   ImGuiTableColumnFlags_WidthFixed, 60.0f,  FrameCol_Filter);
+        ImGui::TableSetupColumn("Exp (s)",  ImGuiTableColumnFlags_WidthFixed, 70.0f,  FrameCol_Exposure);
+        ImGui::TableSetupColumn("DATE-OBS", ImGuiTableColumnFlags_WidthFixed, 200.0f, FrameCol_DateObs);
+        ImGui::TableSetupColumn("Temp",     ImGuiTableColumnFlags_WidthFixed, 60.0f,  FrameCol_Temp);
+        ImGui::TableSetupColumn("Gain",     ImGuiTableColumnFlags_WidthFixed, 60.0f,  FrameCol_Gain);
+        ImGui::TableSetupColumn("Size",     ImGuiTableColumnFlags_WidthFixed, 100.0f, FrameCol_Size);
+        ImGui::TableSetupColumn("HFR",      ImGuiTableColumnFlags_WidthFixed, 60.0f,  FrameCol_HFR);
+        ImGui::TableSetupColumn("Object",   ImGuiTableColumnFlags_WidthFixed, 120.0f, FrameCol_Object);
+        ImGui::TableHeadersRow();
+
+        if (ImGuiTableSortSpecs* specs = ImGui::TableGetSortSpecs())
+        {
+            if (specs->SpecsDirty && specs->SpecsCount > 0)
+            {
+                _headerSortColumn    = (int)specs->Specs[0].ColumnUserID;
+                _headerSortAscending = specs->Specs[0].SortDirection != ImGuiSortDirection_Descending;
+                _headerOrderDirty    = true;
+                specs->SpecsDirty    = false;
+            }
+        }
+        if (_headerOrderDirty)
+            sort_frame_table();
+
+        auto numberCell = [](double v, const char* fmt) {
+            if (std::isnan(v))
+                ImGui::TextDisabled("-");
+            else
+                ImGui::Text(fmt, v);
+        };
+
+        ImGuiListClipper clipper;
+        clipper.Begin((int)_headerOrder.size());
+        while (clipper.Step())
+        {
+            for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row)
+            {
+                const FrameHeader& h = _headers[_headerOrder[row]];
+                std::string path = (fs::path(_headersDir) / h.name).string();
+
+                ImGui::TableNextRow();
+                ImGui::PushID(row);
+
+                ImGui::TableSetColumnIndex(FrameCol_Name);
+                if (ImGui::Selectable(h.name.c_str(), path == _currentPath, ImGuiSelectableFlags_SpanAllColumns))
+                {
+                    // 单击即在表格顺序下浏览到这一帧
+                    std::vector<std::string> seq;
+                    seq.reserve(_headerOrder.size());
+                    for (int idx : _headerOrder)
+                        seq.push_back((fs::path(_headersDir) / _headers[idx].name).string());
+                    open_sequence(seq, row, false);
+                }
+
+                ImGui::TableSetColumnIndex(FrameCol_Type);
+                ImGui::TextUnformatted(h.imageType.c_str());
+                ImGui::TableSetColumnIndex(FrameCol_Filter);
+                ImGui::TextUnformatted(h.filter.c_str());
+                ImGui::TableSetColumnIndex(FrameCol_Exposure);
+                numberCell(h.exptime, "%.1f");
+                ImGui::TableSetColumnIndex(FrameCol_DateObs);
+                ImGui::TextUnformatted(h.dateObs.c_str());
+                ImGui::TableSetColumnIndex(FrameCol_Temp);
+                numberCell(h.ccdTemp, "%.1f");
+                ImGui::TableSetColumnIndex(FrameCol_Gain);
+                numberCell(h.gain, "%.0f");
+                ImGui::TableSetColumnIndex(FrameCol_Size);
+                if (h.width > 0 && h.planes > 1)
+                    ImGui::Text("%dx%dx%d", h.width, h.height, h.planes);
+                else if (h.width > 0)
+                    ImGui::Text("%dx%d", h.width, h.height);
+                ImGui::TableSetColumnIndex(FrameCol_HFR);
+                numberCell(h.hfr, "%.2f");
+                ImGui::TableSetColumnIndex(FrameCol_Object);
+                ImGui::TextUnformatted(h.object.c_str());
+
+                ImGui::PopID();
+            }
+        }
+        clipper.End();
+
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
+
+// ---------- 导出：完全用 GPU 渲染 ----------
+
+void ImageApp::export_image()
+{
+    if (!_hasImage || _imgWidth <= 0 || _imgHeight <= 0)
+        return;
+
+    ExportFormat format = static_cast<ExportFormat>(_exportFormat);
+
     fs::path inPath(_currentPath);
     fs::path outPath;
 
     if (!inPath.empty())
     {
         outPath = inPath;
-        outPath.replace_extension(".png");
+        outPath.replace_extension(export_format_extension(format));
     }
     else
     {
-        outPath = fs::current_path() / "output.png";
+        outPath = fs::current_path() / (std::string("output") + export_format_extension(format));
+    }
+
+    if (format == ExportFormat::FITS32)
+    {
+        // 不能覆盖源 FITS
+        outPath.replace_filename(outPath.stem().string() + "_processed" + export_format_extension(format));
+        export_fits(outPath.string());
+        return;
     }
 
-    std::string outStr = outPath.string();
-    int stride = _imgWidth * 3;
+    // 导出使用独立的恒等视图，不受当前 zoom/pan 影响
+    ExportRegion region;
+    region.scale = _exportScale;
+
+    ExportPixelFormat pixelFormat = export_format_bit_depth(format) == 16
+                                        ? ExportPixelFormat::RGB16
+                                        : ExportPixelFormat::RGB8;
 
-    if (!stbi_write_png(outStr.c_str(), _imgWidth, _imgHeight, 3,
-                        rgb.data(), stride))
+    if (export_readbacks_full())
+        return;
+
+    // GL 阶段：按点击时的参数渲染，并发起异步读回；编码在 update_exports 里交给后台线程
+    PendingExport pending;
+    if (!_renderer.beginExportReadback(region, pixelFormat, pending.readback))
     {
-        std::cerr << "Failed to write png: " << outStr << "\n";
+        std::cerr << "Failed to render image for export\n";
         _exportJustSucceeded = false;
+        _exportJustFailed    = true;
+        return;
     }
-    else
+
+    pending.job.id            = _nextExportId++;
+    pending.job.path          = outPath.string();
+    pending.job.format        = format;
+    pending.job.options.level = _exportLevel;
+    pending.job.width         = pending.readback.width;
+    pending.job.height        = pending.readback.height;
+    pending.job.rowBytes      = pending.readback.rowBytes;
+    pending.job.bottomUp      = true;
+
+    _pendingExports.push_back(pending);
+}
+
+bool ImageApp::export_readbacks_full() const
+{
+    int readbacks = 0;
+    for (const PendingExport& p : _pendingExports)
+        if (p.readback.pbo)
+            ++readbacks;
+    return readbacks >= kMaxExportReadbacks;
+}
+
+BayerPattern ImageApp::effective_bayer() const
+{
+    if (_bayerFromHeader && _fits && _fits->bayerFromHeader)
+        return _fits->bayer;
+    return _bayerHint;
+}
+
+StretchParams ImageApp::current_stretch_params() const
+{
+    StretchParams p;
+    p.wbR        = _wbR;
+    p.wbG        = _wbG;
+    p.wbB        = _wbB;
+    p.useAuto    = _autoStretch;
+    p.low        = _autoLow;
+    p.high       = _autoHigh;
+    p.strength   = _stretchStrength;
+    p.mode       = _stretchMode;
+    p.useCurve   = _useManualCurve;
+    p.curveBlack = _curveBlack;
+    p.curveWhite = _curveWhite;
+    p.curveGamma = _curveGamma;
+    return p;
+}
+
+// FITS 导出不经过 GPU：后台线程从 RAW 逐行带去拜耳 + 白平衡（+ 拉伸）并流式写出
+void ImageApp::export_fits(const std::string& path)
+{
+    if (!_fits)
+        return;
+
+    std::shared_ptr<const FitsImage> fits = _fits;
+    FitsExportOptions options;
+    options.stretch = _exportFitsStretch;
+    options.params  = current_stretch_params();
+    options.bayer   = effective_bayer();
+
+    PendingExport pending;
+    pending.job.id     = _nextExportId++;
+    pending.job.path   = path;
+    pending.job.format = ExportFormat::FITS32;
+    // GPU 校准 / 修坏点只作用在显示上，CPU 侧的 raw 还是原始数据：导出前在副本上按同样的开关补做一遍
+    std::shared_ptr<const Calibration> calibration;
+    std::shared_ptr<CosmeticSettings>  cosmetic;
+    bool calUse[3] = {_calUse[0] || _calUse[1], _calUse[1], _calUse[2]};
+    if (_calOnGpu && !_frameCalibrated)
+    {
+        calibration = _calibration;
+        if (_cosmeticEnabled)
+        {
+            cosmetic = std::make_shared<CosmeticSettings>();
+            cosmetic->hotSigma  = _cosmeticHot;
+            cosmetic->coldSigma = _cosmeticCold;
+        }
+    }
+
+    pending.job.task   = [fits, path, options, calibration, cosmetic, calUse](std::atomic<float>& progress) {
+        if (!calibration && !cosmetic)
+            return write_processed_fits(*fits, path, options,
+                                        [&](float p) { progress = p; });
+
+        FitsImage copy;
+        copy.width       = fits->width;
+        copy.height      = fits->height;
+        copy.channels    = fits->channels;
+        copy.bayer       = fits->bayer;
+        copy.raw         = fits->raw;
+        copy.headerCards = fits->headerCards;
+
+        double mn = 0.0, mx = 0.0;
+        if (calibration)
+            calibration->apply(copy, mn, mx, calUse[0], calUse[1], calUse[2]);
+        if (cosmetic)
+            cosmetic_correct(copy, options.bayer != BayerPattern::NONE, *cosmetic, mn, mx);
+        return write_processed_fits(copy, path, options,
+                                    [&](float p) { progress = p; });
+    };
+    pending.submitted = true;
+
+    _exportQueue.submit(pending.job);
+    _pendingExports.push_back(std::move(pending));
+}
+
+void ImageApp::update_exports()
+{
+    // 读回完成的交给编码线程；读回出错的不会再完成，直接释放 PBO 并提示失败
+    for (auto it = _pendingExports.begin(); it != _pendingExports.end();)
+    {
+        PendingExport& p = *it;
+        if (p.submitted)
+        {
+            ++it;
+            continue;
+        }
+
+        const void* pixels = _renderer.mapExportReadback(p.readback);
+        if (!pixels)
+        {
+            if (!p.readback.failed)
+            {
+                ++it;
+                continue;
+            }
+
+            std::cerr << "Export readback failed: " << p.job.path << "\n";
+            _renderer.releaseExportReadback(p.readback);
+            _lastExportPath      = p.job.path;
+            _exportJustSucceeded = false;
+            _exportJustFailed    = true;
+            it = _pendingExports.erase(it);
+            continue;
+        }
+
+        p.job.pixels = static_cast<const unsigned char*>(pixels);
+        p.submitted  = true;
+        _exportQueue.submit(p.job);
+        ++it;
+    }
+
+    // 完成事件驱动成功/失败提示，并释放对应的 PBO
+    std::vector<ExportResult> results;
+    if (!_exportQueue.pollCompleted(results))
+        return;
+
+    for (const ExportResult& r : results)
+    {
+        auto it = std::find_if(_pendingExports.begin(), _pendingExports.end(),
+                               [&](const PendingExport& p) { return p.job.id == r.id; });
+        if (it != _pendingExports.end())
+        {
+            _renderer.releaseExportReadback(it->readback);
+            _pendingExports.erase(it);
+        }
+
+        _lastExportPath      = r.path;
+        _exportJustSucceeded = r.ok;
+        _exportJustFailed    = !r.ok;
+        if (r.ok)
+            std::cout << "Image saved to " << r.path << "\n";
+    }
+}
+
+void ImageApp::render_export_status()
+{
+    std::string current;
+    float progress = 0.0f;
+    if (_exportQueue.currentProgress(current, progress))
+    {
+        std::string name = fs::path(current).filename().string();
+        ImGui::ProgressBar(progress, ImVec2(-1, 0), name.c_str());
+    }
+
+    if (!_pendingExports.empty())
+        ImGui::Text("导出队列: %d", (int)_pendingExports.size());
+
+    if (_exportJustSucceeded && !_lastExportPath.empty())
+    {
+        ImGui::Spacing();
+        ImGui::TextColored(ImVec4(0.3f, 0.9f, 0.3f, 1.0f),
+                           "导出成功: %s", _lastExportPath.c_str());
+    }
+    else if (_exportJustFailed)
     {
-        _lastExportPath = outStr;
-        _exportJustSucceeded = true;
-        std::cout << "PNG saved to " << _lastExportPath << "\n";
+        ImGui::Spacing();
+        ImGui::TextColored(ImVec4(0.9f, 0.3f, 0.3f, 1.0f),
+                           "导出失败: %s", _lastExportPath.c_str());
     }
 }
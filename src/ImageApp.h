@@ -2,7 +2,25 @@
 
 #include "FitsImage.h"
 #include "GlImageRenderer.h"
+#include "BackgroundModel.h"
+#include "BlinkPlayer.h"
+#include "CaptureWatcher.h"
+#include "DirectoryLister.h"
+#include "DirectoryWatcher.h"
+#include "ExportQueue.h"
+#include "FramePrefetcher.h"
+#include "HeaderIndex.h"
+#include "LiveStack.h"
+#include "Registration.h"
+#include "Stacker.h"
+#include "StarDetector.h"
+#include "Stretch.h"
+#include "ThumbnailCache.h"
+#include "Wcs.h"
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class ImageApp
@@ -22,18 +40,115 @@ private:
 
     // 图像 & GPU 渲染
     void load_fits_file(const std::string& path);
+    // keepStretch：沿用当前的黑白点，统计异步做（跟随目录换帧时用）
+    void apply_frame(const DecodedFrame& frame, bool resetView, bool keepStretch = false);
 
-    // 导出 PNG 时完全使用 GPU（renderToImage）
-    void export_png(const std::string& path);
+    // 序列浏览：当前文件所在目录的 FITS 按文件名排序，左右键切换，后台预取相邻帧
+    void show_sequence_frame(int index);
+    // 切换到指定序列并显示第 index 帧；block 为 true 时同步等解码（打开文件），否则后台加载
+    void open_sequence(const std::vector<std::string>& sequence, int index, bool block);
+    void update_sequence();
+    void render_sequence_controls();
+
+    // 闪烁播放：从当前帧开始把序列上传成常驻纹理，按目标帧率循环显示
+    void start_blink_load();
+    void stop_blink();
+    void update_blink();
+    void render_blink_controls();
+
+    // 校准：master bias / dark / flat 常驻内存，整个序列共用。
+    // CPU 模式在后台解码时和归一化一起做；GPU 模式只上传主帧纹理，开关只改 shader 参数
+    bool load_calibration_master(int kind);
+    void rebuild_calibration();
+    void update_gpu_calibration();
+    // 坏点修正跟着校准走同一条路：CPU 模式在预取线程里修 RAW，GPU 模式在 renderer 里做预处理
+    bool update_cpu_cosmetic();
+    void update_gpu_cosmetic();
+    void reload_current_frame();
+    // 返回 true 表示显示的数据变了，需要重新统计 auto stretch
+    bool render_calibration_controls();
+
+    // 背景梯度：GPU 降采样取样本，CPU 上拟合多项式曲面，结果作为小纹理在 shader 里扣除
+    void refit_background();
+    // 返回 true 表示显示的数据变了，需要重新统计 auto stretch
+    bool render_background_controls();
+
+    // 找星：预取线程里对每帧做，结果跟着帧走；当前帧的结果画成叠加层
+    std::shared_ptr<const StarField> frame_stars(const DecodedFrame& frame);
+    void update_star_detection();
+    void render_star_controls();
+    void render_star_overlay();
+
+    // 天球坐标：头里的 WCS，光标处的像素值 / RA Dec 读数，以及只在视图变化时重新生成的赤经赤纬网格
+    bool view_to_frame(float vx, float vy, float viewW, float viewH, double& x, double& y) const;
+    bool frame_to_view(double x, double y, float viewW, float viewH, float& vx, float& vy) const;
+    void update_sky_grid(float viewW, float viewH);
+    void render_wcs_controls();
+    void render_wcs_overlay();
+    void render_cursor_readout();
+
+    // 对齐：按星匹配出各帧到参考帧的变换（内存 + 磁盘缓存），由 renderer 在 shader 里对齐显示
+    bool frame_alignment(const DecodedFrame& frame, std::shared_ptr<const StarField> stars, Registration& out);
+    void set_align_reference();
+    void update_align_target();
+    void apply_frame_alignment();
+    void render_align_controls();
+
+    // 叠加：把当前序列按行带流式叠加成一张 32 bit FITS，完成后直接显示结果
+    void start_stack();
+    void update_stack();
+    void render_stack_controls();
+
+    // 实时叠加：后台监视采集目录，新帧校准 + 对齐后增量累加，每出结果就替换显示
+    void start_live_stack();
+    void update_live_stack();
+    void render_live_stack_controls();
+
+    // 跟随目录：当前文件所在目录出现写完的新 FITS 就在后台解码并切过去，沿用上一帧的拉伸参数
+    void set_follow_folder(bool enabled);
+    bool follow_keeps_stretch(const DecodedFrame& frame) const;
+    void update_follow_folder();
+    void render_follow_controls();
+
+    // 帧信息表：后台扫描当前目录的 FITS 头（带磁盘索引），排序 / 过滤后驱动序列浏览
+    void update_headers();
+    void render_frame_table();
+    void sort_frame_table();
+    std::string sequence_directory() const;
+
+    // 导出分两段：GL 线程渲染 + 发起 PBO 异步读回（export_image），
+    // 读回完成后交给 ExportQueue 在后台线程编码写文件（update_exports 每帧推进）
+    void export_image();
+    bool export_readbacks_full() const;
+    void export_fits(const std::string& path);
+    void update_exports();
+    void render_export_status();
+
+    // 性能统计窗口（F3）
+    void render_profiler();
 
     // 文件对话框
     void open_file_dialog();
     void render_file_dialog();
     void refresh_file_list();
+    void update_file_list();
+    void render_file_table();
+
+    // 文件对话框的缩略图网格：后台生成 + 磁盘缓存，UI 线程每帧只上传少量已完成的纹理
+    void render_thumbnail_grid();
+    void update_thumbnails();
+    void clear_thumbnails();
+
+private:
+    // 当前 UI 参数对应的 CPU 显示参数（与 shader 一致）
+    StretchParams current_stretch_params() const;
+
+    // 当前图像实际使用的 Bayer 排列：允许时用头里的，否则用下拉框
+    BayerPattern effective_bayer() const;
 
 private:
-    // 图像数据（RAW FITS）
-    FitsImage _fits;           // raw 里是 Bayer / 灰度
+    // 图像数据（RAW FITS），共享给后台导出任务，重新加载时不影响正在写的任务
+    std::shared_ptr<const FitsImage> _fits;   // raw 里是 Bayer / 灰度
     bool _hasImage = false;
 
     // auto stretch 结果黑/白点（0~1），供 GPU 和未来可能的 CPU 使用
@@ -53,6 +168,7 @@ private:
     float _whiteClip        = 0.1f;   // %
     float _stretchStrength  = 5.0f;   // arcsinh / log 强度
     BayerPattern _bayerHint = BayerPattern::RGGB;
+    bool  _bayerFromHeader  = true;
 
     // 拉伸模式：0 线性，1 arcsinh，2 log，3 sqrt
     int   _stretchMode      = 1;     // 默认 arcsinh
@@ -77,14 +193,168 @@ private:
     std::vector<float> _histogram;
 
     // 导出状态
+    int         _exportFormat = 0;     // ExportFormat
+    int         _exportLevel  = 6;     // zlib 压缩级别 1~9
+    float       _exportScale = 1.0f;   // 导出尺寸相对原图的比例
+    bool        _exportFitsStretch = false;  // FITS：写拉伸后的 0~1 数据，否则线性 ADU
     std::string _lastExportPath;
     bool        _exportJustSucceeded = false;
+    bool        _exportJustFailed    = false;
+
+    // 已发起读回、还没编码完成的导出；编码完成前 readback 的映射内存必须保持有效。
+    // 每个 GPU 导出占一整幅读回（输出宽 x 高 x 3 x 1 或 2 字节，60 MP RGB16 约 360 MB），
+    // 同时最多 kMaxExportReadbacks 个，峰值内存也就有上限；FITS 导出不读回，不受这个限制
+    struct PendingExport
+    {
+        ExportReadback readback;
+        ExportJob      job;
+        bool           submitted = false;
+    };
+    static constexpr int       kMaxExportReadbacks = 2;
+    std::vector<PendingExport> _pendingExports;
+    ExportQueue                _exportQueue;
+    int                        _nextExportId = 1;
+
+    // 序列浏览 + 预取
+    FramePrefetcher          _prefetcher;
+    std::vector<std::string> _sequence;
+    int                      _sequenceIndex    = -1;
+    int                      _pendingFrame     = -1;   // 已请求、还没解码完的帧
+    int                      _prefetchAhead    = 2;
+    int                      _prefetchBehind   = 1;
+    int                      _prefetchBudgetMB = 2048;
+
+    // 闪烁播放
+    BlinkPlayer _blink;
+    bool        _blinkLoading  = false;
+    int         _blinkStart    = 0;      // 从序列的哪一帧开始（参考帧）
+    int         _blinkQueued   = 0;      // 已经处理（上传或跳过）的帧数
+    int         _blinkBudgetMB = 2048;
+    float       _blinkFps      = 15.0f;
+
+    // 校准主帧（下标 0 bias, 1 dark, 2 flat）
+    std::string                        _calPath[3];
+    CalibrationFrame                   _calMaster[3];
+    bool                               _calUse[3] = {true, true, true};
+    bool                               _calScaleDark = true;
+    std::shared_ptr<const Calibration> _calibration;
+    std::string                        _calError;
+    bool                               _frameCalibrated = false;   // 当前显示的帧是否已校准
+    bool                               _calOnGpu = false;
+    bool                               _prefetchCalibrated = false;   // 预取线程里是否在做 CPU 校准
+    double                             _frameRawMin = 0.0;         // 当前帧的归一化范围（GPU 校准还原 ADU 用）
+    double                             _frameRawMax = 1.0;
+
+    // 坏点 / 热点修正
+    bool                                    _cosmeticEnabled = false;
+    float                                   _cosmeticHot     = 5.0f;
+    float                                   _cosmeticCold    = 0.0f;    // 0 为不修暗点
+    bool                                    _cosmeticDarkMap = false;   // 用 master dark 生成的坏点表（只在 CPU 模式）
+    size_t                                  _cosmeticDefects = 0;       // 坏点表里的像素数
+    std::shared_ptr<const CosmeticSettings> _prefetchCosmetic;          // 预取线程当前用的参数
+    float                                   _frameNoise = 0.0f;         // 当前帧的噪声（归一化单位，GPU 判定用）
+
+    // 背景梯度
+    int             _bgMode   = (int)BackgroundMode::Off;
+    int             _bgDegree = 2;
+    BackgroundModel _bgModel;           // 当前帧的拟合结果
+    std::string     _bgError;
+
+    // 找星
+    bool                                     _starDetect  = false;
+    bool                                     _starOverlay = true;
+    float                                    _starSigma   = 5.0f;
+    std::shared_ptr<const StarDetectOptions> _starOptions;   // 为空时不找
+    std::shared_ptr<const StarField>         _stars;         // 当前帧的结果
+
+    // 天球坐标
+    Wcs         _wcs;                    // 当前帧头里的 WCS
+    std::string _wcsError;               // 有 WCS 关键字但解析不了的原因
+    bool        _wcsGrid = false;        // 画赤经 / 赤纬网格
+    SkyGrid     _skyGrid;                // 当前视图下的网格，点已换成视图坐标
+    float       _skyGridView[7] = {};    // 生成网格时的缩放 / 平移 / 视图尺寸 / Bayer 翻转，变了才重新生成
+    bool        _skyGridDirty = true;    // 换帧 / 对齐变了
+
+    // 对齐
+    bool                                          _alignEnabled = false;
+    std::string                                   _alignRefPath;
+    std::shared_ptr<const StarField>              _alignRef;     // 为空时下一帧成为参考帧
+    std::unordered_map<std::string, Registration> _alignCache;   // 当前参考帧下各帧的结果
+    std::shared_ptr<const AlignTarget>            _prefetchAlign; // 交给预取线程的参考帧（后台顺带匹配）
+    Registration                                  _frameAlign;   // 当前帧
+
+    // 叠加
+    StackRunner _stacker;
+    int         _stackMethod    = (int)StackMethod::SigmaClip;
+    float       _stackSigmaLow  = 3.0f;
+    float       _stackSigmaHigh = 3.0f;
+    bool        _stackNormalize = true;
+    std::string _stackOutPath;          // 为空时写到第一帧所在目录
+    std::string _stackTarget;           // 正在叠加的输出路径
+    std::string _stackStatus;
+
+    // 实时叠加
+    LiveStacker _liveStacker;
+    std::string _liveDir;               // 为空时用当前文件所在目录
+    int         _liveMethod          = (int)LiveStackMethod::SigmaClip;
+    float       _liveSigma           = 3.0f;
+    bool        _liveNormalize       = true;
+    bool        _liveIncludeExisting = false;
+    std::string _liveError;
+
+    // 跟随目录
+    bool           _followFolder = false;
+    CaptureWatcher _followWatcher;
+    std::string    _followTarget;           // 最近一个新帧的路径（在解码或已显示）
+    std::string    _followError;
+    bool           _statsPending = false;   // 异步统计还没读回
+
+    // 帧信息表
+    HeaderIndexer            _headerIndexer;
+    std::vector<FrameHeader> _headers;
+    std::string              _headersDir;          // _headers 对应的目录（扫描请求发出时就设置）
+    std::vector<int>         _headerOrder;         // 过滤 + 排序后的行 -> _headers 下标
+    bool                     _headerOrderDirty = true;
+    int                      _headerSortColumn = 0;
+    bool                     _headerSortAscending = true;
+    std::string              _headerFilter;
+    bool                     _showFrameTable = false;
+
+    // 性能统计
+    bool        _showProfiler = false;
+    std::string _lastTracePath;
 
     // 文件对话框
     bool _showFileDialog    = false;
     std::string _fileDialogDir;
-    std::vector<std::string> _fileEntries;
+    std::vector<DirEntry> _fileEntries;      // 按名字排序，元数据在列目录时取好
     bool _fileListDirty     = true;
 
+    // 后台列目录 + 目录监视（有变化才增量更新 / 重新列）
+    DirectoryLister          _dirLister;
+    DirectoryWatcher         _dirWatcher;
+    bool                     _dirListing      = false;   // 全量列目录进行中
+    bool                     _dirProgressive  = true;    // 新目录边列边显示；重新列时先攒好再替换
+    std::vector<DirEntry>    _dirStaging;
+    std::vector<std::string> _dirChangedNames;
+    bool                     _dirRescan       = false;
+    double                   _dirChangeTime   = -1.0;   // 最近一次变化事件，稍等事件平息再处理
+    std::string              _dirError;
+
+    // 缩略图
+    struct ThumbEntry
+    {
+        unsigned int texture  = 0;
+        int          width    = 0;
+        int          height   = 0;
+        int          state    = 0;   // 0: 未请求, 1: 生成中, 2: 完成, 3: 失败
+        uint64_t     lastUsed = 0;   // 最后一次显示的 UI 帧号
+    };
+    ThumbnailCache                              _thumbCache;
+    std::unordered_map<std::string, ThumbEntry> _thumbs;
+    bool                                        _fileDialogThumbs = true;
+    int                                         _thumbCellSize    = 128;
+    uint64_t                                    _uiFrame          = 0;
+
     struct GLFWwindow* _window = nullptr;
 };
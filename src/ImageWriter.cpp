@@ -0,0 +1,654 @@
+#include "ImageWriter.h"
+
+#include <zlib.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+const char* export_format_extension(ExportFormat fmt)
+{
+    switch (fmt)
+    {
+        case ExportFormat::PNG8:
+        case ExportFormat::PNG16:
+            return ".png";
+        case ExportFormat::TIFF16:
+        case ExportFormat::TIFF16Deflate:
+            return ".tif";
+        case ExportFormat::FITS32:
+            return ".fits";
+    }
+    return ".png";
+}
+
+int export_format_bit_depth(ExportFormat fmt)
+{
+    if (fmt == ExportFormat::FITS32)
+        return 32;
+    return fmt == ExportFormat::PNG8 ? 8 : 16;
+}
+
+static void put_be32(unsigned char* p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)(v);
+}
+
+// 本机字节序的 uint16 行 -> 指定字节序的字节流
+static void copy_u16_row(const void* src, unsigned char* dst, size_t samples, bool bigEndian)
+{
+    const uint16_t* s = static_cast<const uint16_t*>(src);
+    if (bigEndian)
+    {
+        for (size_t i = 0; i < samples; ++i)
+        {
+            dst[2 * i + 0] = (unsigned char)(s[i] >> 8);
+            dst[2 * i + 1] = (unsigned char)(s[i] & 0xFF);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < samples; ++i)
+        {
+            dst[2 * i + 0] = (unsigned char)(s[i] & 0xFF);
+            dst[2 * i + 1] = (unsigned char)(s[i] >> 8);
+        }
+    }
+}
+
+// ====================== PNG ======================
+
+static const size_t kPngStripeBytes = 512 * 1024;   // 每条带的目标原始字节数
+
+PngWriter::~PngWriter()
+{
+    release();
+}
+
+void PngWriter::release()
+{
+    if (_fp)
+    {
+        fclose(_fp);
+        _fp = nullptr;
+    }
+    _pending.clear();
+    _pending.shrink_to_fit();
+}
+
+bool PngWriter::open(const std::string& path, int width, int height,
+                     int channels, int bitDepth, const ImageWriterOptions& options)
+{
+    release();
+
+    if (width <= 0 || height <= 0 ||
+        (channels != 1 && channels != 3 && channels != 4) ||
+        (bitDepth != 8 && bitDepth != 16))
+    {
+        std::cerr << "PngWriter: unsupported image layout\n";
+        return false;
+    }
+
+    _fp = fopen(path.c_str(), "wb");
+    if (!_fp)
+    {
+        std::cerr << "PngWriter: cannot open " << path << "\n";
+        return false;
+    }
+
+    _width       = width;
+    _height      = height;
+    _bitDepth    = bitDepth;
+    _bpp         = channels * bitDepth / 8;
+    _rowBytes    = (size_t)width * _bpp;
+    _rowsWritten = 0;
+    _level       = std::clamp(options.level, 1, 9);
+
+    int hw = (int)std::thread::hardware_concurrency();
+    _threads = options.threads > 0 ? options.threads : std::max(1, hw);
+
+    _stripeRows  = (int)std::max<size_t>(16, kPngStripeBytes / _rowBytes);
+    _stripeRows  = std::min(_stripeRows, height);
+    _pendingRows = 0;
+    _adler       = adler32(0L, Z_NULL, 0);
+    _headerDone  = false;
+
+    _pending.assign(_rowBytes * (size_t)_stripeRows * _threads, 0);
+    _prevRow.assign(_rowBytes, 0);
+
+    static const unsigned char sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (fwrite(sig, 1, 8, _fp) != 8)
+    {
+        release();
+        return false;
+    }
+
+    unsigned char ihdr[13];
+    put_be32(ihdr + 0, (uint32_t)width);
+    put_be32(ihdr + 4, (uint32_t)height);
+    ihdr[8]  = (unsigned char)bitDepth;
+    ihdr[9]  = (unsigned char)(channels == 1 ? 0 : (channels == 3 ? 2 : 6));
+    ihdr[10] = 0;   // deflate
+    ihdr[11] = 0;   // 自适应滤波
+    ihdr[12] = 0;   // 不隔行
+    if (!writeChunk("IHDR", ihdr, sizeof(ihdr)))
+    {
+        release();
+        return false;
+    }
+    return true;
+}
+
+bool PngWriter::writeChunk(const char type[4], const unsigned char* data, size_t size)
+{
+    unsigned char hdr[8];
+    put_be32(hdr, (uint32_t)size);
+    std::memcpy(hdr + 4, type, 4);
+
+    uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(type), 4);
+    if (size > 0)
+        crc = crc32(crc, data, (uInt)size);
+    unsigned char crcBuf[4];
+    put_be32(crcBuf, (uint32_t)crc);
+
+    if (fwrite(hdr, 1, 8, _fp) != 8)
+        return false;
+    if (size > 0 && fwrite(data, 1, size, _fp) != size)
+        return false;
+    return fwrite(crcBuf, 1, 4, _fp) == 4;
+}
+
+static inline unsigned char paeth(int a, int b, int c)
+{
+    int p  = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return (unsigned char)a;
+    if (pb <= pc) return (unsigned char)b;
+    return (unsigned char)c;
+}
+
+// 一行自适应滤波：挑选绝对值和最小的滤波器（与 libpng 默认启发式一致）
+// out 长度 n + 1，首字节为滤波类型
+static void filter_row(const unsigned char* cur, const unsigned char* prev,
+                       size_t n, size_t bpp,
+                       unsigned char* out, unsigned char* trial)
+{
+    unsigned long bestSum = ~0UL;
+    for (int type = 0; type < 5; ++type)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            int a = i >= bpp ? cur[i - bpp] : 0;
+            int b = prev[i];
+            int c = i >= bpp ? prev[i - bpp] : 0;
+            int pred = 0;
+            switch (type)
+            {
+                case 1: pred = a; break;
+                case 2: pred = b; break;
+                case 3: pred = (a + b) >> 1; break;
+                case 4: pred = paeth(a, b, c); break;
+                default: break;
+            }
+            trial[i] = (unsigned char)(cur[i] - pred);
+        }
+
+        unsigned long sum = 0;
+        for (size_t i = 0; i < n; ++i)
+            sum += (unsigned long)std::abs((int)(signed char)trial[i]);
+
+        if (sum < bestSum)
+        {
+            bestSum = sum;
+            out[0] = (unsigned char)type;
+            std::memcpy(out + 1, trial, n);
+        }
+    }
+}
+
+namespace
+{
+    // 单个条带的编码结果
+    struct PngStripe
+    {
+        std::vector<unsigned char> data;   // raw deflate 字节
+        unsigned long adler  = 1;
+        size_t        length = 0;          // 滤波后的未压缩字节数
+        bool          ok     = false;
+    };
+
+    // 滤波 + raw deflate 一个条带；prevRow 是条带第一行的上一行
+    void encode_png_stripe(const unsigned char* rows, int nrows,
+                           const unsigned char* prevRow,
+                           size_t rowBytes, size_t bpp,
+                           int level, bool last, PngStripe& out)
+    {
+        std::vector<unsigned char> filtered((rowBytes + 1) * (size_t)nrows);
+        std::vector<unsigned char> trial(rowBytes);
+        for (int r = 0; r < nrows; ++r)
+        {
+            const unsigned char* cur  = rows + (size_t)r * rowBytes;
+            const unsigned char* prev = r == 0 ? prevRow : cur - rowBytes;
+            filter_row(cur, prev, rowBytes, bpp, filtered.data() + (size_t)r * (rowBytes + 1), trial.data());
+        }
+
+        out.length = filtered.size();
+        out.adler  = adler32(adler32(0L, Z_NULL, 0), filtered.data(), (uInt)filtered.size());
+
+        z_stream zs{};
+        if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return;
+
+        // Z_SYNC_FLUSH 额外输出一个空的 stored block（最多 5 字节）
+        out.data.resize(deflateBound(&zs, (uLong)filtered.size()) + 16);
+        zs.next_in   = filtered.data();
+        zs.avail_in  = (uInt)filtered.size();
+        zs.next_out  = out.data.data();
+        zs.avail_out = (uInt)out.data.size();
+
+        int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        out.ok = last ? (ret == Z_STREAM_END) : (ret == Z_OK && zs.avail_in == 0);
+        out.data.resize(out.data.size() - zs.avail_out);
+        deflateEnd(&zs);
+    }
+}
+
+bool PngWriter::writeRow(const void* row)
+{
+    if (!_fp || _rowsWritten >= _height)
+        return false;
+
+    unsigned char* dst = _pending.data() + (size_t)_pendingRows * _rowBytes;
+    if (_bitDepth == 16)
+        copy_u16_row(row, dst, _rowBytes / 2, true);
+    else
+        std::memcpy(dst, row, _rowBytes);
+
+    ++_pendingRows;
+    ++_rowsWritten;
+
+    if (_pendingRows == _stripeRows * _threads || _rowsWritten == _height)
+        return encodePending();
+    return true;
+}
+
+bool PngWriter::encodePending()
+{
+    if (_pendingRows == 0)
+        return true;
+
+    const bool lastBatch = (_rowsWritten == _height);
+    const int  nStripes  = (_pendingRows + _stripeRows - 1) / _stripeRows;
+
+    std::vector<PngStripe> stripes(nStripes);
+    auto encode = [&](int i) {
+        int first = i * _stripeRows;
+        int rows  = std::min(_stripeRows, _pendingRows - first);
+        const unsigned char* data = _pending.data() + (size_t)first * _rowBytes;
+        const unsigned char* prev = first == 0 ? _prevRow.data() : data - _rowBytes;
+        encode_png_stripe(data, rows, prev, _rowBytes, (size_t)_bpp, _level,
+                          lastBatch && i == nStripes - 1, stripes[i]);
+    };
+
+    // 第 0 条带在当前线程做，其余各开一个线程
+    std::vector<std::thread> workers;
+    for (int i = 1; i < nStripes; ++i)
+        workers.emplace_back(encode, i);
+    encode(0);
+    for (auto& t : workers)
+        t.join();
+
+    if (!_headerDone)
+    {
+        // zlib 头：CMF = deflate + 32K 窗口，FLG 带压缩级别提示并满足 FCHECK
+        unsigned char cmf = 0x78;
+        unsigned char flg = (unsigned char)((_level <= 1 ? 0 : (_level < 6 ? 1 : (_level == 6 ? 2 : 3))) << 6);
+        flg = (unsigned char)(flg + (31 - ((cmf * 256 + flg) % 31)) % 31);
+        const unsigned char zhdr[2] = {cmf, flg};
+        if (!writeChunk("IDAT", zhdr, 2))
+            return false;
+        _headerDone = true;
+    }
+
+    for (const PngStripe& st : stripes)
+    {
+        if (!st.ok)
+        {
+            std::cerr << "PngWriter: deflate failed\n";
+            return false;
+        }
+        if (!st.data.empty() && !writeChunk("IDAT", st.data.data(), st.data.size()))
+            return false;
+        _adler = adler32_combine(_adler, st.adler, (z_off_t)st.length);
+    }
+
+    std::memcpy(_prevRow.data(), _pending.data() + (size_t)(_pendingRows - 1) * _rowBytes, _rowBytes);
+    _pendingRows = 0;
+
+    if (lastBatch)
+    {
+        unsigned char trailer[4];
+        put_be32(trailer, (uint32_t)_adler);
+        if (!writeChunk("IDAT", trailer, 4))
+            return false;
+    }
+    return true;
+}
+
+bool PngWriter::close()
+{
+    if (!_fp)
+        return false;
+
+    bool ok = _rowsWritten == _height && _pendingRows == 0;
+    if (ok)
+        ok = writeChunk("IEND", nullptr, 0);
+
+    if (fflush(_fp) != 0)
+        ok = false;
+    release();
+    return ok;
+}
+
+// ====================== TIFF ======================
+
+static const size_t kTiffStripBytes = 256 * 1024;
+
+TiffWriter::~TiffWriter()
+{
+    release();
+}
+
+void TiffWriter::release()
+{
+    if (_fp)
+    {
+        fclose(_fp);
+        _fp = nullptr;
+    }
+}
+
+bool TiffWriter::open(const std::string& path, int width, int height,
+                      int channels, int bitDepth, bool deflate, int level)
+{
+    release();
+
+    if (width <= 0 || height <= 0 ||
+        (channels != 1 && channels != 3) ||
+        (bitDepth != 8 && bitDepth != 16))
+    {
+        std::cerr << "TiffWriter: unsupported image layout\n";
+        return false;
+    }
+
+    _fp = fopen(path.c_str(), "wb");
+    if (!_fp)
+    {
+        std::cerr << "TiffWriter: cannot open " << path << "\n";
+        return false;
+    }
+
+    _width       = width;
+    _height      = height;
+    _channels    = channels;
+    _bitDepth    = bitDepth;
+    _deflate     = deflate;
+    _level       = std::clamp(level, 1, 9);
+    _rowBytes    = (size_t)width * channels * (bitDepth / 8);
+    _rowsPerStrip = (int)std::max<size_t>(1, kTiffStripBytes / _rowBytes);
+    _rowsPerStrip = std::min(_rowsPerStrip, height);
+    _rowsWritten = 0;
+
+    _strip.clear();
+    _strip.reserve(_rowBytes * _rowsPerStrip);
+    _stripOffsets.clear();
+    _stripByteCounts.clear();
+
+    // 头：小端 + 魔数 42 + IFD 偏移（结尾回填）
+    const unsigned char header[8] = {'I', 'I', 42, 0, 0, 0, 0, 0};
+    if (fwrite(header, 1, 8, _fp) != 8)
+    {
+        release();
+        return false;
+    }
+    _fileOffset = 8;
+    return true;
+}
+
+bool TiffWriter::writeRow(const void* row)
+{
+    if (!_fp || _rowsWritten >= _height)
+        return false;
+
+    size_t off = _strip.size();
+    _strip.resize(off + _rowBytes);
+    if (_bitDepth == 16)
+        copy_u16_row(row, _strip.data() + off, _rowBytes / 2, false);
+    else
+        std::memcpy(_strip.data() + off, row, _rowBytes);
+
+    ++_rowsWritten;
+
+    int rowsInStrip = (int)(_strip.size() / _rowBytes);
+    if (rowsInStrip == _rowsPerStrip || _rowsWritten == _height)
+        return flushStrip();
+    return true;
+}
+
+bool TiffWriter::flushStrip()
+{
+    if (_strip.empty())
+        return true;
+
+    const unsigned char* data = _strip.data();
+    size_t size = _strip.size();
+
+    if (_deflate)
+    {
+        // 水平差分预测（Predictor = 2），从右往左原地做，按样本而不是字节
+        size_t rows = _strip.size() / _rowBytes;
+        size_t samplesPerRow = (size_t)_width * _channels;
+        for (size_t r = 0; r < rows; ++r)
+        {
+            unsigned char* p = _strip.data() + r * _rowBytes;
+            if (_bitDepth == 16)
+            {
+                for (size_t i = samplesPerRow - 1; i >= (size_t)_channels; --i)
+                {
+                    uint16_t v = (uint16_t)(p[2 * i] | (p[2 * i + 1] << 8));
+                    size_t j = i - _channels;
+                    uint16_t u = (uint16_t)(p[2 * j] | (p[2 * j + 1] << 8));
+                    uint16_t d = (uint16_t)(v - u);
+                    p[2 * i]     = (unsigned char)(d & 0xFF);
+                    p[2 * i + 1] = (unsigned char)(d >> 8);
+                }
+            }
+            else
+            {
+                for (size_t i = samplesPerRow - 1; i >= (size_t)_channels; --i)
+                    p[i] = (unsigned char)(p[i] - p[i - _channels]);
+            }
+        }
+
+        uLongf zsize = compressBound((uLong)size);
+        _zout.resize(zsize);
+        if (compress2(_zout.data(), &zsize, data, (uLong)size, _level) != Z_OK)
+        {
+            std::cerr << "TiffWriter: deflate failed\n";
+            return false;
+        }
+        data = _zout.data();
+        size = zsize;
+    }
+
+    if (_fileOffset + size > 0xFFFFFFFFull)
+    {
+        std::cerr << "TiffWriter: file exceeds 4 GB (classic TIFF limit)\n";
+        return false;
+    }
+    if (fwrite(data, 1, size, _fp) != size)
+        return false;
+
+    _stripOffsets.push_back((uint32_t)_fileOffset);
+    _stripByteCounts.push_back((uint32_t)size);
+    _fileOffset += size;
+    _strip.clear();
+    return true;
+}
+
+namespace
+{
+    struct TiffEntry
+    {
+        uint16_t tag;
+        uint16_t type;    // 3: SHORT, 4: LONG
+        uint32_t count;
+        uint32_t value;   // 内联值或偏移
+    };
+
+    void put_le16(std::vector<unsigned char>& b, uint16_t v)
+    {
+        b.push_back((unsigned char)(v & 0xFF));
+        b.push_back((unsigned char)(v >> 8));
+    }
+
+    void put_le32(std::vector<unsigned char>& b, uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+            b.push_back((unsigned char)((v >> (8 * i)) & 0xFF));
+    }
+}
+
+bool TiffWriter::close()
+{
+    if (!_fp)
+        return false;
+
+    bool ok = _rowsWritten == _height && _strip.empty();
+
+    // IFD 之后的附加数组：BitsPerSample / StripOffsets / StripByteCounts
+    std::vector<unsigned char> extra;
+    if (_fileOffset & 1)
+        extra.push_back(0);   // 保证按字对齐
+
+    auto longArray = [&](const std::vector<uint32_t>& v, TiffEntry& e) {
+        e.type  = 4;
+        e.count = (uint32_t)v.size();
+        if (v.size() == 1)
+        {
+            e.value = v[0];
+            return;
+        }
+        e.value = (uint32_t)(_fileOffset + extra.size());
+        for (uint32_t x : v)
+            put_le32(extra, x);
+    };
+
+    TiffEntry bits{258, 3, (uint32_t)_channels, (uint32_t)_bitDepth};
+    if (_channels > 2)
+    {
+        bits.value = (uint32_t)(_fileOffset + extra.size());
+        for (int c = 0; c < _channels; ++c)
+            put_le16(extra, (uint16_t)_bitDepth);
+    }
+
+    TiffEntry offsets{273, 4, 0, 0};
+    TiffEntry counts{279, 4, 0, 0};
+    longArray(_stripOffsets, offsets);
+    longArray(_stripByteCounts, counts);
+
+    if (extra.size() & 1)
+        extra.push_back(0);
+    uint64_t ifdOffset = _fileOffset + extra.size();
+
+    std::vector<TiffEntry> entries = {
+        {256, 4, 1, (uint32_t)_width},
+        {257, 4, 1, (uint32_t)_height},
+        bits,
+        {259, 3, 1, _deflate ? 8u : 1u},
+        {262, 3, 1, _channels == 1 ? 1u : 2u},
+        offsets,
+        {277, 3, 1, (uint32_t)_channels},
+        {278, 4, 1, (uint32_t)_rowsPerStrip},
+        counts,
+        {284, 3, 1, 1u},
+    };
+    if (_deflate)
+        entries.push_back({317, 3, 1, 2u});
+
+    std::vector<unsigned char> ifd;
+    put_le16(ifd, (uint16_t)entries.size());
+    for (const TiffEntry& e : entries)
+    {
+        put_le16(ifd, e.tag);
+        put_le16(ifd, e.type);
+        put_le32(ifd, e.count);
+        if (e.type == 3 && e.count == 1)
+        {
+            put_le16(ifd, (uint16_t)e.value);
+            put_le16(ifd, 0);
+        }
+        else
+        {
+            put_le32(ifd, e.value);
+        }
+    }
+    put_le32(ifd, 0);   // 没有下一个 IFD
+
+    if (ifdOffset + ifd.size() > 0xFFFFFFFFull)
+        ok = false;
+
+    if (ok && fwrite(extra.data(), 1, extra.size(), _fp) != extra.size())
+        ok = false;
+    if (ok && fwrite(ifd.data(), 1, ifd.size(), _fp) != ifd.size())
+        ok = false;
+
+    if (ok)
+    {
+        unsigned char off[4];
+        for (int i = 0; i < 4; ++i)
+            off[i] = (unsigned char)((ifdOffset >> (8 * i)) & 0xFF);
+        ok = fseek(_fp, 4, SEEK_SET) == 0 && fwrite(off, 1, 4, _fp) == 4;
+    }
+
+    if (fflush(_fp) != 0)
+        ok = false;
+    release();
+    return ok;
+}
+
+// ====================== 工厂 ======================
+
+std::unique_ptr<ImageRowWriter> open_image_writer(const std::string& path,
+                                                  ExportFormat fmt,
+                                                  int width, int height,
+                                                  const ImageWriterOptions& options)
+{
+    int bitDepth = export_format_bit_depth(fmt);
+
+    if (fmt == ExportFormat::PNG8 || fmt == ExportFormat::PNG16)
+    {
+        auto w = std::make_unique<PngWriter>();
+        if (!w->open(path, width, height, 3, bitDepth, options))
+            return nullptr;
+        return w;
+    }
+
+    if (fmt == ExportFormat::FITS32)
+    {
+        std::cerr << "open_image_writer: FITS output is written by FitsWriter\n";
+        return nullptr;
+    }
+
+    auto w = std::make_unique<TiffWriter>();
+    if (!w->open(path, width, height, 3, bitDepth,
+                 fmt == ExportFormat::TIFF16Deflate, options.level))
+        return nullptr;
+    return w;
+}
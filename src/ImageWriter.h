@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// 导出文件格式
+enum class ExportFormat {
+    PNG8          = 0,
+    PNG16         = 1,
+    TIFF16        = 2,   // 不压缩
+    TIFF16Deflate = 3,   // Deflate + 水平差分预测
+    FITS32        = 4    // 32 bit 浮点 FITS，CPU 从 RAW 处理，见 FitsWriter.h
+};
+
+const char* export_format_extension(ExportFormat fmt);
+int         export_format_bit_depth(ExportFormat fmt);
+
+// 逐行流式写出交错 RGB 图像：调用方按自上而下的顺序喂行数据，
+// 写入器只缓存一两行 + 压缩缓冲，内存占用和图像高度无关。
+// 16 bit 行数据为本机字节序的 uint16，写入器负责转成文件要求的字节序。
+class ImageRowWriter
+{
+public:
+    virtual ~ImageRowWriter() = default;
+
+    virtual bool writeRow(const void* row) = 0;
+
+    // 写完所有行后调用；行数不足或写盘失败返回 false
+    virtual bool close() = 0;
+};
+
+// 编码参数：速度/体积旋钮
+struct ImageWriterOptions
+{
+    int level   = 6;   // zlib 压缩级别 1~9，越小越快
+    int threads = 0;   // PNG 编码线程数，0 = 硬件线程数
+};
+
+// 并行 PNG 编码：行先攒成若干条带（stripe），每条带在独立线程里做滤波 + raw deflate，
+// 非最后一条带以 Z_SYNC_FLUSH 结束（字节对齐、不置 final 位），按顺序拼成同一个 zlib 流，
+// adler32 用 adler32_combine 合并。内存只占 threads 条带，和图像高度无关。
+class PngWriter : public ImageRowWriter
+{
+public:
+    PngWriter() = default;
+    ~PngWriter() override;
+
+    PngWriter(const PngWriter&) = delete;
+    PngWriter& operator=(const PngWriter&) = delete;
+
+    // bitDepth: 8 / 16
+    bool open(const std::string& path, int width, int height,
+              int channels, int bitDepth,
+              const ImageWriterOptions& options = ImageWriterOptions());
+
+    bool writeRow(const void* row) override;
+    bool close() override;
+
+private:
+    bool encodePending();
+    bool writeChunk(const char type[4], const unsigned char* data, size_t size);
+    void release();
+
+private:
+    FILE* _fp          = nullptr;
+    int   _width       = 0;
+    int   _height      = 0;
+    int   _rowsWritten = 0;
+    int   _bpp         = 0;         // 每像素字节数
+    int   _bitDepth    = 8;
+    int   _level       = 6;
+    int   _threads     = 1;
+    int   _stripeRows  = 0;
+
+    size_t        _rowBytes  = 0;
+    int           _pendingRows = 0;
+    unsigned long _adler       = 1;     // 整个 zlib 流的 adler32
+    bool          _headerDone  = false; // zlib 头（2 字节）是否已写
+
+    std::vector<unsigned char> _pending;   // 待编码的行（已转成大端），threads * stripeRows 行
+    std::vector<unsigned char> _prevRow;   // _pending 第一行之前的那一行（滤波用）
+};
+
+class TiffWriter : public ImageRowWriter
+{
+public:
+    TiffWriter() = default;
+    ~TiffWriter() override;
+
+    TiffWriter(const TiffWriter&) = delete;
+    TiffWriter& operator=(const TiffWriter&) = delete;
+
+    // 基线 TIFF（小端、交错 RGB），deflate 时每个 strip 是独立的 zlib 流
+    bool open(const std::string& path, int width, int height,
+              int channels, int bitDepth, bool deflate, int level = 6);
+
+    bool writeRow(const void* row) override;
+    bool close() override;
+
+private:
+    bool flushStrip();
+    void release();
+
+private:
+    FILE* _fp          = nullptr;
+    int   _width       = 0;
+    int   _height      = 0;
+    int   _channels    = 3;
+    int   _bitDepth    = 16;
+    bool  _deflate     = false;
+    int   _level       = 6;
+    int   _rowsPerStrip = 0;
+    int   _rowsWritten = 0;
+
+    size_t _rowBytes = 0;
+    std::vector<unsigned char> _strip;         // 当前 strip 的原始数据
+    std::vector<unsigned char> _zout;
+    std::vector<uint32_t>      _stripOffsets;
+    std::vector<uint32_t>      _stripByteCounts;
+    uint64_t                   _fileOffset = 0;
+};
+
+// 按格式创建写入器，失败返回 nullptr（FITS32 不走 RGB 行写入器）
+std::unique_ptr<ImageRowWriter> open_image_writer(const std::string& path,
+                                                  ExportFormat fmt,
+                                                  int width, int height,
+                                                  const ImageWriterOptions& options = ImageWriterOptions());
@@ -0,0 +1,431 @@
+#include "LiveStack.h"
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+
+namespace fs = std::filesystem;
+
+// 工作线程没事时多久轮询一次目录
+static const int kPollMs = 250;
+// 积压了多帧（比如 includeExisting）时，至少隔这么久给 UI 一份快照
+static const double kPublishSeconds = 5.0;
+
+static double ms_since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// 数据分成几组统计背景：Bayer 按 2x2 里的位置分 4 组，RGB 按平面分 3 组，单色 1 组
+static int background_groups(const FitsImage& img, bool cfa)
+{
+    return cfa ? 4 : img.channels;
+}
+
+// 各组的背景中值（ADU），等间隔抽样大约 4 万个点 / 组，对星点不敏感
+static void background_levels(const FitsImage& img, bool cfa, float out[4])
+{
+    const int W = img.width;
+    const int H = img.height;
+    const int step = cfa ? 2 : 1;
+    const int stride = std::max(1, (int)std::sqrt((double)W * H / (step * step) / 40000.0));
+
+    std::vector<float> samples;
+    for (int g = 0; g < background_groups(img, cfa); ++g)
+    {
+        const int     phx   = cfa ? (g & 1) : 0;
+        const int     phy   = cfa ? (g >> 1) : 0;
+        const double* plane = img.raw.data() + (cfa ? 0 : (size_t)g * W * H);
+
+        samples.clear();
+        for (int y = phy; y < H; y += step * stride)
+            for (int x = phx; x < W; x += step * stride)
+            {
+                double v = plane[(size_t)y * W + x];
+                if (std::isfinite(v))
+                    samples.push_back((float)v);
+            }
+
+        if (samples.empty())
+        {
+            out[g] = 0.0f;
+            continue;
+        }
+        auto mid = samples.begin() + samples.size() / 2;
+        std::nth_element(samples.begin(), mid, samples.end());
+        out[g] = *mid;
+    }
+}
+
+LiveStacker::~LiveStacker()
+{
+    stop();
+}
+
+bool LiveStacker::start(const std::string& dir, const LiveStackOptions& options)
+{
+    stop();
+
+    if (!_watcher.start(dir, options.includeExisting))
+        return false;
+
+    _dir     = dir;
+    _options = options;
+    {
+        std::lock_guard<std::mutex> lock(_stopMutex);
+        _stop = false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _status = LiveStackStatus();
+        _latest.reset();
+    }
+
+    _width = _height = 0;
+    _refStars.reset();
+    _refCards.clear();
+    _mean.clear();
+    _m2.clear();
+    _count.clear();
+
+    _running = true;
+    _worker = std::thread([this] { run(); });
+    return true;
+}
+
+void LiveStacker::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_stopMutex);
+        _stop = true;
+    }
+    _stopCv.notify_all();
+    if (_worker.joinable())
+        _worker.join();
+    _running = false;
+    _watcher.stop();
+
+    // 累加缓冲可能有几百 MB，停下就释放（最后一份快照还在 UI 那边）
+    std::vector<float>().swap(_mean);
+    std::vector<float>().swap(_m2);
+    std::vector<uint16_t>().swap(_count);
+}
+
+LiveStackStatus LiveStacker::status() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _status;
+}
+
+bool LiveStacker::poll(std::shared_ptr<const DecodedFrame>& frame)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_latest)
+        return false;
+    frame = std::move(_latest);
+    _latest.reset();
+    return true;
+}
+
+void LiveStacker::run()
+{
+    std::vector<std::string> queue;
+    std::vector<std::string> ready;
+    auto lastPublish = std::chrono::steady_clock::now();
+    bool dirty = false;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_stopMutex);
+            if (_stop)
+                break;
+            // 队列里还有帧时不等
+            if (queue.empty())
+                _stopCv.wait_for(lock, std::chrono::milliseconds(kPollMs), [this] { return _stop; });
+            if (_stop)
+                break;
+        }
+
+        if (_watcher.poll(ready))
+            queue.insert(queue.end(), ready.begin(), ready.end());
+
+        LiveStackStatus st = status();
+        st.queued = (int)queue.size();
+
+        if (!queue.empty())
+        {
+            std::string path = queue.front();
+            queue.erase(queue.begin());
+            st.queued = (int)queue.size();
+            dirty |= process(path, st);
+        }
+
+        // 队列清空，或者积压太久时才生成快照：快照要转一遍 double + 归一化，不值得每帧都做
+        bool publishNow = dirty && (queue.empty() ||
+                          std::chrono::duration<double>(std::chrono::steady_clock::now() - lastPublish).count() >= kPublishSeconds);
+        if (publishNow)
+        {
+            publish(st);
+            lastPublish = std::chrono::steady_clock::now();
+            dirty = false;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _status = st;
+    }
+
+    _running = false;
+}
+
+bool LiveStacker::process(const std::string& path, LiveStackStatus& st)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    st.lastFile = fs::path(path).filename().string();
+
+    auto skip = [&](const std::string& why) {
+        st.skipped++;
+        st.message = st.lastFile + ": " + why;
+        std::cerr << "Live stack: skipped " << path << " (" << why << ")\n";
+        return false;
+    };
+
+    FitsImage img;
+    if (!load_fits(path, img, _options.bayer))
+        return skip("无法读取");
+    st.loadMs = ms_since(t0);
+
+    auto t1 = std::chrono::steady_clock::now();
+    std::vector<float> normalized;
+    double mn = 0.0, mx = 1.0;
+    bool calibrated = calibrate_and_normalize(img, _options.calibration.get(), _options.cosmetic.get(),
+                                              normalized, &mn, &mx);
+    st.calibrateMs = ms_since(t1);
+
+    const bool cfa = img.channels == 1 && img.bayer != BayerPattern::NONE;
+
+    auto t2 = std::chrono::steady_clock::now();
+    auto stars = std::make_shared<StarField>();
+    detect_stars(normalized.data(), img.width, img.height, img.channels, cfa, _options.stars, *stars);
+    normalized = std::vector<float>();
+
+    // 第一帧星够多就当参考帧，直接成为累加的起点
+    if (!_refStars)
+    {
+        if ((int)stars->stars.size() < _options.registration.minMatches)
+            return skip("星太少，不能作参考帧");
+
+        _width    = img.width;
+        _height   = img.height;
+        _channels = img.channels;
+        _bayer    = cfa ? img.bayer : BayerPattern::NONE;
+        _bayerFromHeader = img.bayerFromHeader;
+        _calibrated = calibrated;
+        _refCards = img.headerCards;
+        _refStars = stars;
+        background_levels(img, cfa, _refBackground);
+
+        const size_t n = img.raw.size();
+        _mean.assign(n, 0.0f);
+        _count.assign(n, 0);
+        if (_options.method == LiveStackMethod::SigmaClip)
+            _m2.assign(n, 0.0f);
+        else
+            _m2.clear();
+        st.alignMs = ms_since(t2);
+        st.lastAlign = Registration();
+        st.lastAlign.ok = true;
+        st.lastAlign.matches = (int)stars->stars.size();
+
+        auto t3 = std::chrono::steady_clock::now();
+        const double identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+        const float  zero[4] = {};
+        accumulate(img, identity, zero, st);
+        st.accumulateMs = ms_since(t3);
+        st.frames = 1;
+        st.totalMs = ms_since(t0);
+        return true;
+    }
+
+    if (img.width != _width || img.height != _height || img.channels != _channels ||
+        (cfa ? img.bayer : BayerPattern::NONE) != _bayer)
+        return skip("尺寸 / 通道 / Bayer 和参考帧不一致");
+
+    Registration reg;
+    double refToFrame[9];
+    if (!register_stars(*_refStars, *stars, _options.registration, reg) ||
+        !invert_transform(reg.toRef, refToFrame))
+    {
+        st.alignMs = ms_since(t2);
+        st.lastAlign = reg;
+        return skip("对齐失败");
+    }
+    st.alignMs = ms_since(t2);
+    st.lastAlign = reg;
+
+    auto t3 = std::chrono::steady_clock::now();
+    float offset[4] = {};
+    if (_options.normalize)
+    {
+        float bg[4];
+        background_levels(img, cfa, bg);
+        for (int g = 0; g < background_groups(img, cfa); ++g)
+            offset[g] = _refBackground[g] - bg[g];
+    }
+    accumulate(img, refToFrame, offset, st);
+    st.accumulateMs = ms_since(t3);
+    st.frames++;
+    st.totalMs = ms_since(t0);
+    return true;
+}
+
+void LiveStacker::accumulate(const FitsImage& img, const double m[9], const float offset[4], LiveStackStatus& st)
+{
+    const int  W     = _width;
+    const int  H     = _height;
+    const bool cfa   = _bayer != BayerPattern::NONE;
+    const int  step  = cfa ? 2 : 1;
+    const bool clip  = _options.method == LiveStackMethod::SigmaClip;
+    const int  warmup = std::max(3, _options.warmup);
+
+    // 剔除阈值按已累加的帧数 n 预先算好：判定 d² > thr[n] * M2（不用开方）。
+    // 均值和方差都只由 n 个样本估计，新样本的偏差服从自由度 n - 1 的 t 分布（尺度再乘 sqrt(1 + 1/n)），
+    // 直接拿正态的 sigma 当阈值在帧数少时会误剔好几个百分点，这里用 Cornish-Fisher 展开把它换成 t 分位数
+    std::vector<float> thr;
+    if (clip)
+    {
+        const double z = _options.sigma;
+        thr.resize(256);
+        for (int n = warmup; n < (int)thr.size(); ++n)
+        {
+            const double nu = n - 1;
+            const double t  = z + (z * z * z + z) / (4.0 * nu) +
+                              (5.0 * std::pow(z, 5) + 16.0 * z * z * z + 3.0 * z) / (96.0 * nu * nu);
+            thr[n] = (float)(t * t * (1.0 + 1.0 / n) / nu);
+        }
+    }
+
+    std::atomic<long long> clipped{0};
+    std::atomic<long long> samples{0};
+
+    for (int c = 0; c < _channels; ++c)
+    {
+        const double* src   = img.raw.data() + (size_t)c * W * H;
+        float*        mean  = _mean.data()  + (size_t)c * W * H;
+        float*        m2    = clip ? _m2.data() + (size_t)c * W * H : nullptr;
+        uint16_t*     count = _count.data() + (size_t)c * W * H;
+
+        parallel_for(0, H, 16, [&](int y0, int y1) {
+            long long localClipped = 0;
+            long long localSamples = 0;
+            for (int y = y0; y < y1; ++y)
+            {
+                const int phy = y & (step - 1);
+                for (int x = 0; x < W; ++x)
+                {
+                    // 参考帧像素 (x, y) 在本帧里的位置
+                    double w  = m[6] * x + m[7] * y + m[8];
+                    double fx = (m[0] * x + m[1] * y + m[2]) / w;
+                    double fy = (m[3] * x + m[4] * y + m[5]) / w;
+
+                    // 同色子格上双线性插值：Bayer 时只用和输出像素同一 CFA 位置的像素，颜色不串
+                    const int phx = x & (step - 1);
+                    double u = (fx - phx) / step;
+                    double v = (fy - phy) / step;
+                    double iu = std::floor(u);
+                    double iv = std::floor(v);
+                    int sx0 = phx + step * (int)iu;
+                    int sy0 = phy + step * (int)iv;
+                    if (sx0 < 0 || sy0 < 0 || sx0 >= W || sy0 >= H)
+                        continue;
+                    // 最后一列 / 行同色像素之外不再插值（不到一个子格的边）
+                    const int dx = sx0 + step < W ? step : 0;
+                    const int dy = sy0 + step < H ? step : 0;
+
+                    float tx = (float)(u - iu);
+                    float ty = (float)(v - iv);
+                    const double* r0 = src + (size_t)sy0 * W + sx0;
+                    const double* r1 = r0 + (size_t)dy * W;
+                    float top = (float)r0[0] + tx * (float)(r0[dx] - r0[0]);
+                    float bot = (float)r1[0] + tx * (float)(r1[dx] - r1[0]);
+                    float val = top + ty * (bot - top) + offset[cfa ? (phy * 2 + phx) : c];
+                    if (!std::isfinite(val))
+                        continue;
+
+                    const size_t i = (size_t)y * W + x;
+                    const int    n = count[i];
+                    localSamples++;
+
+                    if (clip && n >= warmup)
+                    {
+                        const float d = val - mean[i];
+                        if (d * d > thr[std::min(n, (int)thr.size() - 1)] * m2[i])
+                        {
+                            localClipped++;
+                            continue;
+                        }
+                    }
+                    if (n >= std::numeric_limits<uint16_t>::max())
+                        continue;
+
+                    // Welford：均值和平方差和一起增量更新
+                    const float d  = val - mean[i];
+                    const float mu = mean[i] + d / (float)(n + 1);
+                    if (m2)
+                        m2[i] += d * (val - mu);
+                    mean[i]  = mu;
+                    count[i] = (uint16_t)(n + 1);
+                }
+            }
+            clipped += localClipped;
+            samples += localSamples;
+        });
+    }
+
+    st.clipped = samples > 0 ? (double)clipped / (double)samples : 0.0;
+}
+
+void LiveStacker::publish(LiveStackStatus& st)
+{
+    if (_mean.empty())
+        return;
+
+    const auto t0 = std::chrono::steady_clock::now();
+
+    auto image = std::make_shared<FitsImage>();
+    image->width    = _width;
+    image->height   = _height;
+    image->channels = _channels;
+    image->bayer    = _bayer;
+    image->bayerFromHeader = _bayerFromHeader;
+    image->headerCards = _refCards;
+    image->raw.resize(_mean.size());
+
+    // 边缘没被任何帧覆盖过的像素（理论上参考帧都覆盖了）按 0 处理
+    double* dst = image->raw.data();
+    const float*    mean  = _mean.data();
+    const uint16_t* count = _count.data();
+    const int rows = (int)(_mean.size() / (size_t)_width);
+    parallel_for(0, rows, 64, [&](int y0, int y1) {
+        for (size_t i = (size_t)y0 * _width; i < (size_t)y1 * _width; ++i)
+            dst[i] = count[i] > 0 ? (double)mean[i] : 0.0;
+    });
+
+    auto frame = std::make_shared<DecodedFrame>();
+    frame->path = (fs::path(_dir) / "[live stack]").string();
+    calibrate_and_normalize(*image, nullptr, nullptr, frame->normalized, &frame->rawMin, &frame->rawMax);
+    frame->image      = image;
+    frame->calibrated = _calibrated;
+    frame->stars      = _refStars;
+    frame->bytes      = image->raw.size() * sizeof(double) + frame->normalized.size() * sizeof(float);
+
+    st.publishMs = ms_since(t0);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _latest = frame;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "CaptureWatcher.h"
+#include "FramePrefetcher.h"
+#include "Registration.h"
+#include "StarDetector.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class LiveStackMethod {
+    Mean      = 0,
+    SigmaClip = 1    // 逐像素和运行均值 / 标准差比较，超过 sigma 倍的新样本不进累加
+};
+
+struct LiveStackOptions
+{
+    LiveStackMethod method = LiveStackMethod::SigmaClip;
+    float sigma     = 3.0f;
+    int   warmup    = 5;       // 累加满这么多帧后才开始剔除（之前的方差估计不可靠）
+    bool  normalize = true;    // 按各色平面的背景中值做加性对齐（天光整晚在变）
+    bool  includeExisting = false;                  // 目录里已有的帧也叠进来
+    BayerPattern bayer = BayerPattern::NONE;        // 头里没有 CFA 关键字时用的排列
+    std::shared_ptr<const Calibration>      calibration;   // 为空时不校准
+    std::shared_ptr<const CosmeticSettings> cosmetic;      // 为空时不修坏点
+    StarDetectOptions stars;
+    RegisterOptions   registration;
+};
+
+struct LiveStackStatus
+{
+    int    frames  = 0;        // 已叠加的帧数（含参考帧）
+    int    skipped = 0;        // 读失败 / 尺寸不符 / 对不齐而跳过的帧数
+    int    queued  = 0;        // 已写完、还没处理的帧数
+    double clipped = 0.0;      // 上一帧被剔除的像素比例
+    // 上一帧各阶段耗时
+    double loadMs       = 0.0;
+    double calibrateMs  = 0.0;
+    double alignMs      = 0.0;   // 找星 + 匹配
+    double accumulateMs = 0.0;
+    double publishMs    = 0.0;   // 生成显示用的快照
+    double totalMs      = 0.0;
+    Registration lastAlign;
+    std::string  lastFile;
+    std::string  message;        // 最近一次跳过的原因
+};
+
+// 实时叠加：后台线程监视采集目录，每出现一帧写完的 FITS 就读入、校准、找星对齐到第一帧，
+// 重采样到参考帧网格后累加进 float 的运行均值（sigma clip 时再加一份 Welford 方差），
+// 不会从头重算。Bayer 数据按同色子格插值重采样，累加结果仍是 RAW 马赛克，显示照常在 shader 里去拜耳。
+// 每处理完一批就生成一份快照（raw + 归一化），UI 线程取走当成一帧显示。
+class LiveStacker
+{
+public:
+    LiveStacker() = default;
+    ~LiveStacker();
+
+    LiveStacker(const LiveStacker&) = delete;
+    LiveStacker& operator=(const LiveStacker&) = delete;
+
+    // 开始监视 dir（从零开始叠加），目录无效时返回 false
+    bool start(const std::string& dir, const LiveStackOptions& options);
+    void stop();
+
+    bool running() const { return _running.load(); }
+    const std::string& directory() const { return _dir; }
+    LiveStackStatus status() const;
+
+    // 取走最新的叠加快照（中间没被取走的旧快照直接丢弃），没有新结果时返回 false
+    bool poll(std::shared_ptr<const DecodedFrame>& frame);
+
+private:
+    void run();
+    bool process(const std::string& path, LiveStackStatus& st);
+    void accumulate(const FitsImage& img, const double refToFrame[9], const float offset[4], LiveStackStatus& st);
+    void publish(LiveStackStatus& st);
+
+private:
+    std::string      _dir;
+    LiveStackOptions _options;
+    CaptureWatcher   _watcher;    // start 之后只由工作线程使用
+
+    std::thread             _worker;
+    std::atomic<bool>       _running{false};
+    std::mutex              _stopMutex;
+    std::condition_variable _stopCv;
+    bool                    _stop = false;
+
+    mutable std::mutex                  _mutex;
+    LiveStackStatus                     _status;
+    std::shared_ptr<const DecodedFrame> _latest;
+
+    // 累加状态（只在工作线程里访问）：参考帧网格上的逐像素统计
+    int                              _width    = 0;
+    int                              _height   = 0;
+    int                              _channels = 1;
+    BayerPattern                     _bayer    = BayerPattern::NONE;
+    bool                             _bayerFromHeader = false;
+    bool                             _calibrated = false;
+    std::vector<std::string>         _refCards;
+    std::shared_ptr<const StarField> _refStars;
+    float                            _refBackground[4] = {};
+    std::vector<float>               _mean;
+    std::vector<float>               _m2;      // 只在 sigma clip 时使用
+    std::vector<uint16_t>            _count;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// 把 [begin, end) 切成连续的块，在多个线程里执行 fn(b, e)（当前线程也算一个）。
+// 块数不超过硬件线程数，每块至少 minChunk 个；总量太小时直接在当前线程执行。
+// 用于整幅图按行带处理（校准、归一化等），各块互不重叠，fn 里不需要加锁。
+template <class F>
+void parallel_for(int begin, int end, int minChunk, F&& fn)
+{
+    const int count = end - begin;
+    if (count <= 0)
+        return;
+
+    int hw     = std::max(1, (int)std::thread::hardware_concurrency());
+    int chunks = std::min(hw, std::max(1, count / std::max(1, minChunk)));
+    if (chunks <= 1)
+    {
+        fn(begin, end);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(chunks - 1);
+    for (int c = 1; c < chunks; ++c)
+    {
+        int b = begin + (int)((long long)count * c / chunks);
+        int e = begin + (int)((long long)count * (c + 1) / chunks);
+        workers.emplace_back([&fn, b, e] { fn(b, e); });
+    }
+
+    fn(begin, begin + (int)((long long)count / chunks));
+
+    for (std::thread& t : workers)
+        t.join();
+}
@@ -0,0 +1,203 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+// trace 最多保存的事件数，防止忘了停止时无限增长（约 48 MB）
+static constexpr size_t kMaxTraceEvents = 2000000;
+
+// GPU 事件在 trace 里的轨道号
+static constexpr int kGpuTrack = 1000;
+
+static int64_t steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+Profiler& Profiler::instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler()
+    : _originNs(steady_ns())
+{
+}
+
+void Profiler::setEnabled(bool enabled)
+{
+    _enabled = enabled;
+}
+
+int64_t Profiler::nowUs() const
+{
+    return (steady_ns() - _originNs) / 1000;
+}
+
+int Profiler::threadIndex()
+{
+    auto id = std::this_thread::get_id();
+    auto it = _threadIds.find(id);
+    if (it != _threadIds.end())
+        return it->second;
+    int index = (int)_threadIds.size() + 1;
+    _threadIds.emplace(id, index);
+    return index;
+}
+
+void Profiler::addSample(const char* name, bool gpu, double ms)
+{
+    Ring& ring = _stages[gpu ? std::string("GPU ") + name : std::string(name)];
+    ring.gpu = gpu;
+    ring.samples[ring.next] = (float)ms;
+    ring.next = (ring.next + 1) % kHistory;
+    ring.count = std::min(ring.count + 1, kHistory);
+}
+
+void Profiler::recordCpu(const char* name, int64_t startUs, int64_t durationUs)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_enabled)
+        return;
+
+    addSample(name, false, durationUs / 1000.0);
+
+    if (_tracing && _trace.size() < kMaxTraceEvents)
+        _trace.push_back({name, startUs, durationUs, threadIndex()});
+}
+
+void Profiler::recordGpu(const char* name, int64_t cpuStartUs, double gpuMs)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_enabled)
+        return;
+
+    addSample(name, true, gpuMs);
+
+    if (_tracing && _trace.size() < kMaxTraceEvents)
+        _trace.push_back({name, cpuStartUs, (int64_t)(gpuMs * 1000.0), kGpuTrack});
+}
+
+static double percentile_sorted(const std::vector<float>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+void Profiler::snapshot(std::vector<StageStats>& out) const
+{
+    out.clear();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<float> sorted;
+    for (const auto& [name, ring] : _stages)
+    {
+        if (ring.count == 0)
+            continue;
+
+        StageStats s;
+        s.name   = name;
+        s.gpu    = ring.gpu;
+        s.count  = ring.count;
+        s.lastMs = ring.samples[(ring.next + kHistory - 1) % kHistory];
+
+        sorted.assign(ring.samples, ring.samples + ring.count);
+        std::sort(sorted.begin(), sorted.end());
+        s.p50   = percentile_sorted(sorted, 0.50);
+        s.p95   = percentile_sorted(sorted, 0.95);
+        s.p99   = percentile_sorted(sorted, 0.99);
+        s.maxMs = sorted.back();
+        out.push_back(s);
+    }
+}
+
+void Profiler::history(const std::string& name, std::vector<float>& out) const
+{
+    out.clear();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _stages.find(name);
+    if (it == _stages.end())
+        return;
+
+    const Ring& ring = it->second;
+    int first = (ring.next + kHistory - ring.count) % kHistory;
+    for (int i = 0; i < ring.count; ++i)
+        out.push_back(ring.samples[(first + i) % kHistory]);
+}
+
+void Profiler::startTrace()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _trace.clear();
+    _tracing = true;
+}
+
+void Profiler::stopTrace()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tracing = false;
+}
+
+bool Profiler::tracing() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _tracing;
+}
+
+size_t Profiler::traceEventCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _trace.size();
+}
+
+bool Profiler::writeChromeTrace(const std::string& path) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    FILE* fp = std::fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+
+    std::fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    // 轨道名
+    std::fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}",
+                 kGpuTrack);
+    for (const auto& [id, index] : _threadIds)
+    {
+        (void)id;
+        std::fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                         "\"args\":{\"name\":\"thread %d\"}}",
+                     index, index);
+    }
+
+    for (const TraceEvent& e : _trace)
+    {
+        std::fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+                         "\"pid\":1,\"tid\":%d}",
+                     e.name, e.tid == kGpuTrack ? "gpu" : "cpu",
+                     (long long)e.ts, (long long)e.dur, e.tid);
+    }
+
+    std::fprintf(fp, "\n]}\n");
+    return std::fclose(fp) == 0;
+}
+
+ProfileScope::ProfileScope(const char* name)
+    : _name(name),
+      _startUs(Profiler::instance().nowUs())
+{
+}
+
+ProfileScope::~ProfileScope()
+{
+    Profiler& p = Profiler::instance();
+    p.recordCpu(_name, _startUs, p.nowUs() - _startUs);
+}
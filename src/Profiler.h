@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 轻量级性能统计：
+// - ProfileScope 记录 CPU 耗时，GpuTimer（GlImageRenderer 内）记录 GL_TIME_ELAPSED
+// - 每个阶段保留最近 kHistory 个样本，按需求 p50 / p95 / p99 / max
+// - 开启 trace 时保存每一条事件，可导出 Chrome trace（chrome://tracing / Perfetto）
+// 所有接口线程安全，记录频率是每帧几十次，直接用一把锁
+class Profiler
+{
+public:
+    static constexpr int kHistory = 240;
+
+    struct StageStats
+    {
+        std::string name;
+        bool   gpu    = false;
+        int    count  = 0;     // 历史里的样本数
+        double lastMs = 0.0;
+        double p50    = 0.0;
+        double p95    = 0.0;
+        double p99    = 0.0;
+        double maxMs  = 0.0;
+    };
+
+    static Profiler& instance();
+
+    void setEnabled(bool enabled);
+    bool enabled() const { return _enabled; }
+
+    // 进程内单调时间（微秒）
+    int64_t nowUs() const;
+
+    void recordCpu(const char* name, int64_t startUs, int64_t durationUs);
+    // GPU 只知道耗时，trace 里按发起时的 CPU 时间放在单独的 GPU 轨道上
+    void recordGpu(const char* name, int64_t cpuStartUs, double gpuMs);
+
+    // 各阶段统计，按名字排序
+    void snapshot(std::vector<StageStats>& out) const;
+
+    // 某个阶段最近的样本（毫秒，旧 -> 新），用于画曲线
+    void history(const std::string& name, std::vector<float>& out) const;
+
+    void startTrace();
+    void stopTrace();
+    bool tracing() const;
+    size_t traceEventCount() const;
+    bool writeChromeTrace(const std::string& path) const;
+
+private:
+    Profiler();
+
+    struct Ring
+    {
+        bool   gpu   = false;
+        int    next  = 0;
+        int    count = 0;
+        float  samples[kHistory] = {};
+    };
+
+    struct TraceEvent
+    {
+        const char* name;
+        int64_t     ts;
+        int64_t     dur;
+        int         tid;
+    };
+
+    void addSample(const char* name, bool gpu, double ms);
+    int  threadIndex();
+
+private:
+    std::atomic<bool> _enabled{true};
+    int64_t _originNs = 0;
+
+    mutable std::mutex          _mutex;
+    std::map<std::string, Ring> _stages;
+
+    bool                         _tracing = false;
+    std::vector<TraceEvent>      _trace;
+    std::map<std::thread::id, int> _threadIds;
+};
+
+// 作用域 CPU 计时，name 必须是字符串字面量（trace 里只保存指针）
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char* name);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    const char* _name;
+    int64_t     _startUs;
+};
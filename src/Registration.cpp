@@ -0,0 +1,454 @@
+#include "Registration.h"
+#include "AppPaths.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <unordered_set>
+
+static const char     kRegMagic[4] = {'F', 'V', 'R', 'G'};
+static const uint32_t kRegVersion  = 2;
+
+namespace
+{
+
+struct Point
+{
+    double x;
+    double y;
+};
+
+// 三角形：三条边从长到短 L0 >= L1 >= L2，不变量 (L1 / L0, L2 / L0)；
+// v[0] 为最长边所对的顶点，依此类推，两个相似三角形的顶点按这个顺序一一对应
+struct Triangle
+{
+    float u;
+    float w;
+    int   v[3];
+};
+
+// 2x3 仿射：x' = a x + b y + c，y' = d x + e y + f
+struct Affine
+{
+    double a = 1, b = 0, c = 0;
+    double d = 0, e = 1, f = 0;
+
+    Point apply(const Point& p) const { return {a * p.x + b * p.y + c, d * p.x + e * p.y + f}; }
+};
+
+// 参考星的均匀网格（CSR），格子边长不小于容差，查最近邻只看 3x3 个格子
+class PointGrid
+{
+public:
+    PointGrid(const std::vector<Point>& pts, int width, int height, double tolerance)
+        : _pts(pts)
+    {
+        double area = std::max(1.0, (double)width * height);
+        _cell = std::max(tolerance, std::sqrt(area / std::max<size_t>(1, pts.size())));
+        _gw   = std::max(1, (int)std::ceil(width / _cell));
+        _gh   = std::max(1, (int)std::ceil(height / _cell));
+
+        _start.assign((size_t)_gw * _gh + 1, 0);
+        for (const Point& p : pts)
+            ++_start[cellOf(p) + 1];
+        for (size_t i = 1; i < _start.size(); ++i)
+            _start[i] += _start[i - 1];
+        _index.resize(pts.size());
+        std::vector<int> fill(_start.begin(), _start.end() - 1);
+        for (int i = 0; i < (int)pts.size(); ++i)
+            _index[fill[cellOf(pts[i])]++] = i;
+    }
+
+    // 距离 <= maxDist 的最近点，没有返回 -1
+    int nearest(const Point& p, double maxDist, double& dist2) const
+    {
+        int gx = (int)std::floor(p.x / _cell), gy = (int)std::floor(p.y / _cell);
+        int best = -1;
+        dist2 = maxDist * maxDist;
+        for (int y = std::max(0, gy - 1); y <= std::min(_gh - 1, gy + 1); ++y)
+            for (int x = std::max(0, gx - 1); x <= std::min(_gw - 1, gx + 1); ++x)
+            {
+                size_t c = (size_t)y * _gw + x;
+                for (int k = _start[c]; k < _start[c + 1]; ++k)
+                {
+                    const Point& q = _pts[_index[k]];
+                    double d2 = (q.x - p.x) * (q.x - p.x) + (q.y - p.y) * (q.y - p.y);
+                    if (d2 <= dist2)
+                    {
+                        dist2 = d2;
+                        best  = _index[k];
+                    }
+                }
+            }
+        return best;
+    }
+
+private:
+    size_t cellOf(const Point& p) const
+    {
+        int x = std::clamp((int)std::floor(p.x / _cell), 0, _gw - 1);
+        int y = std::clamp((int)std::floor(p.y / _cell), 0, _gh - 1);
+        return (size_t)y * _gw + x;
+    }
+
+private:
+    const std::vector<Point>& _pts;
+    double           _cell = 1.0;
+    int              _gw = 1, _gh = 1;
+    std::vector<int> _start;
+    std::vector<int> _index;
+};
+
+} // namespace
+
+// 最亮的 n 颗（StarField 已按 flux 排好），饱和星的质心不准，不用
+static std::vector<Point> brightest(const StarField& f, int n)
+{
+    std::vector<Point> out;
+    for (const Star& s : f.stars)
+    {
+        if ((int)out.size() >= n)
+            break;
+        if (!s.saturated)
+            out.push_back({s.x, s.y});
+    }
+    return out;
+}
+
+static bool make_triangle(const std::vector<Point>& p, int i, int j, int k, Triangle& t)
+{
+    auto dist = [&](int a, int b) { return std::hypot(p[a].x - p[b].x, p[a].y - p[b].y); };
+    // (边长, 所对顶点)
+    std::pair<double, int> s[3] = {{dist(j, k), i}, {dist(i, k), j}, {dist(i, j), k}};
+    std::sort(s, s + 3, [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    const double L0 = s[0].first, L1 = s[1].first, L2 = s[2].first;
+    if (L0 < 8.0 || L2 < 1e-3)
+        return false;
+    // 接近等腰时顶点顺序不可靠，不用
+    if ((L0 - L1) / L0 < 0.02 || (L1 - L2) / L0 < 0.02)
+        return false;
+
+    t.u = (float)(L1 / L0);
+    t.w = (float)(L2 / L0);
+    for (int n = 0; n < 3; ++n)
+        t.v[n] = s[n].second;
+    return true;
+}
+
+// 每颗星和最近的 k 颗组成的 k + 1 个点里任取三个
+static void build_triangles(const std::vector<Point>& p, int k, std::vector<Triangle>& out)
+{
+    const int n = (int)p.size();
+    k = std::min(k, n - 1);
+    std::unordered_set<uint64_t> seen;
+    std::vector<std::pair<double, int>> d(n);
+    for (int i = 0; i < n; ++i)
+    {
+        for (int j = 0; j < n; ++j)
+            d[j] = {j == i ? 1e300 : std::hypot(p[i].x - p[j].x, p[i].y - p[j].y), j};
+        std::partial_sort(d.begin(), d.begin() + k, d.end());
+
+        std::vector<int> group = {i};
+        for (int m = 0; m < k; ++m)
+            group.push_back(d[m].second);
+
+        const int g = (int)group.size();
+        for (int a = 0; a < g; ++a)
+            for (int b = a + 1; b < g; ++b)
+                for (int c = b + 1; c < g; ++c)
+                {
+                    int v[3] = {group[a], group[b], group[c]};
+                    std::sort(v, v + 3);
+                    uint64_t key = ((uint64_t)v[0] << 42) | ((uint64_t)v[1] << 21) | (uint64_t)v[2];
+                    if (!seen.insert(key).second)
+                        continue;
+                    Triangle t;
+                    if (make_triangle(p, v[0], v[1], v[2], t))
+                        out.push_back(t);
+                }
+    }
+    std::sort(out.begin(), out.end(), [](const Triangle& a, const Triangle& b) { return a.u < b.u; });
+}
+
+// 3x3 线性方程组（列主元消元），奇异返回 false
+static bool solve3(double A[3][3], double b[3], double x[3])
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        int piv = c;
+        for (int r = c + 1; r < 3; ++r)
+            if (std::fabs(A[r][c]) > std::fabs(A[piv][c]))
+                piv = r;
+        if (std::fabs(A[piv][c]) < 1e-12)
+            return false;
+        std::swap(A[c], A[piv]);
+        std::swap(b[c], b[piv]);
+        for (int r = c + 1; r < 3; ++r)
+        {
+            double f = A[r][c] / A[c][c];
+            for (int k = c; k < 3; ++k)
+                A[r][k] -= f * A[c][k];
+            b[r] -= f * b[c];
+        }
+    }
+    for (int r = 2; r >= 0; --r)
+    {
+        double s = b[r];
+        for (int k = r + 1; k < 3; ++k)
+            s -= A[r][k] * x[k];
+        x[r] = s / A[r][r];
+    }
+    return true;
+}
+
+// 最小二乘仿射（src -> dst），坐标先减均值，数值上更稳
+static bool fit_affine(const std::vector<Point>& src, const std::vector<Point>& dst, Affine& out)
+{
+    const size_t n = src.size();
+    if (n < 3)
+        return false;
+
+    double mx = 0, my = 0;
+    for (const Point& p : src)
+    {
+        mx += p.x;
+        my += p.y;
+    }
+    mx /= n;
+    my /= n;
+
+    double A[3][3] = {}, bx[3] = {}, by[3] = {};
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double r[3] = {src[i].x - mx, src[i].y - my, 1.0};
+        for (int a = 0; a < 3; ++a)
+        {
+            for (int b = 0; b < 3; ++b)
+                A[a][b] += r[a] * r[b];
+            bx[a] += r[a] * dst[i].x;
+            by[a] += r[a] * dst[i].y;
+        }
+    }
+
+    double A2[3][3];
+    std::copy(&A[0][0], &A[0][0] + 9, &A2[0][0]);
+    double px[3], py[3];
+    if (!solve3(A, bx, px) || !solve3(A2, by, py))
+        return false;
+
+    out.a = px[0];
+    out.b = px[1];
+    out.c = px[2] - px[0] * mx - px[1] * my;
+    out.d = py[0];
+    out.e = py[1];
+    out.f = py[2] - py[0] * mx - py[1] * my;
+    return true;
+}
+
+// 把 frame 的星变换后在参考星里找最近邻，返回配上的星对
+static int collect_pairs(const Affine& T, const std::vector<Point>& frame, const PointGrid& grid,
+                         const std::vector<Point>& ref, double tol,
+                         std::vector<Point>* src, std::vector<Point>* dst, double* sumSq)
+{
+    int count = 0;
+    double ss = 0.0;
+    for (const Point& p : frame)
+    {
+        double d2;
+        int j = grid.nearest(T.apply(p), tol, d2);
+        if (j < 0)
+            continue;
+        ++count;
+        ss += d2;
+        if (src)
+        {
+            src->push_back(p);
+            dst->push_back(ref[j]);
+        }
+    }
+    if (sumSq)
+        *sumSq = ss;
+    return count;
+}
+
+bool register_stars(const StarField& reference, const StarField& frame,
+                    const RegisterOptions& options, Registration& out)
+{
+    out = Registration();
+
+    std::vector<Point> refTri   = brightest(reference, options.triangleStars);
+    std::vector<Point> frameTri = brightest(frame, options.triangleStars);
+    if ((int)refTri.size() < 3 || (int)frameTri.size() < 3)
+        return false;
+
+    std::vector<Point> refPts   = brightest(reference, options.verifyStars);
+    std::vector<Point> framePts = brightest(frame, options.verifyStars);
+    const double tol = options.tolerance;
+    PointGrid grid(refPts, reference.width, reference.height, tol);
+
+    std::vector<Triangle> refTris, frameTris;
+    build_triangles(refTri, options.neighbours, refTris);
+    build_triangles(frameTri, options.neighbours, frameTris);
+
+    // 候选三角形对 -> 三点确定的仿射 -> 验证星投票
+    const float eps = 0.01f;
+    const int   enough = (int)(0.7 * std::min(refPts.size(), framePts.size()));
+    Affine best;
+    int    bestScore = 0;
+    for (const Triangle& ft : frameTris)
+    {
+        auto it = std::lower_bound(refTris.begin(), refTris.end(), ft.u - eps,
+                                   [](const Triangle& t, float u) { return t.u < u; });
+        for (; it != refTris.end() && it->u <= ft.u + eps; ++it)
+        {
+            if (std::fabs(it->w - ft.w) > eps)
+                continue;
+
+            std::vector<Point> src = {frameTri[ft.v[0]], frameTri[ft.v[1]], frameTri[ft.v[2]]};
+            std::vector<Point> dst = {refTri[it->v[0]], refTri[it->v[1]], refTri[it->v[2]]};
+            Affine T;
+            if (!fit_affine(src, dst, T))
+                continue;
+            // 同一台相机的帧之间尺度基本不变（允许翻转）
+            double det = std::fabs(T.a * T.e - T.b * T.d);
+            if (det < 0.5 || det > 2.0)
+                continue;
+
+            int score = collect_pairs(T, framePts, grid, refPts, tol, nullptr, nullptr, nullptr);
+            if (score > bestScore)
+            {
+                bestScore = score;
+                best = T;
+            }
+        }
+        if (bestScore >= enough)
+            break;
+    }
+    if (bestScore < options.minMatches)
+        return false;
+
+    // 用全部星对迭代精化（第一轮容差放宽一点，三点仿射在远处误差较大）
+    Affine T = best;
+    std::vector<Point> src, dst;
+    double sumSq = 0.0;
+    for (int iter = 0; iter < 3; ++iter)
+    {
+        src.clear();
+        dst.clear();
+        collect_pairs(T, framePts, grid, refPts, iter == 0 ? 2.0 * tol : tol, &src, &dst, nullptr);
+        if ((int)src.size() < options.minMatches || !fit_affine(src, dst, T))
+            return false;
+    }
+    int matches = collect_pairs(T, framePts, grid, refPts, tol, nullptr, nullptr, &sumSq);
+    if (matches < options.minMatches)
+        return false;
+
+    const double m[9] = {T.a, T.b, T.c,
+                         T.d, T.e, T.f,
+                         0.0, 0.0, 1.0};
+    std::copy(m, m + 9, out.toRef);
+    out.ok      = true;
+    out.matches = matches;
+    out.rms     = std::sqrt(sumSq / matches);
+    return true;
+}
+
+bool invert_transform(const double m[9], double out[9])
+{
+    double det = m[0] * (m[4] * m[8] - m[5] * m[7]) -
+                 m[1] * (m[3] * m[8] - m[5] * m[6]) +
+                 m[2] * (m[3] * m[7] - m[4] * m[6]);
+    if (std::fabs(det) < 1e-12)
+        return false;
+    double k = 1.0 / det;
+    out[0] =  (m[4] * m[8] - m[5] * m[7]) * k;
+    out[1] = -(m[1] * m[8] - m[2] * m[7]) * k;
+    out[2] =  (m[1] * m[5] - m[2] * m[4]) * k;
+    out[3] = -(m[3] * m[8] - m[5] * m[6]) * k;
+    out[4] =  (m[0] * m[8] - m[2] * m[6]) * k;
+    out[5] = -(m[0] * m[5] - m[2] * m[3]) * k;
+    out[6] =  (m[3] * m[7] - m[4] * m[6]) * k;
+    out[7] = -(m[0] * m[7] - m[1] * m[6]) * k;
+    out[8] =  (m[0] * m[4] - m[1] * m[3]) * k;
+    return true;
+}
+
+void transform_point(const double m[9], double x, double y, double& ox, double& oy)
+{
+    const double w = m[6] * x + m[7] * y + m[8];
+    ox = (m[0] * x + m[1] * y + m[2]) / w;
+    oy = (m[3] * x + m[4] * y + m[5]) / w;
+}
+
+// ---------- 磁盘缓存 ----------
+
+static bool registration_cache_file(const std::string& cacheDir, const std::string& refPath,
+                                    const std::string& framePath, const StarDetectOptions& stars,
+                                    const RegisterOptions& options, std::string& file, std::string& key)
+{
+    if (cacheDir.empty())
+        return false;
+
+    key.clear();
+    if (!append_file_stamp(refPath, key) || !append_file_stamp(framePath, key))
+        return false;
+
+    // 影响星表或匹配结果的参数都进键，改了任何一个都重新匹配
+    std::ostringstream ss;
+    ss << stars.sigma << ' ' << stars.minArea << ' ' << stars.maxArea << ' ' << stars.maxStars << ' '
+       << stars.gridCell << '|' << options.triangleStars << ' ' << options.verifyStars << ' '
+       << options.neighbours << ' ' << options.tolerance << ' ' << options.minMatches;
+    key += ss.str();
+    file = cache_file_path(cacheDir, key, ".reg");
+    return true;
+}
+
+bool load_cached_registration(const std::string& cacheDir, const std::string& refPath,
+                              const std::string& framePath, const StarDetectOptions& stars,
+                              const RegisterOptions& options, Registration& out)
+{
+    std::string file;
+    std::string key;
+    if (!registration_cache_file(cacheDir, refPath, framePath, stars, options, file, key))
+        return false;
+
+    FILE* fp = open_cache_file(file, kRegMagic, kRegVersion, key);
+    if (!fp)
+        return false;
+
+    uint32_t header[2] = {};   // ok, matches
+    Registration reg;
+    bool ok = std::fread(header, sizeof(header), 1, fp) == 1 &&
+              std::fread(reg.toRef, sizeof(double), 9, fp) == 9 &&
+              std::fread(&reg.rms, sizeof(double), 1, fp) == 1;
+
+    std::fclose(fp);
+    if (!ok || header[0] == 0)
+        return false;
+
+    reg.ok      = true;
+    reg.matches = (int)header[1];
+    out = reg;
+    return true;
+}
+
+void store_cached_registration(const std::string& cacheDir, const std::string& refPath,
+                               const std::string& framePath, const StarDetectOptions& stars,
+                               const RegisterOptions& options, const Registration& reg)
+{
+    // 失败不落盘：可能只是这一帧有云 / sigma 不合适，换了参数或下次打开时应该重试
+    std::string file;
+    std::string key;
+    if (!reg.ok || !registration_cache_file(cacheDir, refPath, framePath, stars, options, file, key))
+        return;
+
+    write_cache_file(file, kRegMagic, kRegVersion, key, [&](FILE* fp) {
+        uint32_t header[2] = {reg.ok ? 1u : 0u, (uint32_t)reg.matches};
+        return std::fwrite(header, sizeof(header), 1, fp) == 1 &&
+               std::fwrite(reg.toRef, sizeof(double), 9, fp) == 9 &&
+               std::fwrite(&reg.rms, sizeof(double), 1, fp) == 1;
+    });
+}
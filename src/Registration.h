@@ -0,0 +1,48 @@
+#pragma once
+
+#include "StarDetector.h"
+
+#include <string>
+
+// 一帧相对参考帧的对齐结果。toRef 为 3x3 行优先矩阵，把本帧像素坐标 (x, y, 1) 映射到参考帧；
+// 估计的是仿射（同一套光学系统的帧之间足够：平移 + 旋转 + 缩放 + 轻微剪切），
+// 用齐次矩阵存，renderer 里按单应处理
+struct Registration
+{
+    bool   ok = false;
+    double toRef[9] = {1, 0, 0,
+                       0, 1, 0,
+                       0, 0, 1};
+    int    matches = 0;      // 参与最小二乘的星对数
+    double rms     = 0.0;    // 残差（参考帧像素）
+};
+
+struct RegisterOptions
+{
+    int   triangleStars = 40;    // 只用最亮的若干颗星组三角形
+    int   verifyStars   = 300;   // 验证 / 精化时用的星数
+    int   neighbours    = 4;     // 每颗星和最近的几颗组三角形
+    float tolerance     = 2.0f;  // 星对的最大距离（参考帧像素）
+    int   minMatches    = 6;
+};
+
+// 三角形相似匹配：两边各取最亮的星，每颗星和最近邻组三角形，按边长比（对平移 / 旋转 / 缩放不变）配对；
+// 每个候选三角形对给出一个仿射，用验证星数投票选最好的，再用全部星对迭代最小二乘精化。
+// 星太少或找不到足够的星对时返回 false（out.ok = false）
+bool register_stars(const StarField& reference, const StarField& frame,
+                    const RegisterOptions& options, Registration& out);
+
+// 3x3 矩阵求逆，奇异时返回 false
+bool invert_transform(const double m[9], double out[9]);
+
+// 按 3x3 齐次矩阵变换一个点：(x, y, 1) -> 除以 w 后的 (ox, oy)
+void transform_point(const double m[9], double x, double y, double& ox, double& oy);
+
+// 对齐结果的磁盘缓存：键 = 参考帧和本帧的绝对路径 + 修改时间 + 大小 + 找星参数 + 匹配参数，
+// 同一序列再次闪烁时不用重新匹配。只存成功的结果，失败的帧下次还会重新匹配
+bool load_cached_registration(const std::string& cacheDir, const std::string& refPath,
+                              const std::string& framePath, const StarDetectOptions& stars,
+                              const RegisterOptions& options, Registration& out);
+void store_cached_registration(const std::string& cacheDir, const std::string& refPath,
+                               const std::string& framePath, const StarDetectOptions& stars,
+                               const RegisterOptions& options, const Registration& reg);
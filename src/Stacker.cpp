@@ -0,0 +1,596 @@
+#include "Stacker.h"
+#include "FitsWriter.h"
+#include "Parallel.h"
+
+#include <fitsio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <future>
+#include <limits>
+#include <mutex>
+
+// 行内按这么多像素一组转置成 “像素 x 帧”，每个像素的所有帧连续存放，剔除循环对连续内存操作
+static const int kTileWidth = 64;
+
+// 背景对齐时每帧抽样的行数
+static const int kNormRows = 32;
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+const char* stack_method_name(StackMethod method)
+{
+    switch (method)
+    {
+    case StackMethod::Mean:       return "mean";
+    case StackMethod::Median:     return "median";
+    case StackMethod::SigmaClip:  return "sigma-clip";
+    case StackMethod::Winsorized: return "winsorized sigma-clip";
+    }
+    return "unknown";
+}
+
+// ---------- 逐像素合并（v 为一个像素的 n 个有效值，可以被打乱） ----------
+
+static float mean_of(const float* v, int n)
+{
+    float s = 0.0f;
+    for (int i = 0; i < n; ++i)
+        s += v[i];
+    return s / (float)n;
+}
+
+static float stddev_of(const float* v, int n, float mean)
+{
+    float s = 0.0f;
+    for (int i = 0; i < n; ++i)
+    {
+        float d = v[i] - mean;
+        s += d * d;
+    }
+    return std::sqrt(s / (float)std::max(1, n - 1));
+}
+
+static float median_of(float* v, int n)
+{
+    const int h = n / 2;
+    std::nth_element(v, v + h, v + n);
+    float m = v[h];
+    if ((n & 1) == 0)
+        m = 0.5f * (m + *std::max_element(v, v + h));
+    return m;
+}
+
+// 按 center ± k·sigma 剔除，保留的值移到前面；返回剩下的个数
+static int reject(float* v, int n, float center, float sigma, float kLow, float kHigh,
+                  int& rejLow, int& rejHigh)
+{
+    const float lo = center - kLow * sigma;
+    const float hi = center + kHigh * sigma;
+    int kept = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        float x = v[i];
+        if (x < lo)
+            ++rejLow;
+        else if (x > hi)
+            ++rejHigh;
+        else
+            v[kept++] = x;
+    }
+    return kept;
+}
+
+// Winsorized σ：把超出 1.5σ 的值收缩到边界再估计，迭代到收敛（1.134 补偿截断造成的低估）
+static float winsorized_sigma(const float* v, int n, float center, float sigma, float* work)
+{
+    for (int it = 0; it < 10 && sigma > 0.0f; ++it)
+    {
+        const float lo = center - 1.5f * sigma;
+        const float hi = center + 1.5f * sigma;
+        for (int i = 0; i < n; ++i)
+            work[i] = std::clamp(v[i], lo, hi);
+        float s = 1.134f * stddev_of(work, n, mean_of(work, n));
+        bool done = std::fabs(s - sigma) <= 5e-4f * sigma;
+        sigma = s;
+        if (done)
+            break;
+    }
+    return sigma;
+}
+
+static float combine_pixel(float* v, int n, const StackOptions& opt, float* work,
+                           int& rejLow, int& rejHigh)
+{
+    if (n == 0)
+        return 0.0f;
+
+    switch (opt.method)
+    {
+    case StackMethod::Mean:
+        return mean_of(v, n);
+
+    case StackMethod::Median:
+        return median_of(v, n);
+
+    case StackMethod::SigmaClip:
+    case StackMethod::Winsorized:
+        for (int it = 0; it < opt.iterations && n >= 3; ++it)
+        {
+            std::copy(v, v + n, work);
+            float center = median_of(work, n);
+            float sigma  = 0.0f;
+            if (opt.method == StackMethod::Winsorized)
+            {
+                sigma = winsorized_sigma(v, n, center, stddev_of(v, n, mean_of(v, n)), work);
+            }
+            else
+            {
+                // 标准差会被离群值本身撑大（n 帧里单个离群值最多偏 (n-1)/√n 个 σ，10 帧以内 3σ 永远剔不掉），
+                // 所以第一轮用 MAD 估计 σ；之后大离群值已经去掉，用标准差（小样本上 MAD 反复迭代会越剔越多）
+                if (it == 0)
+                {
+                    for (int i = 0; i < n; ++i)
+                        work[i] = std::fabs(v[i] - center);
+                    sigma = 1.4826f * median_of(work, n);
+                }
+                if (!(sigma > 0.0f))
+                    sigma = stddev_of(v, n, mean_of(v, n));
+            }
+            if (!(sigma > 0.0f))
+                break;
+
+            int kept = reject(v, n, center, sigma, opt.sigmaLow, opt.sigmaHigh, rejLow, rejHigh);
+            if (kept == n)
+                break;
+            n = kept;
+        }
+        return n > 0 ? mean_of(v, n) : 0.0f;
+    }
+    return 0.0f;
+}
+
+// ---------- 按行合并 ----------
+
+namespace {
+
+struct RowScratch
+{
+    std::vector<float> tile, work, sum, count;
+
+    RowScratch(int width, int frames)
+        : tile((size_t)kTileWidth * frames), work(frames), sum(width), count(width) {}
+};
+
+} // namespace
+
+// 平均不需要剔除：按帧在外层累加整行，内层循环是连续的 SIMD 加法（(v - v) == 0 排除 NaN / Inf）
+static void mean_row(const float* src, size_t frameStride, const float* offset, int N, int W,
+                     float* dst, RowScratch& s)
+{
+    float* sum = s.sum.data();
+    float* cnt = s.count.data();
+    std::fill(sum, sum + W, 0.0f);
+    std::fill(cnt, cnt + W, 0.0f);
+    for (int i = 0; i < N; ++i)
+    {
+        const float* row = src + i * frameStride;
+        const float  o   = offset[i];
+        for (int x = 0; x < W; ++x)
+        {
+            float v  = row[x] + o;
+            bool  ok = (v - v) == 0.0f;
+            sum[x] += ok ? v : 0.0f;
+            cnt[x] += ok ? 1.0f : 0.0f;
+        }
+    }
+    for (int x = 0; x < W; ++x)
+        dst[x] = cnt[x] > 0.0f ? sum[x] / cnt[x] : 0.0f;
+}
+
+// 带剔除的方法：按 kTileWidth 个像素一组转置成 “像素 x 帧”，每个像素的各帧值连续，再逐像素合并
+static void combine_row(const float* src, size_t frameStride, const float* offset, int N, int W,
+                        float* dst, const StackOptions& opt, RowScratch& s, int& rejLow, int& rejHigh)
+{
+    float* tile = s.tile.data();
+    for (int x0 = 0; x0 < W; x0 += kTileWidth)
+    {
+        const int tw = std::min(kTileWidth, W - x0);
+        for (int i = 0; i < N; ++i)
+        {
+            const float* row = src + i * frameStride + x0;
+            const float  o   = offset[i];
+            for (int x = 0; x < tw; ++x)
+                tile[(size_t)x * N + i] = row[x] + o;
+        }
+
+        for (int x = 0; x < tw; ++x)
+        {
+            float* v = tile + (size_t)x * N;
+            int n = 0;
+            for (int i = 0; i < N; ++i)
+            {
+                if (std::isfinite(v[i]))
+                    v[n++] = v[i];
+            }
+            dst[x0 + x] = combine_pixel(v, n, opt, s.work.data(), rejLow, rejHigh);
+        }
+    }
+}
+
+// ---------- 输入文件 ----------
+
+namespace {
+
+struct InputFiles
+{
+    std::vector<fitsfile*> files;
+
+    ~InputFiles()
+    {
+        for (fitsfile* f : files)
+        {
+            int status = 0;
+            fits_close_file(f, &status);
+        }
+    }
+};
+
+} // namespace
+
+static bool fits_error(int status, const std::string& what, std::string& error)
+{
+    char text[FLEN_STATUS] = {};
+    fits_get_errstatus(status, text);
+    error = what + ": " + text;
+    return false;
+}
+
+static void read_header_cards(fitsfile* f, std::vector<std::string>& cards)
+{
+    int nkeys = 0, status = 0;
+    if (fits_get_hdrspace(f, &nkeys, nullptr, &status))
+        return;
+    char card[FLEN_CARD];
+    for (int i = 1; i <= nkeys; ++i)
+    {
+        if (fits_read_record(f, i, card, &status))
+            break;
+        cards.emplace_back(card);
+    }
+}
+
+// 读 [y0, y0 + rows) 行（FITS 行序，从 0 开始），空值读成 NaN
+static bool read_rows(fitsfile* f, int width, int y0, int rows, float* out, int& status)
+{
+    long  fpixel[2] = {1, (long)y0 + 1};
+    float nan = std::numeric_limits<float>::quiet_NaN();
+    return fits_read_pix(f, TFLOAT, fpixel, (LONGLONG)width * rows, &nan, out, nullptr, &status) == 0;
+}
+
+// 抽样若干整行估计背景中值
+static bool sample_median(fitsfile* f, int width, int height, float& out, int& status)
+{
+    std::vector<float> row(width), samples;
+    const int rows = std::min(kNormRows, height);
+    for (int i = 0; i < rows; ++i)
+    {
+        int y = (int)(((long long)i * 2 + 1) * height / (rows * 2));
+        if (!read_rows(f, width, y, 1, row.data(), status))
+            return false;
+        for (int x = 0; x < width; x += 4)
+        {
+            if (std::isfinite(row[x]))
+                samples.push_back(row[x]);
+        }
+    }
+    out = samples.empty() ? 0.0f : median_of(samples.data(), (int)samples.size());
+    return true;
+}
+
+bool stack_frames(const std::vector<std::string>& paths, const std::string& outPath,
+                  const StackOptions& opt, StackResult& result, std::string& error,
+                  FitsImage* preview, const std::function<void(float)>& progress)
+{
+    auto t0 = Clock::now();
+    result = StackResult();
+
+    const int N = (int)paths.size();
+    if (N == 0)
+    {
+        error = "no input frames";
+        return false;
+    }
+
+    // ---- 打开所有输入，检查尺寸 ----
+    InputFiles inputs;
+    int W = 0, H = 0;
+    for (const std::string& path : paths)
+    {
+        fitsfile* f = nullptr;
+        int status = 0;
+        if (fits_open_file(&f, path.c_str(), READONLY, &status))
+            return fits_error(status, path, error);
+        inputs.files.push_back(f);
+
+        int  bitpix = 0, naxis = 0;
+        long naxes[3] = {1, 1, 1};
+        if (fits_get_img_param(f, 3, &bitpix, &naxis, naxes, &status))
+            return fits_error(status, path, error);
+        if (naxis < 2 || (naxis >= 3 && naxes[2] != 1))
+        {
+            error = "not a single-plane image: " + path;
+            return false;
+        }
+        if (W == 0)
+        {
+            W = (int)naxes[0];
+            H = (int)naxes[1];
+        }
+        else if (naxes[0] != W || naxes[1] != H)
+        {
+            error = "size mismatch: " + path;
+            return false;
+        }
+    }
+
+    std::vector<std::string> cards;
+    read_header_cards(inputs.files[0], cards);
+
+    // ---- 背景对齐：各帧加上 (参考帧中值 - 本帧中值) ----
+    std::vector<float> offset(N, 0.0f);
+    if (opt.normalize && N > 1)
+    {
+        std::vector<float> med(N);
+        for (int i = 0; i < N; ++i)
+        {
+            int status = 0;
+            if (!sample_median(inputs.files[i], W, H, med[i], status))
+                return fits_error(status, paths[i], error);
+        }
+        for (int i = 0; i < N; ++i)
+            offset[i] = med[0] - med[i];
+    }
+
+    // ---- 行带大小：两份输入缓冲不超过预算 ----
+    const size_t rowBytes = (size_t)N * W * sizeof(float);
+    const int bandRows = std::clamp((int)(opt.memoryBudget / std::max<size_t>(1, 2 * rowBytes)), 1, H);
+    const int bands    = (H + bandRows - 1) / bandRows;
+
+    std::vector<float> in[2], out[2];
+    for (int k = 0; k < 2; ++k)
+    {
+        in[k].resize((size_t)N * bandRows * W);
+        out[k].resize((size_t)bandRows * W);
+    }
+
+    FitsWriter writer;
+    if (!writer.open(outPath, W, H, 1, cards))
+    {
+        error = "cannot create " + outPath;
+        return false;
+    }
+
+    // 中途失败 / 取消时不留下写了一半的文件
+    struct PartialOutput
+    {
+        FitsWriter&        writer;
+        const std::string& path;
+        bool               done = false;
+        ~PartialOutput()
+        {
+            if (done)
+                return;
+            writer.close();
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+    } partial{writer, outPath};
+    writer.addHistory(std::string("Stacked ") + std::to_string(N) + " frames (" +
+                      stack_method_name(opt.method) + ") by FitsViewer");
+
+    if (preview)
+    {
+        preview->width    = W;
+        preview->height   = H;
+        preview->channels = 1;
+        preview->headerCards = cards;
+        preview->bayerFromHeader = bayer_pattern_from_header(cards, H, preview->bayer);
+        if (!preview->bayerFromHeader)
+            preview->bayer = BayerPattern::NONE;
+        preview->raw.assign((size_t)W * H, 0.0);
+        preview->rgb.clear();
+    }
+
+    // I/O 任务：写上一个行带的结果，再读下一个行带（都在同一个线程里，不会并发调用 cfitsio）
+    double readMs = 0.0;
+    auto io = [&](int writeBand, int readBand) -> std::string {
+        if (writeBand >= 0)
+        {
+            int y0   = writeBand * bandRows;
+            int rows = std::min(bandRows, H - y0);
+            if (!writer.writeRows(out[writeBand & 1].data(), rows, 1))
+                return "write failed: " + outPath;
+        }
+        if (readBand >= 0 && readBand < bands)
+        {
+            auto r0  = Clock::now();
+            int  y0   = readBand * bandRows;
+            int  rows = std::min(bandRows, H - y0);
+            float* dst = in[readBand & 1].data();
+            for (int i = 0; i < N; ++i)
+            {
+                int status = 0;
+                if (!read_rows(inputs.files[i], W, y0, rows, dst + (size_t)i * bandRows * W, status))
+                {
+                    std::string e;
+                    fits_error(status, paths[i], e);
+                    return e;
+                }
+            }
+            readMs += elapsed_ms(r0);
+        }
+        return std::string();
+    };
+
+    error = io(-1, 0);
+    if (!error.empty())
+        return false;
+
+    std::mutex statsMutex;
+    long long rejLowTotal = 0, rejHighTotal = 0;
+    double    combineMs   = 0.0;
+
+    for (int b = 0; b < bands; ++b)
+    {
+        if (opt.cancel && opt.cancel->load())
+        {
+            error = "cancelled";
+            return false;
+        }
+
+        // 读下一个行带、写上一个行带的同时合并当前行带
+        std::future<std::string> pending = std::async(std::launch::async, io, b - 1, b + 1);
+
+        auto c0 = Clock::now();
+        const int    y0   = b * bandRows;
+        const int    rows = std::min(bandRows, H - y0);
+        const float* src  = in[b & 1].data();
+        float*       dst  = out[b & 1].data();
+        const size_t frameStride = (size_t)bandRows * W;
+
+        parallel_for(0, rows, 1, [&](int r0, int r1) {
+            RowScratch scratch(W, N);
+            int rejLow = 0, rejHigh = 0;
+            for (int r = r0; r < r1; ++r)
+            {
+                const float* s = src + (size_t)r * W;
+                float*       d = dst + (size_t)r * W;
+                if (opt.method == StackMethod::Mean)
+                    mean_row(s, frameStride, offset.data(), N, W, d, scratch);
+                else
+                    combine_row(s, frameStride, offset.data(), N, W, d, opt, scratch, rejLow, rejHigh);
+            }
+            std::lock_guard<std::mutex> lock(statsMutex);
+            rejLowTotal  += rejLow;
+            rejHighTotal += rejHigh;
+        });
+
+        if (preview)
+        {
+            double* p = preview->raw.data() + (size_t)y0 * W;
+            for (size_t i = 0, n = (size_t)rows * W; i < n; ++i)
+                p[i] = dst[i];
+        }
+        combineMs += elapsed_ms(c0);
+
+        error = pending.get();
+        if (!error.empty())
+            return false;
+        if (progress)
+            progress((float)(b + 1) / (float)bands);
+    }
+
+    // 最后一个行带
+    error = io(bands - 1, -1);
+    if (!error.empty())
+        return false;
+    partial.done = true;
+    if (!writer.close())
+    {
+        error = "write failed: " + outPath;
+        return false;
+    }
+
+    const double total = (double)N * W * H;
+    result.width        = W;
+    result.height       = H;
+    result.frames       = N;
+    result.bandRows     = bandRows;
+    result.rejectedLow  = rejLowTotal / total;
+    result.rejectedHigh = rejHighTotal / total;
+    result.readMs       = readMs;
+    result.combineMs    = combineMs;
+    result.totalMs      = elapsed_ms(t0);
+    return true;
+}
+
+// ---------- StackRunner ----------
+
+StackRunner::~StackRunner()
+{
+    cancel();
+    join();
+}
+
+void StackRunner::join()
+{
+    if (_worker.joinable())
+        _worker.join();
+}
+
+bool StackRunner::start(const std::vector<std::string>& paths, const std::string& outPath,
+                        const StackOptions& options)
+{
+    if (_running.load())
+        return false;
+    join();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _finished = false;
+        _image.reset();
+    }
+    _cancel   = false;
+    _progress = 0.0f;
+    _running  = true;
+
+    StackOptions opt = options;
+    opt.cancel = &_cancel;
+    _worker = std::thread([this, paths, outPath, opt]() {
+        auto image = std::make_shared<FitsImage>();
+        StackResult result;
+        std::string error;
+        bool ok = stack_frames(paths, outPath, opt, result, error, image.get(),
+                               [this](float p) { _progress = p; });
+        if (!ok)
+            image.reset();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _finished = true;
+            _ok       = ok;
+            _result   = result;
+            _error    = error;
+            _image    = image;
+        }
+        _running = false;
+    });
+    return true;
+}
+
+void StackRunner::cancel()
+{
+    _cancel = true;
+}
+
+bool StackRunner::poll(bool& ok, StackResult& result, std::string& error, std::shared_ptr<FitsImage>& image)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_finished)
+        return false;
+
+    _finished = false;
+    ok     = _ok;
+    result = _result;
+    error  = _error;
+    image  = std::move(_image);
+    return true;
+}
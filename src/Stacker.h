@@ -0,0 +1,92 @@
+#pragma once
+
+#include "FitsImage.h"
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class StackMethod {
+    Mean       = 0,
+    Median     = 1,
+    SigmaClip  = 2,   // 以中值为中心、MAD 估计的 σ 为尺度迭代剔除，剩下的取平均
+    Winsorized = 3    // 先把离群值收缩到 1.5σ 再估计 σ（对成片的卫星轨迹更稳），然后同样剔除
+};
+
+struct StackOptions
+{
+    StackMethod method     = StackMethod::SigmaClip;
+    float       sigmaLow   = 3.0f;
+    float       sigmaHigh  = 3.0f;
+    int         iterations = 5;
+    bool        normalize  = true;                 // 按各帧背景中值做加性对齐（抽样几十行估计）
+    size_t      memoryBudget = (size_t)1024 << 20; // 输入行带缓冲（两份）的上限，决定每个行带的行数
+    const std::atomic<bool>* cancel = nullptr;     // 置 true 时尽快返回 false
+};
+
+struct StackResult
+{
+    int    width  = 0;
+    int    height = 0;
+    int    frames = 0;
+    int    bandRows = 0;
+    double rejectedLow  = 0.0;   // 被剔除的像素比例（按所有帧的所有像素计）
+    double rejectedHigh = 0.0;
+    double readMs    = 0.0;      // 读盘线程的总耗时（与计算重叠）
+    double combineMs = 0.0;
+    double totalMs   = 0.0;
+};
+
+// 流式叠加：所有输入只按行带读（cfitsio 子区域读），逐像素跨帧剔除后按行带写进 outPath（32 bit float），
+// 内存只占两份 “帧数 × 行带” 的输入缓冲。读 / 写在一个 I/O 线程里顺序进行（cfitsio 不保证可重入），
+// 同时计算线程按行并行合并上一个行带。输入须为同尺寸的单平面图像（RAW / 灰度，不去拜耳）。
+// preview 非空时同时把结果填进去（raw，保留第一帧的头和 Bayer），叠完可以直接显示。
+// progress 取值 0~1，可为空；失败时写 error
+bool stack_frames(const std::vector<std::string>& paths, const std::string& outPath,
+                  const StackOptions& options, StackResult& result, std::string& error,
+                  FitsImage* preview = nullptr,
+                  const std::function<void(float)>& progress = {});
+
+const char* stack_method_name(StackMethod method);
+
+// 后台叠加：一次一个任务，在自己的线程里跑 stack_frames，UI 线程轮询进度和结果
+class StackRunner
+{
+public:
+    StackRunner() = default;
+    ~StackRunner();
+
+    StackRunner(const StackRunner&) = delete;
+    StackRunner& operator=(const StackRunner&) = delete;
+
+    // 已经在跑时返回 false
+    bool start(const std::vector<std::string>& paths, const std::string& outPath, const StackOptions& options);
+    void cancel();
+
+    bool  running() const { return _running.load(); }
+    float progress() const { return _progress.load(); }
+
+    // 任务结束后取走结果（每个任务只返回一次），image 为叠加结果（失败时为空）
+    bool poll(bool& ok, StackResult& result, std::string& error, std::shared_ptr<FitsImage>& image);
+
+private:
+    void join();
+
+private:
+    std::thread        _worker;
+    std::atomic<bool>  _running{false};
+    std::atomic<bool>  _cancel{false};
+    std::atomic<float> _progress{0.0f};
+
+    std::mutex                 _mutex;
+    bool                       _finished = false;
+    bool                       _ok       = false;
+    StackResult                _result;
+    std::string                _error;
+    std::shared_ptr<FitsImage> _image;
+};
@@ -0,0 +1,534 @@
+#include "StarDetector.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+// 每个线程至少处理的行数
+static const int kMinRowsPerThread = 64;
+
+namespace
+{
+
+// 背景 / 噪声网格：格子中心在 ((i + 0.5) * cell, (j + 0.5) * cell)，之间双线性插值
+struct BackgroundGrid
+{
+    int cell = 64;
+    int gw   = 0;
+    int gh   = 0;
+    std::vector<float> bg;
+    std::vector<float> noise;
+
+    void coord(float p, int n, int& i0, int& i1, float& t) const
+    {
+        float f = (p + 0.5f) / (float)cell - 0.5f;
+        if (f <= 0.0f || n == 1)
+        {
+            i0 = i1 = 0;
+            t = 0.0f;
+            return;
+        }
+        if (f >= (float)(n - 1))
+        {
+            i0 = i1 = n - 1;
+            t = 0.0f;
+            return;
+        }
+        i0 = (int)f;
+        i1 = i0 + 1;
+        t  = f - (float)i0;
+    }
+
+    static float lerp2(const std::vector<float>& g, int gw, int x0, int x1, int y0, int y1, float tx, float ty)
+    {
+        float a = g[(size_t)y0 * gw + x0] + (g[(size_t)y0 * gw + x1] - g[(size_t)y0 * gw + x0]) * tx;
+        float b = g[(size_t)y1 * gw + x0] + (g[(size_t)y1 * gw + x1] - g[(size_t)y1 * gw + x0]) * tx;
+        return a + (b - a) * ty;
+    }
+
+    void sample(float x, float y, float& b, float& n) const
+    {
+        int x0, x1, y0, y1;
+        float tx, ty;
+        coord(x, gw, x0, x1, tx);
+        coord(y, gh, y0, y1, ty);
+        b = lerp2(bg, gw, x0, x1, y0, y1, tx, ty);
+        n = lerp2(noise, gw, x0, x1, y0, y1, tx, ty);
+    }
+};
+
+// 一行里连续超过阈值的一段 [x0, x1)
+struct Run
+{
+    int y;
+    int x0;
+    int x1;
+};
+
+struct Component
+{
+    int   area = 0;
+    int   minX = 0, maxX = 0, minY = 0, maxY = 0;
+    int   nearMax = 0;      // 接近全图最大值的像素数（判饱和）
+    float peak = 0.0f;
+    double sw = 0.0, swx = 0.0, swy = 0.0;
+};
+
+} // namespace
+
+static float median_inplace(float* v, int n)
+{
+    std::nth_element(v, v + n / 2, v + n);
+    return v[n / 2];
+}
+
+// 亮度图：Bayer 2x2 合并 / RGB 平均；单色直接返回原数据
+static const float* build_luminance(const float* data, int width, int height, int channels, bool cfa,
+                                    std::vector<float>& buf, int& lw, int& lh, int& scale)
+{
+    if (channels == 1 && !cfa)
+    {
+        lw = width;
+        lh = height;
+        scale = 1;
+        return data;
+    }
+
+    const size_t plane = (size_t)width * height;
+    if (channels == 1)
+    {
+        scale = 2;
+        lw = width / 2;
+        lh = height / 2;
+        buf.resize((size_t)lw * lh);
+        parallel_for(0, lh, kMinRowsPerThread, [&](int y0, int y1) {
+            for (int y = y0; y < y1; ++y)
+            {
+                const float* r0 = data + (size_t)(2 * y) * width;
+                const float* r1 = r0 + width;
+                float*       o  = buf.data() + (size_t)y * lw;
+                for (int x = 0; x < lw; ++x)
+                    o[x] = 0.25f * (r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1]);
+            }
+        });
+    }
+    else
+    {
+        scale = 1;
+        lw = width;
+        lh = height;
+        buf.resize(plane);
+        const float k = 1.0f / (float)channels;
+        parallel_for(0, lh, kMinRowsPerThread, [&](int y0, int y1) {
+            for (size_t i = (size_t)y0 * lw, e = (size_t)y1 * lw; i < e; ++i)
+            {
+                float s = 0.0f;
+                for (int c = 0; c < channels; ++c)
+                    s += data[c * plane + i];
+                buf[i] = s * k;
+            }
+        });
+    }
+    return buf.data();
+}
+
+// 每格抽样（最多 16x16 个点，中值的误差约 0.08σ）求中值和 MAD，按 3σ 剔除亮的（星）后再算一次
+static void estimate_grid(const float* L, int lw, int lh, BackgroundGrid& g)
+{
+    g.gw = (lw + g.cell - 1) / g.cell;
+    g.gh = (lh + g.cell - 1) / g.cell;
+    g.bg.assign((size_t)g.gw * g.gh, 0.0f);
+    g.noise.assign((size_t)g.gw * g.gh, 0.0f);
+
+    const int step = std::max(1, g.cell / 16);
+    parallel_for(0, g.gh, 1, [&](int gy0, int gy1) {
+        std::vector<float> s, d;
+        for (int gy = gy0; gy < gy1; ++gy)
+        {
+            for (int gx = 0; gx < g.gw; ++gx)
+            {
+                s.clear();
+                int x0 = gx * g.cell, x1 = std::min(lw, x0 + g.cell);
+                int y0 = gy * g.cell, y1 = std::min(lh, y0 + g.cell);
+                for (int y = y0; y < y1; y += step)
+                    for (int x = x0; x < x1; x += step)
+                        s.push_back(L[(size_t)y * lw + x]);
+
+                float med = 0.0f, sigma = 0.0f;
+                for (int pass = 0; pass < 2 && !s.empty(); ++pass)
+                {
+                    med = median_inplace(s.data(), (int)s.size());
+                    d.resize(s.size());
+                    for (size_t i = 0; i < s.size(); ++i)
+                        d[i] = std::fabs(s[i] - med);
+                    sigma = 1.4826f * median_inplace(d.data(), (int)d.size());
+
+                    // 量化很粗的平坦区域 MAD 为 0，退回标准差
+                    if (!(sigma > 0.0f))
+                    {
+                        double sum = 0.0;
+                        for (float v : s)
+                            sum += (double)(v - med) * (v - med);
+                        sigma = (float)std::sqrt(sum / (double)s.size());
+                    }
+                    if (pass == 0)
+                    {
+                        const float hi = med + 3.0f * sigma;
+                        s.erase(std::remove_if(s.begin(), s.end(), [hi](float v) { return v > hi; }), s.end());
+                    }
+                }
+                g.bg[(size_t)gy * g.gw + gx]    = med;
+                g.noise[(size_t)gy * g.gw + gx] = std::max(sigma, 1e-6f);
+            }
+        }
+    });
+
+    // 3x3 中值滤波：个别格子被亮星 / 星云占满时由邻居顶替
+    auto filter = [&](std::vector<float>& grid) {
+        std::vector<float> out(grid.size());
+        float v[9];
+        for (int gy = 0; gy < g.gh; ++gy)
+            for (int gx = 0; gx < g.gw; ++gx)
+            {
+                int n = 0;
+                for (int dy = -1; dy <= 1; ++dy)
+                    for (int dx = -1; dx <= 1; ++dx)
+                    {
+                        int x = gx + dx, y = gy + dy;
+                        if (x >= 0 && x < g.gw && y >= 0 && y < g.gh)
+                            v[n++] = grid[(size_t)y * g.gw + x];
+                    }
+                out[(size_t)gy * g.gw + gx] = median_inplace(v, n);
+            }
+        grid.swap(out);
+    };
+    filter(g.bg);
+    filter(g.noise);
+}
+
+// 阈值化：按行带并行，每行先求整行阈值的下限，绝大多数背景像素只比较一次
+static void threshold_runs(const float* L, int lw, int lh, const BackgroundGrid& g, float k,
+                           std::vector<Run>& runs, float& maxValue)
+{
+    std::mutex mergeMutex;
+    std::vector<std::pair<int, std::vector<Run>>> bands;
+    maxValue = 0.0f;
+
+    parallel_for(0, lh, kMinRowsPerThread, [&](int y0, int y1) {
+        std::vector<int>   xi0(lw), xi1(lw);
+        std::vector<float> xt(lw);
+        for (int x = 0; x < lw; ++x)
+            g.coord((float)x, g.gw, xi0[x], xi1[x], xt[x]);
+
+        std::vector<float> thr(g.gw);
+        std::vector<Run>   out;
+        float              mx = 0.0f;
+        for (int y = y0; y < y1; ++y)
+        {
+            int gy0, gy1;
+            float ty;
+            g.coord((float)y, g.gh, gy0, gy1, ty);
+            float rowMin = std::numeric_limits<float>::infinity();
+            for (int i = 0; i < g.gw; ++i)
+            {
+                float b0 = g.bg[(size_t)gy0 * g.gw + i] + k * g.noise[(size_t)gy0 * g.gw + i];
+                float b1 = g.bg[(size_t)gy1 * g.gw + i] + k * g.noise[(size_t)gy1 * g.gw + i];
+                thr[i] = b0 + (b1 - b0) * ty;
+                rowMin = std::min(rowMin, thr[i]);
+            }
+
+            const float* row   = L + (size_t)y * lw;
+            int          start = -1;
+            for (int x = 0; x < lw; ++x)
+            {
+                float v = row[x];
+                bool  on = false;
+                if (v > rowMin)
+                {
+                    float t = thr[xi0[x]] + (thr[xi1[x]] - thr[xi0[x]]) * xt[x];
+                    on = v > t;
+                    mx = std::max(mx, v);
+                }
+                if (on && start < 0)
+                    start = x;
+                else if (!on && start >= 0)
+                {
+                    out.push_back({y, start, x});
+                    start = -1;
+                }
+            }
+            if (start >= 0)
+                out.push_back({y, start, lw});
+        }
+
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        bands.emplace_back(y0, std::move(out));
+        maxValue = std::max(maxValue, mx);
+    });
+
+    std::sort(bands.begin(), bands.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    runs.clear();
+    for (auto& b : bands)
+        runs.insert(runs.end(), b.second.begin(), b.second.end());
+}
+
+static int find_root(std::vector<int>& parent, int i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// 行程按 (y, x0) 有序：只和上一行重叠或对角相邻的行程合并（8 邻接）
+static void label_runs(const std::vector<Run>& runs, std::vector<int>& parent)
+{
+    const int n = (int)runs.size();
+    parent.resize(n);
+    for (int i = 0; i < n; ++i)
+        parent[i] = i;
+
+    int prevBegin = 0, prevEnd = 0;
+    for (int rowBegin = 0; rowBegin < n;)
+    {
+        int y = runs[rowBegin].y;
+        int rowEnd = rowBegin;
+        while (rowEnd < n && runs[rowEnd].y == y)
+            ++rowEnd;
+
+        if (prevEnd > prevBegin && runs[prevBegin].y == y - 1)
+        {
+            int j0 = prevBegin;
+            for (int i = rowBegin; i < rowEnd; ++i)
+            {
+                while (j0 < prevEnd && runs[j0].x1 < runs[i].x0)
+                    ++j0;
+                for (int j = j0; j < prevEnd && runs[j].x0 <= runs[i].x1; ++j)
+                {
+                    int a = find_root(parent, i), b = find_root(parent, j);
+                    if (a != b)
+                        parent[std::max(a, b)] = std::min(a, b);
+                }
+            }
+        }
+        prevBegin = rowBegin;
+        prevEnd   = rowEnd;
+        rowBegin  = rowEnd;
+    }
+}
+
+// 圆形孔径里扣背景测量：先用孔径加权修正质心，再求 flux / HFR / 二阶矩。
+// 权重减去 1σ 噪声，孔径外圈的噪声不会把 HFR / FWHM 撑大；孔径不超过到最近邻星距离的一半，不吃进邻星
+static bool measure_star(const float* L, int lw, int lh, const BackgroundGrid& g,
+                         const Component& c, float maxRadius, float satLevel, Star& s)
+{
+    float cx = (float)(c.swx / c.sw);
+    float cy = (float)(c.swy / c.sw);
+    float bg, nz;
+    g.sample(cx, cy, bg, nz);
+
+    const float r  = std::min(maxRadius, std::clamp(2.5f * std::sqrt((float)c.area / 3.14159265f) + 2.0f, 3.0f, 40.0f));
+    const float r2 = r * r;
+    const float floorLevel = bg + nz;
+
+    double sw = 0.0, swr = 0.0, swr2 = 0.0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        int x0 = std::max(0, (int)std::floor(cx - r)), x1 = std::min(lw - 1, (int)std::ceil(cx + r));
+        int y0 = std::max(0, (int)std::floor(cy - r)), y1 = std::min(lh - 1, (int)std::ceil(cy + r));
+        double swx = 0.0, swy = 0.0;
+        sw = swr = swr2 = 0.0;
+        for (int y = y0; y <= y1; ++y)
+        {
+            const float* row = L + (size_t)y * lw;
+            float dy = (float)y - cy;
+            for (int x = x0; x <= x1; ++x)
+            {
+                float dx = (float)x - cx;
+                float d2 = dx * dx + dy * dy;
+                float w  = row[x] - floorLevel;
+                if (d2 > r2 || w <= 0.0f)
+                    continue;
+                sw   += w;
+                swx  += w * x;
+                swy  += w * y;
+                swr  += w * std::sqrt(d2);
+                swr2 += w * d2;
+            }
+        }
+        if (!(sw > 0.0))
+            return false;
+        if (pass == 0)
+        {
+            cx = (float)(swx / sw);
+            cy = (float)(swy / sw);
+        }
+    }
+
+    s.x    = cx;
+    s.y    = cy;
+    s.flux = (float)sw;
+    s.peak = c.peak;
+    s.area = c.area;
+    s.hfr  = (float)(swr / sw);
+    // 二阶矩里含像素离散化的 1/12 px²（每轴），扣掉后小星的 FWHM 不偏大
+    s.fwhm = 2.3548f * (float)std::sqrt(std::max(0.0, swr2 / (2.0 * sw) - 1.0 / 12.0));
+    s.saturated = c.nearMax >= 3 && c.peak >= satLevel;
+    return true;
+}
+
+bool detect_stars(const float* data, int width, int height, int channels, bool cfa,
+                  const StarDetectOptions& options, StarField& out)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    out = StarField();
+    out.options = options;
+    out.width  = width;
+    out.height = height;
+    if (!data || width < 8 || height < 8 || channels < 1)
+        return false;
+
+    std::vector<float> lumBuf;
+    int lw = 0, lh = 0, scale = 1;
+    const float* L = build_luminance(data, width, height, channels, cfa && channels == 1, lumBuf, lw, lh, scale);
+
+    BackgroundGrid grid;
+    grid.cell = std::max(8, options.gridCell);
+    estimate_grid(L, lw, lh, grid);
+
+    std::vector<Run> runs;
+    float maxValue = 0.0f;
+    threshold_runs(L, lw, lh, grid, options.sigma, runs, maxValue);
+
+    std::vector<int> parent;
+    label_runs(runs, parent);
+
+    // 连通域统计：面积、包围盒、扣背景的加权质心、峰值
+    const float satLevel = 0.98f * maxValue;
+    std::vector<int>       compOf(runs.size(), -1);
+    std::vector<Component> comps;
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        int root = find_root(parent, (int)i);
+        int ci   = compOf[root];
+        if (ci < 0)
+        {
+            ci = compOf[root] = (int)comps.size();
+            Component c;
+            c.minX = runs[i].x0;
+            c.maxX = runs[i].x1 - 1;
+            c.minY = c.maxY = runs[i].y;
+            comps.push_back(c);
+        }
+        Component& c = comps[ci];
+        const Run& run = runs[i];
+        c.area += run.x1 - run.x0;
+        c.minX = std::min(c.minX, run.x0);
+        c.maxX = std::max(c.maxX, run.x1 - 1);
+        c.minY = std::min(c.minY, run.y);
+        c.maxY = std::max(c.maxY, run.y);
+        if (c.area > options.maxArea)
+            continue;   // 已经不会当星，不再累加
+
+        const float* row = L + (size_t)run.y * lw;
+        for (int x = run.x0; x < run.x1; ++x)
+        {
+            float bg, nz;
+            grid.sample((float)x, (float)run.y, bg, nz);
+            float w = std::max(0.0f, row[x] - bg);
+            c.sw  += w;
+            c.swx += (double)w * x;
+            c.swy += (double)w * run.y;
+            c.peak = std::max(c.peak, row[x]);
+            c.nearMax += row[x] >= satLevel ? 1 : 0;
+        }
+    }
+    out.candidates = (int)comps.size();
+
+    // 贴边（被截断）、太小（热点）、太大（星云）的不要
+    std::vector<int> keep;
+    for (int i = 0; i < (int)comps.size(); ++i)
+    {
+        const Component& c = comps[i];
+        if (c.area < options.minArea || c.area > options.maxArea || !(c.sw > 0.0))
+            continue;
+        if (c.minX == 0 || c.minY == 0 || c.maxX == lw - 1 || c.maxY == lh - 1)
+            continue;
+        keep.push_back(i);
+    }
+
+    // 按质心 y 排序，二分找 y 方向 40 像素内的邻居，求到最近邻的距离
+    const float kMaxRadius = 40.0f;
+    auto cyOf = [&](int i) { return (float)(comps[i].swy / comps[i].sw); };
+    auto cxOf = [&](int i) { return (float)(comps[i].swx / comps[i].sw); };
+    std::sort(keep.begin(), keep.end(), [&](int a, int b) { return cyOf(a) < cyOf(b); });
+    std::vector<float> keepY(keep.size());
+    for (size_t k = 0; k < keep.size(); ++k)
+        keepY[k] = cyOf(keep[k]);
+
+    std::vector<Star> stars(keep.size());
+    std::vector<char> valid(keep.size(), 0);
+    parallel_for(0, (int)keep.size(), 256, [&](int b, int e) {
+        for (int k = b; k < e; ++k)
+        {
+            const float x = cxOf(keep[k]), y = keepY[k];
+            float nearest = 2.0f * kMaxRadius;
+            auto lo = std::lower_bound(keepY.begin(), keepY.end(), y - nearest) - keepY.begin();
+            for (size_t j = (size_t)lo; j < keep.size() && keepY[j] < y + nearest; ++j)
+            {
+                if ((int)j == k)
+                    continue;
+                float d = std::hypot(cxOf(keep[j]) - x, keepY[j] - y);
+                nearest = std::min(nearest, d);
+            }
+            valid[k] = measure_star(L, lw, lh, grid, comps[keep[k]], std::max(2.5f, 0.5f * nearest),
+                                    satLevel, stars[k]) ? 1 : 0;
+        }
+    });
+
+    // 换回原图坐标：合并后的像素 (i, j) 覆盖原图 (2i, 2j) ~ (2i + 1, 2j + 1)
+    const float fs = (float)scale;
+    const float off = scale == 2 ? 0.5f : 0.0f;
+    for (size_t i = 0; i < stars.size(); ++i)
+    {
+        if (!valid[i])
+            continue;
+        Star s = stars[i];
+        s.x    = s.x * fs + off;
+        s.y    = s.y * fs + off;
+        s.hfr  *= fs;
+        s.fwhm *= fs;
+        out.stars.push_back(s);
+    }
+
+    std::vector<float> hfr, fwhm;
+    for (const Star& s : out.stars)
+    {
+        if (s.saturated)
+            continue;
+        hfr.push_back(s.hfr);
+        fwhm.push_back(s.fwhm);
+    }
+    if (!hfr.empty())
+    {
+        out.medianHfr  = median_inplace(hfr.data(), (int)hfr.size());
+        out.medianFwhm = median_inplace(fwhm.data(), (int)fwhm.size());
+    }
+
+    std::vector<float> tmp = grid.bg;
+    out.background = median_inplace(tmp.data(), (int)tmp.size());
+    tmp = grid.noise;
+    out.noise = median_inplace(tmp.data(), (int)tmp.size());
+
+    std::sort(out.stars.begin(), out.stars.end(),
+              [](const Star& a, const Star& b) { return a.flux > b.flux; });
+    if ((int)out.stars.size() > options.maxStars)
+        out.stars.resize(std::max(0, options.maxStars));
+
+    out.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// 一颗星：坐标为原图像素坐标（像素 (i, j) 的中心为 (i, j)），HFR / FWHM 以原图像素计
+struct Star
+{
+    float x    = 0.0f;
+    float y    = 0.0f;
+    float flux = 0.0f;       // 扣背景后的总亮度（归一化单位）
+    float peak = 0.0f;       // 最亮像素（含背景）
+    float hfr  = 0.0f;       // 半通量半径：sum(w * r) / sum(w)
+    float fwhm = 0.0f;       // 由二阶矩按高斯换算
+    int   area = 0;          // 阈值以上的像素数
+    bool  saturated = false; // 峰值接近满阱，不参与 HFR / FWHM 统计
+};
+
+struct StarDetectOptions
+{
+    float sigma    = 5.0f;   // 阈值：背景 + sigma * 噪声
+    int   minArea  = 3;      // 小于它的是热点 / 噪声
+    int   maxArea  = 4000;   // 大于它的是星云 / 亮星光晕，不当星
+    int   maxStars = 2000;   // 只保留最亮的若干颗
+    int   gridCell = 64;     // 背景 / 噪声网格的格子边长（亮度图像素）
+};
+
+struct StarField
+{
+    StarDetectOptions options;          // 检测时用的参数
+    std::vector<Star> stars;            // 按 flux 从大到小
+    int    width  = 0;                  // 原图尺寸
+    int    height = 0;
+    float  medianHfr  = std::numeric_limits<float>::quiet_NaN();
+    float  medianFwhm = std::numeric_limits<float>::quiet_NaN();
+    float  background = 0.0f;           // 网格背景 / 噪声的中值（归一化单位）
+    float  noise      = 0.0f;
+    int    candidates = 0;              // 连通域总数（过滤前）
+    double ms = 0.0;
+};
+
+// 在归一化数据（0~1，FramePrefetcher / calibrate_and_normalize 的输出）上找星：
+// 1) 亮度图：Bayer 时 2x2 合并（一个 CFA 单元一个像素，不用去拜耳），RGB 三个平面取平均，单色直接用；
+// 2) 粗网格上抽样估计背景中值和噪声（MAD），3x3 中值滤波后双线性插值到每个像素；
+// 3) 按行带多线程阈值化成行程，行程做 8 邻接连通域；
+// 4) 每个连通域先求质心，再在圆形孔径里扣背景求 flux、HFR、FWHM。
+// 失败（尺寸不对）返回 false
+bool detect_stars(const float* data, int width, int height, int channels, bool cfa,
+                  const StarDetectOptions& options, StarField& out);
@@ -9,23 +9,34 @@ static float clamp01(float v)
     return v;
 }
 
-static float percentile(const std::vector<float>& data, float percent)
+// 就地部分排序，data 会被打乱
+static float percentile(std::vector<float>& data, float percent)
 {
     if (data.empty())
         return 0.0f;
 
-    std::vector<float> tmp = data;
-    std::sort(tmp.begin(), tmp.end());
-
     percent = std::clamp(percent, 0.0f, 100.0f);
     float p = percent / 100.0f;
-    size_t n = tmp.size();
+    size_t n = data.size();
     size_t idx = static_cast<size_t>(p * (n - 1));
     if (idx >= n) idx = n - 1;
-    return tmp[idx];
+    std::nth_element(data.begin(), data.begin() + idx, data.end());
+    return data[idx];
+}
+
+static float median_inplace(std::vector<float>& data)
+{
+    size_t n = data.size();
+    size_t mid = n / 2;
+    std::nth_element(data.begin(), data.begin() + mid, data.end());
+    float hi = data[mid];
+    if (n % 2 != 0)
+        return hi;
+    float lo = *std::max_element(data.begin(), data.begin() + mid);
+    return 0.5f * (lo + hi);
 }
 
-static void median_and_mad(const std::vector<float>& data, float& median, float& mad)
+static void median_and_mad(std::vector<float>& data, float& median, float& mad)
 {
     if (data.empty())
     {
@@ -34,48 +45,35 @@ static void median_and_mad(const std::vector<float>& data, float& median, float&
         return;
     }
 
-    std::vector<float> tmp = data;
-    std::sort(tmp.begin(), tmp.end());
-    size_t n = tmp.size();
-    size_t mid = n / 2;
-
-    if (n % 2 == 0)
-        median = 0.5f * (tmp[mid - 1] + tmp[mid]);
-    else
-        median = tmp[mid];
-
-    std::vector<float> devs;
-    devs.reserve(n);
-    for (float v : data)
-        devs.push_back(std::fabs(v - median));
-
-    std::sort(devs.begin(), devs.end());
-    if (n % 2 == 0)
-        mad = 0.5f * (devs[mid - 1] + devs[mid]);
-    else
-        mad = devs[mid];
+    median = median_inplace(data);
+    for (float& v : data)
+        v = std::fabs(v - median);
+    mad = median_inplace(data);
 
     if (mad < 1e-6f)
         mad = 1e-6f;
 }
 
-void auto_stretch(
-    std::vector<float>& rgb,
-    float black_clip,
-    float white_clip,
-    float stretch_strength)
+void compute_auto_stretch(const float* rgb, size_t pixels,
+                          float black_clip, float white_clip,
+                          float& outLow, float& outHigh,
+                          size_t maxSamples)
 {
-    if (rgb.empty())
+    outLow = 0.0f;
+    outHigh = 1.0f;
+    if (!rgb || pixels == 0)
         return;
 
+    size_t step = 1;
+    if (maxSamples > 0 && pixels > maxSamples)
+        step = (pixels + maxSamples - 1) / maxSamples;
+
     std::vector<float> lum;
-    lum.reserve(rgb.size() / 3);
-    for (size_t i = 0; i + 2 < rgb.size(); i += 3)
+    lum.reserve(pixels / step + 1);
+    for (size_t i = 0; i < pixels; i += step)
     {
-        float r = rgb[i];
-        float g = rgb[i + 1];
-        float b = rgb[i + 2];
-        float l = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+        const float* c = rgb + i * 3;
+        float l = 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
         lum.push_back(clamp01(l));
     }
 
@@ -97,22 +95,56 @@ void auto_stretch(
         high = std::max(highP, low + 1e-3f);
     }
 
-    float range = high - low;
+    outLow = low;
+    outHigh = high;
+}
+
+void apply_stretch(float* rgb, size_t pixels, const StretchParams& p)
+{
+    if (!rgb)
+        return;
 
-    if (stretch_strength < 1.0f)
-        stretch_strength = 1.0f;
+    const float range = std::max(p.high - p.low, 1e-3f);
+    const float s = std::max(p.strength, 1.0f);
+    const float asinhDenom = std::asinh(s);
+    const float logDenom = std::log(1.0f + s);
+    const float gains[3] = {p.wbR, p.wbG, p.wbB};
 
-    float denom = std::asinh(stretch_strength);
-    if (denom < 1e-6f)
-        denom = 1e-6f;
+    for (size_t i = 0; i < pixels * 3; ++i)
+    {
+        float c = clamp01(rgb[i] * gains[i % 3]);
+
+        if (p.useAuto)
+        {
+            float t = clamp01((c - p.low) / range);
+            switch (p.mode)
+            {
+                case 1:  c = clamp01(std::asinh(s * t) / asinhDenom); break;
+                case 2:  c = clamp01(std::log(1.0f + s * t) / logDenom); break;
+                case 3:  c = std::sqrt(t); break;
+                default: c = t; break;
+            }
+        }
+
+        if (p.useCurve)
+            c = tone_curve(c, p.curveBlack, p.curveWhite, p.curveGamma);
+
+        rgb[i] = c;
+    }
+}
 
-    auto stretch = [&](float v) -> float {
-        float t = (v - low) / range;
-        t = clamp01(t);
-        float s = std::asinh(stretch_strength * t) / denom;
-        return clamp01(s);
-    };
+void auto_stretch(
+    std::vector<float>& rgb,
+    float black_clip,
+    float white_clip,
+    float stretch_strength)
+{
+    if (rgb.empty())
+        return;
 
-    for (float& v : rgb)
-        v = stretch(v);
+    StretchParams p;
+    compute_auto_stretch(rgb.data(), rgb.size() / 3, black_clip, white_clip, p.low, p.high);
+    p.strength = stretch_strength;
+    p.mode = 1;
+    apply_stretch(rgb.data(), rgb.size() / 3, p);
 }
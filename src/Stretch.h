@@ -1,8 +1,36 @@
 #pragma once
 
+#include <cstddef>
 #include <vector>
 #include <cmath>
 
+// 与显示 shader 相同的一整套显示参数：白平衡 -> auto stretch -> tone curve
+struct StretchParams
+{
+    float wbR = 1.0f, wbG = 1.0f, wbB = 1.0f;
+
+    bool  useAuto  = true;
+    float low      = 0.0f;
+    float high     = 1.0f;
+    float strength = 5.0f;
+    int   mode     = 1;        // 0: 线性, 1: arcsinh, 2: log, 3: sqrt
+
+    bool  useCurve   = false;
+    float curveBlack = 0.0f;
+    float curveWhite = 1.0f;
+    float curveGamma = 1.0f;
+};
+
+// 按亮度统计 auto stretch 的 low/high（背景 median - 1.5 MAD 与百分位取大者），
+// 像素多时等间隔抽样，最多 maxSamples 个
+void compute_auto_stretch(const float* rgb, size_t pixels,
+                          float black_clip, float white_clip,
+                          float& outLow, float& outHigh,
+                          size_t maxSamples = 1u << 20);
+
+// 对交错 RGB（0~1）原地应用显示参数，结果与 GPU 显示一致
+void apply_stretch(float* rgb, size_t pixels, const StretchParams& p);
+
 // NINA 风格 auto stretch（背景 + 百分位 + arcsinh）
 void auto_stretch(
     std::vector<float>& rgb,
@@ -0,0 +1,74 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threads, int maxQueue)
+{
+    if (threads <= 0)
+        threads = std::max(1, (int)std::thread::hardware_concurrency());
+    if (maxQueue <= 0)
+        maxQueue = 2 * threads;
+
+    _maxQueue = (size_t)maxQueue;
+    _workers.reserve(threads);
+    for (int i = 0; i < threads; ++i)
+        _workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _taskCv.notify_all();
+
+    for (std::thread& t : _workers)
+        t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _spaceCv.wait(lock, [&] { return _tasks.size() < _maxQueue; });
+        _tasks.push_back(std::move(task));
+    }
+    _taskCv.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idleCv.wait(lock, [&] { return _tasks.empty() && _active == 0; });
+}
+
+void ThreadPool::workerLoop()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _taskCv.wait(lock, [&] { return _stopping || !_tasks.empty(); });
+            if (_tasks.empty())
+                return;   // _stopping
+
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+            ++_active;
+        }
+        _spaceCv.notify_one();
+
+        task();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            --_active;
+            if (_tasks.empty() && _active == 0)
+                _idleCv.notify_all();
+        }
+    }
+}
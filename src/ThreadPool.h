@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 固定线程数 + 有界任务队列的线程池：队列满时 submit 阻塞，
+// 批量处理大量文件时生产者不会一次把所有任务（和它们的内存）堆进队列
+class ThreadPool
+{
+public:
+    // threads <= 0 时用硬件线程数；maxQueue <= 0 时为 2 * threads
+    explicit ThreadPool(int threads = 0, int maxQueue = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+    // 等待队列清空且所有任务执行完
+    void wait();
+
+    int threadCount() const { return (int)_workers.size(); }
+
+private:
+    void workerLoop();
+
+private:
+    std::vector<std::thread>          _workers;
+    std::deque<std::function<void()>> _tasks;
+    size_t                            _maxQueue = 0;
+    int                               _active   = 0;
+    bool                              _stopping = false;
+
+    std::mutex              _mutex;
+    std::condition_variable _taskCv;    // 有新任务 / 停止
+    std::condition_variable _spaceCv;   // 队列有空位
+    std::condition_variable _idleCv;    // 全部完成
+};
@@ -0,0 +1,408 @@
+#include "ThumbnailCache.h"
+#include "AppPaths.h"
+
+#include <fitsio.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static const char     kThumbMagic[4] = {'F', 'V', 'T', 'H'};
+static const uint32_t kThumbVersion  = 1;
+
+// ---------- 缩略图生成 ----------
+
+// 中间调传递函数（PixInsight STF 同款）
+static float mtf(float m, float x)
+{
+    if (x <= 0.0f) return 0.0f;
+    if (x >= 1.0f) return 1.0f;
+    return ((m - 1.0f) * x) / ((2.0f * m - 1.0f) * x - m);
+}
+
+// 中值 / MAD 自动拉伸：阴影点 = 中值 - 2.8 * MADN，背景中值映射到 0.25
+static void stf_stretch(std::vector<float>& v)
+{
+    if (v.empty())
+        return;
+
+    auto [itMin, itMax] = std::minmax_element(v.begin(), v.end());
+    float mn = *itMin;
+    float mx = *itMax;
+    float range = (mx > mn) ? (mx - mn) : 1.0f;
+    for (float& x : v)
+        x = (x - mn) / range;
+
+    std::vector<float> tmp(v);
+    size_t mid = tmp.size() / 2;
+    std::nth_element(tmp.begin(), tmp.begin() + mid, tmp.end());
+    float median = tmp[mid];
+
+    for (float& x : tmp)
+        x = std::fabs(x - median);
+    std::nth_element(tmp.begin(), tmp.begin() + mid, tmp.end());
+    float madn = 1.4826f * tmp[mid];
+
+    const float targetBkg = 0.25f;
+    float c0 = (madn > 0.0f) ? std::clamp(median - 2.8f * madn, 0.0f, 1.0f) : 0.0f;
+    float x0 = (c0 < 1.0f) ? (median - c0) / (1.0f - c0) : 0.5f;
+
+    // 解 mtf(m, x0) = targetBkg
+    float m = 0.5f;
+    float denom = 2.0f * targetBkg * x0 - targetBkg - x0;
+    if (x0 > 0.0f && denom != 0.0f)
+        m = std::clamp(x0 * (targetBkg - 1.0f) / denom, 1e-4f, 1.0f - 1e-4f);
+
+    for (float& x : v)
+    {
+        float t = (c0 < 1.0f) ? (x - c0) / (1.0f - c0) : 0.0f;
+        x = mtf(m, std::clamp(t, 0.0f, 1.0f));
+    }
+}
+
+bool make_fits_thumbnail(const std::string& path, BayerPattern bayer, bool fromHeader,
+                         int maxSize, Thumbnail& out)
+{
+    fitsfile* fptr = nullptr;
+    int status = 0;
+
+    if (fits_open_file(&fptr, path.c_str(), READONLY, &status))
+        return false;
+
+    int bitpix = 0, naxis = 0;
+    long naxes[3] = {1, 1, 1};
+    if (fits_get_img_param(fptr, 3, &bitpix, &naxis, naxes, &status) || naxis < 2)
+    {
+        status = 0;
+        fits_close_file(fptr, &status);
+        return false;
+    }
+
+    const int  W      = (int)naxes[0];
+    const int  H      = (int)naxes[1];
+
+    if (fromHeader)
+    {
+        int nkeys = 0;
+        int hdrStatus = 0;
+        std::vector<std::string> cards;
+        if (!fits_get_hdrspace(fptr, &nkeys, nullptr, &hdrStatus))
+        {
+            char card[FLEN_CARD];
+            for (int i = 1; i <= nkeys && !fits_read_record(fptr, i, card, &hdrStatus); ++i)
+                cards.emplace_back(card);
+        }
+        bayer_pattern_from_header(cards, H, bayer);
+    }
+
+    const bool cube   = naxis >= 3 && naxes[2] == 3;
+    const bool mosaic = !cube && bayer != BayerPattern::NONE && W >= 2 && H >= 2;
+
+    // 超像素网格（Bayer 时每 2x2 一个像素），再按步长抽取
+    const int srcW = mosaic ? W / 2 : W;
+    const int srcH = mosaic ? H / 2 : H;
+    maxSize = std::max(maxSize, 8);
+    const int step = std::max(1, (std::max(srcW, srcH) + maxSize - 1) / maxSize);
+    const int tw   = std::max(1, srcW / step);
+    const int th   = std::max(1, srcH / step);
+
+    // 与 GPU 去拜耳相同的“概念 RGGB”翻转
+    const bool flipX = bayer == BayerPattern::BGGR || bayer == BayerPattern::GRBG;
+    const bool flipY = bayer == BayerPattern::BGGR || bayer == BayerPattern::GBRG;
+
+    std::vector<double> row0(W), row1(W), row2(W);
+    auto readRow = [&](int plane, int y, std::vector<double>& buf) {
+        long fpixel[3] = {1, (long)y + 1, (long)plane + 1};
+        return fits_read_pix(fptr, TDOUBLE, fpixel, W, nullptr, buf.data(), nullptr, &status) == 0;
+    };
+
+    // lin：自下而上（FITS 第一行在画面底部）
+    std::vector<float> lin((size_t)tw * th * 3);
+    bool ok = true;
+
+    for (int ty = 0; ty < th && ok; ++ty)
+    {
+        float* dst = lin.data() + (size_t)ty * tw * 3;
+
+        if (mosaic)
+        {
+            int cy = (ty * step + step / 2) * 2;
+            int py0 = flipY ? (H - 1 - cy) : cy;
+            int py1 = flipY ? (H - 2 - cy) : cy + 1;
+            ok = readRow(0, py0, row0) && readRow(0, py1, row1);
+
+            for (int tx = 0; tx < tw && ok; ++tx)
+            {
+                int cx = (tx * step + step / 2) * 2;
+                int px0 = flipX ? (W - 1 - cx) : cx;
+                int px1 = flipX ? (W - 2 - cx) : cx + 1;
+                dst[tx * 3 + 0] = (float)row0[px0];
+                dst[tx * 3 + 1] = (float)(0.5 * (row0[px1] + row1[px0]));
+                dst[tx * 3 + 2] = (float)row1[px1];
+            }
+        }
+        else if (cube)
+        {
+            int y = ty * step + step / 2;
+            ok = readRow(0, y, row0) && readRow(1, y, row1) && readRow(2, y, row2);
+            for (int tx = 0; tx < tw && ok; ++tx)
+            {
+                int x = tx * step + step / 2;
+                dst[tx * 3 + 0] = (float)row0[x];
+                dst[tx * 3 + 1] = (float)row1[x];
+                dst[tx * 3 + 2] = (float)row2[x];
+            }
+        }
+        else
+        {
+            int y = ty * step + step / 2;
+            ok = readRow(0, y, row0);
+            for (int tx = 0; tx < tw && ok; ++tx)
+            {
+                float v = (float)row0[tx * step + step / 2];
+                dst[tx * 3 + 0] = v;
+                dst[tx * 3 + 1] = v;
+                dst[tx * 3 + 2] = v;
+            }
+        }
+    }
+
+    status = 0;
+    fits_close_file(fptr, &status);
+    if (!ok)
+        return false;
+
+    stf_stretch(lin);
+
+    out.width  = tw;
+    out.height = th;
+    out.rgb.resize(lin.size());
+    for (int ty = 0; ty < th; ++ty)
+    {
+        const float*   src = lin.data() + (size_t)ty * tw * 3;
+        unsigned char* dst = out.rgb.data() + (size_t)(th - 1 - ty) * tw * 3;
+        for (int i = 0; i < tw * 3; ++i)
+            dst[i] = (unsigned char)(src[i] * 255.0f + 0.5f);
+    }
+    return true;
+}
+
+// ---------- 磁盘缓存 ----------
+
+// 键：绝对路径 + 修改时间 + 大小 + Bayer + 尺寸，任何一项变了都视为新文件
+static bool make_cache_key(const std::string& path, BayerPattern bayer, bool fromHeader,
+                           int maxSize, std::string& key)
+{
+    key.clear();
+    if (!append_file_stamp(path, key))
+        return false;
+
+    std::ostringstream ss;
+    ss << (int)bayer << (fromHeader ? "h" : "") << '|' << maxSize;
+    key += ss.str();
+    return true;
+}
+
+static bool load_cached(const std::string& file, const std::string& key, Thumbnail& out)
+{
+    FILE* fp = open_cache_file(file, kThumbMagic, kThumbVersion, key);
+    if (!fp)
+        return false;
+
+    uint32_t size[2] = {};
+    bool ok = std::fread(size, sizeof(size), 1, fp) == 1 &&
+              size[0] > 0 && size[1] > 0 && size[0] <= 4096 && size[1] <= 4096;
+    if (ok)
+    {
+        out.width  = (int)size[0];
+        out.height = (int)size[1];
+        out.rgb.resize((size_t)size[0] * size[1] * 3);
+        ok = std::fread(out.rgb.data(), 1, out.rgb.size(), fp) == out.rgb.size();
+    }
+
+    std::fclose(fp);
+    return ok;
+}
+
+static void store_cached(const std::string& file, const std::string& key, const Thumbnail& t)
+{
+    write_cache_file(file, kThumbMagic, kThumbVersion, key, [&](FILE* fp) {
+        uint32_t size[2] = {(uint32_t)t.width, (uint32_t)t.height};
+        return std::fwrite(size, sizeof(size), 1, fp) == 1 &&
+               std::fwrite(t.rgb.data(), 1, t.rgb.size(), fp) == t.rgb.size();
+    });
+}
+
+std::string ThumbnailCache::defaultCacheDir()
+{
+    return app_cache_dir("thumbs");
+}
+
+// ---------- 后台线程池 ----------
+
+ThumbnailCache::~ThumbnailCache()
+{
+    stop();
+}
+
+void ThumbnailCache::start(int threads)
+{
+    if (!_workers.empty())
+        return;
+
+    if (threads <= 0)
+    {
+        unsigned hw = std::thread::hardware_concurrency();
+        threads = (int)std::min(4u, hw ? hw : 1u);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = false;
+    }
+    for (int i = 0; i < threads; ++i)
+        _workers.emplace_back(&ThumbnailCache::workerLoop, this);
+}
+
+void ThumbnailCache::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _queue.clear();
+        _queued.clear();
+    }
+    _cv.notify_all();
+
+    for (std::thread& t : _workers)
+        t.join();
+    _workers.clear();
+}
+
+void ThumbnailCache::setCacheDir(const std::string& dir)
+{
+    if (!dir.empty())
+    {
+        std::error_code ec;
+        fs::create_directories(dir, ec);
+        if (ec)
+            std::cerr << "Thumbnail cache dir unavailable: " << dir << " (" << ec.message() << ")\n";
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _cacheDir = dir;
+}
+
+void ThumbnailCache::setBayer(BayerPattern bayer, bool fromHeader)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _bayer = bayer;
+    _bayerFromHeader = fromHeader;
+}
+
+void ThumbnailCache::setMaxSize(int maxSize)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _maxSize = std::clamp(maxSize, 16, 1024);
+}
+
+void ThumbnailCache::request(const std::string& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_queued.insert(path).second)
+            return;
+        _queue.push_front(path);
+    }
+    _cv.notify_one();
+}
+
+void ThumbnailCache::cancelPending()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (const std::string& p : _queue)
+        _queued.erase(p);
+    _queue.clear();
+}
+
+bool ThumbnailCache::pollReady(std::vector<Result>& out, int maxCount)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_ready.empty())
+        return false;
+
+    size_t n = std::min(_ready.size(), (size_t)std::max(maxCount, 1));
+    out.insert(out.end(),
+               std::make_move_iterator(_ready.begin()),
+               std::make_move_iterator(_ready.begin() + n));
+    _ready.erase(_ready.begin(), _ready.begin() + n);
+    return true;
+}
+
+int ThumbnailCache::pendingCount() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return (int)_queue.size() + _busy;
+}
+
+void ThumbnailCache::workerLoop()
+{
+    for (;;)
+    {
+        std::string  path;
+        BayerPattern bayer;
+        bool         fromHeader;
+        int          maxSize;
+        std::string  cacheDir;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [&] { return _stopping || !_queue.empty(); });
+            if (_stopping)
+                return;
+
+            path = std::move(_queue.front());
+            _queue.pop_front();
+            bayer    = _bayer;
+            fromHeader = _bayerFromHeader;
+            maxSize  = _maxSize;
+            cacheDir = _cacheDir;
+            ++_busy;
+        }
+
+        std::shared_ptr<const Thumbnail> thumb = produce(path, bayer, fromHeader, maxSize, cacheDir);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        --_busy;
+        _queued.erase(path);
+        _ready.emplace_back(std::move(path), std::move(thumb));
+    }
+}
+
+std::shared_ptr<const Thumbnail> ThumbnailCache::produce(const std::string& path, BayerPattern bayer,
+                                                         bool fromHeader, int maxSize,
+                                                         const std::string& cacheDir)
+{
+    std::string key;
+    std::string cacheFile;
+    if (!cacheDir.empty() && make_cache_key(path, bayer, fromHeader, maxSize, key))
+    {
+        cacheFile = cache_file_path(cacheDir, key, ".thm");
+
+        auto cached = std::make_shared<Thumbnail>();
+        if (load_cached(cacheFile, key, *cached))
+            return cached;
+    }
+
+    auto thumb = std::make_shared<Thumbnail>();
+    if (!make_fits_thumbnail(path, bayer, fromHeader, maxSize, *thumb))
+        return nullptr;
+
+    if (!cacheFile.empty())
+        store_cached(cacheFile, key, *thumb);
+    return thumb;
+}
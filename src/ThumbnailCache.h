@@ -0,0 +1,85 @@
+#pragma once
+
+#include "FitsImage.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// 一张缩略图：交错 RGB8，自上而下（和屏幕显示方向一致）
+struct Thumbnail
+{
+    int                        width  = 0;
+    int                        height = 0;
+    std::vector<unsigned char> rgb;
+};
+
+// 从 FITS 直接生成缩略图：按步长只读需要的行（隔行抽取），
+// Bayer 数据用 2x2 超像素去拜耳，再做类似 STF 的中值 / MAD 自动拉伸。
+// maxSize 为长边像素数；fromHeader 时头里的 BAYERPAT 优先于 bayer。
+bool make_fits_thumbnail(const std::string& path, BayerPattern bayer, bool fromHeader,
+                         int maxSize, Thumbnail& out);
+
+// 缩略图缓存：后台线程池生成缩略图，结果写进磁盘缓存（键 = 路径 + 修改时间 + 文件大小 + Bayer），
+// 再次打开同一目录时直接从磁盘读回。所有磁盘 / 解码工作都在后台线程，UI 线程只提交请求和取结果。
+class ThumbnailCache
+{
+public:
+    ThumbnailCache() = default;
+    ~ThumbnailCache();
+
+    ThumbnailCache(const ThumbnailCache&) = delete;
+    ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+    // threads <= 0 时用 min(4, 硬件线程数)
+    void start(int threads = 0);
+    void stop();
+
+    // 缓存目录为空时不落盘（只在内存里生成）
+    void setCacheDir(const std::string& dir);
+    void setBayer(BayerPattern bayer, bool fromHeader);
+    void setMaxSize(int maxSize);
+
+    // 平台默认缓存目录（macOS: ~/Library/Caches，Windows: %LOCALAPPDATA%，其它: $XDG_CACHE_HOME 或 ~/.cache）
+    static std::string defaultCacheDir();
+
+    // 请求一张缩略图，不阻塞；后请求的先处理（最近滚动到的可见项优先）
+    void request(const std::string& path);
+
+    // 丢弃所有还没开始的请求（换目录时）
+    void cancelPending();
+
+    // 取走已完成的结果，最多 maxCount 个；失败的缩略图为 nullptr
+    using Result = std::pair<std::string, std::shared_ptr<const Thumbnail>>;
+    bool pollReady(std::vector<Result>& out, int maxCount);
+
+    int pendingCount() const;
+
+private:
+    void workerLoop();
+    std::shared_ptr<const Thumbnail> produce(const std::string& path, BayerPattern bayer, bool fromHeader,
+                                             int maxSize, const std::string& cacheDir);
+
+private:
+    std::vector<std::thread> _workers;
+    mutable std::mutex       _mutex;
+    std::condition_variable  _cv;
+    bool                     _stopping = false;
+
+    std::deque<std::string>         _queue;      // 前面先处理
+    std::unordered_set<std::string> _queued;
+    std::vector<Result>             _ready;
+    int                             _busy = 0;
+
+    std::string  _cacheDir;
+    BayerPattern _bayer   = BayerPattern::NONE;
+    bool         _bayerFromHeader = true;
+    int          _maxSize = 160;
+};
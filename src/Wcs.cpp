@@ -0,0 +1,534 @@
+#include "Wcs.h"
+
+#include "HeaderIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <map>
+
+static const double kPi       = 3.14159265358979323846;
+static const double kDegToRad = kPi / 180.0;
+static const double kRadToDeg = 180.0 / kPi;
+static const size_t kChunk    = 256;   // 批量换算每段的点数（幂次表放在栈上）
+
+static bool parse_double(const std::map<std::string, std::string>& keys, const std::string& key, double& out)
+{
+    auto it = keys.find(key);
+    if (it == keys.end() || it->second.empty())
+        return false;
+
+    // FITS 允许 D 作为指数符号
+    std::string t = it->second;
+    std::replace(t.begin(), t.end(), 'D', 'E');
+    char* end = nullptr;
+    double v = std::strtod(t.c_str(), &end);
+    if (!end || end == t.c_str() || !std::isfinite(v))
+        return false;
+    out = v;
+    return true;
+}
+
+// A_p_q / B_p_q（prefix 为 A / B 或 AP / BP）合成一张项表，全为 0 的项不要
+static void read_sip(const std::map<std::string, std::string>& keys, const char* prefixA, const char* prefixB,
+                     int order, std::vector<Wcs::SipTerm>& out)
+{
+    out.clear();
+    char key[32];
+    for (int p = 0; p <= order; ++p)
+        for (int q = 0; p + q <= order; ++q)
+        {
+            Wcs::SipTerm t;
+            t.p = p;
+            t.q = q;
+            std::snprintf(key, sizeof(key), "%s_%d_%d", prefixA, p, q);
+            parse_double(keys, key, t.a);
+            std::snprintf(key, sizeof(key), "%s_%d_%d", prefixB, p, q);
+            parse_double(keys, key, t.b);
+            if (t.a != 0.0 || t.b != 0.0)
+                out.push_back(t);
+        }
+}
+
+bool parse_wcs(const std::vector<std::string>& cards, Wcs& out, std::string& error)
+{
+    out = Wcs{};
+    error.clear();
+
+    std::map<std::string, std::string> keys;
+    std::string key, value;
+    for (const std::string& card : cards)
+        if (parse_fits_card(card, key, value))
+            keys[key] = value;
+
+    auto ctype1 = keys.find("CTYPE1");
+    auto ctype2 = keys.find("CTYPE2");
+    if (ctype1 == keys.end() || ctype2 == keys.end())
+        return false;
+
+    // 'RA---TAN' / 'RA---TAN-SIP'：前 4 个字符是坐标轴，5~7 是投影
+    const std::string& t1 = ctype1->second;
+    const std::string& t2 = ctype2->second;
+    if (t1.size() < 8 || t2.size() < 8 || t1.compare(0, 4, "RA--") != 0 || t2.compare(0, 4, "DEC-") != 0)
+    {
+        error = "不支持的坐标轴 " + t1 + " / " + t2;
+        return false;
+    }
+    if (t1.compare(5, 3, "TAN") != 0 || t2.compare(5, 3, "TAN") != 0)
+    {
+        error = "不支持的投影 " + t1.substr(5) + "（只支持 TAN / TAN-SIP）";
+        return false;
+    }
+    const bool sip = t1.size() >= 12 && t1.compare(8, 4, "-SIP") == 0;
+
+    if (!parse_double(keys, "CRPIX1", out.crpix[0]) || !parse_double(keys, "CRPIX2", out.crpix[1]) ||
+        !parse_double(keys, "CRVAL1", out.crval[0]) || !parse_double(keys, "CRVAL2", out.crval[1]))
+    {
+        error = "缺少 CRPIX / CRVAL";
+        return false;
+    }
+
+    double lonpole = 180.0;
+    if (parse_double(keys, "LONPOLE", lonpole) && std::fabs(lonpole - 180.0) > 1e-9)
+    {
+        error = "不支持 LONPOLE ≠ 180";
+        return false;
+    }
+
+    // 线性部分：CD，其次 PC x CDELT，最后 CDELT + CROTA2（老式头）
+    double* cd = out.cd;
+    bool hasCd = false;
+    const char* cdKeys[4] = {"CD1_1", "CD1_2", "CD2_1", "CD2_2"};
+    for (int i = 0; i < 4; ++i)
+    {
+        cd[i] = 0.0;
+        hasCd |= parse_double(keys, cdKeys[i], cd[i]);
+    }
+    if (!hasCd)
+    {
+        double pc[4] = {1.0, 0.0, 0.0, 1.0};
+        const char* pcKeys[4] = {"PC1_1", "PC1_2", "PC2_1", "PC2_2"};
+        bool hasPc = false;
+        for (int i = 0; i < 4; ++i)
+            hasPc |= parse_double(keys, pcKeys[i], pc[i]);
+
+        // 有 PC 时 CDELT 按标准缺省为 1；CD、PC 都没有时只剩 CDELT，必须两个都有
+        double cdelt[2] = {1.0, 1.0};
+        const bool hasCdelt1 = parse_double(keys, "CDELT1", cdelt[0]);
+        const bool hasCdelt2 = parse_double(keys, "CDELT2", cdelt[1]);
+        if (!hasPc && !(hasCdelt1 && hasCdelt2))
+        {
+            error = "缺少 CD / PC / CDELT";
+            return false;
+        }
+
+        double crota = 0.0;
+        if (!hasPc && (parse_double(keys, "CROTA2", crota) || parse_double(keys, "CROTA1", crota)))
+        {
+            const double c = std::cos(crota * kDegToRad), s = std::sin(crota * kDegToRad);
+            pc[0] = c;
+            pc[1] = -s * cdelt[1] / cdelt[0];
+            pc[2] = s * cdelt[0] / cdelt[1];
+            pc[3] = c;
+        }
+        cd[0] = cdelt[0] * pc[0];
+        cd[1] = cdelt[0] * pc[1];
+        cd[2] = cdelt[1] * pc[2];
+        cd[3] = cdelt[1] * pc[3];
+    }
+
+    const double det = cd[0] * cd[3] - cd[1] * cd[2];
+    if (!(std::fabs(det) > 0.0))
+    {
+        error = "WCS 矩阵奇异";
+        return false;
+    }
+    out.cdInv[0] =  cd[3] / det;
+    out.cdInv[1] = -cd[1] / det;
+    out.cdInv[2] = -cd[2] / det;
+    out.cdInv[3] =  cd[0] / det;
+
+    if (sip)
+    {
+        double a = 0.0, b = 0.0;
+        parse_double(keys, "A_ORDER", a);
+        parse_double(keys, "B_ORDER", b);
+        out.sipOrder = std::clamp((int)std::max(a, b), 0, Wcs::kMaxSipOrder);
+        read_sip(keys, "A", "B", out.sipOrder, out.sip);
+
+        a = b = 0.0;
+        parse_double(keys, "AP_ORDER", a);
+        parse_double(keys, "BP_ORDER", b);
+        out.sipInvOrder = std::clamp((int)std::max(a, b), 0, Wcs::kMaxSipOrder);
+        read_sip(keys, "AP", "BP", out.sipInvOrder, out.sipInv);
+
+        if (out.sip.empty())
+            out.sipOrder = 0;
+        if (out.sipInv.empty())
+            out.sipInvOrder = 0;
+    }
+
+    out.valid = true;
+    return true;
+}
+
+double Wcs::pixelScale() const
+{
+    return std::sqrt(std::fabs(cd[0] * cd[3] - cd[1] * cd[2])) * 3600.0;
+}
+
+double Wcs::rotation() const
+{
+    return std::atan2(-cd[1], cd[3]) * kRadToDeg;
+}
+
+// 一段点上的 SIP 多项式：先建 u / v 的幂次表，再按项累加，内层循环都是同样的乘加
+static void sip_eval(const std::vector<Wcs::SipTerm>& terms, int order,
+                     const double* u, const double* v, double* du, double* dv, size_t n)
+{
+    double up[Wcs::kMaxSipOrder + 1][kChunk];
+    double vp[Wcs::kMaxSipOrder + 1][kChunk];
+    for (size_t k = 0; k < n; ++k)
+    {
+        up[0][k] = 1.0;
+        vp[0][k] = 1.0;
+        du[k] = 0.0;
+        dv[k] = 0.0;
+    }
+    for (int p = 1; p <= order; ++p)
+        for (size_t k = 0; k < n; ++k)
+        {
+            up[p][k] = up[p - 1][k] * u[k];
+            vp[p][k] = vp[p - 1][k] * v[k];
+        }
+
+    for (const Wcs::SipTerm& t : terms)
+    {
+        const double* a = up[t.p];
+        const double* b = vp[t.q];
+        for (size_t k = 0; k < n; ++k)
+        {
+            const double m = a[k] * b[k];
+            du[k] += t.a * m;
+            dv[k] += t.b * m;
+        }
+    }
+}
+
+void wcs_pixel_to_sky(const Wcs& wcs, const double* x, const double* y, double* ra, double* dec, size_t n)
+{
+    const double ra0  = wcs.crval[0];
+    const double sin0 = std::sin(wcs.crval[1] * kDegToRad);
+    const double cos0 = std::cos(wcs.crval[1] * kDegToRad);
+    const double* cd  = wcs.cd;
+
+    double u[kChunk], v[kChunk], du[kChunk], dv[kChunk];
+    for (size_t base = 0; base < n; base += kChunk)
+    {
+        const size_t m = std::min(kChunk, n - base);
+        for (size_t k = 0; k < m; ++k)
+        {
+            u[k] = x[base + k] + 1.0 - wcs.crpix[0];
+            v[k] = y[base + k] + 1.0 - wcs.crpix[1];
+        }
+
+        if (wcs.sipOrder > 0)
+        {
+            sip_eval(wcs.sip, wcs.sipOrder, u, v, du, dv, m);
+            for (size_t k = 0; k < m; ++k)
+            {
+                u[k] += du[k];
+                v[k] += dv[k];
+            }
+        }
+
+        // 中间坐标（切平面，弧度）反投影：LONPOLE = 180 时的 gnomonic 反变换
+        for (size_t k = 0; k < m; ++k)
+        {
+            const double X   = (cd[0] * u[k] + cd[1] * v[k]) * kDegToRad;
+            const double Y   = (cd[2] * u[k] + cd[3] * v[k]) * kDegToRad;
+            const double den = cos0 - Y * sin0;
+            const double a   = ra0 + std::atan2(X, den) * kRadToDeg;
+            ra[base + k]  = a - 360.0 * std::floor(a / 360.0);
+            dec[base + k] = std::atan2(sin0 + Y * cos0, std::sqrt(X * X + den * den)) * kRadToDeg;
+        }
+    }
+}
+
+void wcs_sky_to_pixel(const Wcs& wcs, const double* ra, const double* dec, double* x, double* y, size_t n)
+{
+    const double ra0  = wcs.crval[0];
+    const double sin0 = std::sin(wcs.crval[1] * kDegToRad);
+    const double cos0 = std::cos(wcs.crval[1] * kDegToRad);
+    const double* ci  = wcs.cdInv;
+    const double nan  = std::numeric_limits<double>::quiet_NaN();
+
+    double u[kChunk], v[kChunk], u0[kChunk], v0[kChunk], du[kChunk], dv[kChunk];
+    for (size_t base = 0; base < n; base += kChunk)
+    {
+        const size_t m = std::min(kChunk, n - base);
+        for (size_t k = 0; k < m; ++k)
+        {
+            const double dra  = (ra[base + k] - ra0) * kDegToRad;
+            const double d    = dec[base + k] * kDegToRad;
+            const double sd   = std::sin(d), cd = std::cos(d);
+            const double cdra = std::cos(dra);
+            const double cosc = sin0 * sd + cos0 * cd * cdra;
+            // 投影中心背面（cosc <= 0）在切平面上没有像
+            const double inv  = cosc > 1e-8 ? kRadToDeg / cosc : nan;
+            const double X    = cd * std::sin(dra) * inv;
+            const double Y    = (cos0 * sd - sin0 * cd * cdra) * inv;
+            u[k] = ci[0] * X + ci[1] * Y;
+            v[k] = ci[2] * X + ci[3] * Y;
+        }
+
+        if (wcs.sipInvOrder > 0)
+        {
+            sip_eval(wcs.sipInv, wcs.sipInvOrder, u, v, du, dv, m);
+            for (size_t k = 0; k < m; ++k)
+            {
+                u[k] += du[k];
+                v[k] += dv[k];
+            }
+        }
+        else if (wcs.sipOrder > 0)
+        {
+            // 没有 AP / BP：解 u + f(u, v) = u'，畸变只有几个像素，不动点迭代几次就收敛
+            std::copy(u, u + m, u0);
+            std::copy(v, v + m, v0);
+            for (int iter = 0; iter < 6; ++iter)
+            {
+                sip_eval(wcs.sip, wcs.sipOrder, u, v, du, dv, m);
+                for (size_t k = 0; k < m; ++k)
+                {
+                    u[k] = u0[k] - du[k];
+                    v[k] = v0[k] - dv[k];
+                }
+            }
+        }
+
+        for (size_t k = 0; k < m; ++k)
+        {
+            x[base + k] = u[k] + wcs.crpix[0] - 1.0;
+            y[base + k] = v[k] + wcs.crpix[1] - 1.0;
+        }
+    }
+}
+
+// ---------- 格式化 ----------
+
+std::string format_ra(double ra, double resolution)
+{
+    ra -= 360.0 * std::floor(ra / 360.0);
+    char buf[32];
+    if (resolution >= 15.0)
+    {
+        std::snprintf(buf, sizeof(buf), "%02dh", (int)(std::llround(ra / 15.0) % 24));
+    }
+    else if (resolution >= 0.25)
+    {
+        const long long m = std::llround(ra * 4.0) % (24 * 60);
+        std::snprintf(buf, sizeof(buf), "%02dh%02dm", (int)(m / 60), (int)(m % 60));
+    }
+    else if (resolution >= 1.0 / 240.0)
+    {
+        const long long s = std::llround(ra * 240.0) % (24 * 3600);
+        std::snprintf(buf, sizeof(buf), "%02dh%02dm%02ds", (int)(s / 3600), (int)(s / 60 % 60), (int)(s % 60));
+    }
+    else
+    {
+        // 先按要显示的位数取整再拆分，避免 59.99 秒显示成 60
+        const int       digits = resolution >= 1.0 / 2400.0 ? 1 : 2;
+        const long long scale  = digits == 1 ? 10 : 100;
+        const long long t = std::llround(ra * 240.0 * scale) % (24 * 3600 * scale);
+        const long long s = t / scale;
+        std::snprintf(buf, sizeof(buf), "%02dh%02dm%0*.*fs", (int)(s / 3600), (int)(s / 60 % 60),
+                      digits + 3, digits, (double)(t % (60 * scale)) / scale);
+    }
+    return buf;
+}
+
+std::string format_dec(double dec, double resolution)
+{
+    const char sign = dec < 0.0 ? '-' : '+';
+    const double a  = std::fabs(dec);
+    char buf[32];
+    if (resolution >= 1.0)
+    {
+        std::snprintf(buf, sizeof(buf), "%c%02d°", sign, (int)std::llround(a));
+    }
+    else if (resolution >= 1.0 / 60.0)
+    {
+        const long long m = std::llround(a * 60.0);
+        std::snprintf(buf, sizeof(buf), "%c%02d°%02d'", sign, (int)(m / 60), (int)(m % 60));
+    }
+    else if (resolution >= 1.0 / 3600.0)
+    {
+        const long long s = std::llround(a * 3600.0);
+        std::snprintf(buf, sizeof(buf), "%c%02d°%02d'%02d\"", sign, (int)(s / 3600), (int)(s / 60 % 60), (int)(s % 60));
+    }
+    else
+    {
+        const long long t = std::llround(a * 36000.0);
+        const long long s = t / 10;
+        std::snprintf(buf, sizeof(buf), "%c%02d°%02d'%04.1f\"", sign, (int)(s / 3600), (int)(s / 60 % 60),
+                      (double)(t % 600) / 10.0);
+    }
+    return buf;
+}
+
+// ---------- 网格 ----------
+
+// 可选的间隔（度）：赤经按时间单位（1s .. 6h），赤纬按角度（1" .. 30°）
+static const double kRaSteps[] = {
+    1.0 / 240, 2.0 / 240, 5.0 / 240, 10.0 / 240, 15.0 / 240, 30.0 / 240,
+    0.25, 0.5, 1.25, 2.5, 3.75, 5.0, 7.5,
+    15.0, 30.0, 45.0, 90.0
+};
+static const double kDecSteps[] = {
+    1.0 / 3600, 2.0 / 3600, 5.0 / 3600, 10.0 / 3600, 15.0 / 3600, 30.0 / 3600,
+    1.0 / 60, 2.0 / 60, 5.0 / 60, 10.0 / 60, 15.0 / 60, 30.0 / 60,
+    1.0, 2.0, 5.0, 10.0, 15.0, 30.0
+};
+static const int kTargetLines  = 5;    // 每个方向大约几条线
+static const int kMaxLines     = 64;
+static const int kLinePoints   = 96;   // 每条线的采样点数
+static const int kRangeSamples = 17;   // 估计 RA / Dec 范围时每边抽样的点数
+
+template <size_t N>
+static double pick_step(double range, const double (&steps)[N])
+{
+    for (double s : steps)
+        if (s * kTargetLines >= range)
+            return s;
+    return steps[N - 1];
+}
+
+bool build_sky_grid(const Wcs& wcs, double x0, double y0, double x1, double y1, SkyGrid& out)
+{
+    out = SkyGrid{};
+    if (!wcs.valid || !(x1 > x0) || !(y1 > y0))
+        return false;
+
+    // 可见区域抽样，RA 相对中心点展开（跨 0h 时不跳变）
+    const int S = kRangeSamples;
+    std::vector<double> px(S * S), py(S * S), sra(S * S), sdec(S * S);
+    for (int j = 0; j < S; ++j)
+        for (int i = 0; i < S; ++i)
+        {
+            px[j * S + i] = x0 + (x1 - x0) * i / (S - 1);
+            py[j * S + i] = y0 + (y1 - y0) * j / (S - 1);
+        }
+    wcs_pixel_to_sky(wcs, px.data(), py.data(), sra.data(), sdec.data(), px.size());
+
+    const double raC = sra[(S * S) / 2];
+    double dMin = 1e30, dMax = -1e30, decMin = 1e30, decMax = -1e30;
+    for (size_t k = 0; k < sra.size(); ++k)
+    {
+        if (!std::isfinite(sra[k]) || !std::isfinite(sdec[k]))
+            continue;
+        double d = sra[k] - raC;
+        d -= 360.0 * std::floor((d + 180.0) / 360.0);
+        dMin   = std::min(dMin, d);
+        dMax   = std::max(dMax, d);
+        decMin = std::min(decMin, sdec[k]);
+        decMax = std::max(decMax, sdec[k]);
+    }
+    if (!(dMax >= dMin) || !std::isfinite(raC))
+        return false;
+
+    // 抽样点之间可能还有更大的值，两边各放宽一点
+    const double decPad = 0.05 * (decMax - decMin);
+    decMin = std::max(decMin - decPad, -90.0);
+    decMax = std::min(decMax + decPad, 90.0);
+    const double raPad = 0.05 * (dMax - dMin);
+    double raMin = raC + dMin - raPad;
+    double raMax = raC + dMax + raPad;
+
+    // 天极在可见区域里时赤经取满一圈
+    bool fullRa = false;
+    for (double pole : {90.0, -90.0})
+    {
+        double x, y;
+        wcs_sky_to_pixel(wcs, &raC, &pole, &x, &y, 1);
+        if (x >= x0 && x <= x1 && y >= y0 && y <= y1)
+        {
+            fullRa = true;
+            (pole > 0.0 ? decMax : decMin) = pole;
+        }
+    }
+    if (fullRa || raMax - raMin >= 360.0)
+    {
+        fullRa = true;
+        raMin  = raC - 180.0;
+        raMax  = raC + 180.0;
+    }
+
+    out.raStep  = pick_step(raMax - raMin, kRaSteps);
+    out.decStep = pick_step(decMax - decMin, kDecSteps);
+
+    // 所有线上的点放进同一组数组，一次批量换算
+    std::vector<double> ra, dec;
+    const long long r0 = (long long)std::ceil(raMin / out.raStep);
+    long long       r1 = (long long)std::floor(raMax / out.raStep);
+    if (fullRa)
+        r1 = r0 + std::llround(360.0 / out.raStep) - 1;
+    for (long long k = r0; k <= r1 && (int)out.lines.size() < kMaxLines; ++k)
+    {
+        SkyGridLine line;
+        line.constantRa = true;
+        line.value = k * out.raStep;
+        line.value -= 360.0 * std::floor(line.value / 360.0);
+        line.label = format_ra(line.value, out.raStep);
+        for (int j = 0; j < kLinePoints; ++j)
+        {
+            ra.push_back(line.value);
+            dec.push_back(decMin + (decMax - decMin) * j / (kLinePoints - 1));
+        }
+        out.lines.push_back(std::move(line));
+    }
+
+    const int raLines = (int)out.lines.size();
+    const long long d0 = (long long)std::ceil(decMin / out.decStep);
+    const long long d1 = (long long)std::floor(decMax / out.decStep);
+    for (long long k = d0; k <= d1 && (int)out.lines.size() < raLines + kMaxLines; ++k)
+    {
+        SkyGridLine line;
+        line.constantRa = false;
+        line.value = k * out.decStep;
+        if (std::fabs(line.value) > 90.0 - 1e-9)
+            continue;   // 天极只是一个点
+        line.label = format_dec(line.value, out.decStep);
+        for (int j = 0; j < kLinePoints; ++j)
+        {
+            ra.push_back(raMin + (raMax - raMin) * j / (kLinePoints - 1));
+            dec.push_back(line.value);
+        }
+        out.lines.push_back(std::move(line));
+    }
+
+    std::vector<double> gx(ra.size()), gy(ra.size());
+    wcs_sky_to_pixel(wcs, ra.data(), dec.data(), gx.data(), gy.data(), ra.size());
+
+    // 离可见区域超过一个区域大小的点不要（切平面边缘会飞到很远），线在那里断开
+    const double mx = x1 - x0, my = y1 - y0;
+    const float  nanf = std::numeric_limits<float>::quiet_NaN();
+    size_t k = 0;
+    for (SkyGridLine& line : out.lines)
+    {
+        line.x.resize(kLinePoints);
+        line.y.resize(kLinePoints);
+        for (int j = 0; j < kLinePoints; ++j, ++k)
+        {
+            const double x = gx[k], y = gy[k];
+            const bool near = x >= x0 - mx && x <= x1 + mx && y >= y0 - my && y <= y1 + my;
+            line.x[j] = near ? (float)x : nanf;
+            line.y[j] = near ? (float)y : nanf;
+            if (line.labelIndex < 0 && x >= x0 && x <= x1 && y >= y0 && y <= y1)
+                line.labelIndex = j;
+        }
+    }
+    return true;
+}
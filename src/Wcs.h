@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// 头里的天球坐标（FITS WCS）：TAN（gnomonic）投影，可选 SIP 畸变多项式。
+// 像素坐标和程序里其他地方一致：像素 (i, j) 的中心为 (i, j)，第 0 行是文件第一行
+// （FITS 约定里同一个像素是 (i + 1, j + 1)）。角度单位都是度
+struct Wcs
+{
+    bool   valid = false;
+    double crpix[2] = {0.0, 0.0};        // FITS 约定（从 1 开始）
+    double crval[2] = {0.0, 0.0};        // 参考点的 RA / Dec
+    double cd[4]    = {1.0, 0.0, 0.0, 1.0};   // 行优先，像素 -> 中间坐标（度）
+    double cdInv[4] = {1.0, 0.0, 0.0, 1.0};
+
+    // SIP：u' = u + sum A_p_q u^p v^q（p + q <= order），AP / BP 为反向多项式（没有时反向用迭代）
+    static constexpr int kMaxSipOrder = 9;
+    struct SipTerm
+    {
+        int    p = 0;
+        int    q = 0;
+        double a = 0.0;    // x 方向（A / AP）
+        double b = 0.0;    // y 方向（B / BP）
+    };
+    int sipOrder    = 0;   // 0 为没有 SIP
+    int sipInvOrder = 0;
+    std::vector<SipTerm> sip;
+    std::vector<SipTerm> sipInv;
+
+    // 参考点附近每像素对应的角度（角秒），和等价的 CROTA2（度）
+    double pixelScale() const;
+    double rotation() const;
+};
+
+// 从头卡片解析：CTYPE1 / 2 = 'RA---TAN' / 'DEC--TAN'（或 -SIP），CRPIX / CRVAL，线性部分依次取
+// CD、PC x CDELT（CDELT 缺省为 1）、CDELT + CROTA2。没有 WCS 关键字时返回 false 且 error 为空；
+// 有但不支持（别的投影、矩阵奇异、LONPOLE 不是 180）时返回 false，error 给出原因
+bool parse_wcs(const std::vector<std::string>& cards, Wcs& out, std::string& error);
+
+// 批量换算（结构数组）：按 256 个点一段，SIP 多项式按项累加、TAN 投影逐段做，内层循环没有分支，
+// 网格叠加层一次换算几千个点。skyToPixel 对投影中心背面的点给出 NaN
+void wcs_pixel_to_sky(const Wcs& wcs, const double* x, const double* y, double* ra, double* dec, size_t n);
+void wcs_sky_to_pixel(const Wcs& wcs, const double* ra, const double* dec, double* x, double* y, size_t n);
+
+// 格式化：resolution 是需要分辨的最小角度（度），据此决定显示到时 / 分 / 秒 / 小数
+std::string format_ra(double ra, double resolution);
+std::string format_dec(double dec, double resolution);
+
+// 一条网格线：等赤经线沿赤纬方向画，等赤纬线沿赤经方向画
+struct SkyGridLine
+{
+    bool               constantRa = true;
+    double             value = 0.0;     // 度
+    std::vector<float> x, y;            // 图像像素坐标，NaN 处断开
+    int                labelIndex = -1; // 第一个落在可见区域里的点（标注位置），-1 为不可见
+    std::string        label;
+};
+
+struct SkyGrid
+{
+    double raStep  = 0.0;     // 度
+    double decStep = 0.0;
+    std::vector<SkyGridLine> lines;
+};
+
+// 为图像上的可见区域 [x0, x1] x [y0, y1]（像素坐标）生成赤经 / 赤纬网格：
+// 先在区域里抽样换算出 RA / Dec 范围（包含天极时赤经取满一圈），按范围选整齐的间隔（赤经按时间单位），
+// 再把所有线上的点一次批量换算回像素。离可见区域太远的点置为 NaN，线在那里断开。
+// 只在视图变化时调用，区域太小或换算失败时返回 false
+bool build_sky_grid(const Wcs& wcs, double x0, double y0, double x1, double y1, SkyGrid& out);
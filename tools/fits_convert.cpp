@@ -0,0 +1,646 @@
+// 无界面批量转换：FITS -> PNG / TIFF / FITS
+// 复用 load_fits + debayer_bilinear + auto_stretch，多个文件在线程池里并行处理，
+// 不依赖 GLFW / ImGui / OpenGL，可以在没有显示器的服务器上跑
+#include "FitsImage.h"
+#include "Calibration.h"
+#include "Cosmetic.h"
+#include "AppPaths.h"
+#include "Debayer.h"
+#include "Stretch.h"
+#include "ImageWriter.h"
+#include "FitsWriter.h"
+#include "ThreadPool.h"
+
+#ifdef FITSVIEWER_HAS_HEADLESS_GL
+#include <glad/glad.h>
+#include "GlImageRenderer.h"
+#include "HeadlessGlContext.h"
+#include <future>
+#include <memory>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Options
+{
+    std::string  outDir;
+    ExportFormat format   = ExportFormat::PNG8;
+    BayerPattern bayer    = BayerPattern::RGGB;
+    bool         headerBayer = true;   // 头里有 BAYERPAT 时优先用头里的
+    std::string  biasPath, darkPath, flatPath;
+    bool         scaleDark = true;
+    std::shared_ptr<const Calibration> calibration;   // 所有文件共用，main 里加载一次
+    float        hotSigma  = 0.0f;                    // 0 为不修热点
+    float        coldSigma = 0.0f;
+    bool         darkDefects = false;                 // 从 --dark 生成坏点表
+    std::shared_ptr<const CosmeticSettings> cosmetic;
+    int          jobs     = 0;
+    int          level    = 6;
+    bool         stretch  = true;
+    float        blackClip = 0.1f;
+    float        whiteClip = 0.1f;
+    float        strength  = 5.0f;
+    bool         quiet     = false;
+    bool         gpu       = false;
+};
+
+// 每个阶段的耗时（毫秒）
+struct StageTimes
+{
+    double load    = 0.0;
+    double debayer = 0.0;
+    double stretch = 0.0;
+    double encode  = 0.0;
+    double megapixels = 0.0;
+
+    StageTimes& operator+=(const StageTimes& o)
+    {
+        load    += o.load;
+        debayer += o.debayer;
+        stretch += o.stretch;
+        encode  += o.encode;
+        megapixels += o.megapixels;
+        return *this;
+    }
+};
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+void print_usage()
+{
+    std::cout <<
+        "Usage: fits_convert [options] <file.fits | directory>...\n"
+        "\n"
+        "  -o <dir>         output directory (default: next to each input)\n"
+        "  -f <format>      png8 | png16 | tiff16 | tiff16z | fits   (default png8)\n"
+        "  -b <pattern>     RGGB | BGGR | GRBG | GBRG | NONE          (default RGGB)\n"
+        "                   used when the header has no BAYERPAT / COLORTYP\n"
+        "  --ignore-header-bayer  always use -b, even if the header names a pattern\n"
+        "  --bias <file>    master bias subtracted from every frame\n"
+        "  --dark <file>    master dark (scaled by EXPTIME when a bias is given)\n"
+        "  --flat <file>    master flat (bias-subtracted, normalised to its mean)\n"
+        "  --no-dark-scale  subtract the dark as is\n"
+        "  --hot-sigma <s>  replace pixels s sigma above their same-colour neighbours\n"
+        "  --cold-sigma <s> same for pixels below their neighbours (default off)\n"
+        "  --dark-defects   also replace the hot pixels found in --dark (cached)\n"
+        "  -j <n>           files converted in parallel (default: hardware threads)\n"
+        "  -l <level>       zlib level 1-9 for PNG / TIFF Deflate (default 6)\n"
+        "  --linear         no stretch (min/max normalised; FITS keeps ADU)\n"
+        "  --black <pct>    auto stretch black clip %  (default 0.1)\n"
+        "  --white <pct>    auto stretch white clip %  (default 0.1)\n"
+        "  --strength <s>   arcsinh strength          (default 5)\n"
+        "  -q               only print the summary\n"
+#ifdef FITSVIEWER_HAS_HEADLESS_GL
+        "  --gpu            render with the viewer's GPU shader pipeline (headless GL),\n"
+        "                   files are rendered one at a time, the next one loads meanwhile\n"
+#endif
+        ;
+}
+
+bool parse_format(const std::string& s, ExportFormat& out)
+{
+    if (s == "png8")    { out = ExportFormat::PNG8;          return true; }
+    if (s == "png16")   { out = ExportFormat::PNG16;         return true; }
+    if (s == "tiff16")  { out = ExportFormat::TIFF16;        return true; }
+    if (s == "tiff16z") { out = ExportFormat::TIFF16Deflate; return true; }
+    if (s == "fits")    { out = ExportFormat::FITS32;        return true; }
+    return false;
+}
+
+bool parse_bayer(const std::string& s, BayerPattern& out)
+{
+    if (s == "RGGB") { out = BayerPattern::RGGB; return true; }
+    if (s == "BGGR") { out = BayerPattern::BGGR; return true; }
+    if (s == "GRBG") { out = BayerPattern::GRBG; return true; }
+    if (s == "GBRG") { out = BayerPattern::GBRG; return true; }
+    if (s == "NONE") { out = BayerPattern::NONE; return true; }
+    return false;
+}
+
+void collect_inputs(const std::string& arg, std::vector<fs::path>& out)
+{
+    std::error_code ec;
+    if (fs::is_directory(arg, ec))
+    {
+        std::vector<fs::path> files;
+        for (const auto& e : fs::directory_iterator(arg, ec))
+        {
+            if (e.is_regular_file(ec) && has_fits_extension(e.path().string()))
+                files.push_back(e.path());
+        }
+        std::sort(files.begin(), files.end());
+        out.insert(out.end(), files.begin(), files.end());
+    }
+    else
+    {
+        out.emplace_back(arg);
+    }
+}
+
+fs::path output_path(const fs::path& in, const Options& opt)
+{
+    fs::path dir = opt.outDir.empty() ? in.parent_path() : fs::path(opt.outDir);
+    std::string name = in.stem().string();
+    if (opt.format == ExportFormat::FITS32)
+        name += "_processed";   // 不能覆盖源文件
+    return dir / (name + export_format_extension(opt.format));
+}
+
+// 0~1 浮点 RGB 写 PNG / TIFF：自上而下写，第一行是 FITS 最后一行（和界面导出一致）
+bool write_rgb_image(const std::vector<float>& rgb, int W, int H,
+                     const fs::path& path, const Options& opt,
+                     const ImageWriterOptions& wopt)
+{
+    std::unique_ptr<ImageRowWriter> writer =
+        open_image_writer(path.string(), opt.format, W, H, wopt);
+    if (!writer)
+        return false;
+
+    const bool is16 = export_format_bit_depth(opt.format) == 16;
+    const size_t samples = (size_t)W * 3;
+    std::vector<uint16_t> row16(is16 ? samples : 0);
+    std::vector<unsigned char> row8(is16 ? 0 : samples);
+
+    bool ok = true;
+    for (int y = 0; y < H && ok; ++y)
+    {
+        const float* src = rgb.data() + (size_t)(H - 1 - y) * samples;
+        if (is16)
+        {
+            for (size_t i = 0; i < samples; ++i)
+                row16[i] = (uint16_t)(std::clamp(src[i], 0.0f, 1.0f) * 65535.0f + 0.5f);
+            ok = writer->writeRow(row16.data());
+        }
+        else
+        {
+            for (size_t i = 0; i < samples; ++i)
+                row8[i] = (unsigned char)(std::clamp(src[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+            ok = writer->writeRow(row8.data());
+        }
+    }
+
+    return writer->close() && ok;
+}
+
+// load_fits 默认让头里的 BAYERPAT 优先；--ignore-header-bayer 时换回 -b 指定的排列
+bool load_input(const fs::path& path, FitsImage& img, BayerPattern bayer, bool headerBayer)
+{
+    if (!load_fits(path.string(), img, bayer))
+        return false;
+    if (!headerBayer && img.bayerFromHeader)
+    {
+        img.bayer = bayer;
+        img.bayerFromHeader = false;
+    }
+    return true;
+}
+
+bool convert_file(const fs::path& in, const Options& opt,
+                  const ImageWriterOptions& wopt, StageTimes& t)
+{
+    fs::path out = output_path(in, opt);
+
+    auto t0 = Clock::now();
+    FitsImage img;
+    if (!load_input(in, img, opt.bayer, opt.headerBayer))
+        return false;
+    if (opt.calibration)
+    {
+        double mn = 0.0, mx = 0.0;
+        if (!opt.calibration->apply(img, mn, mx))
+            std::cerr << "Calibration skipped (size mismatch): " << in.string() << "\n";
+    }
+    if (opt.cosmetic)
+    {
+        double mn = 0.0, mx = 0.0;
+        cosmetic_correct(img, img.channels == 1 && img.bayer != BayerPattern::NONE, *opt.cosmetic, mn, mx);
+    }
+    t.load = elapsed_ms(t0);
+    t.megapixels = (double)img.width * img.height / 1e6;
+
+    // 线性 FITS：不用先把整幅图去拜耳，直接按行带处理并写出原始 ADU
+    if (opt.format == ExportFormat::FITS32 && !opt.stretch)
+    {
+        t0 = Clock::now();
+        FitsExportOptions fopt;
+        fopt.stretch = false;
+        fopt.bayer   = img.bayer;
+        bool ok = write_processed_fits(img, out.string(), fopt);
+        t.encode = elapsed_ms(t0);
+        return ok;
+    }
+
+    t0 = Clock::now();
+    FitsImage rgbImg;
+    if (!debayer_bilinear(img, rgbImg))
+        return false;
+    t.debayer = elapsed_ms(t0);
+
+    // RAW 已经用不到了，尽早释放
+    img.raw.clear();
+    img.raw.shrink_to_fit();
+    rgbImg.raw.clear();
+    rgbImg.raw.shrink_to_fit();
+
+    if (opt.stretch)
+    {
+        t0 = Clock::now();
+        auto_stretch(rgbImg.rgb, opt.blackClip, opt.whiteClip, opt.strength);
+        t.stretch = elapsed_ms(t0);
+    }
+
+    t0 = Clock::now();
+    bool ok = false;
+    if (opt.format == ExportFormat::FITS32)
+    {
+        const bool mono = img.bayer == BayerPattern::NONE && img.channels == 1;
+        FitsWriter writer;
+        ok = writer.open(out.string(), rgbImg.width, rgbImg.height, mono ? 1 : 3, img.headerCards);
+        if (ok)
+        {
+            writer.addHistory("Debayered and auto stretched by fits_convert, values scaled to 0-1");
+            ok = writer.writeRows(rgbImg.rgb.data(), rgbImg.height, 3);
+            ok = writer.close() && ok;
+        }
+    }
+    else
+    {
+        ok = write_rgb_image(rgbImg.rgb, rgbImg.width, rgbImg.height, out, opt, wopt);
+    }
+    t.encode = elapsed_ms(t0);
+    return ok;
+}
+
+#ifdef FITSVIEWER_HAS_HEADLESS_GL
+
+struct LoadedFrame
+{
+    bool               ok = false;
+    FitsImage          image;
+    std::vector<float> normalized;   // 上传给 GPU 的 0~1 单通道数据
+    double             loadMs = 0.0;
+};
+
+std::unique_ptr<LoadedFrame> load_frame(const fs::path& path, BayerPattern bayer, bool headerBayer,
+                                        const Calibration* calibration, const CosmeticSettings* cosmetic)
+{
+    auto frame = std::make_unique<LoadedFrame>();
+    auto t0 = Clock::now();
+    frame->ok = load_input(path, frame->image, bayer, headerBayer);
+    if (frame->ok)
+    {
+        calibrate_and_normalize(frame->image, calibration, cosmetic, frame->normalized);
+        frame->image.raw.clear();
+        frame->image.raw.shrink_to_fit();
+    }
+    frame->loadMs = elapsed_ms(t0);
+    return frame;
+}
+
+// GPU 管线：和界面用同一套 shader（去拜耳 + 统计 + 拉伸 + 导出），
+// GL 只在主线程，下一个文件在后台线程同时加载
+int run_gpu(const std::vector<fs::path>& files, const Options& opt)
+{
+    if (opt.format == ExportFormat::FITS32)
+    {
+        std::cerr << "--gpu renders 8/16-bit RGB only, use the CPU path for FITS output\n";
+        return 2;
+    }
+
+    HeadlessGlContext context;
+    if (!context.create())
+        return 1;
+
+    GlImageRenderer renderer;
+    if (!renderer.init())
+    {
+        std::cerr << "Failed to init GPU renderer\n";
+        return 1;
+    }
+
+    if (!opt.quiet)
+        std::printf("GPU: %s (%s)\n", (const char*)glGetString(GL_RENDERER), context.backendName());
+
+    ImageWriterOptions wopt;
+    wopt.level = opt.level;
+
+    const ExportPixelFormat pixelFormat = export_format_bit_depth(opt.format) == 16
+                                              ? ExportPixelFormat::RGB16
+                                              : ExportPixelFormat::RGB8;
+
+    double sumLoad = 0.0, sumUpload = 0.0, sumStats = 0.0, sumRender = 0.0, megapixels = 0.0;
+    int failed = 0;
+
+    auto wall0 = Clock::now();
+    std::future<std::unique_ptr<LoadedFrame>> next =
+        std::async(std::launch::async, load_frame, files[0], opt.bayer, opt.headerBayer,
+                   opt.calibration.get(), opt.cosmetic.get());
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        std::unique_ptr<LoadedFrame> frame = next.get();
+        if (i + 1 < files.size())
+            next = std::async(std::launch::async, load_frame, files[i + 1], opt.bayer, opt.headerBayer,
+                              opt.calibration.get(), opt.cosmetic.get());
+
+        if (!frame->ok)
+        {
+            ++failed;
+            std::cerr << "FAILED " << files[i].string() << "\n";
+            continue;
+        }
+
+        const FitsImage& img = frame->image;
+
+        auto t0 = Clock::now();
+        renderer.uploadBaseTexture(frame->normalized, img.width, img.height);
+        renderer.setBayerPattern(static_cast<int>(img.bayer));
+        renderer.setStretchMode(1);
+        glFinish();
+        double uploadMs = elapsed_ms(t0);
+
+        t0 = Clock::now();
+        float low = 0.0f, high = 1.0f;
+        if (!renderer.computeAutoParamsGpu(opt.stretch, opt.blackClip, opt.whiteClip, low, high))
+        {
+            low = 0.0f;
+            high = 1.0f;
+        }
+        renderer.setAutoParams(opt.stretch, low, high, opt.strength);
+        double statsMs = elapsed_ms(t0);
+
+        t0 = Clock::now();
+        fs::path out = output_path(files[i], opt);
+        int outW = 0, outH = 0, cropX = 0, cropY = 0, cropW = 0, cropH = 0;
+        ExportRegion region;
+        bool ok = renderer.resolveExportRegion(region, cropX, cropY, cropW, cropH, outW, outH);
+
+        std::unique_ptr<ImageRowWriter> writer;
+        if (ok)
+            writer = open_image_writer(out.string(), opt.format, outW, outH, wopt);
+        ok = ok && writer &&
+             renderer.renderToRows(region, pixelFormat, [&](const void* row, int) {
+                 return writer->writeRow(row);
+             });
+        if (writer)
+            ok = writer->close() && ok;
+        double renderMs = elapsed_ms(t0);
+
+        if (!ok)
+        {
+            ++failed;
+            std::cerr << "FAILED " << files[i].string() << "\n";
+            continue;
+        }
+
+        sumLoad    += frame->loadMs;
+        sumUpload  += uploadMs;
+        sumStats   += statsMs;
+        sumRender  += renderMs;
+        megapixels += (double)img.width * img.height / 1e6;
+
+        if (!opt.quiet)
+        {
+            std::printf("%-40s load %8.1f  upload %8.1f  stats %8.1f  render+encode %8.1f ms\n",
+                        files[i].filename().string().c_str(),
+                        frame->loadMs, uploadMs, statsMs, renderMs);
+        }
+    }
+    double wall = elapsed_ms(wall0);
+
+    renderer.shutdown();
+    context.destroy();
+
+    std::printf("\n%d file(s) converted, %d failed, GPU, wall %.1f ms, %.1f MP/s\n",
+                (int)files.size() - failed, failed, wall,
+                wall > 0.0 ? megapixels / (wall / 1000.0) : 0.0);
+    std::printf("stage totals (ms): load %.1f (overlapped)  upload %.1f  stats %.1f  render+encode %.1f\n",
+                sumLoad, sumUpload, sumStats, sumRender);
+
+    return failed == 0 ? 0 : 1;
+}
+
+#endif
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Missing value for " << a << "\n";
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+
+        if (a == "-h" || a == "--help")
+        {
+            print_usage();
+            return 0;
+        }
+        else if (a == "-o")          opt.outDir = next();
+        else if (a == "-j")          opt.jobs = std::atoi(next());
+        else if (a == "-l")          opt.level = std::clamp(std::atoi(next()), 1, 9);
+        else if (a == "--linear")    opt.stretch = false;
+        else if (a == "--black")     opt.blackClip = (float)std::atof(next());
+        else if (a == "--white")     opt.whiteClip = (float)std::atof(next());
+        else if (a == "--strength")  opt.strength = (float)std::atof(next());
+        else if (a == "-q")          opt.quiet = true;
+        else if (a == "--ignore-header-bayer") opt.headerBayer = false;
+        else if (a == "--bias")      opt.biasPath = next();
+        else if (a == "--dark")      opt.darkPath = next();
+        else if (a == "--flat")      opt.flatPath = next();
+        else if (a == "--no-dark-scale") opt.scaleDark = false;
+        else if (a == "--hot-sigma") opt.hotSigma = (float)std::atof(next());
+        else if (a == "--cold-sigma") opt.coldSigma = (float)std::atof(next());
+        else if (a == "--dark-defects") opt.darkDefects = true;
+#ifdef FITSVIEWER_HAS_HEADLESS_GL
+        else if (a == "--gpu")       opt.gpu = true;
+#endif
+        else if (a == "-f")
+        {
+            if (!parse_format(next(), opt.format))
+            {
+                std::cerr << "Unknown format: " << argv[i] << "\n";
+                return 2;
+            }
+        }
+        else if (a == "-b")
+        {
+            if (!parse_bayer(next(), opt.bayer))
+            {
+                std::cerr << "Unknown bayer pattern: " << argv[i] << "\n";
+                return 2;
+            }
+        }
+        else if (!a.empty() && a[0] == '-')
+        {
+            std::cerr << "Unknown option: " << a << "\n";
+            print_usage();
+            return 2;
+        }
+        else
+        {
+            inputs.push_back(a);
+        }
+    }
+
+    std::vector<fs::path> files;
+    for (const std::string& in : inputs)
+        collect_inputs(in, files);
+
+    if (files.empty())
+    {
+        print_usage();
+        return 2;
+    }
+
+    if (!opt.outDir.empty())
+    {
+        std::error_code ec;
+        fs::create_directories(opt.outDir, ec);
+    }
+
+    if (opt.darkDefects && opt.darkPath.empty())
+    {
+        std::cerr << "--dark-defects needs --dark\n";
+        return 2;
+    }
+
+    // 主帧只读一次，所有文件共用
+    CalibrationFrame masters[3];
+    if (!opt.biasPath.empty() || !opt.darkPath.empty() || !opt.flatPath.empty())
+    {
+        const std::string* paths[3] = {&opt.biasPath, &opt.darkPath, &opt.flatPath};
+        for (int k = 0; k < 3; ++k)
+        {
+            if (!paths[k]->empty() && !load_calibration_frame(*paths[k], masters[k]))
+            {
+                std::cerr << "Cannot read master: " << *paths[k] << "\n";
+                return 1;
+            }
+        }
+
+        std::string error;
+        opt.calibration = Calibration::build(masters[0].isValid() ? &masters[0] : nullptr,
+                                             masters[1].isValid() ? &masters[1] : nullptr,
+                                             masters[2].isValid() ? &masters[2] : nullptr,
+                                             opt.scaleDark, error);
+        if (!opt.calibration)
+        {
+            std::cerr << "Calibration: " << error << "\n";
+            return 1;
+        }
+    }
+
+    if (opt.hotSigma > 0.0f || opt.coldSigma > 0.0f || opt.darkDefects)
+    {
+        auto cosmetic = std::make_shared<CosmeticSettings>();
+        cosmetic->detect    = opt.hotSigma > 0.0f || opt.coldSigma > 0.0f;
+        cosmetic->hotSigma  = opt.hotSigma;
+        cosmetic->coldSigma = opt.coldSigma;
+        if (opt.darkDefects)
+        {
+            // 头里的 CFA 可能和 -b 不同，这里按 -b 判断；坏点表只在 dark 的同色邻居里找
+            const bool  cfa   = opt.bayer != BayerPattern::NONE;
+            const float sigma = opt.hotSigma > 0.0f ? opt.hotSigma : 5.0f;
+            const std::string cacheDir = app_cache_dir("defects");
+            const CalibrationFrame& dark = masters[1];
+            if (!load_cached_defect_map(cacheDir, opt.darkPath, cfa, sigma, cosmetic->defects))
+            {
+                build_defect_map(dark.data.data(), dark.width, dark.height, cfa, sigma, cosmetic->defects);
+                store_cached_defect_map(cacheDir, opt.darkPath, cfa, sigma, cosmetic->defects);
+            }
+            if (!opt.quiet)
+                std::printf("Defect map: %zu pixels from %s\n", cosmetic->defects.pixels.size(),
+                            opt.darkPath.c_str());
+        }
+        opt.cosmetic = cosmetic;
+    }
+
+#ifdef FITSVIEWER_HAS_HEADLESS_GL
+    if (opt.gpu)
+        return run_gpu(files, opt);
+#endif
+
+    int hw = std::max(1, (int)std::thread::hardware_concurrency());
+    int jobs = opt.jobs > 0 ? opt.jobs : hw;
+    jobs = std::min(jobs, (int)files.size());
+
+    // 文件级并行已经占满核心时，单个 PNG 的条带并行只会互相抢
+    ImageWriterOptions wopt;
+    wopt.level   = opt.level;
+    wopt.threads = std::max(1, hw / jobs);
+
+    std::mutex        printMutex;
+    StageTimes        sum;
+    std::atomic<int>  failed{0};
+
+    auto wall0 = Clock::now();
+    {
+        ThreadPool pool(jobs);
+        for (const fs::path& f : files)
+        {
+            pool.submit([&, f]() {
+                StageTimes t;
+                bool ok = convert_file(f, opt, wopt, t);
+
+                std::lock_guard<std::mutex> lock(printMutex);
+                if (!ok)
+                {
+                    ++failed;
+                    std::cerr << "FAILED " << f.string() << "\n";
+                    return;
+                }
+
+                sum += t;
+                if (!opt.quiet)
+                {
+                    std::printf("%-40s load %8.1f  debayer %8.1f  stretch %8.1f  encode %8.1f ms\n",
+                                f.filename().string().c_str(),
+                                t.load, t.debayer, t.stretch, t.encode);
+                }
+            });
+        }
+        pool.wait();
+    }
+    double wall = elapsed_ms(wall0);
+
+    int ok = (int)files.size() - failed.load();
+    std::printf("\n%d file(s) converted, %d failed, %d job(s), wall %.1f ms, %.1f MP/s\n",
+                ok, failed.load(), jobs, wall,
+                wall > 0.0 ? sum.megapixels / (wall / 1000.0) : 0.0);
+    std::printf("stage totals (CPU ms): load %.1f  debayer %.1f  stretch %.1f  encode %.1f\n",
+                sum.load, sum.debayer, sum.stretch, sum.encode);
+
+    return failed.load() == 0 ? 0 : 1;
+}